@@ -0,0 +1,140 @@
+// Author: Luca Pellegrini
+// Microbenchmark of the Hamming nearest neighbour search (HammingMatcher kernels, MIHIndex) against cv::BFMatcher
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+#include <hamming_matcher.hpp>
+#include <mih_index.h>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace
+{
+
+// Runs `body` `repeats` times, and returns the fastest run in milliseconds
+template <typename Body>
+double bestTimeMs(const int repeats, Body body)
+{
+    double best {0.0};
+    for (int i {0}; i < repeats; i++)
+    {
+        const int64 start {cv::getTickCount()};
+        body();
+        const double elapsed {1000.0 * static_cast<double>(cv::getTickCount() - start) / cv::getTickFrequency()};
+        best = (i == 0) ? elapsed : std::min(best, elapsed);
+    }
+    return best;
+}
+
+// Queries whose nearest distance differs from the reference one
+int differingDistances(const std::vector<cv::DMatch>& matches, const std::vector<cv::DMatch>& reference)
+{
+    if (matches.size() != reference.size())
+    {
+        return static_cast<int>(std::max(matches.size(), reference.size()));
+    }
+    int differing {0};
+    for (size_t i {0}; i < matches.size(); i++)
+    {
+        differing += (matches[i].queryIdx != reference[i].queryIdx || matches[i].distance != reference[i].distance);
+    }
+    return differing;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    const std::string parser_keys {
+        "{help h ? | | print this message}"
+        "{train    |200000| train descriptors}"
+        "{queries  |1500| query descriptors}"
+        "{flips    |40| bits flipped in a train descriptor to make every query (more bits = farther neighbours)}"
+        "{repeats  |3| runs of every implementation (the fastest one is reported)}"
+        "{threads  |1| OpenCV threads used by cv::BFMatcher (the kernels run on one thread)}"
+    };
+    cv::CommandLineParser parser {argc, argv, parser_keys};
+    parser.about("hamming_bench");
+    if (parser.has("help"))
+    {
+        parser.printMessage();
+        return 0;
+    }
+    const int num_train {parser.get<int>("train")};
+    const int num_queries {parser.get<int>("queries")};
+    const int flips {parser.get<int>("flips")};
+    const int repeats {std::max(1, parser.get<int>("repeats"))};
+    if (num_train <= 0 || num_queries <= 0 || flips < 0)
+    {
+        cerr << "Invalid sizes" << endl;
+        return 1;
+    }
+    cv::setNumThreads(parser.get<int>("threads"));
+
+    // Random 256-bit descriptors; every query is a train descriptor with some bits flipped, as a
+    // matching ORB descriptor of another image of the same flower
+    cv::RNG rng {12345};
+    cv::Mat train {num_train, HammingMatcher::descriptor_bytes, CV_8U};
+    rng.fill(train, cv::RNG::UNIFORM, 0, 256);
+    cv::Mat queries {num_queries, HammingMatcher::descriptor_bytes, CV_8U};
+    for (int q {0}; q < num_queries; q++)
+    {
+        train.row(rng.uniform(0, num_train)).copyTo(queries.row(q));
+        for (int f {0}; f < flips; f++)
+        {
+            const int bit {rng.uniform(0, 8 * HammingMatcher::descriptor_bytes)};
+            queries.at<uchar>(q, bit / 8) ^= static_cast<uchar>(1 << (bit % 8));
+        }
+    }
+    const double scanned_gb {static_cast<double>(num_train) * num_queries * HammingMatcher::descriptor_bytes / 1e9};
+    cout << num_queries << " queries, " << num_train << " train descriptors, " << flips << " bits flipped" << endl;
+
+    std::vector<cv::DMatch> reference;
+    const cv::Ptr<cv::BFMatcher> bf_matcher {cv::BFMatcher::create(cv::NORM_HAMMING, false)};
+    const double reference_ms {bestTimeMs(repeats, [&]()
+    {
+        bf_matcher->match(queries, train, reference);
+    })};
+    cout << "cv::BFMatcher: " << reference_ms << " ms (" << scanned_gb / (reference_ms / 1000.0) << " GB/s)" << endl;
+
+    const HammingMatcher::Isa best_isa {HammingMatcher::bestIsa()};
+    for (const HammingMatcher::Isa isa :
+         {HammingMatcher::Isa::Scalar, HammingMatcher::Isa::AVX2, HammingMatcher::Isa::AVX512})
+    {
+        if (!HammingMatcher::setIsa(isa))
+        {
+            cout << HammingMatcher::isaName(isa) << ": not supported" << endl;
+            continue;
+        }
+        std::vector<cv::DMatch> matches;
+        const double ms {bestTimeMs(repeats, [&]()
+        {
+            HammingMatcher::match(queries, train, matches);
+        })};
+        cout << HammingMatcher::isaName(isa) << ": " << ms << " ms (" << scanned_gb / (ms / 1000.0) << " GB/s, "
+             << reference_ms / ms << "x cv::BFMatcher), " << differingDistances(matches, reference)
+             << " differing distances" << endl;
+    }
+    HammingMatcher::setIsa(best_isa);
+
+    MIHIndex index;
+    const double build_ms {bestTimeMs(1, [&]()
+    {
+        index = MIHIndex{train};
+    })};
+    std::vector<cv::DMatch> matches;
+    const double ms {bestTimeMs(repeats, [&]()
+    {
+        index.match(queries, matches);
+    })};
+    cout << "MIHIndex: " << ms << " ms (" << reference_ms / ms << "x cv::BFMatcher, built in " << build_ms
+         << " ms), " << differingDistances(matches, reference) << " differing distances" << endl;
+    return 0;
+}
@@ -0,0 +1,159 @@
+// Author: Luca Pellegrini
+// Microbenchmark of the masked TM_CCORR_NORMED and TM_SQDIFF_NORMED kernels (MaskedCCorr, MaskedSqDiff)
+// against cv::matchTemplate()
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <masked_ccorr.hpp>
+#include <masked_sqdiff.hpp>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace
+{
+
+// Runs `body` `repeats` times, and returns the fastest run in milliseconds
+template <typename Body>
+double bestTimeMs(const int repeats, Body body)
+{
+    double best {0.0};
+    for (int i {0}; i < repeats; i++)
+    {
+        const int64 start {cv::getTickCount()};
+        body();
+        const double elapsed {1000.0 * static_cast<double>(cv::getTickCount() - start) / cv::getTickFrequency()};
+        best = (i == 0) ? elapsed : std::min(best, elapsed);
+    }
+    return best;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    const std::string parser_keys {
+        "{help h ? | | print this message}"
+        "{@image   | | BGR test image (default: random pixels)}"
+        "{width    |480| width of the test image}"
+        "{height   |360| height of the test image}"
+        "{templ-width |400| width of the template (cut from the center of the image)}"
+        "{templ-height|300| height of the template}"
+        "{repeats  |5| runs of every implementation (the fastest one is reported)}"
+        "{threads  |1| OpenCV threads used by cv::matchTemplate() (the kernels run on one thread)}"
+    };
+    cv::CommandLineParser parser {argc, argv, parser_keys};
+    parser.about("masked_ccorr_bench");
+    if (parser.has("help"))
+    {
+        parser.printMessage();
+        return 0;
+    }
+    const int repeats {std::max(1, parser.get<int>("repeats"))};
+    cv::setNumThreads(parser.get<int>("threads"));
+
+    cv::Mat_<cv::Vec3b> image;
+    const std::string image_path {parser.get<std::string>("@image")};
+    const cv::Size image_size {parser.get<int>("width"), parser.get<int>("height")};
+    if (!image_path.empty())
+    {
+        image = cv::imread(image_path, cv::IMREAD_COLOR);
+        if (image.empty())
+        {
+            cerr << "Cannot read " << image_path << endl;
+            return 1;
+        }
+        cv::resize(image, image, image_size, 0, 0, cv::INTER_AREA);
+    }
+    else
+    {
+        image.create(image_size);
+        cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+    }
+    const cv::Size templ_size {parser.get<int>("templ-width"), parser.get<int>("templ-height")};
+    if (templ_size.width <= 0 || templ_size.height <= 0 ||
+        templ_size.width > image.cols || templ_size.height > image.rows)
+    {
+        cerr << "The template must fit in the image" << endl;
+        return 1;
+    }
+
+    // Template cut from the middle of the image, with an elliptic mask like the ones of the flower templates
+    const cv::Rect templ_rect {(image.cols - templ_size.width) / 2, (image.rows - templ_size.height) / 2,
+                               templ_size.width, templ_size.height};
+    const cv::Mat_<cv::Vec3b> templ {image(templ_rect).clone()};
+    cv::Mat_<uchar> mask {templ_size.height, templ_size.width, uchar{0}};
+    cv::ellipse(mask, cv::Point{templ_size.width / 2, templ_size.height / 2},
+                cv::Size{templ_size.width * 2 / 5, templ_size.height * 2 / 5}, 0, 0, 360, cv::Scalar{255}, cv::FILLED);
+
+    cout << "Image " << image.cols << "x" << image.rows << ", template " << templ.cols << "x" << templ.rows
+         << ", " << (image.cols - templ.cols + 1) * (image.rows - templ.rows + 1) << " positions" << endl;
+
+    cv::Mat reference;
+    const double reference_ms {bestTimeMs(repeats, [&]()
+    {
+        cv::matchTemplate(image, templ, reference, cv::TM_CCORR_NORMED, mask);
+    })};
+    cout << "cv::matchTemplate: " << reference_ms << " ms" << endl;
+
+    const MaskedCCorr kernel {templ, mask};
+    const MaskedCCorr::Isa best_isa {MaskedCCorr::bestIsa()};
+    for (const MaskedCCorr::Isa isa : {MaskedCCorr::Isa::Scalar, MaskedCCorr::Isa::AVX2, MaskedCCorr::Isa::AVX512})
+    {
+        if (!MaskedCCorr::setIsa(isa))
+        {
+            cout << MaskedCCorr::isaName(isa) << ": not supported" << endl;
+            continue;
+        }
+        cv::Mat_<float> result;
+        const double ms {bestTimeMs(repeats, [&]()
+        {
+            kernel.match(image, result);
+        })};
+        const double max_difference {cv::norm(result, reference, cv::NORM_INF)};
+        cout << MaskedCCorr::isaName(isa) << ": " << ms << " ms (" << reference_ms / ms << "x cv::matchTemplate)"
+             << ", largest difference " << max_difference << endl;
+    }
+
+    // MaskedSqDiff scores 1 - R / 2, clamped at 0
+    cv::Mat sqdiff_reference;
+    const double sqdiff_reference_ms {bestTimeMs(repeats, [&]()
+    {
+        cv::matchTemplate(image, templ, sqdiff_reference, cv::TM_SQDIFF_NORMED, mask);
+    })};
+    sqdiff_reference.convertTo(sqdiff_reference, CV_32F, -0.5, 1.0);
+    cv::threshold(sqdiff_reference, sqdiff_reference, 0.0, 0.0, cv::THRESH_TOZERO);
+    cout << "cv::matchTemplate (TM_SQDIFF_NORMED): " << sqdiff_reference_ms << " ms" << endl;
+
+    const MaskedSqDiff sqdiff_kernel {templ, mask};
+    cv::Mat_<double> integral;
+    const double integral_ms {bestTimeMs(repeats, [&]()
+    {
+        MaskedSqDiff::integrate(image, integral);
+    })};
+    cout << "MaskedSqDiff::integrate: " << integral_ms << " ms" << endl;
+    for (const MaskedCCorr::Isa isa : {MaskedCCorr::Isa::Scalar, MaskedCCorr::Isa::AVX2, MaskedCCorr::Isa::AVX512})
+    {
+        if (!MaskedCCorr::setIsa(isa))
+        {
+            continue;
+        }
+        cv::Mat_<float> result;
+        const double ms {bestTimeMs(repeats, [&]()
+        {
+            sqdiff_kernel.match(image, integral, result);
+        })};
+        const double max_difference {cv::norm(result, sqdiff_reference, cv::NORM_INF)};
+        cout << MaskedCCorr::isaName(isa) << " (TM_SQDIFF_NORMED): " << ms << " ms ("
+             << sqdiff_reference_ms / ms << "x cv::matchTemplate), largest difference " << max_difference << endl;
+    }
+    MaskedCCorr::setIsa(best_isa);
+    return 0;
+}
@@ -5,6 +5,8 @@
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/features2d.hpp>
+#include <flower_image_container.hpp>
+#include <string>
 #include <vector>
 
 class BoWExtractor {
@@ -16,24 +18,41 @@ class BoWExtractor {
             int attempts = 2
         );
 
-        // Build visual vocabulary using train images
-        bool buildVocabulary(const std::vector<cv::Mat> &trainImages);
+        // Build visual vocabulary using train images (healthy images first, in index order)
+        bool buildVocabulary(
+            const FlowerImageContainer &trainHealthyImages,
+            const FlowerImageContainer &trainDiseasedImages
+        );
 
         // Extract BoW histogram from one image
-        bool extract(const cv::Mat &image, cv::Mat &histogram);
+        // If useCache is true, ORB descriptors are looked up in (and stored to) the feature cache
+        bool extract(const cv::Mat &image, cv::Mat &histogram, bool useCache = false);
 
         // Compute distance between 2 BoW histograms
         double matchDescriptors(const cv::Mat &histogram1, const cv::Mat &histogram2) const;
 
+        // Get a string identifying the ORB extraction parameters (used as feature cache key)
+        const std::string &getParamsKey() const;
+
+        // Get/set the visual vocabulary (used to save and restore a trained model)
+        const cv::Mat &getVocabulary() const;
+        void setVocabulary(const cv::Mat &vocabulary);
+
+        // Create a new extractor with the same parameters and vocabulary (the cv::ORB is not
+        // safe to share between threads: every parallel task works on its own clone)
+        BoWExtractor clone() const;
+
     private:
-        bool computeORBDescriptors(const cv::Mat &image, cv::Mat &descriptors) const;
+        bool computeORBDescriptors(const cv::Mat &image, cv::Mat &descriptors, bool useCache) const;
         cv::Mat computeHistogram(const cv::Mat &descriptors) const;
 
         cv::Ptr<cv::ORB> orb_;
         cv::Mat vocabulary_;
+        int nfeatures_;
         int vocabularySize_;
         int maxIterations_;
         int attempts_;
+        std::string paramsKey_;
 };
 
 #endif // BOW_H
@@ -0,0 +1,108 @@
+// Author: Luca Pellegrini
+#ifndef CLASSIFIER_MODELS_HPP
+#define CLASSIFIER_MODELS_HPP
+
+#include <filesystem>
+#include <map>
+#include <opencv2/core.hpp>
+
+#include <flower_type.hpp>
+#include <flower_image_container.hpp>
+#include <flower_template.hpp>
+#include <template_search.hpp>
+#include <labelled_descriptors.h>
+#include <matching.h>
+#include <orb_processing.h>
+#include <sift.h>
+#ifdef ENABLE_SURF
+#include <surf.h>
+#endif
+
+/**
+ * @brief Everything every classifier needs to classify a new image, kept in memory
+ *
+ * Train descriptors, BoW vocabulary and templates are computed once by
+ * `trainClassifierModels()`, and then reused for every call to `classifyImage()`.
+ */
+struct ClassifierModels
+{
+    SIFTExtractor sift;
+    std::map<FlowerType, cv::Mat> sift_descriptors;
+    LabelledDescriptors sift_labelled;  // built from `sift_descriptors`
+#ifdef ENABLE_SURF
+    SURFExtractor surf;
+    std::map<FlowerType, cv::Mat> surf_descriptors;
+    LabelledDescriptors surf_labelled;  // built from `surf_descriptors`
+#endif
+    ORBExtractor orb;
+    std::map<FlowerType, cv::Mat> orb_descriptors;
+    ORBTrainIndex orb_index;            // built from `orb_descriptors`
+    TemplateBank templates;
+    TMSearchOptions tm_search;       // set before training or loading the models
+    TemplateSearch template_search;  // built from `templates` and `tm_search`
+    size_t classified_images {0};    // calls to `classifyImage()` so far: index of the next image, for pruning verification
+    HOGModel hog;
+    BoWModel bow;
+    bool bow_trained {false};
+};
+
+/**
+ * @brief Class predicted by every classifier for a single image
+ *
+ * Methods that could not classify the image (e.g. no keypoints) predict FlowerType::NoFlower.
+ */
+struct ImagePredictions
+{
+    FlowerType sift {FlowerType::NoFlower};
+#ifdef ENABLE_SURF
+    FlowerType surf {FlowerType::NoFlower};
+#endif
+    FlowerType orb {FlowerType::NoFlower};
+    FlowerType tm {FlowerType::NoFlower};
+    FlowerType hog {FlowerType::NoFlower};
+    FlowerType bow {FlowerType::NoFlower};
+};
+
+/**
+ * @brief Train every classifier on the given images
+ * @param templates templates of every class, as loaded by `loadTemplates()`
+ * @param models Output param
+ * @return true if successful; false otherwise
+ */
+bool trainClassifierModels(
+    const FlowerImageContainer& train_healthy_imgs,
+    const FlowerImageContainer& train_diseased_imgs,
+    TemplateBank templates,
+    ClassifierModels& models
+);
+
+/**
+ * @brief Classify a single image with every classifier
+ */
+ImagePredictions classifyImage(
+    const cv::Mat_<cv::Vec3b>& img_color,
+    const cv::Mat_<uchar>& img_gray,
+    ClassifierModels& models
+);
+
+/**
+ * @brief Save trained classifiers to a snapshot file
+ *
+ * The snapshot is written with cv::FileStorage (the format follows the file
+ * extension, e.g. `.yml.gz`); it is versioned and records the parameters of
+ * every extractor.
+ * @return true if successful; false otherwise
+ */
+bool saveClassifierModels(const std::filesystem::path model_path, const ClassifierModels& models);
+
+/**
+ * @brief Restore trained classifiers from a snapshot written by `saveClassifierModels()`
+ *
+ * The snapshot is rejected if its version, or the parameters of any of its
+ * extractors, differ from those of `models`' extractors.
+ * @param models Output param
+ * @return true if successful; false otherwise
+ */
+bool loadClassifierModels(const std::filesystem::path model_path, ClassifierModels& models);
+
+#endif // CLASSIFIER_MODELS_HPP
@@ -0,0 +1,99 @@
+// Author: Luca Pellegrini
+#ifndef COARSE_BOUND_HPP
+#define COARSE_BOUND_HPP
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+/**
+ * @brief Upper bound of the masked TM_CCORR_NORMED score of a template on blocks of positions, from a coarse level
+ *
+ * Test image and template are averaged over blocks of B x B pixels (B = 2^levels).
+ * The positions of the full resolution score map are grouped into the same blocks:
+ * position x = B X + f, with f in [0, B)^2, belongs to block X. A block b of the
+ * template window is a core block when the mask covers it at every offset f, so
+ * that at every position of block X the core blocks cover the same pixels of the
+ * image: blocks X + b. Let J be the masked image patch at x, and T the masked
+ * template (shifted by f):
+ *
+ *  - on the core, J is its block means plus a remainder orthogonal to them; the
+ *    coarse level gives the correlation n of the block means with the unit
+ *    vector of the block means of T (at f = 0), and the energy E of J on the core;
+ *  - the angle between the block means of T at f and at 0 is a constant of the
+ *    template, and so are the energy of T off its block means on the core, and
+ *    off the core.
+ *
+ * Bounding every term of the correlation by Cauchy-Schwarz, the score of every
+ * position of block X is at most
+ *
+ *     max_f sqrt( (a_f cos(psi_f) c + k_f sqrt(1 - c^2))^2 + e_f^2 ) / |T|,    c = n / sqrt(E)
+ *
+ * (a_f: norm of the block means of T on the core; psi_f: their angle with the ones
+ * at f = 0; k_f^2 = a_f^2 sin(psi_f)^2 + energy of T off its block means on the
+ * core; e_f^2: energy of T off the core). The image enters only through c, the
+ * normalized correlation of its core with the block means of the template core,
+ * so the bound of a whole map costs two correlations at the coarse level.
+ *
+ * The bound holds for the scores of MaskedNCC, MaskedCCorr and MaskedSqDiff
+ * (which never exceed the TM_CCORR_NORMED ones), up to their rounding errors:
+ * `tolerance` is added to every bound. It is loose on textured templates, since
+ * nothing is known about the image off its block means.
+ */
+class CoarseBound
+{
+public:
+    /**
+     * @brief A test image averaged over blocks, as computed by `prepareImage()`
+     */
+    struct PreparedImage
+    {
+        int block {0};              // block side B, in pixels
+        cv::Mat_<cv::Vec3f> means;  // block means of the image
+        cv::Mat_<float> energies;   // block means of B^2 + G^2 + R^2
+    };
+
+    // Added to every bound: rounding errors of the single precision correlations and scores
+    static constexpr double tolerance {1e-3};
+
+    CoarseBound() = default;
+
+    /**
+     * @brief Precompute the block means and the constants of a template and its mask (pixels where the mask is not 0)
+     */
+    CoarseBound(const cv::Mat_<cv::Vec3b>& templ, const cv::Mat_<uchar>& mask, const int levels);
+
+    bool empty() const;
+    int blockSize() const;
+
+    /**
+     * @brief Average the test image over blocks of 2^levels pixels (the last incomplete blocks are dropped)
+     */
+    static void prepareImage(const cv::Mat_<cv::Vec3b>& image, const int levels, PreparedImage& prepared);
+
+    /**
+     * @brief Bound of every block of positions of a score map of `result_size` (the size of the one of `cv::matchTemplate()`)
+     *
+     * `result` has one entry per block of B x B positions (partial blocks included),
+     * and is reused if it already has the right size. The image must have been
+     * prepared with the levels of this object.
+     */
+    void bounds(const PreparedImage& image, const cv::Size result_size, cv::Mat_<float>& result) const;
+
+private:
+    // Constants of the template at one offset f within a block
+    struct Offset
+    {
+        double cos_term;  // a_f cos(psi_f) / |T|
+        double sin_term;  // k_f / |T|
+        double off_core;  // e_f^2 / |T|^2
+    };
+
+    int m_block {0};
+    cv::Size m_size;                // of the template, at full resolution
+    cv::Mat_<cv::Vec3f> m_means;    // block means of the masked template on the core (0 elsewhere)
+    cv::Mat_<float> m_core;         // 1 on the core blocks, 0 elsewhere
+    double m_means_norm {0.0};      // norm of `m_means`
+    std::vector<Offset> m_offsets;  // empty if there is no core block: the bound is 1
+};
+
+#endif // COARSE_BOUND_HPP
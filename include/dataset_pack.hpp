@@ -0,0 +1,81 @@
+// Author: Luca Pellegrini
+#ifndef DATASET_PACK_HPP
+#define DATASET_PACK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+#include <flower_image_container.hpp>
+
+/**
+ * @brief Write already decoded train and test images into a single binary "pack" file
+ *
+ * The pack stores, for every image, its BGR and grayscale planes along with
+ * its metadata (name, flower type, healthy flag, train/test flag). Planes are
+ * stored uncompressed and aligned, so that they can be used in place once the
+ * file is memory-mapped by DatasetPack. Images are written one at a time: with
+ * lazy containers, only the images held by their cache are decoded at once.
+ * @return true if successful; false otherwise
+ */
+bool writeDatasetPack(
+    const std::filesystem::path pack_path,
+    const FlowerImageContainer& test_imgs,
+    const FlowerImageContainer& train_healthy_imgs,
+    const FlowerImageContainer& train_diseased_imgs
+);
+
+/**
+ * @brief Read-only view over a memory-mapped pack file written by `writeDatasetPack()`
+ *
+ * Images loaded from the pack do not own their pixels: their cv::Mat objects are
+ * headers over the mapped file, hence the DatasetPack object must outlive every
+ * FlowerImage (and every cv::Mat copied from it) created by `load()`.
+ * The file is mapped copy-on-write: unmodified pages are shared through the page
+ * cache between all the processes that map the same pack.
+ */
+class DatasetPack
+{
+public:
+    DatasetPack() = default;
+    ~DatasetPack();
+    DatasetPack(const DatasetPack&) = delete;
+    DatasetPack& operator=(const DatasetPack&) = delete;
+
+    /**
+     * @brief Map the given pack file in memory, and validate its header
+     * @return true if successful; false otherwise
+     */
+    bool open(const std::filesystem::path pack_path);
+
+    /**
+     * @brief Unmap the pack file (if any)
+     */
+    void close();
+
+    bool isOpen() const;
+
+    /**
+     * @brief Create zero-copy FlowerImage objects for every image stored in the pack
+     * @param test_imgs           Output param, test images
+     * @param train_healthy_imgs  Output param, train healthy flower images
+     * @param train_diseased_imgs Output param, train diseased flower images
+     * @return true if successful; false otherwise
+     */
+    bool load(
+        FlowerImageContainer& test_imgs,
+        FlowerImageContainer& train_healthy_imgs,
+        FlowerImageContainer& train_diseased_imgs
+    ) const;
+
+private:
+    /**
+     * @brief Whether `length` bytes starting at `offset` lie inside the mapped file
+     */
+    bool inBounds(const uint64_t offset, const uint64_t length) const;
+
+    void* m_data {nullptr};
+    size_t m_size {0};
+};
+
+#endif // DATASET_PACK_HPP
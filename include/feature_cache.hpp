@@ -0,0 +1,69 @@
+// Author: Luca Pellegrini
+#ifndef FEATURE_CACHE_HPP
+#define FEATURE_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+/**
+ * @brief Persistent, content-addressed cache of extracted features
+ *
+ * Every entry is a file in the cache directory, named after a hash of the image
+ * pixels (as seen by the extractor) and of the extractor's parameters. It stores
+ * keypoints (optional) and descriptors in a compact binary format.
+ * The cache is process-wide and disabled by default; it is enabled by
+ * `setFeatureCacheDir()`. While disabled, lookups fail and stores are no-ops.
+ * All functions are thread-safe.
+ */
+
+/**
+ * @brief Enable the feature cache, storing entries in the given directory (created if missing)
+ * @return true if successful; false otherwise (the cache stays disabled)
+ */
+bool setFeatureCacheDir(const std::filesystem::path cache_dir);
+
+bool featureCacheEnabled();
+
+struct FeatureCacheStats
+{
+    size_t hits {0};
+    size_t misses {0};
+    size_t stores {0};
+};
+
+FeatureCacheStats featureCacheStats();
+
+/**
+ * @brief Look up the features extracted from `image` by an extractor with parameters `params_key`
+ * @param keypoints Output param, may be null if the extractor has no keypoints
+ * @param descriptors Output param
+ * @return true on a cache hit; false otherwise
+ */
+bool loadCachedFeatures(
+    const std::string& params_key,
+    const cv::Mat& image,
+    std::vector<cv::KeyPoint>* keypoints,
+    cv::Mat& descriptors
+);
+
+/**
+ * @brief Store the features extracted from `image` by an extractor with parameters `params_key`
+ * @param keypoints may be null if the extractor has no keypoints
+ */
+void storeCachedFeatures(
+    const std::string& params_key,
+    const cv::Mat& image,
+    const std::vector<cv::KeyPoint>* keypoints,
+    const cv::Mat& descriptors
+);
+
+/**
+ * @brief 64-bit hash of the size, type and pixels of an image
+ */
+uint64_t hashImage(const cv::Mat& image);
+
+#endif // FEATURE_CACHE_HPP
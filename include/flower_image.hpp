@@ -21,7 +21,7 @@ class FlowerImage
 public:
     FlowerImage() = default;
     FlowerImage(std::string name, FlowerType fl_type, bool healthy, int img_type,
-                cv::Mat_<cv::Vec3b>& img_color, cv::Mat_<uchar>& img_gray);
+                cv::Mat_<cv::Vec3b> img_color, cv::Mat_<uchar> img_gray);
 
     /**
      * @brief Returns the BGR color version (3 channels) of the image
@@ -2,22 +2,52 @@
 #ifndef FLOWER_IMAGE_CONTAINER_HPP
 #define FLOWER_IMAGE_CONTAINER_HPP
 
+#include <cstddef>
+#include <iterator>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include <flower_type.hpp>
 #include <flower_image.hpp>
+#include <image_decode.hpp>
+
+/**
+ * @brief Counters of the decoded-image cache of a lazy FlowerImageContainer
+ */
+struct ImageCacheStats
+{
+    size_t hits {0};
+    size_t misses {0};
+    size_t evictions {0};
+    size_t resident_bytes {0};  // bytes of decoded pixels currently held
+};
+
+class FlowerImageView;
 
 /**
  * @brief A container of FlowerImage objects
+ *
+ * By default all images are decoded up front and stay resident. In lazy mode
+ * (see `setLazy()`) the container only stores file paths and metadata: images
+ * are decoded on access and evicted in least-recently-used order, so that the
+ * decoded pixels held by the container stay within a byte budget.
  */
 class FlowerImageContainer
 {
 public:
     FlowerImageContainer();
+    FlowerImageContainer(FlowerImageContainer&&) = default;
+    FlowerImageContainer& operator=(FlowerImageContainer&&) = default;
 
     /**
      * @brief getImagesVector
+     *
+     * In lazy mode the images in the vector are not decoded (use `get()` instead)
      * @return a const reference to the underlying vector of FlowerImage objects
      */
     const std::vector<FlowerImage>& getImagesVector() const;
@@ -27,12 +57,28 @@ public:
     /**
      * @brief getImagesByFlowerType
      *
-     * Time complexity O(n), where n = number of images of given FlowerType stored in the container
+     * Time complexity O(n), where n = number of images of given FlowerType stored in the container.
+     * Prefer `view(flower_type)`, which does not copy the images of eager containers.
      * @param flower_type one of FlowerType values
      * @return a const vector of FlowerImage objects with given flower type
      */
     const std::vector<FlowerImage> getImagesByFlowerType(const FlowerType& flower_type) const;
 
+    /**
+     * @brief Returns a view over all the images of the container, in insertion order
+     *
+     * Time complexity O(1); see FlowerImageView
+     */
+    FlowerImageView view() const;
+
+    /**
+     * @brief Returns a view over the images with given flower type, in insertion order
+     *
+     * Time complexity O(1); see FlowerImageView. The view is invalidated by insertions into the container.
+     * @param flower_type one of FlowerType values
+     */
+    FlowerImageView view(const FlowerType& flower_type) const;
+
     /**
      * @brief Checks if the container has no elements
      * @return true if the container is empty, false otherwise
@@ -45,18 +91,96 @@ public:
     size_t size() const;
 
     /**
-     * @brief Returns a reference to the FlowerImage object at the given index
+     * @brief Returns a copy of the FlowerImage object at the given index
+     *
+     * In lazy mode the image is decoded if it is not resident. The copy shares
+     * its pixels with the container, and keeps them alive even if the image is
+     * later evicted, so it is safe to call `get()` from several threads at the
+     * same time (also in lazy mode). Eager containers are better read with `at()`,
+     * which does not copy.
+     */
+    FlowerImage get(const size_t i) const;
+
+    /**
+     * @brief Returns a reference to the FlowerImage object at the given index of an eager container
+     *
+     * Not available in lazy mode (use `get()`): another thread may evict the image,
+     * and release its cv::Mat images, at any time.
      */
     FlowerImage& at(const size_t i);
     const FlowerImage& at(const size_t i) const;
 
     /**
-     * @brief Adds a FlowerImage object to the end of the container
+     * @brief Returns the metadata (name, flower type, etc.) of the image at the
+     * given index, without decoding it. In lazy mode the cv::Mat images may be empty.
+     */
+    const FlowerImage& metadataAt(const size_t i) const;
+
+    /**
+     * @brief Adds a FlowerImage object to the end of an eager container (use `push_back_lazy()` in lazy mode)
      */
     void push_back(const FlowerImage& img);
+    void push_back(FlowerImage&& img);
+
+    /**
+     * @brief Constructs a FlowerImage object in place at the end of an eager container
+     * @param args arguments forwarded to the FlowerImage constructor
+     * @return a reference to the inserted image
+     */
+    template <typename... Args>
+    FlowerImage& emplace_back(Args&&... args)
+    {
+        CV_Assert(!m_lazy);
+        m_vec.emplace_back(std::forward<Args>(args)...);
+        m_map.at(m_vec.back().flowerType()).push_back(m_vec.size()-1);
+        return m_vec.back();
+    }
+
+    /**
+     * @brief Switch the (empty) container to lazy mode
+     * @param budget_bytes maximum amount of decoded pixels kept in memory.
+     * The most recently accessed image is never evicted, even if it alone exceeds the budget.
+     * @param decode_opts resolution cap applied when images are decoded
+     */
+    void setLazy(const size_t budget_bytes, const DecodeOptions& decode_opts = DecodeOptions{});
+
+    /**
+     * @brief Checks if the container decodes images on demand
+     */
+    bool isLazy() const;
+
+    /**
+     * @brief Switch the (empty) container to lazy mode, with the budget and DecodeOptions of another lazy container
+     */
+    void setLazyLike(const FlowerImageContainer& other);
+
+    /**
+     * @brief Adds an image to the end of a lazy container, without decoding it
+     * @param img_path path of the image file, decoded on first access
+     * @param img metadata of the image (its cv::Mat images are ignored)
+     * @param roi if not empty, the decoded image is cropped to it (clipped to the image; the whole image is kept
+     * if nothing is left), and only the crop is kept in memory
+     */
+    void push_back_lazy(const std::string& img_path, const FlowerImage& img, const cv::Rect& roi = cv::Rect{});
+
+    /**
+     * @brief Adds the image at index i of the lazy container `other` to the end of this lazy container,
+     * without decoding it
+     * @param roi crop region, in the coordinates of the image of `other` (see above)
+     */
+    void push_back_lazy(const FlowerImageContainer& other, const size_t i, const cv::Rect& roi = cv::Rect{});
+
+    /**
+     * @brief Returns the hit/miss/eviction counters of a lazy container
+     */
+    ImageCacheStats cacheStats() const;
 
     /**
      * @brief Combines two FlowerImageContainer into one, preserving the ordering of the elements
+     *
+     * Images are copied (cv::Mat images share their pixels with the source containers).
+     * Both containers must be either eager or lazy; in the latter case `out` is
+     * lazy too, with the budget of `first`.
      * @param first
      * @param second
      * @param out output FlowerImageContainer, passed by reference
@@ -67,9 +191,122 @@ public:
         FlowerImageContainer& out
     );
 
+    /**
+     * @brief Combines two FlowerImageContainer into one, moving their images
+     *
+     * `first` and `second` are left empty.
+     */
+    static void combineContainers(
+        FlowerImageContainer&& first,
+        FlowerImageContainer&& second,
+        FlowerImageContainer& out
+    );
+
 private:
+    struct LazyState
+    {
+        size_t budget_bytes {0};
+        DecodeOptions decode_opts;
+        std::vector<std::string> paths;
+        std::vector<cv::Rect> rois; // crop of every image once decoded (empty = whole image)
+        std::vector<size_t> bytes;  // 0 if not resident
+        std::list<size_t> lru;      // most recently used first
+        std::vector<std::list<size_t>::iterator> lru_pos;
+        ImageCacheStats stats;
+        std::mutex mutex;
+    };
+
+    // Decodes (if needed) the image at index i of a lazy container; if `copy`
+    // is not null, the image is also copied to it while the container is locked
+    void loadLazy(const size_t i, FlowerImage* copy = nullptr) const;
+
+    // Appends the images of `other` (copied, or moved if `move` is true) to this container
+    void append(FlowerImageContainer& other, const bool move);
+
+    // Appends an image to m_vec and m_map, without looking at the mode of the container
+    void pushImage(FlowerImage&& img);
+
     std::vector<FlowerImage> m_vec;
     std::map<FlowerType, std::vector<size_t>> m_map;
+    std::unique_ptr<LazyState> m_lazy;
+};
+
+/**
+ * @brief A lightweight, non-owning range over (a subset of) the images of a FlowerImageContainer
+ *
+ * Iterators of eager containers refer to the images in the container, without
+ * copies. With lazy containers, images are decoded as they are visited
+ * (`FlowerImageContainer::get()`), and the iterator holds a copy of the current
+ * one (sharing its pixels with the container): the reference is valid until the
+ * iterator is moved or destroyed. The `index()` of an iterator is the position
+ * of the image in the container.
+ */
+class FlowerImageView
+{
+public:
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = FlowerImage;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const FlowerImage*;
+        using reference = const FlowerImage&;
+
+        const_iterator(const FlowerImageContainer* container, const size_t* idx_ptr, size_t pos) :
+            m_container{container}, m_idx_ptr{idx_ptr}, m_pos{pos} {}
+
+        reference operator*() const
+        {
+            if (!m_container->isLazy())
+            {
+                return m_container->at(index());
+            }
+            m_current = m_container->get(index());
+            return m_current;
+        }
+        pointer operator->() const { return &**this; }
+        const_iterator& operator++() { m_pos++; return *this; }
+        const_iterator operator++(int) { const_iterator tmp {*this}; m_pos++; return tmp; }
+        bool operator==(const const_iterator& other) const { return m_pos == other.m_pos; }
+        bool operator!=(const const_iterator& other) const { return m_pos != other.m_pos; }
+
+        /**
+         * @brief Returns the index of the current image in the container
+         */
+        size_t index() const { return (m_idx_ptr != nullptr) ? m_idx_ptr[m_pos] : m_pos; }
+
+    private:
+        const FlowerImageContainer* m_container;
+        const size_t* m_idx_ptr;  // nullptr when viewing the whole container
+        size_t m_pos;
+        mutable FlowerImage m_current;  // lazy containers only: copy of the image last dereferenced
+    };
+
+    /**
+     * @param indices indices of the viewed images, or nullptr to view the whole container
+     */
+    FlowerImageView(const FlowerImageContainer* container, const std::vector<size_t>* indices) :
+        m_container{container},
+        m_idx_ptr{(indices != nullptr) ? indices->data() : nullptr},
+        m_size{(indices != nullptr) ? indices->size() : container->size()} {}
+
+    const_iterator begin() const { return const_iterator{m_container, m_idx_ptr, 0}; }
+    const_iterator end() const { return const_iterator{m_container, m_idx_ptr, m_size}; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    /**
+     * @brief The i-th image of an eager container (lazy containers: iterate, or use `FlowerImageContainer::get()`)
+     */
+    const FlowerImage& operator[](const size_t i) const
+    {
+        return m_container->at((m_idx_ptr != nullptr) ? m_idx_ptr[i] : i);
+    }
+
+private:
+    const FlowerImageContainer* m_container;
+    const size_t* m_idx_ptr;
+    size_t m_size;
 };
 
 #endif // FLOWER_IMAGE_CONTAINER_HPP
@@ -2,7 +2,9 @@
 #ifndef FLOWER_TEMPLATE_HPP
 #define FLOWER_TEMPLATE_HPP
 
+#include <array>
 #include <string>
+#include <vector>
 #include <opencv2/core.hpp>
 #include <flower_type.hpp>
 #include <flower_image.hpp>
@@ -15,7 +17,7 @@ class FlowerTemplate : public FlowerImage
 public:
     FlowerTemplate() = default;
     FlowerTemplate(std::string name, FlowerType fl_type, bool healthy, int img_type,
-                   cv::Mat_<cv::Vec3b>& img_templ, cv::Mat_<uchar>& img_mask);
+                   cv::Mat_<cv::Vec3b> img_templ, cv::Mat_<uchar> img_mask);
 
     /**
      * @brief Returns the Template associated with the image
@@ -30,4 +32,9 @@ public:
     cv::Mat_<uchar>& getMask();
 };
 
+/**
+ * @brief Templates of every flower class, indexed by FlowerType (NoFlower has no templates)
+ */
+using TemplateBank = std::array<std::vector<FlowerTemplate>, num_classes - 1>;
+
 #endif // FLOWER_TEMPLATE_HPP
@@ -0,0 +1,108 @@
+// Author: Luca Pellegrini
+#ifndef FOURIER_MELLIN_HPP
+#define FOURIER_MELLIN_HPP
+
+#include <cstddef>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <flower_template.hpp>
+
+/**
+ * @brief Scale- and rotation-invariant template matching (Fourier-Mellin)
+ *
+ * The magnitude of the Fourier transform does not depend on translations, and
+ * scales and rotates with the image: in log-polar coordinates, scaling and
+ * rotation become translations, which phase correlation recovers. Templates and
+ * test images are placed on a square canvas (windowed, so that the borders do
+ * not add spurious frequencies), their high-pass filtered magnitude spectra are
+ * mapped to log-polar coordinates, and the `poses` highest peaks of the phase
+ * correlation between the log-polar maps of a template and of the test image are
+ * its candidate poses (scale and rotation). The magnitude spectrum is symmetric,
+ * so every rotation is ambiguous by 180 degrees: both are verified.
+ *
+ * Verification warps template and mask to the candidate pose, and computes their
+ * masked TM_CCORR_NORMED on the test image (`cv::matchTemplate()`): the score
+ * of a template is the highest one among its candidate poses. Every template
+ * costs one phase correlation and 2 * `poses` correlations, whatever the scale
+ * of the flower in the test image.
+ *
+ * The log-polar spectra of the templates are computed once, when the object is
+ * built; the one of a test image is computed once by `prepareImage()`.
+ */
+class FourierMellin
+{
+public:
+    /**
+     * @brief Scale and rotation of a template in a test image
+     */
+    struct Pose
+    {
+        double scale {1.0};
+        double angle {0.0};  // degrees, counter-clockwise
+    };
+
+    /**
+     * @brief A test image, ready to be searched by `maxScore()`
+     */
+    struct PreparedImage
+    {
+        cv::Mat_<cv::Vec3b> image;
+        cv::Mat log_polar_spectrum;  // spectrum of the windowed log-polar map of the magnitude spectrum
+    };
+
+    // Size of the log-polar maps: log radius on columns, angle (0 to 360 degrees) on rows
+    static constexpr int log_polar_width {512};
+    static constexpr int log_polar_height {360};
+
+    FourierMellin() = default;
+
+    /**
+     * @brief Precompute the log-polar spectrum of every template of the bank
+     * @param image_side longest side of the test images (the canvas is a square of this side, at least)
+     * @param poses candidate poses verified per template
+     */
+    FourierMellin(const TemplateBank& templates, const int image_side, const int poses);
+
+    bool empty() const;
+    size_t numClasses() const;
+    size_t numTemplates(const size_t c) const;
+
+    /**
+     * @brief Compute the log-polar spectrum of a test image (whose longest side must not exceed `image_side`)
+     */
+    void prepareImage(const cv::Mat_<cv::Vec3b>& image, PreparedImage& prepared) const;
+
+    /**
+     * @brief Candidate poses of template `t` of class `c`, from the best to the worst peak
+     */
+    std::vector<Pose> estimatePoses(const PreparedImage& prepared, const size_t c, const size_t t) const;
+
+    /**
+     * @brief Highest score of template `t` of class `c` at its candidate poses (0 if it never fits in the image)
+     * @param best_pose if not null, output param, pose of the highest score
+     * @param best_rect if not null, output param, bounding box of the warped template at the highest score
+     */
+    double maxScore(const PreparedImage& prepared, const size_t c, const size_t t, Pose* best_pose = nullptr,
+                    cv::Rect* best_rect = nullptr) const;
+
+private:
+    struct TemplateData
+    {
+        cv::Mat_<cv::Vec3b> templ;
+        cv::Mat_<uchar> mask;        // 0 or 255
+        cv::Mat log_polar_spectrum;  // empty if the template never matches
+    };
+
+    cv::Mat logPolarSpectrum(const cv::Mat& gray) const;
+    double verify(const cv::Mat_<cv::Vec3b>& image, const TemplateData& templ, const Pose& pose,
+                  cv::Rect& match_rect) const;
+
+    int m_canvas {0};           // side of the square canvas
+    int m_poses {1};
+    cv::Mat m_canvas_window;    // Hanning window of the canvas
+    cv::Mat m_high_pass;        // high-pass filter of the centered magnitude spectrum
+    cv::Mat m_log_polar_window; // Hanning window of the log-polar maps
+    std::vector<std::vector<TemplateData>> m_templates;
+};
+
+#endif // FOURIER_MELLIN_HPP
@@ -0,0 +1,96 @@
+// Author: Luca Pellegrini
+#ifndef HAMMING_MATCHER_HPP
+#define HAMMING_MATCHER_HPP
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include <opencv2/core.hpp>
+
+/**
+ * @brief Brute-force k-nearest neighbour search among 256-bit binary descriptors (ORB), by Hamming distance
+ *
+ * Queries and train descriptors are compared in blocks: a block of `query_block`
+ * queries runs through `train_block` train descriptors at a time, which stay in
+ * the L1 cache meanwhile. Distances are computed by a kernel selected at
+ * runtime: AVX-512 with VPOPCNTDQ (one `vpopcntq` per descriptor pair), AVX2
+ * (per-byte popcount from two `vpshufb` nibble lookups, summed by `vpsadbw`),
+ * or `cv::hal::normHamming()`, according to the CPU and to what the build
+ * enabled (`CONFIG_TM_SIMD`).
+ *
+ * Matches are the same as the ones of `cv::BFMatcher` with `cv::NORM_HAMMING`:
+ * the k nearest train rows of every query, closest first, the lowest row first
+ * among equally distant ones.
+ */
+class HammingMatcher
+{
+public:
+    enum class Isa
+    {
+        Scalar,
+        AVX2,
+        AVX512
+    };
+
+    static constexpr int descriptor_bytes {32};
+    static constexpr int train_block {1024};  // 32 KiB of train descriptors
+    static constexpr int query_block {64};
+
+    /**
+     * @brief The `k` nearest train rows of every query row (CV_8U, 32 bytes per row)
+     * @param matches Output param, one vector per query (shorter than `k` if there are fewer train rows)
+     */
+    static void knnMatch(const cv::Mat& queries, const cv::Mat& train, const int k,
+                         std::vector<std::vector<cv::DMatch>>& matches);
+
+    /**
+     * @brief The nearest train row of every query row (no match for any query if `train` is empty)
+     */
+    static void match(const cv::Mat& queries, const cv::Mat& train, std::vector<cv::DMatch>& matches);
+
+    /**
+     * @brief The nearest train row of every query row that passes Lowe's ratio test
+     *
+     * A match is accepted if its distance is less than `ratio` times the one of
+     * the second nearest train row (always, if there is a single train row).
+     * Only the two nearest distances of every query are kept during the scan, and
+     * a query whose two nearest rows are both at distance 0 is not scanned any
+     * further, since its test can no longer pass.
+     * @param on_match called with every accepted match, in query order
+     */
+    static void ratioMatch(const cv::Mat& queries, const cv::Mat& train, const double ratio,
+                           const std::function<void(const cv::DMatch&)>& on_match);
+
+    /**
+     * @brief The kernel used by every search
+     */
+    static Isa isa();
+
+    /**
+     * @brief The best kernel supported by both the CPU and the build
+     */
+    static Isa bestIsa();
+
+    /**
+     * @brief Use another kernel (e.g. to compare them); fails if the kernel is not supported
+     */
+    static bool setIsa(const Isa isa);
+
+    static const char* isaName(const Isa isa);
+};
+
+// Kernels of HammingMatcher: `distances[i]` = Hamming distance between `query` and
+// train row i, for `count` rows. The SIMD ones are compiled (with their own flags)
+// only when the build enables them
+void hammingDistancesScalar(const uchar* query, const uchar* train, const size_t train_step, const int count,
+                            int* distances);
+#ifdef TM_SIMD_AVX2
+void hammingDistancesAVX2(const uchar* query, const uchar* train, const size_t train_step, const int count,
+                          int* distances);
+#endif
+#ifdef TM_SIMD_AVX512
+void hammingDistancesAVX512(const uchar* query, const uchar* train, const size_t train_step, const int count,
+                            int* distances);
+#endif
+
+#endif // HAMMING_MATCHER_HPP
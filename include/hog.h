@@ -5,6 +5,7 @@
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/objdetect.hpp>
+#include <string>
 #include <vector>
 
 class HOGExtractor {
@@ -23,8 +24,12 @@ class HOGExtractor {
         // Compute L2 distance between 2 HOG descriptor vectors
         double matchDescriptors(const std::vector<float> &descriptors1, const std::vector<float> &descriptors2) const;
 
+        // Get a string identifying the extraction parameters (used as feature cache key)
+        const std::string &getParamsKey() const;
+
     private:
         cv::HOGDescriptor hog_;
+        std::string paramsKey_;
 };
 
 #endif // HOG_H
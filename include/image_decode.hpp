@@ -0,0 +1,49 @@
+// Author: Luca Pellegrini
+#ifndef IMAGE_DECODE_HPP
+#define IMAGE_DECODE_HPP
+
+#include <string>
+#include <opencv2/core.hpp>
+
+/**
+ * @brief Resolution policy applied while decoding dataset images
+ *
+ * A value of 0 disables the corresponding limit. When both limits are set,
+ * the stricter one applies. Aspect ratio is always preserved.
+ */
+struct DecodeOptions
+{
+    int max_side {0};       // maximum length (pixels) of the longest side
+    double max_area {0.0};  // maximum number of pixels
+
+    bool enabled() const { return max_side > 0 || max_area > 0.0; }
+};
+
+/**
+ * @brief Decode an image file once, and derive its grayscale version from the BGR buffer
+ *
+ * If `opts` sets a resolution cap, the image is decoded at reduced resolution
+ * (`cv::IMREAD_REDUCED_COLOR_*`) whenever its size can be read from the file header,
+ * so that the full-resolution image is never held in memory; then it is resized
+ * to fit the cap.
+ * @return true if successful; false otherwise
+ */
+bool decodeImage(
+    const std::string& img_path,
+    cv::Mat_<cv::Vec3b>& img_color,
+    cv::Mat_<uchar>& img_gray,
+    const DecodeOptions& opts = DecodeOptions{}
+);
+
+/**
+ * @brief Read width and height of a JPEG, PNG or WEBP image from its header, without decoding it
+ * @return true if successful; false if the format is not recognized
+ */
+bool readImageSize(const std::string& img_path, cv::Size& size);
+
+/**
+ * @brief Size of an image of size `size` once the resolution cap is applied
+ */
+cv::Size cappedSize(const cv::Size size, const DecodeOptions& opts);
+
+#endif // IMAGE_DECODE_HPP
@@ -0,0 +1,58 @@
+// Author: Marco Carraro
+
+#ifndef LABELLED_DESCRIPTORS_H
+#define LABELLED_DESCRIPTORS_H
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+#include <array>
+#include <map>
+#include <vector>
+
+#include "flower_type.hpp"
+
+// The training descriptors of every class stacked into one matrix, with the class of every row,
+// so that a test image is matched once against all the classes
+struct LabelledDescriptors {
+    cv::Mat descriptors;
+    std::vector<FlowerType> labels;     // class of every row of descriptors
+    cv::Ptr<cv::DescriptorMatcher> matcher;     // trained FLANN index of descriptors (SIFT, SURF; null = none)
+};
+
+// Number of matches voting for every class, indexed by FlowerType
+using ClassVotes = std::array<int, num_classes>;
+
+// Stack descriptor matrices of the same type and width: rows are counted first, and every block is copied
+// once into a single matrix (linear in the number of rows)
+cv::Mat stackDescriptors(const std::vector<cv::Mat>& blocks);
+
+// Stack the per-class descriptor matrices (in class order) and label their rows
+void buildLabelledDescriptors(
+    const std::map<FlowerType, cv::Mat>& train_descriptors,
+    LabelledDescriptors& labelled
+);
+
+// Train the FLANN index of the stacked (float) descriptors once: it is only read while matching, so every
+// extractor clone of every thread reuses it instead of building its own (see SIFTExtractor::setTrainedMatcher)
+void trainLabelledMatcher(LabelledDescriptors& labelled);
+
+// Class with the most votes; the first class wins ties, NoFlower if there are no votes
+FlowerType mostVoted(const ClassVotes& votes);
+
+// Class with the most good matches, as mostVoted: each match votes for the class of its train row if its
+// distance is under threshold * the minimum distance among the matches of that class (as if every class
+// had been matched on its own). The minima of all the classes are found in a single pass over the matches
+FlowerType voteClasses(
+    const std::vector<cv::DMatch>& matches,
+    const std::vector<FlowerType>& labels,
+    double threshold
+);
+
+// How SIFT, SURF and ORB keep the matches of a test image against the labelled descriptors:
+// ratio > 0 runs Lowe's ratio test with that ratio (in (0, 1]) while matching, and every accepted match
+// votes directly; ratio = 0 (default) keeps the nearest neighbours under threshold * the minimum distance
+// of their class (see voteClasses)
+void setRatioTest(double ratio);
+double getRatioTest();
+
+#endif // LABELLED_DESCRIPTORS_H
@@ -0,0 +1,110 @@
+// Author: Luca Pellegrini
+#ifndef MASKED_CCORR_HPP
+#define MASKED_CCORR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+/**
+ * @brief Masked TM_CCORR_NORMED of an 8-bit BGR template, computed directly in the spatial domain
+ *
+ * Scores are the same as the ones of `cv::matchTemplate()` with `cv::TM_CCORR_NORMED`
+ * and an 8-bit mask (used as a binary mask M, see MaskedNCC):
+ *
+ *     sum_c sum_p I_c(x+p) T_c(p) M(p) / sqrt( sum_c sum_p (T_c(p) M(p))^2 * sum_c sum_p I_c(x+p)^2 M(p) )
+ *
+ * Both sums are computed exactly with integer arithmetic, so scores do not
+ * depend on the instruction set. The kernel is selected at runtime: AVX-512
+ * (BW and VL), AVX2, or plain scalar code, according to the CPU and to what the
+ * build enabled (`CONFIG_TM_SIMD`).
+ *
+ * Every position costs a full pass over the template: use it for a few
+ * positions (as the coarse-to-fine search does), and MaskedNCC for whole maps
+ * with large templates.
+ */
+class MaskedCCorr
+{
+public:
+    enum class Isa
+    {
+        Scalar,
+        AVX2,
+        AVX512
+    };
+
+    // Longest template row, in bytes, whose sums fit into the 32-bit accumulators of one row
+    static constexpr int max_row_bytes {32768};
+
+    MaskedCCorr() = default;
+
+    /**
+     * @brief Prepare a template and its mask (pixels where the mask is not 0)
+     */
+    MaskedCCorr(const cv::Mat_<cv::Vec3b>& templ, const cv::Mat_<uchar>& mask);
+
+    bool empty() const;
+    cv::Size size() const;
+
+    /**
+     * @brief Score of the template with its top-left corner at `pos`, which must fit in the image
+     *
+     * Positions where the masked image patch is black score 0.
+     */
+    double scoreAt(const cv::Mat_<cv::Vec3b>& image, const cv::Point pos) const;
+
+    /**
+     * @brief Score map, of the same size as the one of `cv::matchTemplate()` (empty if the image is smaller than the template)
+     */
+    void match(const cv::Mat_<cv::Vec3b>& image, cv::Mat_<float>& result) const;
+
+    /**
+     * @brief The kernel used by every object
+     */
+    static Isa isa();
+
+    /**
+     * @brief The best kernel supported by both the CPU and the build
+     */
+    static Isa bestIsa();
+
+    /**
+     * @brief Use another kernel (e.g. to compare them); fails if the kernel is not supported
+     */
+    static bool setIsa(const Isa isa);
+
+    static const char* isaName(const Isa isa);
+
+private:
+    cv::Mat_<cv::Vec3b> m_masked_templ;  // T * M
+    cv::Mat_<cv::Vec3b> m_mask;          // M, 0 or 255 on every channel
+    int64_t m_energy {0};                // sum_c sum_p (T_c(p) M(p))^2
+};
+
+/**
+ * @brief Sums computed by the kernels of MaskedCCorr, for one position
+ */
+struct MaskedCCorrSums
+{
+    int64_t correlation {0};   // sum I * (T M)
+    int64_t patch_energy {0};  // sum (I M)^2
+};
+
+// Kernels of MaskedCCorr: `rows` rows of `row_bytes` bytes, starting at the given
+// position of the image. The SIMD ones are compiled (with their own flags) only
+// when the build enables them
+MaskedCCorrSums maskedCCorrScalar(const uchar* image, const size_t image_step,
+                                  const uchar* masked_templ, const uchar* mask, const size_t templ_step,
+                                  const int rows, const int row_bytes);
+#ifdef TM_SIMD_AVX2
+MaskedCCorrSums maskedCCorrAVX2(const uchar* image, const size_t image_step,
+                                const uchar* masked_templ, const uchar* mask, const size_t templ_step,
+                                const int rows, const int row_bytes);
+#endif
+#ifdef TM_SIMD_AVX512
+MaskedCCorrSums maskedCCorrAVX512(const uchar* image, const size_t image_step,
+                                  const uchar* masked_templ, const uchar* mask, const size_t templ_step,
+                                  const int rows, const int row_bytes);
+#endif
+
+#endif // MASKED_CCORR_HPP
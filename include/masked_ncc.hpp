@@ -0,0 +1,166 @@
+// Author: Luca Pellegrini
+#ifndef MASKED_NCC_HPP
+#define MASKED_NCC_HPP
+
+#include <array>
+#include <cstddef>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <flower_template.hpp>
+
+/**
+ * @brief Masked normalized cross-correlation, computed in the frequency domain
+ *
+ * Computes the same scores as `cv::matchTemplate()` with `cv::TM_CCORR_NORMED`
+ * and an 8-bit mask (which OpenCV uses as a binary mask M):
+ *
+ *     sum_c sum_p I_c(x+p) T_c(p) M(p) / sqrt( sum_c sum_p (T_c(p) M(p))^2 * sum_c sum_p I_c(x+p)^2 M(p) )
+ *
+ * Test images are cut into overlapping tiles of a fixed DFT size (overlap-save),
+ * hence the spectra of every template (T_c * M for every channel, and M) do not
+ * depend on the test image: they are computed once, when the object is built,
+ * and reused for every test image and scale. The spectra of a test image are
+ * computed once by `transformImage()` and shared by all the templates; channels
+ * are summed in the frequency domain, so every template costs two inverse DFTs
+ * per tile.
+ *
+ * The DFT size is about twice the size of the largest template, so the spectra
+ * take 4 * 4 * (2 * width) * (2 * height) bytes per template.
+ *
+ * With `eigen_templates` > 0, the templates of every class are compressed: PCA
+ * on the masked templates T * M (and, separately, on the masks M) keeps the
+ * mean and at most `eigen_templates` components. Only the spectra of these
+ * bases are stored, and every test image is correlated once with every basis
+ * (`matchBases()`); the numerator and the denominator of every template are then
+ * linear combinations of the basis maps (`reconstruct()`), so adding templates
+ * costs a few multiply-adds per position. Scores are exact when the components
+ * span the templates (`eigen_templates` >= templates per class - 1), and
+ * approximate otherwise. All the templates of a class must have the same size:
+ * the ones that differ from the first template of their class never match.
+ */
+class MaskedNCC
+{
+public:
+    /**
+     * @brief Spectra of the tiles of a test image, as computed by `transformImage()`
+     */
+    struct ImageSpectra
+    {
+        cv::Size image_size;
+        std::vector<cv::Point> origins;             // top-left corner of every tile
+        std::vector<std::array<cv::Mat, 4>> tiles;  // spectra of B, G, R and of B^2 + G^2 + R^2 (entries past
+                                                    // origins.size() are spare, and reused by the next image)
+    };
+
+    /**
+     * @brief Correlations of a test image with the bases of a class, as computed by `matchBases()`
+     */
+    struct BasisMaps
+    {
+        std::vector<cv::Mat_<float>> numerators;    // sum_c I_c * B_c, for the mean template and every eigen-template B
+        std::vector<cv::Mat_<float>> denominators;  // sum_c I_c^2 * N, for the mean mask and every eigen-mask N
+    };
+
+    // Masked image patches whose sum of squares is below this value are black, and score 0
+    static constexpr double min_patch_energy {0.5};
+
+    MaskedNCC() = default;
+
+    /**
+     * @brief Precompute the spectra of every template of the bank, or of the eigen-templates of every class
+     * @param eigen_templates 0 = keep every template, N = compress every class to at most N eigen-templates
+     */
+    explicit MaskedNCC(const TemplateBank& templates, const int eigen_templates = 0);
+
+    bool empty() const;
+    bool compressed() const;
+    size_t numClasses() const;
+    size_t numTemplates(const size_t c) const;
+    cv::Size templateSize(const size_t c, const size_t t) const;
+
+    /**
+     * @brief Compute the spectra of the tiles of a test image
+     *
+     * The spectra of `spectra` are overwritten in place: reusing the same object
+     * for every test image avoids reallocating them.
+     */
+    void transformImage(const cv::Mat_<cv::Vec3b>& image, ImageSpectra& spectra) const;
+
+    /**
+     * @brief Score map of template `t` of class `c`, of the same size as the one of `cv::matchTemplate()`
+     *
+     * Positions where the masked image patch is black score 0. The map is empty
+     * if the image is smaller than the template.
+     */
+    void match(const ImageSpectra& spectra, const size_t c, const size_t t, cv::Mat_<float>& result) const;
+
+    /**
+     * @brief Positions of the score map of template `t` of class `c` computed by every tile of the image
+     *
+     * One rectangle per tile, empty for the tiles that compute none of them.
+     */
+    void tileOutputs(const ImageSpectra& spectra, const size_t c, const size_t t, std::vector<cv::Rect>& outputs) const;
+
+    /**
+     * @brief Scores of template `t` of class `c` computed by tile `i` (not on compressed objects)
+     *
+     * `result` must have the size of the whole score map: the scores are written
+     * to their positions (see `tileOutputs()`), the rest is left untouched.
+     */
+    void matchTile(const ImageSpectra& spectra, const size_t c, const size_t t, const size_t i,
+                   cv::Mat_<float>& result) const;
+
+    /**
+     * @brief Highest score of template `t` of class `c` on the image (0 if the image is smaller than the template)
+     * @param max_loc if not null, output param, top-left corner of the best match
+     */
+    double maxScore(const ImageSpectra& spectra, const size_t c, const size_t t, cv::Point* max_loc = nullptr) const;
+
+    /**
+     * @brief Correlate the image with the bases of class `c` (compressed objects only)
+     *
+     * Maps are empty if the image is smaller than the templates of the class.
+     */
+    void matchBases(const ImageSpectra& spectra, const size_t c, BasisMaps& maps) const;
+
+    /**
+     * @brief Score map of template `t` of class `c`, from the basis maps of its class (compressed objects only)
+     */
+    void reconstruct(const BasisMaps& maps, const size_t c, const size_t t, cv::Mat_<float>& result) const;
+
+private:
+    struct TemplateSpectra
+    {
+        cv::Size size;
+        std::array<cv::Mat, 3> masked_templ;  // spectra of T_c * M
+        cv::Mat mask;                         // spectrum of M
+        double energy {0.0};                  // sum_c sum_p (T_c(p) M(p))^2
+    };
+
+    // Bases of a class, when compressed
+    struct ClassBases
+    {
+        cv::Size size;                              // size of the templates of the class
+        std::vector<std::array<cv::Mat, 3>> templ;  // spectra of the mean of T * M, then of every eigen-template
+        std::vector<cv::Mat> mask;                  // spectra of the mean mask, then of every eigen-mask
+        cv::Mat_<float> templ_coeffs;               // [template][eigen-template]
+        cv::Mat_<float> mask_coeffs;                // [template][eigen-mask]
+    };
+
+    cv::Size resultSize(const ImageSpectra& spectra, const TemplateSpectra& templ) const;
+    cv::Rect tileOutput(const ImageSpectra& spectra, const cv::Size result_size, const size_t i) const;
+    cv::Mat forwardDFT(const cv::Mat& plane) const;
+    void forwardDFT(const cv::Mat& plane, cv::Mat& padded, cv::Mat& spectrum) const;
+    void compressClass(const std::vector<FlowerTemplate>& class_templates, const int eigen_templates,
+                       ClassBases& bases, std::vector<TemplateSpectra>& spectra) const;
+    static void normalizeRow(const float* numerator, const float* denominator, const double energy,
+                             float* result, const int cols);
+
+    cv::Size m_dft_size;
+    cv::Size m_step;        // distance between two tiles
+    cv::Size m_min_templ;   // smallest template of the bank
+    std::vector<std::vector<TemplateSpectra>> m_templates;  // only size and energy, when compressed
+    std::vector<ClassBases> m_bases;                         // empty unless compressed
+};
+
+#endif // MASKED_NCC_HPP
@@ -0,0 +1,93 @@
+// Author: Luca Pellegrini
+#ifndef MASKED_SQDIFF_HPP
+#define MASKED_SQDIFF_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+
+/**
+ * @brief Masked TM_SQDIFF_NORMED of an 8-bit BGR template, computed with integer arithmetic
+ *
+ * R is the masked normalized sum of squared differences of `cv::matchTemplate()`
+ * with `cv::TM_SQDIFF_NORMED` and an 8-bit mask (used as a binary mask M):
+ *
+ *     R = sum_c sum_p (T_c(p) - I_c(x+p))^2 M(p) / sqrt( sum_c sum_p (T_c(p) M(p))^2 * sum_c sum_p I_c(x+p)^2 M(p) )
+ *
+ * Scores are 1 - R / 2, so that the best match is the highest score, as with
+ * MaskedCCorr: they equal the TM_CCORR_NORMED score where the masked energies
+ * of template and image patch are the same, and are lower where they differ
+ * (by (sqrt(E_T) - sqrt(E_I))^2 / (2 sqrt(E_T E_I))). Scores below 0, and
+ * positions where the masked image patch is black, are 0.
+ *
+ * The sum of squared differences is computed with saturating 8-bit arithmetic
+ * (|T - I| = (T - I) | (I - T), both saturated at 0), squared and accumulated
+ * into 32 bits for every template row, by the kernel selected with
+ * `MaskedCCorr::setIsa()`. The masked energy of the image patch comes from an
+ * integral image of the squares of the test image (`integrate()`, once per
+ * image): the mask is split into rectangles, and each rectangle costs four
+ * lookups per position. Every sum is exact, so scores do not depend on the
+ * instruction set.
+ *
+ * As MaskedCCorr, every position costs a full pass over the template.
+ */
+class MaskedSqDiff
+{
+public:
+    MaskedSqDiff() = default;
+
+    /**
+     * @brief Prepare a template and its mask (pixels where the mask is not 0)
+     */
+    MaskedSqDiff(const cv::Mat_<cv::Vec3b>& templ, const cv::Mat_<uchar>& mask);
+
+    bool empty() const;
+    cv::Size size() const;
+
+    /**
+     * @brief Integral image of B^2 + G^2 + R^2: one row and one column larger than the image
+     *
+     * Sums are integers, exact in double precision. `integral` is reused if it already has the right size.
+     */
+    static void integrate(const cv::Mat_<cv::Vec3b>& image, cv::Mat_<double>& integral);
+
+    /**
+     * @brief Score of the template with its top-left corner at `pos`, which must fit in the image
+     * @param integral `integrate()` of the image
+     */
+    double scoreAt(const cv::Mat_<cv::Vec3b>& image, const cv::Mat_<double>& integral, const cv::Point pos) const;
+
+    /**
+     * @brief Score map, of the same size as the one of `cv::matchTemplate()` (empty if the image is smaller than the template)
+     *
+     * `result` is reused if it already has the right size.
+     */
+    void match(const cv::Mat_<cv::Vec3b>& image, const cv::Mat_<double>& integral, cv::Mat_<float>& result) const;
+
+private:
+    cv::Mat_<cv::Vec3b> m_masked_templ;  // T * M
+    cv::Mat_<cv::Vec3b> m_mask;          // M, 0 or 255 on every channel
+    std::vector<cv::Rect> m_mask_rects;  // rectangles covering M exactly, each pixel once
+    int64_t m_energy {0};                // sum_c sum_p (T_c(p) M(p))^2
+};
+
+// Kernels of MaskedSqDiff: sum of (|I - T M| & M)^2 over `rows` rows of `row_bytes`
+// bytes (at most MaskedCCorr::max_row_bytes), starting at the given position of
+// the image. The SIMD ones are compiled (with their own flags) only when the
+// build enables them
+int64_t maskedSqDiffScalar(const uchar* image, const size_t image_step,
+                           const uchar* masked_templ, const uchar* mask, const size_t templ_step,
+                           const int rows, const int row_bytes);
+#ifdef TM_SIMD_AVX2
+int64_t maskedSqDiffAVX2(const uchar* image, const size_t image_step,
+                         const uchar* masked_templ, const uchar* mask, const size_t templ_step,
+                         const int rows, const int row_bytes);
+#endif
+#ifdef TM_SIMD_AVX512
+int64_t maskedSqDiffAVX512(const uchar* image, const size_t image_step,
+                           const uchar* masked_templ, const uchar* mask, const size_t templ_step,
+                           const int rows, const int row_bytes);
+#endif
+
+#endif // MASKED_SQDIFF_HPP
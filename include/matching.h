@@ -4,20 +4,83 @@
 #define MATCHING_H
 
 #include <flower_image_container.hpp>
+#include <flower_type.hpp>
+#include <hog.h>
+#include <bow.h>
 #include <string>
+#include <vector>
 
+// Trained HOG classifier: one descriptor per train image (healthy images, then diseased ones, in load order),
+// and the flower type of each one
+struct HOGModel
+{
+    HOGExtractor extractor;
+    std::vector<std::vector<float>> train_descriptors;
+    std::vector<FlowerType> train_labels;
+};
+
+// Trained BoW classifier: vocabulary (inside the extractor) and one histogram per train image (same order as
+// HOGModel), and the flower type of each one
+struct BoWModel
+{
+    BoWExtractor extractor {300, 20};
+    std::vector<cv::Mat> train_histograms;
+    std::vector<FlowerType> train_labels;
+};
+
+void trainHOG(
+    const FlowerImageContainer& train_healthy_images,
+    const FlowerImageContainer& train_diseased_images,
+    HOGModel& model
+);
+
+// Nearest neighbour over the train descriptors; returns false if no descriptor can be extracted
+bool classifyHOG(
+    const cv::Mat& image_gray,
+    HOGModel& model,
+    FlowerType& predicted_type,
+    double& best_distance
+);
+
+bool trainBoW(
+    const FlowerImageContainer& train_healthy_images,
+    const FlowerImageContainer& train_diseased_images,
+    BoWModel& model
+);
+
+// Nearest neighbour over the train histograms; returns false if no histogram can be extracted
+bool classifyBoW(
+    const cv::Mat& image_gray,
+    BoWModel& model,
+    FlowerType& predicted_type,
+    double& best_distance
+);
+
+// Same as above, extracting the test histogram with `extractor` (a clone of model.extractor owned by the calling thread)
+bool classifyBoW(
+    const cv::Mat& image_gray,
+    const BoWModel& model,
+    BoWExtractor& extractor,
+    FlowerType& predicted_type,
+    double& best_distance
+);
+
+// If pretrained is not null, training is skipped
 void hog(
     const FlowerImageContainer& test_images,
     const FlowerImageContainer& train_healthy_images,
     const FlowerImageContainer& train_diseased_images,
-    const std::string& output_dir
+    const std::string& output_dir,
+    HOGModel* pretrained = nullptr
 );
 
+// If pretrained is not null, training (including k-means) is skipped
 void bow(
     const FlowerImageContainer& test_images,
     const FlowerImageContainer& train_healthy_images,
     const FlowerImageContainer& train_diseased_images,
-    const std::string& output_dir
+    const std::string& output_dir,
+    BoWModel* pretrained = nullptr
 );
 
 #endif // MATCHING_H
@@ -5,6 +5,16 @@
 
 #include <vector>
 
+#include "flower_type.hpp"
+
+// Outcome of the classification of a single test image
+// (filled by parallel tasks, then added to the metrics in the original order)
+struct TestOutcome{
+    bool classified = false;
+    FlowerType predicted_type = FlowerType::NoFlower;
+    double time_ms = 0.0;
+};
+
 // Structure to hold metrics data
 struct Metrics{
     int num_classes;
@@ -0,0 +1,67 @@
+// Author: Marco Carraro
+
+#ifndef MIH_INDEX_H
+#define MIH_INDEX_H
+
+#include <opencv2/core.hpp>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Exact nearest neighbour search among 256-bit binary descriptors (ORB), with multi-index hashing
+// (Norouzi et al., "Fast Exact Search in Hamming Space with Multi-Index Hashing").
+//
+// Every descriptor is cut into 16 substrings of 16 bits, and each substring indexes its own hash table.
+// If two descriptors differ by less than 16 * (s + 1) bits, at least one of their substrings differs
+// by at most s bits: a query probes every table at substring radius 0, 1, 2, ... and stops as soon as
+// no descriptor left unseen can be closer than the best one found so far. Near neighbours are then
+// found by looking at a small fraction of the descriptors. When probing would cost more than comparing
+// the query with every descriptor (small indices, or queries far from everything), the query falls
+// back to the linear scan (HammingMatcher), so a query never costs more than about twice the brute-force search.
+//
+// Distances are the same as the ones of cv::BFMatcher with NORM_HAMMING; among equally distant
+// descriptors, the one returned may differ.
+class MIHIndex {
+    public:
+        static constexpr int descriptor_bytes = 32;
+        static constexpr int substrings = 16;       // 16 bits each
+
+        MIHIndex() = default;
+
+        // Index the rows of a CV_8U matrix of 32-byte descriptors (shared, not copied, if continuous)
+        explicit MIHIndex(const cv::Mat &descriptors);
+
+        bool empty() const;
+        int size() const;
+
+        // The indexed descriptors
+        const cv::Mat &descriptors() const;
+
+        // Nearest neighbour of every row of queries (queryIdx = row, trainIdx = row of the indexed descriptors).
+        // If max_distance >= 0, queries with no descriptor within max_distance bits get no match
+        void match(const cv::Mat &queries, std::vector<cv::DMatch> &matches, int max_distance = -1) const;
+
+        // Nearest neighbour of one descriptor: its row, or -1 if there is none within max_distance (if >= 0)
+        int nearest(const uchar *query, int &distance, int max_distance = -1) const;
+
+        // Nearest neighbour of every row of queries that passes Lowe's ratio test (its distance is less than
+        // ratio * the distance of the second nearest neighbour): on_match is called with every accepted match,
+        // in query order. A query stops probing as soon as the outcome of its test is known, which is usually
+        // well before its second nearest neighbour is
+        void ratioMatch(const cv::Mat &queries, double ratio,
+                        const std::function<void(const cv::DMatch &)> &on_match) const;
+
+        // Ratio test of one descriptor: the row of its nearest neighbour, or -1 if the test fails
+        int ratioNearest(const uchar *query, double ratio, int &distance) const;
+
+    private:
+        int linearNearest(const uchar *query, int &distance, int max_distance) const;
+        int linearRatioNearest(const uchar *query, double ratio, int &distance) const;
+
+        cv::Mat descriptors_;
+        // Table t: the rows whose substring t is `key` are ids_[t][offsets_[t][key]] ... ids_[t][offsets_[t][key + 1] - 1]
+        std::vector<std::vector<uint32_t>> offsets_;
+        std::vector<std::vector<int>> ids_;
+};
+
+#endif // MIH_INDEX_H
@@ -5,10 +5,21 @@
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/features2d.hpp>
+#include <functional>
+#include <string>
 #include <vector>
 
+#include "mih_index.h"
+
 class ORBExtractor {
     public:
+        // How test descriptors are matched to train descriptors (all of them find the same nearest distances)
+        enum class MatcherType {
+            MultiIndexHashing,  // MIHIndex, sublinear in the number of train descriptors (brute force without an index)
+            Hamming,            // HammingMatcher, brute force with SIMD popcount
+            BruteForce          // cv::BFMatcher with NORM_HAMMING
+        };
+
         ORBExtractor(                       // Default parameters based on OpenCV documentation
             int nfeatures = 1500,           // The maximum number of features to retain
             float scaleFactor = 1.2f,       // Pyramid decimation ratio, greater than 1. scaleFactor==2 means the classical pyramid, where each next level has 4x less pixels than the previous, but such a big scale factor will degrade feature matching scores dramatically
@@ -31,17 +42,46 @@ class ORBExtractor {
         // Match descriptors between two sets of keypoints
         int matchDescriptors(const cv::Mat &descriptors1, const cv::Mat &descriptors2, std::vector<cv::DMatch> &matches);
 
+        // Match descriptors against an index of train descriptors (same matches as the brute-force matcher)
+        int matchDescriptors(const cv::Mat &descriptors1, const MIHIndex &index2, std::vector<cv::DMatch> &matches);
+
         // Filter matches keeping only those with a distance less than a specified threshold
         std::vector<cv::DMatch> filterMatches(const std::vector<cv::DMatch> &matches, double threshold = 2.0);
 
         // Match descriptors and filter matches in one step
         int matchAndFilter(const cv::Mat &descriptors1, const cv::Mat &descriptors2, std::vector<cv::DMatch> &goodMatches, double threshold = 2.0);
+        int matchAndFilter(const cv::Mat &descriptors1, const MIHIndex &index2, std::vector<cv::DMatch> &goodMatches, double threshold = 2.0);
+
+        // Match descriptors against an index of train descriptors with Lowe's ratio test: onMatch is called with the
+        // nearest neighbour of every descriptor closer than ratio * its second nearest neighbour, with no match vector
+        // in between (early termination with MultiIndexHashing, see MIHIndex::ratioMatch)
+        // Returns the number of accepted matches
+        int ratioMatch(const cv::Mat &descriptors1, const MIHIndex &index2, double ratio, const std::function<void(const cv::DMatch &)> &onMatch);
 
         // Get the time taken for the last matching operation
         double getMatchingTime() const;
 
+        // Get a string identifying the extraction parameters (used as feature cache key)
+        const std::string& getParamsKey() const;
+
+        // Select the matcher used by every extractor (default: MultiIndexHashing)
+        static void setMatcherType(MatcherType type);
+        static MatcherType getMatcherType();
+
+        // Create a new extractor with the same parameters
+        // (an extractor keeps per-call state, so it must not be shared between threads)
+        ORBExtractor clone() const;
+
     private:
         cv::Ptr<cv::ORB> orb_;
+        int nfeatures_;
+        float scaleFactor_;
+        int nlevels_;
+        int edgeThreshold_;
+        int firstLevel_;
+        int WTA_K_;
+        int patchSize_;
+        std::string paramsKey_;
         cv::Ptr<cv::DescriptorMatcher> matcher_;
         double extractionTime_;
         int keypointCount_;
@@ -11,11 +11,21 @@
 #include "flower_image.hpp"
 #include "flower_image_container.hpp"
 #include "orb.h"
+#include "labelled_descriptors.h"
 #include "metrics.h"
 
 using ClassificationRecord = std::array<std::string, 3>;
 using ClassificationRecap = std::vector<ClassificationRecord>;
 
+// Default matching threshold (higher = more matches, lower = stricter)
+const double orb_default_threshold = 1.5;
+
+// Multi-index hashing index of the training descriptors of all the classes, with the class of every row
+struct ORBTrainIndex {
+    MIHIndex index;
+    std::vector<FlowerType> labels;
+};
+
 // Extract ORB features from a container and store them in a temporary map
 void extractORBFeaturesFromContainer(
     const FlowerImageContainer& images,
@@ -30,20 +40,40 @@ void combineORBDescriptors(
     const std::vector<std::string>& class_names
 );
 
+// Build the labelled index of the training descriptors of all the classes
+void buildORBIndex(
+    const std::map<FlowerType, cv::Mat>& train_descriptors,
+    ORBTrainIndex& train_index
+);
+
 // Train ORB on healthy and optionally diseased images
+// If train_index is not null, the labelled index is built too
 void trainORB(
     const FlowerImageContainer& train_healthy,
     const FlowerImageContainer& train_diseased,
     ORBExtractor& orb_extractor,
     std::map<FlowerType, cv::Mat>& train_descriptors,
     const std::vector<std::string>& class_names,
-    bool use_diseased = true
+    bool use_diseased = true,
+    ORBTrainIndex* train_index = nullptr
+);
+
+// Classify a single grayscale image: every descriptor is matched once against the training descriptors
+// of all the classes, and the good matches vote for the class of their training descriptor
+// (matches under threshold * the minimum distance of their class, or the ones that pass the ratio test if set, see setRatioTest)
+// Returns false if no keypoints are found in the image
+bool classifyORB(
+    const cv::Mat& image_gray,
+    const ORBTrainIndex& train_index,
+    ORBExtractor& orb_extractor,
+    double threshold,
+    FlowerType& predicted_type
 );
 
 // Test ORB on test images and update metrics
 void testORB(
     const FlowerImageContainer& test_images,
-    const std::map<FlowerType, cv::Mat>& train_descriptors,
+    const ORBTrainIndex& train_index,
     ORBExtractor& orb_extractor,
     Metrics& metrics,
     const std::vector<std::string>& class_names,
@@ -53,11 +83,13 @@ void testORB(
 );
 
 // Wrapper function to run the entire ORB pipeline (training + testing)
+// If pretrained_descriptors is not null, training is skipped
 void orb(
     const FlowerImageContainer& test_images,
     const FlowerImageContainer& train_healthy,
     const FlowerImageContainer& train_diseased,
-    const std::string& output_dir
+    const std::string& output_dir,
+    const std::map<FlowerType, cv::Mat>* pretrained_descriptors = nullptr
 );
 
 #endif // ORB_PROCESSING_H
\ No newline at end of file
@@ -0,0 +1,75 @@
+// Author: Luca Pellegrini
+#ifndef PARALLEL_IMAGES_HPP
+#define PARALLEL_IMAGES_HPP
+
+#include <cstddef>
+
+#include <flower_image.hpp>
+#include <flower_image_container.hpp>
+#include <prefetch_pipeline.hpp>
+#include <thread_pool.hpp>
+
+/**
+ * @brief Process every image of a container on the ThreadPool
+ *
+ * Images are split into ranges of consecutive indices, each one processed by a
+ * single task. Every task creates its own state with `make_state()` (e.g. a clone
+ * of an extractor, which must not be shared between threads). Images of lazy
+ * containers are decoded by `get()`: each task then has its next images decoded
+ * ahead on the PrefetchThread (see PrefetchPipeline), outside the pool; images of
+ * eager containers are already decoded, and are passed by reference, without copies.
+ * `process(state, i, image)` runs concurrently for different images: results
+ * should be stored by index, and combined in order once this function returns.
+ * @param grain number of images per task (0 = about four tasks per thread)
+ */
+template <typename MakeState, typename Process>
+void forEachImage(
+    const FlowerImageContainer& images,
+    MakeState make_state,
+    Process process,
+    const size_t grain = 0
+)
+{
+    ThreadPool::instance().parallelFor(images.size(), [&](size_t begin, size_t end)
+    {
+        auto state {make_state()};
+        if (!images.isLazy())
+        {
+            for (size_t i {begin}; i < end; i++)
+            {
+                process(state, i, images.at(i));
+            }
+            return;
+        }
+        PrefetchPipeline<FlowerImage> upcoming {
+            end - begin,
+            [&images, begin](size_t k)
+            {
+                return images.get(begin + k);
+            }};
+        FlowerImage image;
+        for (size_t i {begin}; upcoming.next(image); i++)
+        {
+            process(state, i, image);
+        }
+    }, grain);
+}
+
+/**
+ * @brief Same as above, for tasks that need no state of their own: `process(i, image)`
+ */
+template <typename Process>
+void forEachImage(
+    const FlowerImageContainer& images,
+    Process process,
+    const size_t grain = 0
+)
+{
+    forEachImage(
+        images,
+        []() { return 0; },
+        [&process](int&, size_t i, const FlowerImage& image) { process(i, image); },
+        grain);
+}
+
+#endif // PARALLEL_IMAGES_HPP
@@ -0,0 +1,224 @@
+// Author: Luca Pellegrini
+#ifndef PREFETCH_PIPELINE_HPP
+#define PREFETCH_PIPELINE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+/**
+ * @brief Number of items that a PrefetchPipeline prepares ahead of its consumer
+ *
+ * Process-wide setting, used by every PrefetchPipeline created without an explicit depth.
+ * A depth of 0 disables prefetching: items are produced on demand by the consumer thread.
+ */
+void setPrefetchDepth(size_t depth);
+size_t prefetchDepth();
+
+/**
+ * @brief The thread that produces the items of every PrefetchPipeline
+ *
+ * A single process-wide thread, started on first use, that runs jobs in
+ * submission order. It is not a ThreadPool thread, so that upcoming items are
+ * prepared even while every pool thread is busy consuming.
+ */
+class PrefetchThread
+{
+public:
+    /**
+     * @brief Returns the process-wide prefetch thread, starting it on first use
+     */
+    static PrefetchThread& instance();
+
+    ~PrefetchThread();
+    PrefetchThread(const PrefetchThread&) = delete;
+    PrefetchThread& operator=(const PrefetchThread&) = delete;
+
+    void submit(std::function<void()> job);
+
+private:
+    PrefetchThread();
+    void run();
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::function<void()>> m_jobs;
+    bool m_stop {false};
+    std::thread m_thread;  // declared last: started once the members above exist
+};
+
+/**
+ * @brief Bounded producer/consumer stage that prepares items on the PrefetchThread
+ *
+ * Items 0, 1, ..., count-1 are produced by `produce(i)` on the PrefetchThread,
+ * at most `depth` items ahead of the consumer, which retrieves them in order with
+ * `next()`. In this way, loading and preprocessing of upcoming images overlap
+ * with the classification of the current one, however busy the ThreadPool is.
+ * The PrefetchThread serves every pipeline in turn: if it has not started an
+ * item yet when the consumer needs it, the consumer produces it itself rather
+ * than wait behind the items of other pipelines.
+ *
+ * If `produce` throws, the exception is rethrown to the consumer by `next()`.
+ * `produce` is never called once the pipeline is destroyed.
+ */
+template <typename T>
+class PrefetchPipeline
+{
+public:
+    using Producer = std::function<T(size_t)>;
+
+    PrefetchPipeline(size_t count, Producer produce, size_t depth = prefetchDepth());
+    ~PrefetchPipeline();
+    PrefetchPipeline(const PrefetchPipeline&) = delete;
+    PrefetchPipeline& operator=(const PrefetchPipeline&) = delete;
+
+    /**
+     * @brief Retrieve the next item, waiting for it to be produced if necessary
+     * @param item Output param
+     * @return true if an item was retrieved; false if all items have already been retrieved
+     */
+    bool next(T& item);
+
+private:
+    enum class State
+    {
+        Queued,    // waiting for the PrefetchThread
+        Running,   // being produced by the PrefetchThread
+        Done,      // produced by the PrefetchThread (`item` or `error` is set)
+        Cancelled  // taken over by the consumer, or the pipeline was destroyed
+    };
+
+    struct Slot
+    {
+        size_t index;
+        State state {State::Queued};
+        T item {};
+        std::exception_ptr error;
+    };
+
+    // Shared with the jobs, which may outlive the pipeline in the queue of the PrefetchThread
+    struct Shared
+    {
+        Producer produce;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    // Submits items to the PrefetchThread until `depth` of them are in flight
+    void schedule();
+
+    const size_t m_count;
+    const size_t m_depth;
+    std::shared_ptr<Shared> m_shared;
+    size_t m_next {0};       // index of the next item returned to the consumer
+    size_t m_scheduled {0};  // index of the next item to submit
+    std::deque<std::shared_ptr<Slot>> m_pending;
+};
+
+template <typename T>
+PrefetchPipeline<T>::PrefetchPipeline(size_t count, Producer produce, size_t depth)
+    : m_count {count}, m_depth {depth}, m_shared {std::make_shared<Shared>()}
+{
+    m_shared->produce = std::move(produce);
+    schedule();
+}
+
+template <typename T>
+PrefetchPipeline<T>::~PrefetchPipeline()
+{
+    // Queued items are dropped; the one being produced (if any) is waited for, since `produce` may refer to
+    // objects owned by the consumer
+    std::unique_lock<std::mutex> lock {m_shared->mutex};
+    for (const auto& slot : m_pending)
+    {
+        if (slot->state == State::Queued)
+        {
+            slot->state = State::Cancelled;
+        }
+        m_shared->done.wait(lock, [&slot]() { return slot->state != State::Running; });
+    }
+}
+
+template <typename T>
+bool PrefetchPipeline<T>::next(T& item)
+{
+    if (m_next >= m_count)
+    {
+        return false;
+    }
+    if (m_depth == 0)
+    {
+        item = m_shared->produce(m_next++);  // prefetching disabled
+        return true;
+    }
+
+    const std::shared_ptr<Slot> slot {std::move(m_pending.front())};
+    m_pending.pop_front();
+    m_next++;
+    std::unique_lock<std::mutex> lock {m_shared->mutex};
+    if (slot->state == State::Queued)
+    {
+        // Not started yet: produce it here
+        slot->state = State::Cancelled;
+        lock.unlock();
+        schedule();
+        item = m_shared->produce(slot->index);
+        return true;
+    }
+    m_shared->done.wait(lock, [&slot]() { return slot->state == State::Done; });
+    lock.unlock();
+    schedule();
+    if (slot->error)
+    {
+        std::rethrow_exception(slot->error);
+    }
+    item = std::move(slot->item);
+    return true;
+}
+
+template <typename T>
+void PrefetchPipeline<T>::schedule()
+{
+    while (m_scheduled < m_count && m_pending.size() < m_depth)
+    {
+        const std::shared_ptr<Slot> slot {std::make_shared<Slot>()};
+        slot->index = m_scheduled++;
+        m_pending.push_back(slot);
+        PrefetchThread::instance().submit([shared = m_shared, slot]()
+        {
+            {
+                std::lock_guard<std::mutex> lock {shared->mutex};
+                if (slot->state != State::Queued)
+                {
+                    return;
+                }
+                slot->state = State::Running;
+            }
+            T item {};
+            std::exception_ptr error;
+            try
+            {
+                item = shared->produce(slot->index);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            {
+                std::lock_guard<std::mutex> lock {shared->mutex};
+                slot->item = std::move(item);
+                slot->error = error;
+                slot->state = State::Done;
+            }
+            shared->done.notify_all();
+        });
+    }
+}
+
+#endif // PREFETCH_PIPELINE_HPP
@@ -3,11 +3,26 @@
 #define PREPROCESSING_HPP
 
 #include <filesystem>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
 
 #include <flower_type.hpp>
 #include <flower_image.hpp>
 #include <flower_image_container.hpp>
 #include <flower_template.hpp>
+#include <image_decode.hpp>
+
+/**
+ * @brief An image file found inside a dataset directory, together with the
+ * metadata that can be derived from its location (name and flower type)
+ */
+struct DatasetEntry
+{
+    std::filesystem::path path;
+    std::string name;
+    FlowerType fl_type;
+};
 
 /**
  * @brief Load train and test images (from user-supplied or default path)
@@ -15,22 +30,49 @@
  * @param train_healthy_imgs  Output param, vector of train healthy flower images
  * @param train_diseased_imgs Output param, vector of train diseased flower images
  * @param test_imgs           Output param, vector of test images
+ * @param decode_opts         Resolution cap applied while decoding
  * @return true if successful; false otherwise
  */
 bool loadImages(
     const std::filesystem::path data_path,
     FlowerImageContainer& test_imgs,
     FlowerImageContainer& train_healthy_imgs,
-    FlowerImageContainer& train_diseased_imgs
+    FlowerImageContainer& train_diseased_imgs,
+    const DecodeOptions& decode_opts = DecodeOptions{}
 );
 
+/**
+ * @brief Load all the images found in the class subdirectories of `dir_path`
+ *
+ * Each file is decoded exactly once; the grayscale version is derived from
+ * the decoded BGR buffer. Decoding is spread over the threads of the ThreadPool,
+ * but images are appended to `imgs` in a fixed order (sorted by class directory
+ * and file name), which does not depend on thread scheduling.
+ * If `imgs` is a lazy container, images are only registered, not decoded
+ * (the container applies its own DecodeOptions).
+ */
 bool loadImagesFromDataset(
     const std::filesystem::path dir_path,
     const bool healthy,
     const int image_type,
-    FlowerImageContainer& imgs
+    FlowerImageContainer& imgs,
+    const DecodeOptions& decode_opts = DecodeOptions{}
+);
+
+/**
+ * @brief List the image files found in the class subdirectories of `dir_path`
+ *
+ * Entries are sorted by class directory and then by file name.
+ * @param dir_path path of a train or test dataset (e.g. ".../test_photos")
+ * @param entries  Output param, image files found in the dataset
+ * @return true if successful; false otherwise
+ */
+bool listImagesFromDataset(
+    const std::filesystem::path dir_path,
+    std::vector<DatasetEntry>& entries
 );
 
+
 /**
  * @brief Load template images, used by the Template Matching algorithm
  * @param data_path  Path to train/test dataset
@@ -57,6 +99,25 @@ bool loadTemplateFromDataset(
     std::vector<FlowerTemplate>& templates
 );
 
+/**
+ * @brief Crop every image of a container to a region of interest (e.g. its best template match)
+ *
+ * Every region is enlarged by `margin` times its width and height on each side,
+ * and clipped to its image; images whose region is empty are kept whole. Crops
+ * are copied, so that `cropped` does not keep the full images alive. If `images`
+ * is lazy, `cropped` is lazy too (same budget): its images are cropped when they
+ * are decoded, so that no more than the budget of either is decoded at once.
+ * @param rois one region per image, in the coordinates of the decoded image
+ * @param cropped Output param, the cropped images, in the same order and with the same metadata
+ * @return fraction of the pixels of `images` kept in `cropped`
+ */
+double cropImages(
+    const FlowerImageContainer& images,
+    const std::vector<cv::Rect>& rois,
+    const double margin,
+    FlowerImageContainer& cropped
+);
+
 /**
  * @brief Checks if the given path refers to an image file
  */
@@ -0,0 +1,47 @@
+// Author: Luca Pellegrini
+#ifndef SCRATCH_BUFFER_HPP
+#define SCRATCH_BUFFER_HPP
+
+#include <cstddef>
+#include <opencv2/core.hpp>
+
+/**
+ * @brief Memory for matrices whose size changes from call to call, reallocated only when it must grow
+ *
+ * The matrices returned by `get()` do not own their memory: they are valid
+ * until the next call to `get()` on the same buffer, or until the buffer is
+ * destroyed. OpenCV functions that write to a matrix of the right size and type
+ * (e.g. `cv::resize()`, `cv::convertTo()`) use its memory as it is.
+ */
+class ScratchBuffer
+{
+public:
+    cv::Mat get(const cv::Size size, const int type)
+    {
+        const size_t bytes {static_cast<size_t>(size.area()) * CV_ELEM_SIZE(type)};
+        if (m_storage.total() < bytes)
+        {
+            m_storage.create(1, static_cast<int>(bytes), CV_8U);
+        }
+        return cv::Mat{size, type, m_storage.data};
+    }
+
+    template <typename T>
+    cv::Mat_<T> get(const cv::Size size)
+    {
+        return cv::Mat_<T>{get(size, cv::traits::Type<T>::value)};
+    }
+
+    /**
+     * @brief Bytes currently reserved by the buffer
+     */
+    size_t capacity() const
+    {
+        return m_storage.total();
+    }
+
+private:
+    cv::Mat m_storage;  // one row of bytes
+};
+
+#endif // SCRATCH_BUFFER_HPP
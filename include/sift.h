@@ -5,6 +5,8 @@
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/features2d.hpp>
+#include <functional>
+#include <string>
 #include <vector>
 
 class SIFTExtractor {
@@ -27,6 +29,7 @@ class SIFTExtractor {
         int getKeypointCount() const;
 
         // Match descriptors between two sets of keypoints
+        // The FLANN index of descriptors2 is kept until a different matrix is matched against
         int matchDescriptors(const cv::Mat &descriptors1, const cv::Mat &descriptors2, std::vector<cv::DMatch> &matches);
 
         // Filter matches keeping only those with a distance less than a specified threshold
@@ -35,13 +38,40 @@ class SIFTExtractor {
         // Match descriptors and filter matches in one step
         int matchAndFilter(const cv::Mat &descriptors1, const cv::Mat &descriptors2, std::vector<cv::DMatch> &goodMatches, double threshold = 2.0);
 
+        // Match descriptors with Lowe's ratio test: onMatch is called with the nearest neighbour of every descriptor
+        // closer than ratio * its second nearest neighbour (same FLANN index as matchDescriptors)
+        // Returns the number of accepted matches
+        int ratioMatch(const cv::Mat &descriptors1, const cv::Mat &descriptors2, double ratio, const std::function<void(const cv::DMatch &)> &onMatch);
+
+        // Match against descriptors through a FLANN index trained elsewhere (see trainLabelledMatcher), instead of
+        // training one: the index is shared read-only by every extractor, and never modified by this one
+        void setTrainedMatcher(const cv::Mat &descriptors, const cv::Ptr<cv::DescriptorMatcher> &matcher);
+
         // Get the time taken for the last matching operation
         double getMatchingTime() const;
 
+        // Get a string identifying the extraction parameters (used as feature cache key)
+        const std::string& getParamsKey() const;
+
+        // Create a new extractor with the same parameters
+        // (an extractor keeps per-call state, so it must not be shared between threads)
+        SIFTExtractor clone() const;
+
     private:
+        // Index descriptors with matcher_, unless they are already indexed
+        void trainMatcher(const cv::Mat &descriptors);
+
         // OpenCV SIFT feature extractor
         cv::Ptr<cv::SIFT> sift_;
+        int nfeatures_;
+        int nOctaveLayers_;
+        double contrastThreshold_;
+        double edgeThreshold_;
+        double sigma_;
+        std::string paramsKey_;
         cv::Ptr<cv::DescriptorMatcher> matcher_;
+        cv::Mat trainDescriptors_;      // descriptors indexed by matcher_ (empty = none)
+        std::vector<std::vector<cv::DMatch>> knnMatches_;   // reused by ratioMatch
         double extractionTime_;
         int keypointCount_;
         double matchingTime_;
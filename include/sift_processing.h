@@ -11,11 +11,15 @@
 #include "flower_image.hpp"
 #include "flower_image_container.hpp"
 #include "sift.h"
+#include "labelled_descriptors.h"
 #include "metrics.h"
 
 using ClassificationRecord = std::array<std::string, 3>;
 using ClassificationRecap = std::vector<ClassificationRecord>;
 
+// Default matching threshold (higher = more matches, lower = stricter)
+const double sift_default_threshold = 1.7;
+
 // Extract SIFT features from a container and store them in a temporary map
 void extractSIFTFeaturesFromContainer(
     const FlowerImageContainer& images,
@@ -40,10 +44,22 @@ void trainSIFT(
     bool use_diseased = true
 );
 
+// Classify a single grayscale image: every descriptor is matched once against the training descriptors
+// of all the classes, and the good matches vote for the class of their training descriptor
+// (matches under threshold * the minimum distance of their class, or the ones that pass the ratio test if set, see setRatioTest)
+// Returns false if no keypoints are found in the image
+bool classifySIFT(
+    const cv::Mat& image_gray,
+    const LabelledDescriptors& train_descriptors,
+    SIFTExtractor& sift_extractor,
+    double threshold,
+    FlowerType& predicted_type
+);
+
 // Test SIFT on test images and update metrics
 void testSIFT(
     const FlowerImageContainer& test_images,
-    const std::map<FlowerType, cv::Mat>& train_descriptors,
+    const LabelledDescriptors& train_descriptors,
     SIFTExtractor& sift_extractor,
     Metrics& metrics,
     const std::vector<std::string>& class_names,
@@ -53,11 +69,13 @@ void testSIFT(
 );
 
 // Wrapper function to run the entire SIFT pipeline (training + testing)
+// If pretrained_descriptors is not null, training is skipped
 void sift(
     const FlowerImageContainer& test_images,
     const FlowerImageContainer& train_healthy,
     const FlowerImageContainer& train_diseased,
-    const std::string& output_dir
+    const std::string& output_dir,
+    const std::map<FlowerType, cv::Mat>* pretrained_descriptors = nullptr
 );
 
 #endif // SIFT_PROCESSING_H
\ No newline at end of file
@@ -7,6 +7,8 @@
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/xfeatures2d.hpp>
+#include <functional>
+#include <string>
 #include <vector>
 
 class SURFExtractor {
@@ -29,6 +31,7 @@ class SURFExtractor {
         int getKeypointCount() const;
 
         // Match descriptors between two sets of keypoints
+        // The FLANN index of descriptors2 is kept until a different matrix is matched against
         int matchDescriptors(const cv::Mat &descriptors1, const cv::Mat &descriptors2, std::vector<cv::DMatch> &matches);
 
         // Filter matches keeping only those with a distance less than a specified threshold
@@ -37,12 +40,39 @@ class SURFExtractor {
         // Match descriptors and filter matches in one step
         int matchAndFilter(const cv::Mat &descriptors1, const cv::Mat &descriptors2, std::vector<cv::DMatch> &goodMatches, double threshold = 2.0);
 
+        // Match descriptors with Lowe's ratio test: onMatch is called with the nearest neighbour of every descriptor
+        // closer than ratio * its second nearest neighbour (same FLANN index as matchDescriptors)
+        // Returns the number of accepted matches
+        int ratioMatch(const cv::Mat &descriptors1, const cv::Mat &descriptors2, double ratio, const std::function<void(const cv::DMatch &)> &onMatch);
+
+        // Match against descriptors through a FLANN index trained elsewhere (see trainLabelledMatcher), instead of
+        // training one: the index is shared read-only by every extractor, and never modified by this one
+        void setTrainedMatcher(const cv::Mat &descriptors, const cv::Ptr<cv::DescriptorMatcher> &matcher);
+
         // Get the time taken for the last matching operation
         double getMatchingTime() const;
 
+        // Get a string identifying the extraction parameters (used as feature cache key)
+        const std::string& getParamsKey() const;
+
+        // Create a new extractor with the same parameters
+        // (an extractor keeps per-call state, so it must not be shared between threads)
+        SURFExtractor clone() const;
+
     private:
+        // Index descriptors with matcher_, unless they are already indexed
+        void trainMatcher(const cv::Mat &descriptors);
+
         cv::Ptr<cv::xfeatures2d::SURF> surf_;
+        double hessianThreshold_;
+        int nOctaves_;
+        int nOctaveLayers_;
+        bool extended_;
+        bool upright_;
+        std::string paramsKey_;
         cv::Ptr<cv::DescriptorMatcher> matcher_;
+        cv::Mat trainDescriptors_;      // descriptors indexed by matcher_ (empty = none)
+        std::vector<std::vector<cv::DMatch>> knnMatches_;   // reused by ratioMatch
         double extractionTime_;
         int keypointCount_;
         double matchingTime_;
@@ -14,11 +14,15 @@
 #include "flower_image.hpp"
 #include "flower_image_container.hpp"
 #include "surf.h"
+#include "labelled_descriptors.h"
 #include "metrics.h"
 
 using ClassificationRecord = std::array<std::string, 3>;
 using ClassificationRecap = std::vector<ClassificationRecord>;
 
+// Default matching threshold (higher = more matches, lower = stricter)
+const double surf_default_threshold = 1.8;
+
 // Extract SURF features from a container and store them in a temporary map
 void extractSURFFeaturesFromContainer(
     const FlowerImageContainer& images,
@@ -43,10 +47,22 @@ void trainSURF(
     bool use_diseased = true
 );
 
+// Classify a single grayscale image: every descriptor is matched once against the training descriptors
+// of all the classes, and the good matches vote for the class of their training descriptor
+// (matches under threshold * the minimum distance of their class, or the ones that pass the ratio test if set, see setRatioTest)
+// Returns false if no keypoints are found in the image
+bool classifySURF(
+    const cv::Mat& image_gray,
+    const LabelledDescriptors& train_descriptors,
+    SURFExtractor& surf_extractor,
+    double threshold,
+    FlowerType& predicted_type
+);
+
 // Test SURF on test images and update metrics
 void testSURF(
     const FlowerImageContainer& test_images,
-    const std::map<FlowerType, cv::Mat>& train_descriptors,
+    const LabelledDescriptors& train_descriptors,
     SURFExtractor& surf_extractor,
     Metrics& metrics,
     const std::vector<std::string>& class_names,
@@ -56,11 +72,13 @@ void testSURF(
 );
 
 // Wrapper function to run the entire SURF pipeline (training + testing)
+// If pretrained_descriptors is not null, training is skipped
 void surf(
     const FlowerImageContainer& test_images,
     const FlowerImageContainer& train_healthy,
     const FlowerImageContainer& train_diseased,
-    const std::string& output_dir
+    const std::string& output_dir,
+    const std::map<FlowerType, cv::Mat>* pretrained_descriptors = nullptr
 );
 
 #endif // ENABLE_SURF
@@ -5,6 +5,8 @@
 #include <filesystem>
 #include <flower_image_container.hpp>
 #include <flower_template.hpp>
+#include <template_search.hpp>
+#include <tm_workspace.hpp>
 
 /**
  * @brief Classifies test images with the Template Matching method
@@ -15,14 +17,18 @@
  * to the size of the template images).
  *
  * Only TM_SQDIFF and TM_CCORR_NORMED matching methods from the OpenCV library
- * support the use of a mask.
+ * support the use of a mask. Scores are computed by TemplateSearch, either
+ * exhaustively in the frequency domain, or coarse-to-fine (see TMSearchOptions).
  *
  * This function is meant to be run in a separate thread, and it will update the
  * `success` shared variable upon successful completion (or failure).
  *
  * @param test_images Test images as loaded by `loadImages()`
  * @param output_dir where to store the Classification Recap file
+ * @param search_opts how the best match of every template is searched
  * @param success shared variable to comunicate exit status to parent thread
+ * @param rois if not null, output param, best match of the predicted class on every test image
+ * (in the coordinates of the test image; empty if nothing matched), e.g. for `cropImages()`
  */
 void template_match(
     const FlowerImageContainer& test_images,
@@ -32,18 +38,61 @@ void template_match(
     const std::vector<FlowerTemplate>& sunflower_templates,
     const std::vector<FlowerTemplate>& tulip_templates,
     const std::filesystem::path output_dir,
-    bool& success
+    const TMSearchOptions& search_opts,
+    bool& success,
+    std::vector<cv::Rect>* rois = nullptr
 );
 
 /**
- * @brief Compares a set of templates (of the same flower class) with the given image
- * @param image a suitable image (size must be greater than that of the templates)
- * @param templates as loaded by `loadTemplates()`
- * @return the highest similarity score achieved
+ * @brief Resizes an image to the scales on which templates are matched
+ *
+ * Builds one pyramid per image: the largest scale is resized from the image,
+ * every other scale from the previous one. The aspect ratio is preserved.
+ * @param scales longest side of every scale, in pixels (see TMSearchOptions)
+ * @param workspace owns the resized images, which are overwritten by the next call
+ * @return the resized images, from the largest to the smallest, to be passed to `classifyTMScaled()`
+ */
+const std::vector<cv::Mat_<cv::Vec3b>>& scaleForTM(
+    const cv::Mat_<cv::Vec3b>& image,
+    const std::vector<int>& scales,
+    TMWorkspace& workspace
+);
+
+/**
+ * @brief Same as `classifyTM()`, on images already resized by `scaleForTM()`
+ *
+ * Rectangles are in the coordinates of the largest scaled image (the first one).
+ */
+FlowerType classifyTMScaled(
+    const std::vector<cv::Mat_<cv::Vec3b>>& scaled_images,
+    const TemplateSearch& templates,
+    std::vector<double>* class_scores = nullptr,
+    std::vector<cv::Rect>* class_rects = nullptr,
+    const bool verify_pruning = false
+);
+
+/**
+ * @brief Classifies a single image by comparing it with the templates of every class
+ *
+ * The image is resized to every scale of the TemplateSearch options, and every
+ * class is assigned the highest score achieved by one of its templates on any
+ * scale. With pruning, the (class, scale) pairs whose estimated score does not
+ * exceed the best score found so far are skipped.
+ * @param image color image to classify
+ * @param templates templates of every class
+ * @param class_scores if not null, output param, score achieved by every class
+ * @param class_rects if not null, output param, bounding box of the best match of every class
+ * in the image (empty if no template of the class matched)
+ * @param verify_pruning with pruning, also score the skipped pairs, and count the ones that would have won
+ * (pass `templates.verifyPruning(image_index)`)
+ * @return the class with the highest score
  */
-double processImage(
-    const cv::Mat_<cv::Vec3b> image,
-    const std::vector<FlowerTemplate>& templates
+FlowerType classifyTM(
+    const cv::Mat_<cv::Vec3b>& image,
+    const TemplateSearch& templates,
+    std::vector<double>* class_scores = nullptr,
+    std::vector<cv::Rect>* class_rects = nullptr,
+    const bool verify_pruning = false
 );
 
 #endif // TEMPLATE_MATCH_HPP
@@ -0,0 +1,218 @@
+// Author: Luca Pellegrini
+#ifndef TEMPLATE_SEARCH_HPP
+#define TEMPLATE_SEARCH_HPP
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <coarse_bound.hpp>
+#include <flower_template.hpp>
+#include <fourier_mellin.hpp>
+#include <masked_ccorr.hpp>
+#include <masked_ncc.hpp>
+#include <masked_sqdiff.hpp>
+#include <scratch_buffer.hpp>
+
+/**
+ * @brief How template matching looks for the best match of every template
+ */
+struct TMSearchOptions
+{
+    int method {cv::TM_CCORR_NORMED};     // cv::TM_CCORR_NORMED, or cv::TM_SQDIFF_NORMED (MaskedSqDiff, coarse-to-fine search only)
+    std::vector<int> scales {1200, 800};  // longest side of every scale of the test image, in pixels
+    int pyramid_levels {0};      // 0 = exhaustive search at full resolution; N = branch and bound on blocks of 2^N x 2^N positions
+    int top_k {5};               // eigen-templates: peaks of every reconstructed map scored again exactly
+    bool prune {false};          // skip the (class, scale) pairs that are unlikely to beat the best class (lossy)
+    double prune_margin {0.05};  // added to the coarse score of a template to estimate its full resolution score
+    int eigen_templates {0};     // exhaustive search only: 0 = correlate every template; N = N eigen-templates per class
+    bool fourier_mellin {false}; // estimate scale and rotation of every template (FourierMellin) instead of searching `scales`
+    int fm_poses {1};            // candidate poses verified per template, with `fourier_mellin`
+    bool verify {false};         // also run the exhaustive search, and count the differences (slow)
+};
+
+/**
+ * @brief Work of the coarse-to-fine search, outcome of pruning, and verification against the exhaustive search
+ */
+struct TMSearchStats
+{
+    size_t blocks {0};            // coarse-to-fine search: blocks of positions bounded (MaskedNCC tiles, or coarse cells)
+    size_t refined {0};           // blocks scored at full resolution
+    size_t searches {0};          // (template, image) pairs searched both ways
+    size_t differing {0};         // pairs whose maximum (coarse-to-fine, or from eigen-templates) differs from the exhaustive one
+    double max_difference {0.0};  // largest difference between the two maxima
+    size_t pairs {0};             // (class, scale) pairs considered for pruning
+    size_t pruned {0};            // pairs skipped
+    size_t wrongly_pruned {0};    // skipped pairs that would have beaten the best class (only counted on verified images)
+    size_t pruning_verified {0};  // test images on which pruning was verified (see TemplateSearch::verifyPruning())
+};
+
+/**
+ * @brief Finds the highest masked TM_CCORR_NORMED (or TM_SQDIFF_NORMED) score of every template on a test image
+ *
+ * The exhaustive search computes the whole score map at full resolution with
+ * MaskedNCC. The coarse-to-fine search is a branch and bound: test image and
+ * templates are averaged over blocks of 2^`pyramid_levels` pixels, and
+ * CoarseBound bounds the score of every block of positions from the coarse
+ * level. The tiles of MaskedNCC are then scored in decreasing order of the
+ * highest bound of their positions, until that bound does not exceed the best
+ * score found: the maximum is the exhaustive one, at the cost of the tiles
+ * whose bound is above it. The bounds are loose on these templates (masked
+ * TM_CCORR_NORMED scores of flowers are high almost everywhere): on the test
+ * images of the dataset (default scales) 87% of the tiles are scored with 1
+ * level, and 94% with 2: with the coarse correlations on top, the search is
+ * not faster than the exhaustive one. `searchStats()` counts the tiles scored;
+ * set `verify` to compare the maxima with the exhaustive ones.
+ *
+ * With `eigen_templates`, the exhaustive search correlates the test image with
+ * the eigen-templates of every class (see MaskedNCC), and reconstructs from them
+ * the score map of every template. Maps are exact when the eigen-templates span
+ * the templates of the class; otherwise the `top_k` highest peaks of every map
+ * are scored again exactly (MaskedCCorr), so that scores are never overestimated.
+ *
+ * With `method` set to `cv::TM_SQDIFF_NORMED`, every score is computed by
+ * MaskedSqDiff, in the spatial domain: a whole map costs a pass over the
+ * template per position. This method requires the coarse-to-fine search, whose
+ * bounds still apply since these scores never exceed the TM_CCORR_NORMED ones:
+ * blocks of positions are scored one by one, in decreasing order of their
+ * bound. Construction fails when `pyramid_levels` is 0, or the templates are too
+ * small to go down the pyramid. Eigen-templates do not apply, and the pruning
+ * estimates (see below) still do.
+ *
+ * With `fourier_mellin`, the test image is searched at the largest of `scales`
+ * only, and every template at the poses estimated by FourierMellin; the other
+ * options do not apply.
+ *
+ * Pruning is lossy. It estimates the score of a template at full resolution
+ * with its highest score at a coarse level (the coarsest level of the
+ * coarse-to-fine search, or `estimate_levels` levels down), plus `prune_margin`.
+ * The coarse score is computed on the masked energies of image and template at
+ * that level, which are not related to the full resolution ones by any
+ * inequality: it is a cheap estimate, not a bound, and a pair can be skipped
+ * even though it would have won. For this reason, pruning is verified on every
+ * `prune_verify_interval`-th test image (on every one with `verify`), see
+ * `verifyPruning()`.
+ *
+ * Copies of a TemplateSearch object share their statistics.
+ */
+class TemplateSearch
+{
+public:
+    /**
+     * @brief A test image, ready to be searched by `maxScore()`
+     *
+     * Reusing the same object for every test image (see TMWorkspace) reuses its memory too.
+     */
+    struct PreparedImage
+    {
+        cv::Mat_<cv::Vec3b> image;                 // full resolution
+        cv::Mat_<double> integral;                 // TM_SQDIFF_NORMED: integral image of `image`
+        MaskedNCC::ImageSpectra spectra;           // full resolution: every search on TM_CCORR_NORMED, or verification
+        CoarseBound::PreparedImage coarse_bound;   // coarse-to-fine search
+        MaskedNCC::ImageSpectra coarse_spectra;    // pruning estimates
+        FourierMellin::PreparedImage fourier_mellin;
+        std::vector<ScratchBuffer> level_buffers;  // pruning estimates: memory of the levels below full resolution
+    };
+
+    // Levels down at which pruning estimates are computed, when the search is exhaustive
+    static constexpr int estimate_levels {2};
+
+    // Pruning is verified on the test images whose index is a multiple of this
+    static constexpr size_t prune_verify_interval {10};
+
+    TemplateSearch() = default;
+
+    /**
+     * @brief Precompute what every search needs about the templates
+     *
+     * Throws cv::Exception (StsBadArg) if `opts.method` is not supported, or
+     * cannot be used with the other options (see the class description).
+     */
+    explicit TemplateSearch(const TemplateBank& templates, const TMSearchOptions& opts = TMSearchOptions{});
+
+    bool empty() const;
+    size_t numClasses() const;
+    size_t numTemplates(const size_t c) const;
+    const TMSearchOptions& options() const;
+
+    void prepareImage(const cv::Mat_<cv::Vec3b>& image, PreparedImage& prepared) const;
+
+    /**
+     * @brief Highest score of template `t` of class `c` on the image (0 if the image is smaller than the template)
+     * @param match_rect if not null, output param, bounding box of the best match in the image
+     * (left untouched if the score is 0)
+     */
+    double maxScore(const PreparedImage& prepared, const size_t c, const size_t t,
+                    cv::Rect* match_rect = nullptr) const;
+
+    /**
+     * @brief Highest score of the templates of class `c` on the image
+     *
+     * The same as the maximum of `maxScore()` over the templates of the class,
+     * but the templates share the correlation with the eigen-templates.
+     * @param match_rect if not null, output param, bounding box of the best match in the image
+     */
+    double classMaxScore(const PreparedImage& prepared, const size_t c, cv::Rect* match_rect = nullptr) const;
+
+    /**
+     * @brief Whether `classMaxScore()` is cheaper than `maxScore()` on every template of the class (eigen-templates)
+     */
+    bool searchesByClass() const;
+
+    /**
+     * @brief Estimate of `maxScore()` from the coarse score, used for pruning (not a bound, see the class description)
+     */
+    double coarseEstimate(const PreparedImage& prepared, const size_t c, const size_t t) const;
+
+    /**
+     * @brief Whether the caller should check the pairs it pruned on test image `image_index`
+     *
+     * True for every `prune_verify_interval`-th index (starting from 0), and for every index with `verify`.
+     * It depends on the index only, so that the outcome does not depend on the order images are classified in.
+     */
+    bool verifyPruning(const size_t image_index) const;
+
+    /**
+     * @brief Add the outcome of pruning on one test image to the statistics
+     * @param verified whether the skipped pairs were checked (`wrongly_pruned` is meaningful)
+     */
+    void recordPruning(const size_t pairs, const size_t pruned, const size_t wrongly_pruned, const bool verified) const;
+
+    /**
+     * @brief Work of the coarse-to-fine search, pruning statistics, and differences from the exhaustive search (if `verify` is set)
+     */
+    TMSearchStats searchStats() const;
+
+private:
+    struct SharedStats
+    {
+        std::mutex mutex;
+        TMSearchStats stats;
+    };
+
+    bool coarseToFine() const;
+    bool sqdiff() const;
+    double exhaustiveSqDiff(const PreparedImage& prepared, const size_t c, const size_t t, cv::Rect* match_rect) const;
+    double refine(const PreparedImage& prepared, const size_t c, const size_t t, cv::Rect* match_rect) const;
+    double rescore(const PreparedImage& prepared, const size_t c, const size_t t, cv::Mat_<float>& scores,
+                   cv::Rect* match_rect) const;
+    void recordRefinement(const size_t blocks, const size_t refined) const;
+    void recordVerification(const double exact, const double found) const;
+    static bool nextPeak(cv::Mat_<float>& scores, cv::Point& pos);
+
+    TMSearchOptions m_opts;
+    int m_coarse_levels {0};  // levels down of m_coarse (0 = none)
+    MaskedNCC m_full;         // TM_CCORR_NORMED: exhaustive or coarse-to-fine search, or verification
+    MaskedNCC m_eigen;        // exhaustive search on eigen-templates
+    MaskedNCC m_coarse;       // pruning estimates
+    FourierMellin m_fourier_mellin;
+    // [class][template], every vector has an entry per template (empty objects where unused)
+    std::vector<std::vector<MaskedCCorr>> m_ccorr;    // eigen-templates: peaks of the reconstructed maps
+    std::vector<std::vector<MaskedSqDiff>> m_sqdiff;  // TM_SQDIFF_NORMED
+    std::vector<std::vector<CoarseBound>> m_bounds;   // coarse-to-fine search
+    std::shared_ptr<SharedStats> m_stats {std::make_shared<SharedStats>()};
+};
+
+#endif // TEMPLATE_SEARCH_HPP
@@ -0,0 +1,142 @@
+// Author: Luca Pellegrini
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Process-wide work-stealing thread pool, shared by every classifier
+ *
+ * Every worker owns a double-ended queue of tasks: it pushes and pops its own
+ * tasks at the back, and steals tasks from the front of the other workers' queues
+ * when its own queue is empty. Tasks submitted by threads outside the pool go to
+ * a shared queue. A thread that waits for a TaskGroup runs pending tasks in the
+ * meantime, so tasks can submit (and wait for) nested tasks without deadlocks;
+ * when there is nothing to run, it sleeps until new work is queued or the group is done.
+ *
+ * The total number of threads (workers plus the thread that submits the work) is
+ * set once with `setNumThreads()`, before the pool is first used. With a single
+ * thread, tasks are run inline by the submitting thread.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * @brief Returns the process-wide pool, creating it on first use
+     */
+    static ThreadPool& instance();
+
+    /**
+     * @brief Set the total number of threads of the process-wide pool (0 = one per hardware thread)
+     *
+     * Must be called before the first call to `instance()`. OpenCV's own thread
+     * count is reduced accordingly, to avoid oversubscribing the CPU when
+     * OpenCV functions run inside pool tasks.
+     */
+    static void setNumThreads(size_t num_threads);
+
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Total number of threads that run tasks (workers plus the submitting thread)
+     */
+    size_t numThreads() const;
+
+    /**
+     * @brief Run `body(begin, end)` over consecutive ranges covering [0, count), and wait for completion
+     * @param grain number of indices per task (0 = about four tasks per thread)
+     *
+     * Exceptions thrown by `body` are rethrown (the first one) once all tasks are done.
+     */
+    template <typename Body>
+    void parallelFor(size_t count, Body body, size_t grain = 0);
+
+    /**
+     * @brief A set of tasks that can be waited for
+     */
+    class TaskGroup
+    {
+    public:
+        explicit TaskGroup(ThreadPool& pool = ThreadPool::instance());
+        ~TaskGroup();
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        void run(std::function<void()> task);
+
+        /**
+         * @brief Wait for every task of the group, running pending tasks of the pool in the meantime
+         *
+         * Rethrows the first exception thrown by a task of the group.
+         */
+        void wait();
+
+    private:
+        void execute(const std::function<void()>& task);
+        // Runs pending tasks of the pool until every task of the group is done, sleeping when there are none
+        void waitPending();
+
+        ThreadPool& m_pool;
+        std::atomic<size_t> m_pending {0};
+        std::mutex m_error_mutex;
+        std::exception_ptr m_error;
+    };
+
+private:
+    explicit ThreadPool(size_t num_threads);
+
+    void submit(std::function<void()> task);
+    // Runs one pending task, if any; returns false if no task was found
+    bool runPendingTask();
+    void workerLoop(size_t index);
+
+    struct TaskQueue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // One queue per worker, plus (last) the queue shared by external threads
+    std::vector<std::unique_ptr<TaskQueue>> m_queues;
+    std::vector<std::thread> m_workers;
+    std::atomic<size_t> m_queued {0};
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_sleep_cv;  // idle workers
+    std::condition_variable m_wait_cv;   // threads waiting for a TaskGroup (new work, or a group done)
+    size_t m_waiters {0};
+    bool m_stop {false};
+};
+
+template <typename Body>
+void ThreadPool::parallelFor(const size_t count, Body body, size_t grain)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    if (grain == 0)
+    {
+        grain = std::max<size_t>(1, count / (4 * numThreads()));
+    }
+    TaskGroup group {*this};
+    for (size_t begin {0}; begin < count; begin += grain)
+    {
+        const size_t end {std::min(count, begin + grain)};
+        group.run([&body, begin, end]() { body(begin, end); });
+    }
+    group.wait();
+}
+
+#endif // THREAD_POOL_HPP
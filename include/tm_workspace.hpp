@@ -0,0 +1,112 @@
+// Author: Luca Pellegrini
+#ifndef TM_WORKSPACE_HPP
+#define TM_WORKSPACE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <scratch_buffer.hpp>
+#include <template_search.hpp>
+
+/**
+ * @brief Scratch buffers of template matching, reused from one test image to the next
+ *
+ * Every thread owns its workspaces, and a Scope gives it exclusive use of one
+ * of them. Buffers only grow: once they fit the largest test image and score
+ * map, classifying an image allocates no new cv::Mat memory (the exhaustive
+ * search; the coarse-to-fine one allocates within `cv::matchTemplate()`, and
+ * eigen-templates and Fourier-Mellin allocate their own maps). A thread that waits for nested tasks may start another
+ * search in the meantime: nested scopes take the next workspace of the thread,
+ * so they never share buffers.
+ *
+ * The workspaces of a thread live as long as the thread, and keep the memory
+ * of the largest image they have seen.
+ */
+class TMWorkspace
+{
+public:
+    /**
+     * @brief Exclusive use of one of the workspaces of the calling thread, until the scope is destroyed
+     */
+    class Scope
+    {
+    public:
+        Scope();
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        TMWorkspace& workspace() const;
+
+    private:
+        TMWorkspace* m_workspace;
+    };
+
+    // scaleForTM(): the test image at every scale
+    std::vector<ScratchBuffer> scale_buffers;
+    std::vector<cv::Mat_<cv::Vec3b>> scaled_images;
+
+    // classifyTMScaled(): every scale, ready to be searched (entries past the number of scales are spare)
+    std::vector<TemplateSearch::PreparedImage> prepared;
+
+    // MaskedNCC::transformImage(): image in single precision, its channels and their sum of squares, one padded tile
+    ScratchBuffer image_f;
+    std::array<ScratchBuffer, 4> planes;
+    cv::Mat padded;
+
+    // MaskedNCC::match(): spectra and correlations of one tile (all tiles have the same size)
+    cv::Mat numerator_spectrum;
+    cv::Mat product;
+    cv::Mat numerator;
+    cv::Mat denominator;
+
+    // Score map of a template
+    ScratchBuffer scores;
+
+    // CoarseBound::bounds(): correlations at the coarse level, and the bounds of a template
+    std::array<ScratchBuffer, 2> coarse_correlations;
+    ScratchBuffer bounds;
+
+    /**
+     * @brief Attributes the cv::Mat memory allocated by the calling thread to a counter, until destroyed
+     *
+     * Counting is per thread: allocations of other threads (other test images, image
+     * decoding) are never mixed in. Work of the same test image that runs on other
+     * threads of the pool must take its own AllocationCount with the same counter
+     * (see `current()`). Nested objects restore the previous counter when destroyed;
+     * a null counter pauses counting. Nothing is counted before `countAllocations()`.
+     */
+    class AllocationCount
+    {
+    public:
+        explicit AllocationCount(std::atomic<size_t>* bytes);
+        ~AllocationCount();
+        AllocationCount(const AllocationCount&) = delete;
+        AllocationCount& operator=(const AllocationCount&) = delete;
+
+        /**
+         * @brief Counter of the calling thread (null if none)
+         */
+        static std::atomic<size_t>* current();
+
+    private:
+        std::atomic<size_t>* m_previous;
+    };
+
+    /**
+     * @brief Count the bytes of every cv::Mat allocated from now on (see AllocationCount)
+     *
+     * Installs a counting allocator as OpenCV's default one: call it before
+     * other threads start using OpenCV.
+     */
+    static void countAllocations();
+
+    /**
+     * @brief Whether `countAllocations()` has been called
+     */
+    static bool countingAllocations();
+};
+
+#endif // TM_WORKSPACE_HPP
@@ -0,0 +1,37 @@
+// Author: Luca Pellegrini
+#ifndef WATCH_MODE_HPP
+#define WATCH_MODE_HPP
+
+#include <filesystem>
+
+#include <classifier_models.hpp>
+#include <image_decode.hpp>
+
+/**
+ * @brief Classify every new image written to a directory, as soon as it lands
+ *
+ * The directory is watched with inotify: an image is classified once it has been
+ * completely written (`IN_CLOSE_WRITE`) or moved into the directory (`IN_MOVED_TO`).
+ * Images already present when the function is called are ignored.
+ * If the inotify event queue overflows, the overflow is reported and the
+ * directory is rescanned: images whose name was never seen are classified
+ * (an image rewritten under an old name during the overflow is missed).
+ * Names are forgotten when their file is deleted or moved out of the directory,
+ * so memory does not grow with the number of images that go through it.
+ * For every image, one line with the predictions of all classifiers is appended
+ * to `recap_path` (and flushed), so that the recap can be followed while it grows.
+ * Runs until SIGINT or SIGTERM is received.
+ * @param watch_dir directory to watch (not recursive)
+ * @param models trained classifiers, as returned by `trainClassifierModels()`
+ * @param recap_path file to which predictions are appended
+ * @param decode_opts resolution cap applied when decoding new images
+ * @return true on a clean exit; false if the directory cannot be watched
+ */
+bool watchDirectory(
+    const std::filesystem::path watch_dir,
+    ClassifierModels& models,
+    const std::filesystem::path recap_path,
+    const DecodeOptions& decode_opts = DecodeOptions{}
+);
+
+#endif // WATCH_MODE_HPP
@@ -1,6 +1,8 @@
 // Author: Francesco Vezzani
 
 #include "bow.h"
+#include "feature_cache.hpp"
+#include "parallel_images.hpp"
 #include <limits>
 
 BoWExtractor::BoWExtractor(
@@ -8,16 +10,22 @@ BoWExtractor::BoWExtractor(
     int vocabularySize,
     int maxIterations,
     int attempts
-) : vocabularySize_(vocabularySize),
+) : nfeatures_(nfeatures),
+    vocabularySize_(vocabularySize),
     maxIterations_(maxIterations),
     attempts_(attempts),
-    orb_(cv::ORB::create(nfeatures)) {}
+    orb_(cv::ORB::create(nfeatures)),
+    paramsKey_("BoW-ORB nfeatures=" + std::to_string(nfeatures)) {}
 
-bool BoWExtractor::computeORBDescriptors(const cv::Mat &image, cv::Mat &descriptors) const{
+bool BoWExtractor::computeORBDescriptors(const cv::Mat &image, cv::Mat &descriptors, bool useCache) const{
     if (image.empty()) {
         return false;
     }
 
+    if (useCache && loadCachedFeatures(paramsKey_, image, nullptr, descriptors)) {
+        return !descriptors.empty();
+    }
+
     cv::Mat gray;
     if (image.channels() == 1) {
         gray = image;
@@ -27,22 +35,52 @@ bool BoWExtractor::computeORBDescriptors(const cv::Mat &image, cv::Mat &descript
 
     std::vector<cv::KeyPoint> keypoints;
     orb_->detectAndCompute(gray, cv::noArray(), keypoints, descriptors);
+    if (useCache) {
+        storeCachedFeatures(paramsKey_, image, nullptr, descriptors);
+    }
 
     return !descriptors.empty();
 }
 
-bool BoWExtractor::buildVocabulary(const std::vector<cv::Mat> &trainImages){
-    cv::Mat allDescriptors;
+bool BoWExtractor::buildVocabulary(
+    const FlowerImageContainer &trainHealthyImages,
+    const FlowerImageContainer &trainDiseasedImages
+){
+    // Compute descriptors in parallel, each task with its own extractor; images are not kept, only their
+    // (binary) descriptors, which are then converted once into rows of a matrix allocated to their total count
+    std::vector<cv::Mat> imageDescriptors(trainHealthyImages.size() + trainDiseasedImages.size());
+    for (const FlowerImageContainer *trainSet : {&trainHealthyImages, &trainDiseasedImages}) {
+        const size_t offset = (trainSet == &trainHealthyImages) ? 0 : trainHealthyImages.size();
+        forEachImage(*trainSet,
+            [this]() { return clone(); },
+            [&](BoWExtractor &extractor, size_t i, const FlowerImage &img) {
+                cv::Mat descriptors;
+                if (extractor.computeORBDescriptors(img.getImageGrayscale(), descriptors, true)) {
+                    imageDescriptors[offset + i] = descriptors;
+                }
+            });
+    }
 
-    for (const cv::Mat &image : trainImages) {
-        cv::Mat descriptors;
-        if (!computeORBDescriptors(image, descriptors)) {
-            continue;
+    int totalRows = 0;
+    int cols = 0;
+    for (const cv::Mat &descriptors : imageDescriptors) {
+        totalRows += descriptors.rows;
+        if (!descriptors.empty()) {
+            cols = descriptors.cols;
+        }
+    }
+    cv::Mat allDescriptors;
+    if (totalRows > 0) {
+        allDescriptors.create(totalRows, cols, CV_32F);
+    }
+    int row = 0;
+    for (cv::Mat &descriptors : imageDescriptors) {
+        if (!descriptors.empty()) {
+            cv::Mat rows = allDescriptors.rowRange(row, row + descriptors.rows);
+            descriptors.convertTo(rows, CV_32F);
+            row += descriptors.rows;
+            descriptors.release();
         }
-
-        cv::Mat descriptors32f;
-        descriptors.convertTo(descriptors32f, CV_32F);
-        allDescriptors.push_back(descriptors32f);
     }
 
     if (vocabularySize_ <= 0 || allDescriptors.rows < vocabularySize_) {
@@ -98,14 +136,14 @@ cv::Mat BoWExtractor::computeHistogram(const cv::Mat &descriptors) const{
     return histogram;
 }
 
-bool BoWExtractor::extract(const cv::Mat &image, cv::Mat &histogram){
+bool BoWExtractor::extract(const cv::Mat &image, cv::Mat &histogram, bool useCache){
     if (vocabulary_.empty()) {
         histogram.release();
         return false;
     }
 
     cv::Mat descriptors;
-    if (!computeORBDescriptors(image, descriptors)) {
+    if (!computeORBDescriptors(image, descriptors, useCache)) {
         histogram.release();
         return false;
     }
@@ -123,3 +161,21 @@ double BoWExtractor::matchDescriptors(const cv::Mat &histogram1, const cv::Mat &
 
     return cv::norm(histogram1, histogram2, cv::NORM_L2);
 }
+
+const std::string &BoWExtractor::getParamsKey() const{
+    return paramsKey_;
+}
+
+const cv::Mat &BoWExtractor::getVocabulary() const{
+    return vocabulary_;
+}
+
+void BoWExtractor::setVocabulary(const cv::Mat &vocabulary){
+    vocabulary_ = vocabulary;
+}
+
+BoWExtractor BoWExtractor::clone() const{
+    BoWExtractor extractor(nfeatures_, vocabularySize_, maxIterations_, attempts_);
+    extractor.vocabulary_ = vocabulary_;  // only read while extracting
+    return extractor;
+}
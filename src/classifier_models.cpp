@@ -0,0 +1,367 @@
+// Author: Luca Pellegrini
+#include <classifier_models.hpp>
+
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <orb_processing.h>
+#include <sift_processing.h>
+#include <template_match.hpp>
+#include <thread_pool.hpp>
+#ifdef ENABLE_SURF
+#include <surf_processing.h>
+#endif
+
+namespace fs = std::filesystem;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace
+{
+
+constexpr char model_format[] {"flower_classifier_model"};
+constexpr int model_version {2};  // 2: HOG and BoW rows in train image order, with their labels
+
+void writeDescriptorMap(
+    cv::FileStorage& fs,
+    const std::string& name,
+    const std::string& params_key,
+    const std::map<FlowerType, cv::Mat>& descriptors
+)
+{
+    fs << name << "{" << "params" << params_key << "classes" << "[";
+    for (const auto& [fl_type, desc] : descriptors)
+    {
+        fs << "{" << "type" << static_cast<int>(fl_type) << "descriptors" << desc << "}";
+    }
+    fs << "]" << "}";
+}
+
+// The descriptors of the train images, one per row and in train image order, and their flower types.
+// Empty descriptors are never matched, and are left out
+template <typename Descriptor>
+void writeLabelledRows(cv::FileStorage& fs, const std::vector<Descriptor>& descriptors,
+                       const std::vector<FlowerType>& labels)
+{
+    cv::Mat rows;
+    std::vector<int> types;
+    for (size_t i {0}; i < descriptors.size(); i++)
+    {
+        if (!descriptors[i].empty())
+        {
+            rows.push_back(cv::Mat(descriptors[i]).reshape(1, 1));
+            types.push_back(static_cast<int>(labels[i]));
+        }
+    }
+    fs << "types" << types << "rows" << rows;
+}
+
+// Reads what writeLabelledRows() wrote; false if a flower type is invalid
+bool readLabelledRows(const cv::FileNode& node, cv::Mat& rows, std::vector<FlowerType>& labels)
+{
+    std::vector<int> types;
+    node["types"] >> types;
+    node["rows"] >> rows;
+    if (static_cast<int>(types.size()) != rows.rows)
+    {
+        return false;
+    }
+    labels.clear();
+    for (const int type : types)
+    {
+        if (type < 0 || static_cast<size_t>(type) >= num_classes)
+        {
+            return false;
+        }
+        labels.push_back(static_cast<FlowerType>(type));
+    }
+    return true;
+}
+
+bool checkParams(const cv::FileNode& node, const std::string& name, const std::string& params_key)
+{
+    if (node.empty() || static_cast<std::string>(node["params"]) != params_key)
+    {
+        cerr << "Model snapshot: " << name << " parameters do not match (expected \"" << params_key << "\")" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool readFlowerType(const cv::FileNode& node, FlowerType& fl_type)
+{
+    const int type {static_cast<int>(node["type"])};
+    if (type < 0 || static_cast<size_t>(type) >= num_classes)
+    {
+        return false;
+    }
+    fl_type = static_cast<FlowerType>(type);
+    return true;
+}
+
+bool readDescriptorMap(
+    const cv::FileNode& node,
+    const std::string& name,
+    const std::string& params_key,
+    std::map<FlowerType, cv::Mat>& descriptors
+)
+{
+    if (!checkParams(node, name, params_key))
+    {
+        return false;
+    }
+    descriptors.clear();
+    for (const cv::FileNode item : node["classes"])
+    {
+        FlowerType fl_type;
+        if (!readFlowerType(item, fl_type))
+        {
+            return false;
+        }
+        item["descriptors"] >> descriptors[fl_type];
+    }
+    return true;
+}
+
+// Labelled training descriptors of all the classes, built from the per-class ones
+void buildLabelledModels(ClassifierModels& models)
+{
+    buildLabelledDescriptors(models.sift_descriptors, models.sift_labelled);
+    trainLabelledMatcher(models.sift_labelled);
+#ifdef ENABLE_SURF
+    buildLabelledDescriptors(models.surf_descriptors, models.surf_labelled);
+    trainLabelledMatcher(models.surf_labelled);
+#endif
+    buildORBIndex(models.orb_descriptors, models.orb_index);
+}
+
+} // namespace
+
+bool trainClassifierModels(
+    const FlowerImageContainer& train_healthy_imgs,
+    const FlowerImageContainer& train_diseased_imgs,
+    TemplateBank templates,
+    ClassifierModels& models
+)
+{
+    if (train_healthy_imgs.empty() && train_diseased_imgs.empty())
+    {
+        return false;
+    }
+
+    trainSIFT(train_healthy_imgs, train_diseased_imgs, models.sift, models.sift_descriptors, class_names, true);
+#ifdef ENABLE_SURF
+    trainSURF(train_healthy_imgs, train_diseased_imgs, models.surf, models.surf_descriptors, class_names, true);
+#endif
+    trainORB(train_healthy_imgs, train_diseased_imgs, models.orb, models.orb_descriptors, class_names, true);
+    buildLabelledModels(models);
+    trainHOG(train_healthy_imgs, train_diseased_imgs, models.hog);
+    models.bow_trained = trainBoW(train_healthy_imgs, train_diseased_imgs, models.bow);
+    if (!models.bow_trained)
+    {
+        cout << "[BOW] Not enough descriptors to build vocabulary. BoW is disabled." << endl;
+    }
+    models.templates = std::move(templates);
+    try
+    {
+        models.template_search = TemplateSearch{models.templates, models.tm_search};
+    }
+    catch (const cv::Exception& e)
+    {
+        cerr << "Template matching: " << e.what() << endl;
+        return false;
+    }
+    return true;
+}
+
+ImagePredictions classifyImage(
+    const cv::Mat_<cv::Vec3b>& img_color,
+    const cv::Mat_<uchar>& img_gray,
+    ClassifierModels& models
+)
+{
+    ImagePredictions predictions;
+    // Every method has its own extractor and writes its own prediction, so they run concurrently.
+    // The classify functions leave the prediction untouched (NoFlower) when they fail
+    ThreadPool::TaskGroup group;
+    group.run([&]() { classifySIFT(img_gray, models.sift_labelled, models.sift, sift_default_threshold, predictions.sift); });
+#ifdef ENABLE_SURF
+    group.run([&]() { classifySURF(img_gray, models.surf_labelled, models.surf, surf_default_threshold, predictions.surf); });
+#endif
+    group.run([&]() { classifyORB(img_gray, models.orb_index, models.orb, orb_default_threshold, predictions.orb); });
+    const bool verify_pruning {models.template_search.verifyPruning(models.classified_images++)};
+    group.run([&]() { predictions.tm = classifyTM(img_color, models.template_search, nullptr, nullptr, verify_pruning); });
+    group.run([&]()
+    {
+        double distance;
+        classifyHOG(img_gray, models.hog, predictions.hog, distance);
+    });
+    if (models.bow_trained)
+    {
+        group.run([&]()
+        {
+            double distance;
+            classifyBoW(img_gray, models.bow, predictions.bow, distance);
+        });
+    }
+    group.wait();
+    return predictions;
+}
+
+bool saveClassifierModels(const fs::path model_path, const ClassifierModels& models)
+{
+    try
+    {
+        cv::FileStorage fs {model_path.string(), cv::FileStorage::WRITE | cv::FileStorage::BASE64};
+        if (!fs.isOpened())
+        {
+            cerr << "Model snapshot: cannot open " << model_path.string() << endl;
+            return false;
+        }
+        fs << "format" << model_format << "version" << model_version;
+
+        writeDescriptorMap(fs, "sift", models.sift.getParamsKey(), models.sift_descriptors);
+#ifdef ENABLE_SURF
+        writeDescriptorMap(fs, "surf", models.surf.getParamsKey(), models.surf_descriptors);
+#endif
+        writeDescriptorMap(fs, "orb", models.orb.getParamsKey(), models.orb_descriptors);
+
+        fs << "hog" << "{" << "params" << models.hog.extractor.getParamsKey();
+        writeLabelledRows(fs, models.hog.train_descriptors, models.hog.train_labels);
+        fs << "}";
+
+        fs << "bow" << "{" << "params" << models.bow.extractor.getParamsKey()
+           << "trained" << static_cast<int>(models.bow_trained);
+        if (models.bow_trained)
+        {
+            fs << "vocabulary" << models.bow.extractor.getVocabulary();
+            writeLabelledRows(fs, models.bow.train_histograms, models.bow.train_labels);
+        }
+        fs << "}";
+
+        fs << "templates" << "[";
+        for (size_t c {0}; c < models.templates.size(); c++)
+        {
+            for (const FlowerTemplate& templ : models.templates[c])
+            {
+                fs << "{" << "name" << templ.name()
+                   << "type" << static_cast<int>(templ.flowerType())
+                   << "healthy" << static_cast<int>(templ.isHealthy())
+                   << "image_type" << templ.imageType()
+                   << "template" << cv::Mat(templ.getTemplate())
+                   << "mask" << cv::Mat(templ.getMask()) << "}";
+            }
+        }
+        fs << "]";
+        fs.release();
+    }
+    catch (const cv::Exception& e)
+    {
+        cerr << "Model snapshot: error writing " << model_path.string() << ": " << e.what() << endl;
+        return false;
+    }
+    cout << "Saved trained models to " << model_path.string() << endl;
+    return true;
+}
+
+bool loadClassifierModels(const fs::path model_path, ClassifierModels& models)
+{
+    try
+    {
+        cv::FileStorage fs {model_path.string(), cv::FileStorage::READ};
+        if (!fs.isOpened())
+        {
+            cerr << "Model snapshot: cannot open " << model_path.string() << endl;
+            return false;
+        }
+        if (static_cast<std::string>(fs["format"]) != model_format ||
+            static_cast<int>(fs["version"]) != model_version)
+        {
+            cerr << "Model snapshot: unsupported format or version in " << model_path.string() << endl;
+            return false;
+        }
+
+        bool ok {readDescriptorMap(fs["sift"], "SIFT", models.sift.getParamsKey(), models.sift_descriptors)};
+#ifdef ENABLE_SURF
+        ok = ok && readDescriptorMap(fs["surf"], "SURF", models.surf.getParamsKey(), models.surf_descriptors);
+#endif
+        ok = ok && readDescriptorMap(fs["orb"], "ORB", models.orb.getParamsKey(), models.orb_descriptors);
+        if (ok)
+        {
+            buildLabelledModels(models);
+        }
+
+        const cv::FileNode hog_node {fs["hog"]};
+        ok = ok && checkParams(hog_node, "HOG", models.hog.extractor.getParamsKey());
+        models.hog.train_descriptors.clear();
+        models.hog.train_labels.clear();
+        if (ok)
+        {
+            cv::Mat rows;
+            ok = readLabelledRows(hog_node, rows, models.hog.train_labels) && (rows.empty() || rows.type() == CV_32F);
+            for (int r {0}; ok && r < rows.rows; r++)
+            {
+                const float* row {rows.ptr<float>(r)};
+                models.hog.train_descriptors.emplace_back(row, row + rows.cols);
+            }
+        }
+
+        const cv::FileNode bow_node {fs["bow"]};
+        ok = ok && checkParams(bow_node, "BoW", models.bow.extractor.getParamsKey());
+        models.bow_trained = ok && static_cast<int>(bow_node["trained"]) != 0;
+        models.bow.train_histograms.clear();
+        models.bow.train_labels.clear();
+        if (models.bow_trained)
+        {
+            cv::Mat vocabulary;
+            bow_node["vocabulary"] >> vocabulary;
+            models.bow.extractor.setVocabulary(vocabulary);
+            cv::Mat rows;
+            ok = readLabelledRows(bow_node, rows, models.bow.train_labels);
+            for (int r {0}; ok && r < rows.rows; r++)
+            {
+                models.bow.train_histograms.push_back(rows.row(r));
+            }
+        }
+
+        for (auto& class_templates : models.templates)
+        {
+            class_templates.clear();
+        }
+        for (const cv::FileNode item : fs["templates"])
+        {
+            FlowerType fl_type;
+            if (!ok || !readFlowerType(item, fl_type) || fl_type == FlowerType::NoFlower)
+            {
+                ok = false;
+                break;
+            }
+            cv::Mat templ;
+            cv::Mat mask;
+            item["template"] >> templ;
+            item["mask"] >> mask;
+            models.templates[static_cast<size_t>(fl_type)].emplace_back(
+                static_cast<std::string>(item["name"]), fl_type,
+                static_cast<int>(item["healthy"]) != 0, static_cast<int>(item["image_type"]),
+                templ, mask);
+        }
+
+        models.template_search = TemplateSearch{models.templates, models.tm_search};
+
+        if (!ok)
+        {
+            cerr << "Model snapshot: invalid or mismatched snapshot " << model_path.string() << endl;
+            return false;
+        }
+    }
+    catch (const cv::Exception& e)
+    {
+        cerr << "Model snapshot: error reading " << model_path.string() << ": " << e.what() << endl;
+        return false;
+    }
+    cout << "Loaded trained models from " << model_path.string() << endl;
+    return true;
+}
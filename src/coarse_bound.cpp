@@ -0,0 +1,205 @@
+// Author: Luca Pellegrini
+#include <coarse_bound.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <opencv2/imgproc.hpp>
+#include <tm_workspace.hpp>
+
+namespace
+{
+
+// Sum of an integral image over a rectangle, clipped to the image (zero outside)
+template <typename T>
+T rectSum(const cv::Mat_<T>& integral, const cv::Rect& rect)
+{
+    const cv::Rect r {rect & cv::Rect{0, 0, integral.cols - 1, integral.rows - 1}};
+    if (r.empty())
+    {
+        return T{};
+    }
+    return integral(r.y + r.height, r.x + r.width) - integral(r.y, r.x + r.width) -
+        integral(r.y + r.height, r.x) + integral(r.y, r.x);
+}
+
+} // namespace
+
+CoarseBound::CoarseBound(const cv::Mat_<cv::Vec3b>& templ, const cv::Mat_<uchar>& mask, const int levels)
+{
+    if (templ.empty() || mask.size() != templ.size() || levels < 0)
+    {
+        return;  // never matches
+    }
+    cv::Mat_<uchar> binary_mask;
+    cv::threshold(mask, binary_mask, 0, 1, cv::THRESH_BINARY);
+    cv::Mat_<cv::Vec3d> masked_templ;
+    templ.convertTo(masked_templ, CV_64F);
+    masked_templ.setTo(0.0, binary_mask == 0);
+    const cv::Mat_<cv::Vec3d> squares {masked_templ.mul(masked_templ)};
+    const cv::Scalar energy {cv::sum(squares)};
+    const double templ_energy {energy[0] + energy[1] + energy[2]};
+    if (templ_energy <= 0.0)
+    {
+        return;  // never matches
+    }
+    m_block = 1 << levels;
+    m_size = templ.size();
+
+    cv::Mat_<int> mask_sums;
+    cv::Mat_<cv::Vec3d> templ_sums;
+    cv::Mat_<cv::Vec3d> square_sums;
+    cv::integral(binary_mask, mask_sums, CV_32S);
+    cv::integral(masked_templ, templ_sums, CV_64F);
+    cv::integral(squares, square_sums, CV_64F);
+
+    // Block b is core if the mask covers pixels [B b - B + 1, B b + B - 1] (every offset moves it by up to B - 1)
+    const int b {m_block};
+    const cv::Size blocks {m_size.width / b, m_size.height / b};
+    m_core = cv::Mat_<float>::zeros(blocks);
+    std::vector<cv::Point> core;
+    const cv::Rect templ_rect {0, 0, m_size.width, m_size.height};
+    for (int y {0}; y < blocks.height; y++)
+    {
+        for (int x {0}; x < blocks.width; x++)
+        {
+            const cv::Rect cover {b * x - b + 1, b * y - b + 1, 2 * b - 1, 2 * b - 1};
+            if ((cover & templ_rect) == cover && rectSum(mask_sums, cover) == cover.area())
+            {
+                m_core(y, x) = 1.0f;
+                core.emplace_back(x, y);
+            }
+        }
+    }
+    if (core.empty())
+    {
+        return;  // the template is too small for its blocks: no bound
+    }
+
+    // Block means of T on the core at every offset f (the block of window pixels [B b, B b + B) holds
+    // template pixels [B b - f, B b - f + B)); the ones at f = 0 are the coarse template
+    const double block_area {static_cast<double>(b * b)};
+    std::vector<std::vector<cv::Vec3d>> means(static_cast<size_t>(b * b));
+    std::vector<double> core_energies(means.size(), 0.0);
+    for (int fy {0}; fy < b; fy++)
+    {
+        for (int fx {0}; fx < b; fx++)
+        {
+            const size_t f {static_cast<size_t>(fy * b + fx)};
+            for (const cv::Point& block : core)
+            {
+                const cv::Rect pixels {b * block.x - fx, b * block.y - fy, b, b};
+                means[f].push_back(rectSum(templ_sums, pixels) / block_area);
+                const cv::Vec3d block_energy {rectSum(square_sums, pixels)};
+                core_energies[f] += block_energy[0] + block_energy[1] + block_energy[2];
+            }
+        }
+    }
+    m_means = cv::Mat_<cv::Vec3f>::zeros(blocks);
+    for (size_t i {0}; i < core.size(); i++)
+    {
+        m_means(core[i]) = means[0][i];
+    }
+    m_means_norm = cv::norm(m_means);
+    if (m_means_norm <= 0.0)
+    {
+        return;  // black core: no bound
+    }
+
+    // Every inner product and norm below is in pixels: a block mean stands for B^2 pixels
+    const double templ_norm {std::sqrt(templ_energy)};
+    for (size_t f {0}; f < means.size(); f++)
+    {
+        double dot {0.0};
+        double energy_f {0.0};
+        for (size_t i {0}; i < core.size(); i++)
+        {
+            dot += block_area * means[0][i].dot(means[f][i]);
+            energy_f += block_area * means[f][i].dot(means[f][i]);
+        }
+        const double a_f {std::sqrt(energy_f)};
+        const double cos_psi {a_f > 0.0 ? std::clamp(dot / (m_means_norm * std::sqrt(block_area) * a_f), -1.0, 1.0) :
+                                          1.0};
+        const double sin_psi {std::sqrt(1.0 - cos_psi * cos_psi)};
+        const double off_means {std::max(0.0, core_energies[f] - energy_f)};
+        const double off_core {std::max(0.0, templ_energy - core_energies[f])};
+        m_offsets.push_back(Offset{a_f * cos_psi / templ_norm,
+                                   std::sqrt(a_f * a_f * sin_psi * sin_psi + off_means) / templ_norm,
+                                   off_core / templ_energy});
+    }
+}
+
+bool CoarseBound::empty() const
+{
+    return (m_block == 0);
+}
+
+int CoarseBound::blockSize() const
+{
+    return m_block;
+}
+
+void CoarseBound::prepareImage(const cv::Mat_<cv::Vec3b>& image, const int levels, PreparedImage& prepared)
+{
+    const int b {1 << levels};
+    const cv::Size blocks {image.cols / b, image.rows / b};
+    prepared.block = b;
+    if (blocks.area() == 0)
+    {
+        prepared.means.release();
+        prepared.energies.release();
+        return;
+    }
+    TMWorkspace::Scope scope;
+    TMWorkspace& workspace {scope.workspace()};
+    const cv::Size size {blocks.width * b, blocks.height * b};
+    cv::Mat image_f {workspace.image_f.get(size, CV_32FC3)};
+    cv::Mat squares {workspace.planes[3].get(size, CV_32F)};
+    image(cv::Rect{cv::Point{0, 0}, size}).convertTo(image_f, CV_32F);
+    // INTER_AREA by an integer factor is the mean of every block
+    cv::resize(image_f, prepared.means, blocks, 0.0, 0.0, cv::INTER_AREA);
+    cv::multiply(image_f, image_f, image_f);
+    cv::transform(image_f, squares, cv::Matx13f{1.0f, 1.0f, 1.0f});
+    cv::resize(squares, prepared.energies, blocks, 0.0, 0.0, cv::INTER_AREA);
+}
+
+void CoarseBound::bounds(const PreparedImage& image, const cv::Size result_size, cv::Mat_<float>& result) const
+{
+    const cv::Size cells {(result_size.width + m_block - 1) / m_block, (result_size.height + m_block - 1) / m_block};
+    result.create(cells);
+    if (m_offsets.empty())
+    {
+        result.setTo(1.0f);
+        return;
+    }
+
+    // Correlations at the coarse level: block X of positions covers blocks X + b of the image
+    const cv::Size coarse_size {image.means.cols - m_means.cols + 1, image.means.rows - m_means.rows + 1};
+    CV_Assert(image.block == m_block && coarse_size.width >= cells.width && coarse_size.height >= cells.height);
+    TMWorkspace::Scope scope;
+    TMWorkspace& workspace {scope.workspace()};
+    cv::Mat_<float> correlations {workspace.coarse_correlations[0].get<float>(coarse_size)};
+    cv::Mat_<float> core_energies {workspace.coarse_correlations[1].get<float>(coarse_size)};
+    cv::matchTemplate(image.means, m_means, correlations, cv::TM_CCORR);
+    cv::matchTemplate(image.energies, m_core, core_energies, cv::TM_CCORR);
+    for (int y {0}; y < cells.height; y++)
+    {
+        const float* correlation {correlations[y]};
+        const float* core_energy {core_energies[y]};
+        float* bound {result[y]};
+        for (int x {0}; x < cells.width; x++)
+        {
+            // Both are sums over the blocks: the B^2 pixels of every block cancel out
+            const double energy {core_energy[x]};
+            const double c {energy > 0.0 ? std::clamp(correlation[x] / (m_means_norm * std::sqrt(energy)), 0.0, 1.0) :
+                                           0.0};
+            const double s {std::sqrt(1.0 - c * c)};
+            double best {0.0};
+            for (const Offset& offset : m_offsets)
+            {
+                const double dot {offset.cos_term * c + offset.sin_term * s};
+                best = std::max(best, dot * dot + offset.off_core);
+            }
+            bound[x] = static_cast<float>(std::sqrt(best) + tolerance);
+        }
+    }
+}
@@ -0,0 +1,307 @@
+// Author: Luca Pellegrini
+#include <dataset_pack.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <opencv2/core.hpp>
+
+namespace fs = std::filesystem;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace
+{
+
+// Layout of a pack file:
+//   PackHeader
+//   PackRecord[num_records]
+//   image names (not NUL-terminated)
+//   BGR and grayscale planes, each one starting on a `pack_alignment` boundary
+constexpr char pack_magic[8] {'F', 'L', 'W', 'R', 'P', 'A', 'C', 'K'};
+constexpr uint32_t pack_version {1};
+constexpr uint32_t pack_byte_order {0x01020304};
+constexpr uint64_t pack_alignment {64};
+
+struct PackHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t num_records;
+    uint64_t file_size;
+};
+static_assert(sizeof(PackHeader) == 32, "unexpected PackHeader layout");
+
+struct PackRecord
+{
+    uint64_t name_offset;
+    uint32_t name_length;
+    uint8_t fl_type;
+    uint8_t healthy;
+    uint8_t image_type;  // 0 for train, 1 for test
+    uint8_t reserved;
+    int32_t rows;
+    int32_t cols;
+    uint64_t color_offset;
+    uint64_t gray_offset;
+};
+static_assert(sizeof(PackRecord) == 40, "unexpected PackRecord layout");
+
+uint64_t alignUp(const uint64_t offset)
+{
+    return (offset + pack_alignment - 1) / pack_alignment * pack_alignment;
+}
+
+void writePadding(std::ofstream& out, uint64_t& offset, const uint64_t target)
+{
+    static const char zeros[pack_alignment] {};
+    out.write(zeros, static_cast<std::streamsize>(target - offset));
+    offset = target;
+}
+
+} // namespace
+
+bool writeDatasetPack(
+    const fs::path pack_path,
+    const FlowerImageContainer& test_imgs,
+    const FlowerImageContainer& train_healthy_imgs,
+    const FlowerImageContainer& train_diseased_imgs
+)
+{
+    // Images are written in the same order as they will be loaded back
+    const std::vector<const FlowerImageContainer*> containers {&test_imgs, &train_healthy_imgs, &train_diseased_imgs};
+    uint64_t num_records {0};
+    for (const FlowerImageContainer* container : containers)
+    {
+        num_records += container->size();
+    }
+
+    std::ofstream out {pack_path, std::ios::binary | std::ios::trunc};
+    if (!out)
+    {
+        cerr << "writeDatasetPack: cannot open " << pack_path.string() << endl;
+        return false;
+    }
+
+    // Names only need the metadata: they are written right away, after room for the header and the records
+    std::vector<PackRecord> records(num_records);
+    uint64_t offset {sizeof(PackHeader) + num_records * sizeof(PackRecord)};
+    out.seekp(static_cast<std::streamoff>(offset));  // the skipped bytes read as zeros until they are written
+    size_t r {0};
+    for (const FlowerImageContainer* container : containers)
+    {
+        for (size_t i {0}; i < container->size(); i++, r++)
+        {
+            const std::string& name {container->metadataAt(i).name()};
+            records[r].name_offset = offset;
+            records[r].name_length = static_cast<uint32_t>(name.size());
+            out.write(name.data(), records[r].name_length);
+            offset += records[r].name_length;
+        }
+    }
+
+    // Pixels: one image at a time, so that lazy containers decode (and may evict) them as they go
+    r = 0;
+    bool ok {true};
+    for (const FlowerImageContainer* container : containers)
+    {
+        for (size_t i {0}; ok && i < container->size(); i++, r++)
+        {
+            const FlowerImage img {container->get(i)};
+            const cv::Mat_<cv::Vec3b>& color {img.getImageColor()};
+            const cv::Mat_<uchar>& gray {img.getImageGrayscale()};
+            if (color.empty() || color.size() != gray.size())
+            {
+                cerr << "writeDatasetPack: invalid image " << img.name() << endl;
+                ok = false;
+                break;
+            }
+            PackRecord& rec {records[r]};
+            rec.fl_type = static_cast<uint8_t>(img.flowerType());
+            rec.healthy = img.isHealthy() ? 1 : 0;
+            rec.image_type = static_cast<uint8_t>(img.imageType());
+            rec.reserved = 0;
+            rec.rows = color.rows;
+            rec.cols = color.cols;
+
+            // Copy row by row: the source images are not necessarily continuous
+            rec.color_offset = alignUp(offset);
+            writePadding(out, offset, rec.color_offset);
+            for (int y {0}; y < color.rows; y++)
+            {
+                out.write(reinterpret_cast<const char*>(color.ptr(y)), color.cols * 3);
+            }
+            offset += static_cast<uint64_t>(color.rows) * color.cols * 3;
+
+            rec.gray_offset = alignUp(offset);
+            writePadding(out, offset, rec.gray_offset);
+            for (int y {0}; y < gray.rows; y++)
+            {
+                out.write(reinterpret_cast<const char*>(gray.ptr(y)), gray.cols);
+            }
+            offset += static_cast<uint64_t>(gray.rows) * gray.cols;
+        }
+    }
+
+    PackHeader header;
+    std::memcpy(header.magic, pack_magic, sizeof(pack_magic));
+    header.version = pack_version;
+    header.byte_order = pack_byte_order;
+    header.num_records = num_records;
+    header.file_size = offset;
+    if (ok)
+    {
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(records.data()),
+                  static_cast<std::streamsize>(num_records * sizeof(PackRecord)));
+    }
+    out.close();
+    if (!ok || !out)
+    {
+        if (ok)
+        {
+            cerr << "writeDatasetPack: error writing " << pack_path.string() << endl;
+        }
+        std::error_code ec;
+        fs::remove(pack_path, ec);  // never leave a truncated pack behind
+        return false;
+    }
+
+    cout << "Wrote " << num_records << " images (" << header.file_size / (1024 * 1024)
+         << " MiB) to " << pack_path.string() << endl;
+    return true;
+}
+
+DatasetPack::~DatasetPack()
+{
+    close();
+}
+
+bool DatasetPack::open(const fs::path pack_path)
+{
+    close();
+
+    const int fd {::open(pack_path.c_str(), O_RDONLY)};
+    if (fd < 0)
+    {
+        cerr << "DatasetPack: cannot open " << pack_path.string() << endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < sizeof(PackHeader))
+    {
+        cerr << "DatasetPack: invalid pack file " << pack_path.string() << endl;
+        ::close(fd);
+        return false;
+    }
+    const size_t size {static_cast<size_t>(st.st_size)};
+    // Private, writable mapping: pages are shared until someone modifies an image
+    void* data {mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)};
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        cerr << "DatasetPack: mmap failed for " << pack_path.string() << endl;
+        return false;
+    }
+
+    const PackHeader* header {static_cast<const PackHeader*>(data)};
+    const bool valid {
+        std::memcmp(header->magic, pack_magic, sizeof(pack_magic)) == 0 &&
+        header->version == pack_version &&
+        header->byte_order == pack_byte_order &&
+        header->file_size == size &&
+        header->num_records <= (size - sizeof(PackHeader)) / sizeof(PackRecord)
+    };
+    if (!valid)
+    {
+        cerr << "DatasetPack: unsupported or corrupted pack file " << pack_path.string() << endl;
+        munmap(data, size);
+        return false;
+    }
+
+    m_data = data;
+    m_size = size;
+    return true;
+}
+
+void DatasetPack::close()
+{
+    if (m_data != nullptr)
+    {
+        munmap(m_data, m_size);
+        m_data = nullptr;
+        m_size = 0;
+    }
+}
+
+bool DatasetPack::isOpen() const
+{
+    return (m_data != nullptr);
+}
+
+bool DatasetPack::inBounds(const uint64_t offset, const uint64_t length) const
+{
+    // Written so that a corrupted offset cannot wrap around
+    return offset <= m_size && length <= m_size - offset;
+}
+
+bool DatasetPack::load(
+    FlowerImageContainer& test_imgs,
+    FlowerImageContainer& train_healthy_imgs,
+    FlowerImageContainer& train_diseased_imgs
+) const
+{
+    if (!isOpen())
+    {
+        cerr << "DatasetPack: no pack file is open" << endl;
+        return false;
+    }
+    uint8_t* base {static_cast<uint8_t*>(m_data)};
+    const PackHeader* header {reinterpret_cast<const PackHeader*>(base)};
+    const PackRecord* records {reinterpret_cast<const PackRecord*>(base + sizeof(PackHeader))};
+
+    for (uint64_t i {0}; i < header->num_records; i++)
+    {
+        const PackRecord& rec {records[i]};
+        const bool valid_size {rec.rows > 0 && rec.cols > 0};
+        const uint64_t color_bytes {valid_size ? static_cast<uint64_t>(rec.rows) * rec.cols * 3 : 0};
+        const uint64_t gray_bytes {valid_size ? static_cast<uint64_t>(rec.rows) * rec.cols : 0};
+        if (!valid_size ||
+            rec.fl_type >= num_classes ||
+            rec.image_type > 1 ||
+            !inBounds(rec.name_offset, rec.name_length) ||
+            !inBounds(rec.color_offset, color_bytes) ||
+            !inBounds(rec.gray_offset, gray_bytes))
+        {
+            cerr << "DatasetPack: corrupted record " << i << endl;
+            return false;
+        }
+
+        const std::string name(reinterpret_cast<const char*>(base + rec.name_offset), rec.name_length);
+        // Headers over the mapped file, no copy
+        cv::Mat_<cv::Vec3b> img_color(rec.rows, rec.cols, reinterpret_cast<cv::Vec3b*>(base + rec.color_offset));
+        cv::Mat_<uchar> img_gray(rec.rows, rec.cols, base + rec.gray_offset);
+        FlowerImage img {name, static_cast<FlowerType>(rec.fl_type), rec.healthy != 0, rec.image_type, img_color, img_gray};
+
+        if (img.isTest())
+            test_imgs.push_back(std::move(img));
+        else if (img.isHealthy())
+            train_healthy_imgs.push_back(std::move(img));
+        else
+            train_diseased_imgs.push_back(std::move(img));
+    }
+    return true;
+}
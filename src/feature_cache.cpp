@@ -0,0 +1,289 @@
+// Author: Luca Pellegrini
+#include <feature_cache.hpp>
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <system_error>
+
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using std::cerr;
+using std::endl;
+
+namespace
+{
+
+// Layout of a cache entry:
+//   EntryHeader
+//   params key (key_length bytes)
+//   KeypointRecord[num_keypoints]
+//   descriptors (rows * cols * elemSize bytes, row by row)
+constexpr char entry_magic[8] {'F', 'L', 'W', 'R', 'F', 'E', 'A', 'T'};
+constexpr uint32_t entry_version {1};
+
+struct EntryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t key_length;
+    uint64_t image_hash;
+    int32_t has_keypoints;
+    int32_t num_keypoints;
+    int32_t rows;
+    int32_t cols;
+    int32_t type;
+    int32_t reserved;
+};
+static_assert(sizeof(EntryHeader) == 48, "unexpected EntryHeader layout");
+
+struct KeypointRecord
+{
+    float x, y, size, angle, response;
+    int32_t octave;
+    int32_t class_id;
+};
+static_assert(sizeof(KeypointRecord) == 28, "unexpected KeypointRecord layout");
+
+std::mutex cache_mutex;
+fs::path cache_dir;
+std::atomic<bool> cache_enabled {false};
+std::atomic<size_t> cache_hits {0};
+std::atomic<size_t> cache_misses {0};
+std::atomic<size_t> cache_stores {0};
+std::atomic<size_t> tmp_counter {0};
+
+uint64_t mix(uint64_t h)
+{
+    // Finalizer of MurmurHash3
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t hashBytes(const uint8_t* data, const size_t size, uint64_t h)
+{
+    constexpr uint64_t prime {0x9E3779B97F4A7C15ULL};
+    size_t i {0};
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        h = (h ^ mix(word)) * prime;
+    }
+    uint64_t tail {0};
+    std::memcpy(&tail, data + i, size - i);
+    return (h ^ mix(tail ^ size)) * prime;
+}
+
+fs::path entryPath(const std::string& params_key, const uint64_t image_hash)
+{
+    // OpenCV version is part of the key: extraction results may change between releases
+    const std::string key {params_key + " opencv=" CV_VERSION};
+    const uint64_t key_hash {hashBytes(reinterpret_cast<const uint8_t*>(key.data()), key.size(), 0)};
+    std::ostringstream name;
+    name << std::hex << std::setfill('0') << std::setw(16) << key_hash << std::setw(16) << image_hash << ".feat";
+    std::lock_guard<std::mutex> lock {cache_mutex};
+    return cache_dir / name.str();
+}
+
+// Whether the sizes in the header (already checked to be non-negative) add up to the size of the file
+bool sizeMatches(const EntryHeader& header, const uint64_t file_size)
+{
+    uint64_t size {sizeof(EntryHeader) + static_cast<uint64_t>(header.key_length) +
+                   static_cast<uint64_t>(header.num_keypoints) * sizeof(KeypointRecord)};
+    if (size > file_size)
+    {
+        return false;
+    }
+    // rows * row_bytes could overflow: divide instead
+    const uint64_t row_bytes {static_cast<uint64_t>(header.cols) * CV_ELEM_SIZE(header.type)};
+    const uint64_t rows {static_cast<uint64_t>(header.rows)};
+    if (row_bytes > 0 && rows > (file_size - size) / row_bytes)
+    {
+        return false;
+    }
+    size += rows * row_bytes;
+    return size == file_size;
+}
+
+} // namespace
+
+bool setFeatureCacheDir(const fs::path dir)
+{
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec || !fs::is_directory(dir))
+    {
+        cerr << "Feature cache: cannot create directory " << dir.string() << endl;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock {cache_mutex};
+    cache_dir = dir;
+    cache_enabled = true;
+    return true;
+}
+
+bool featureCacheEnabled()
+{
+    return cache_enabled;
+}
+
+FeatureCacheStats featureCacheStats()
+{
+    return FeatureCacheStats {cache_hits, cache_misses, cache_stores};
+}
+
+uint64_t hashImage(const cv::Mat& image)
+{
+    const int32_t dims[3] {image.rows, image.cols, image.type()};
+    uint64_t h {hashBytes(reinterpret_cast<const uint8_t*>(dims), sizeof(dims), 0)};
+    const size_t row_bytes {image.cols * image.elemSize()};
+    for (int r {0}; r < image.rows; r++)  // images are not necessarily continuous
+    {
+        h = hashBytes(image.ptr(r), row_bytes, h);
+    }
+    return mix(h);
+}
+
+bool loadCachedFeatures(
+    const std::string& params_key,
+    const cv::Mat& image,
+    std::vector<cv::KeyPoint>* keypoints,
+    cv::Mat& descriptors
+)
+{
+    if (!cache_enabled)
+    {
+        return false;
+    }
+    const uint64_t image_hash {hashImage(image)};
+    const fs::path path {entryPath(params_key, image_hash)};
+    std::error_code ec;
+    const uintmax_t file_size {fs::file_size(path, ec)};
+    if (ec)
+    {
+        cache_misses++;
+        return false;
+    }
+    std::ifstream in {path, std::ios::binary};
+    EntryHeader header;
+    std::string key(params_key.size(), '\0');
+    const bool valid {
+        in.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+        std::memcmp(header.magic, entry_magic, sizeof(entry_magic)) == 0 &&
+        header.version == entry_version &&
+        header.image_hash == image_hash &&
+        header.key_length == params_key.size() &&
+        in.read(key.data(), static_cast<std::streamsize>(key.size())) &&
+        key == params_key &&
+        (header.has_keypoints != 0) == (keypoints != nullptr) &&
+        header.num_keypoints >= 0 && header.rows >= 0 && header.cols >= 0 &&
+        header.type == CV_MAT_TYPE(header.type) && CV_MAT_DEPTH(header.type) <= CV_16F
+    };
+    // The payload must fill the file exactly: a truncated or corrupted entry is a miss, and nothing is
+    // allocated for it (the sizes in the header are not trusted until they match the file)
+    if (!valid || !sizeMatches(header, file_size))
+    {
+        cache_misses++;
+        return false;
+    }
+
+    std::vector<KeypointRecord> records(static_cast<size_t>(header.num_keypoints));
+    in.read(reinterpret_cast<char*>(records.data()),
+            static_cast<std::streamsize>(records.size() * sizeof(KeypointRecord)));
+    cv::Mat desc;
+    if (header.rows > 0 && header.cols > 0)
+    {
+        desc.create(header.rows, header.cols, header.type);
+        in.read(reinterpret_cast<char*>(desc.data), static_cast<std::streamsize>(desc.total() * desc.elemSize()));
+    }
+    if (!in)
+    {
+        cache_misses++;  // truncated entry
+        return false;
+    }
+
+    if (keypoints != nullptr)
+    {
+        keypoints->clear();
+        keypoints->reserve(records.size());
+        for (const KeypointRecord& rec : records)
+        {
+            keypoints->emplace_back(rec.x, rec.y, rec.size, rec.angle, rec.response, rec.octave, rec.class_id);
+        }
+    }
+    descriptors = desc;
+    cache_hits++;
+    return true;
+}
+
+void storeCachedFeatures(
+    const std::string& params_key,
+    const cv::Mat& image,
+    const std::vector<cv::KeyPoint>* keypoints,
+    const cv::Mat& descriptors
+)
+{
+    if (!cache_enabled)
+    {
+        return;
+    }
+    EntryHeader header;
+    std::memcpy(header.magic, entry_magic, sizeof(entry_magic));
+    header.version = entry_version;
+    header.key_length = static_cast<uint32_t>(params_key.size());
+    header.image_hash = hashImage(image);
+    header.has_keypoints = (keypoints != nullptr) ? 1 : 0;
+    header.num_keypoints = (keypoints != nullptr) ? static_cast<int32_t>(keypoints->size()) : 0;
+    header.rows = descriptors.rows;
+    header.cols = descriptors.cols;
+    header.type = descriptors.type();
+    header.reserved = 0;
+
+    // Write to a temporary file, then rename it: readers never see a partial entry
+    const fs::path path {entryPath(params_key, header.image_hash)};
+    fs::path tmp_path {path};
+    tmp_path += ".tmp" + std::to_string(getpid()) + "_" + std::to_string(tmp_counter++);
+    {
+        std::ofstream out {tmp_path, std::ios::binary | std::ios::trunc};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(params_key.data(), static_cast<std::streamsize>(params_key.size()));
+        if (keypoints != nullptr)
+        {
+            for (const cv::KeyPoint& kp : *keypoints)
+            {
+                const KeypointRecord rec {kp.pt.x, kp.pt.y, kp.size, kp.angle, kp.response, kp.octave, kp.class_id};
+                out.write(reinterpret_cast<const char*>(&rec), sizeof(rec));
+            }
+        }
+        const size_t row_bytes {descriptors.cols * descriptors.elemSize()};
+        for (int r {0}; r < descriptors.rows; r++)
+        {
+            out.write(reinterpret_cast<const char*>(descriptors.ptr(r)), static_cast<std::streamsize>(row_bytes));
+        }
+        if (!out)
+        {
+            out.close();
+            std::error_code ec;
+            fs::remove(tmp_path, ec);
+            return;
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp_path, path, ec);
+    if (ec)
+    {
+        fs::remove(tmp_path, ec);
+        return;
+    }
+    cache_stores++;
+}
@@ -1,14 +1,14 @@
 // Author: Luca Pellegrini
 #include "flower_image.hpp"
 
+#include <utility>
+
 FlowerImage::FlowerImage(
     std::string name, FlowerType fl_type, bool healthy, int img_type,
-    cv::Mat_<cv::Vec3b>& img_color, cv::Mat_<uchar>& img_gray) :
-    m_name{name}, m_fl_type{fl_type}, m_healthy{healthy}, m_image_type{img_type}
-{
-    m_image_color = img_color;
-    m_image_grayscale = img_gray;
-}
+    cv::Mat_<cv::Vec3b> img_color, cv::Mat_<uchar> img_gray) :
+    m_name{std::move(name)}, m_fl_type{fl_type}, m_healthy{healthy}, m_image_type{img_type},
+    m_image_color{std::move(img_color)}, m_image_grayscale{std::move(img_gray)}
+{}
 
 const cv::Mat_<cv::Vec3b>& FlowerImage::getImageColor() const
 {
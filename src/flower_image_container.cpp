@@ -2,6 +2,7 @@
 #include "flower_image_container.hpp"
 
 #include <iostream>
+#include <image_decode.hpp>
 using std::cout;
 using std::endl;
 
@@ -35,12 +36,21 @@ const std::vector<FlowerImage> FlowerImageContainer::getImagesByFlowerType(const
     std::vector<FlowerImage> temp_vec(count);
     for (size_t i {0}; i < count; i++)
     {
-        FlowerImage temp_img {m_vec[indices_vec[i]]};
-        temp_vec[i] = temp_img;
+        temp_vec[i] = get(indices_vec[i]);
     }
     return temp_vec;
 }
 
+FlowerImageView FlowerImageContainer::view() const
+{
+    return FlowerImageView{this, nullptr};
+}
+
+FlowerImageView FlowerImageContainer::view(const FlowerType& flower_type) const
+{
+    return FlowerImageView{this, &m_map.at(flower_type)};
+}
+
 bool FlowerImageContainer::empty() const
 {
     return m_vec.empty();
@@ -53,10 +63,17 @@ size_t FlowerImageContainer::size() const
 
 FlowerImage& FlowerImageContainer::at(const size_t i)
 {
+    CV_Assert(!m_lazy);
     return m_vec.at(i);
 }
 
 const FlowerImage& FlowerImageContainer::at(const size_t i) const
+{
+    CV_Assert(!m_lazy);
+    return m_vec.at(i);
+}
+
+const FlowerImage& FlowerImageContainer::metadataAt(const size_t i) const
 {
     return m_vec.at(i);
 }
@@ -65,57 +82,229 @@ void FlowerImageContainer::push_back(const FlowerImage& img)
 {
     //cout << "push_back image: " << img.name << endl;
     //cout << "        fl_type: " << static_cast<int>(img.flowerType()) << endl;
-    m_vec.push_back(img);
-    std::vector<size_t>& indices_vec {m_map.at(img.flowerType())};
+    // A lazy container needs the path of every image (see push_back_lazy())
+    CV_Assert(!m_lazy);
+    pushImage(FlowerImage{img});
+}
+
+void FlowerImageContainer::push_back(FlowerImage&& img)
+{
+    CV_Assert(!m_lazy);
+    pushImage(std::move(img));
+}
+
+void FlowerImageContainer::pushImage(FlowerImage&& img)
+{
+    const FlowerType fl_type {img.flowerType()};
+    m_vec.push_back(std::move(img));
+    std::vector<size_t>& indices_vec {m_map.at(fl_type)};
     indices_vec.push_back(m_vec.size()-1);
 }
 
+void FlowerImageContainer::setLazy(const size_t budget_bytes, const DecodeOptions& decode_opts)
+{
+    if (!m_vec.empty())
+    {
+        std::cerr << "FlowerImageContainer::setLazy: container is not empty" << endl;
+        return;
+    }
+    m_lazy = std::make_unique<LazyState>();
+    m_lazy->budget_bytes = budget_bytes;
+    m_lazy->decode_opts = decode_opts;
+}
+
+bool FlowerImageContainer::isLazy() const
+{
+    return (m_lazy != nullptr);
+}
+
+void FlowerImageContainer::setLazyLike(const FlowerImageContainer& other)
+{
+    if (!other.m_lazy)
+    {
+        std::cerr << "FlowerImageContainer::setLazyLike: the other container is not lazy" << endl;
+        return;
+    }
+    setLazy(other.m_lazy->budget_bytes, other.m_lazy->decode_opts);
+}
+
+void FlowerImageContainer::push_back_lazy(const FlowerImageContainer& other, const size_t i, const cv::Rect& roi)
+{
+    if (!other.m_lazy)
+    {
+        std::cerr << "FlowerImageContainer::push_back_lazy: the other container is not lazy" << endl;
+        return;
+    }
+    // A crop of a crop is in the coordinates of the first crop: not needed so far
+    CV_Assert(roi.empty() || other.m_lazy->rois.at(i).empty());
+    push_back_lazy(other.m_lazy->paths.at(i), other.m_vec.at(i), roi.empty() ? other.m_lazy->rois.at(i) : roi);
+}
+
+void FlowerImageContainer::push_back_lazy(const std::string& img_path, const FlowerImage& img, const cv::Rect& roi)
+{
+    if (!m_lazy)
+    {
+        std::cerr << "FlowerImageContainer::push_back_lazy: container is not lazy" << endl;
+        return;
+    }
+    // Only keep the metadata
+    pushImage(FlowerImage{img.name(), img.flowerType(), img.isHealthy(), img.imageType(), {}, {}});
+    m_lazy->paths.push_back(img_path);
+    m_lazy->rois.push_back(roi);
+    m_lazy->bytes.push_back(0);
+    m_lazy->lru_pos.push_back(m_lazy->lru.end());
+}
+
+ImageCacheStats FlowerImageContainer::cacheStats() const
+{
+    if (!m_lazy)
+    {
+        return ImageCacheStats{};
+    }
+    std::lock_guard<std::mutex> lock {m_lazy->mutex};
+    return m_lazy->stats;
+}
+
+FlowerImage FlowerImageContainer::get(const size_t i) const
+{
+    if (m_lazy)
+    {
+        FlowerImage copy;
+        loadLazy(i, &copy);
+        return copy;
+    }
+    return m_vec.at(i);
+}
+
+void FlowerImageContainer::loadLazy(const size_t i, FlowerImage* copy) const
+{
+    LazyState& lazy {*m_lazy};
+    std::unique_lock<std::mutex> lock {lazy.mutex};
+    // Logically const: only the cached pixels of the images change
+    std::vector<FlowerImage>& vec {const_cast<std::vector<FlowerImage>&>(m_vec)};
+    FlowerImage& img {vec.at(i)};
+
+    if (lazy.bytes[i] > 0)
+    {
+        lazy.stats.hits++;
+        lazy.lru.splice(lazy.lru.begin(), lazy.lru, lazy.lru_pos[i]);
+        if (copy != nullptr)
+            *copy = img;
+        return;
+    }
+
+    lazy.stats.misses++;
+    const std::string path {lazy.paths[i]};
+    const cv::Rect roi {lazy.rois[i]};
+    lock.unlock();
+    // Decode (and crop) without holding the lock, so that several threads can decode at the same time
+    cv::Mat_<cv::Vec3b> img_color;
+    cv::Mat_<uchar> img_gray;
+    const bool decoded {decodeImage(path, img_color, img_gray, lazy.decode_opts)};
+    const cv::Rect crop {roi & cv::Rect{0, 0, img_color.cols, img_color.rows}};
+    if (decoded && !crop.empty())
+    {
+        // Copies, so that the full image is released (as cropImages() does with eager containers)
+        img_gray = (img_gray.size() == img_color.size()) ? cv::Mat_<uchar>{img_gray(crop).clone()} : cv::Mat_<uchar>{};
+        img_color = img_color(crop).clone();
+    }
+    lock.lock();
+
+    if (lazy.bytes[i] > 0)
+    {
+        // Decoded by another thread in the meantime
+        lazy.lru.splice(lazy.lru.begin(), lazy.lru, lazy.lru_pos[i]);
+        if (copy != nullptr)
+            *copy = img;
+        return;
+    }
+    if (!decoded)
+    {
+        std::cerr << "Error loading image: " << path << endl;
+        img.getImageColor().release();
+        img.getImageGrayscale().release();
+        if (copy != nullptr)
+            *copy = img;
+        return;
+    }
+    img.getImageColor() = img_color;
+    img.getImageGrayscale() = img_gray;
+    const size_t bytes {img.getImageColor().total() * img.getImageColor().elemSize() +
+                        img.getImageGrayscale().total() * img.getImageGrayscale().elemSize()};
+    lazy.bytes[i] = bytes;
+    lazy.stats.resident_bytes += bytes;
+    lazy.lru.push_front(i);
+    lazy.lru_pos[i] = lazy.lru.begin();
+
+    // Evict least recently used images, but never the one just loaded
+    while (lazy.stats.resident_bytes > lazy.budget_bytes && lazy.lru.size() > 1)
+    {
+        const size_t victim {lazy.lru.back()};
+        lazy.lru.pop_back();
+        lazy.lru_pos[victim] = lazy.lru.end();
+        lazy.stats.resident_bytes -= lazy.bytes[victim];
+        lazy.bytes[victim] = 0;
+        vec[victim].getImageColor().release();
+        vec[victim].getImageGrayscale().release();
+        lazy.stats.evictions++;
+    }
+    if (copy != nullptr)
+        *copy = img;
+}
+
 void FlowerImageContainer::combineContainers(
     const FlowerImageContainer& first,
     const FlowerImageContainer& second,
     FlowerImageContainer& out
 )
 {
-    using FlTp = FlowerType;
-    using MapTp = std::map<FlTp, std::vector<size_t>>;
-    const size_t size_first {first.size()};
-    const size_t size_second {second.size()};
-    const size_t size_out {size_first + size_second};
-    std::vector<FlowerImage> vec_out(size_out);
-    // const MapTp& map_first {first.getMap()};
-    // const MapTp& map_second {second.getMap()};
-    MapTp map_out = {
-        {FlTp::Daisy,     {}},
-        {FlTp::Dandelion, {}},
-        {FlTp::Rose,      {}},
-        {FlTp::Sunflower, {}},
-        {FlTp::Tulip,     {}},
-        {FlTp::NoFlower,  {}}
-    };
-    // Concatenate vectors
-    for (size_t i {0}; i < size_first; i++)
+    FlowerImageContainer combined;
+    combined.append(const_cast<FlowerImageContainer&>(first), false);
+    combined.append(const_cast<FlowerImageContainer&>(second), false);
+    out = std::move(combined);
+}
+
+void FlowerImageContainer::combineContainers(
+    FlowerImageContainer&& first,
+    FlowerImageContainer&& second,
+    FlowerImageContainer& out
+)
+{
+    FlowerImageContainer combined;
+    combined.append(first, true);
+    combined.append(second, true);
+    first = FlowerImageContainer{};
+    second = FlowerImageContainer{};
+    out = std::move(combined);  // `out` may alias `first` or `second`
+}
+
+void FlowerImageContainer::append(FlowerImageContainer& other, const bool move)
+{
+    // `other` is only modified when `move` is true
+    if (other.m_lazy && !m_lazy && m_vec.empty())
     {
-        vec_out[i] = first.m_vec[i];
+        setLazy(other.m_lazy->budget_bytes, other.m_lazy->decode_opts);
     }
-    for (size_t i {0}; i < size_second; i++)
+    if (static_cast<bool>(other.m_lazy) != static_cast<bool>(m_lazy))
     {
-        vec_out[i + size_first] = second.m_vec[i];
+        std::cerr << "FlowerImageContainer: cannot combine lazy and eager containers" << endl;
+        return;
     }
-    // Concatenate maps
-    for (auto& [fl_type, indices_vec] : map_out)
+    const size_t count {other.m_vec.size()};
+    m_vec.reserve(m_vec.size() + count);
+    for (size_t i {0}; i < count; i++)
     {
-        const size_t size_first {first.m_map.at(fl_type).size()};
-        const size_t size_second {second.m_map.at(fl_type).size()};
-        const size_t size_out {size_first + size_second};
-        indices_vec.resize(size_out);
-        for (size_t i {0}; i < size_first; i++)
+        if (m_lazy)
         {
-            indices_vec[i] = first.m_map.at(fl_type)[i];
+            push_back_lazy(other, i);
         }
-        for (size_t i {0}; i < size_second; i++)
+        else if (move)
         {
-            indices_vec[i + size_first] = second.m_map.at(fl_type)[i];
+            push_back(std::move(other.m_vec[i]));
+        }
+        else
+        {
+            push_back(other.m_vec[i]);
         }
     }
 }
-
@@ -1,10 +1,12 @@
 // Author: Luca Pellegrini
 #include "flower_template.hpp"
 
+#include <utility>
+
 FlowerTemplate::FlowerTemplate(
     std::string name, FlowerType fl_type, bool healthy, int img_type,
-    cv::Mat_<cv::Vec3b>& img_templ, cv::Mat_<uchar>& img_mask) :
-    FlowerImage{name, fl_type, healthy, img_type, img_templ, img_mask}
+    cv::Mat_<cv::Vec3b> img_templ, cv::Mat_<uchar> img_mask) :
+    FlowerImage{std::move(name), fl_type, healthy, img_type, std::move(img_templ), std::move(img_mask)}
 {}
 
 const cv::Mat_<cv::Vec3b>& FlowerTemplate::getTemplate() const
@@ -0,0 +1,250 @@
+// Author: Luca Pellegrini
+#include <fourier_mellin.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <opencv2/imgproc.hpp>
+
+namespace
+{
+
+// The smallest even DFT size not below `size`, so that the spectrum has a central frequency
+int evenDFTSize(int size)
+{
+    size = cv::getOptimalDFTSize(size);
+    while (size % 2 != 0)
+    {
+        size = cv::getOptimalDFTSize(size + 1);
+    }
+    return size;
+}
+
+// Move the zero frequency to the center of an even-sized spectrum
+void shiftSpectrum(cv::Mat& spectrum)
+{
+    const int cx {spectrum.cols / 2};
+    const int cy {spectrum.rows / 2};
+    cv::Mat q0 {spectrum(cv::Rect{0, 0, cx, cy})};
+    cv::Mat q1 {spectrum(cv::Rect{cx, 0, cx, cy})};
+    cv::Mat q2 {spectrum(cv::Rect{0, cy, cx, cy})};
+    cv::Mat q3 {spectrum(cv::Rect{cx, cy, cx, cy})};
+    cv::Mat tmp;
+    q0.copyTo(tmp);
+    q3.copyTo(q0);
+    tmp.copyTo(q3);
+    q1.copyTo(tmp);
+    q2.copyTo(q1);
+    tmp.copyTo(q2);
+}
+
+} // namespace
+
+FourierMellin::FourierMellin(const TemplateBank& templates, const int image_side, const int poses) :
+    m_poses{std::max(1, poses)}
+{
+    int side {std::max(1, image_side)};
+    for (const std::vector<FlowerTemplate>& class_templates : templates)
+    {
+        for (const FlowerTemplate& templ : class_templates)
+        {
+            side = std::max({side, templ.getTemplate().cols, templ.getTemplate().rows});
+        }
+    }
+    m_canvas = evenDFTSize(side);
+    cv::createHanningWindow(m_canvas_window, cv::Size{m_canvas, m_canvas}, CV_32F);
+    cv::createHanningWindow(m_log_polar_window, cv::Size{log_polar_width, log_polar_height}, CV_32F);
+
+    // Emphasizes high frequencies, where scaling and rotation are easier to see:
+    // H = (1 - X) (2 - X), X = cos(pi u) cos(pi v), u and v in [-0.5, 0.5)
+    cv::Mat_<float> cosines {1, m_canvas};
+    for (int i {0}; i < m_canvas; i++)
+    {
+        cosines(0, i) = static_cast<float>(std::cos(CV_PI * (static_cast<double>(i) / m_canvas - 0.5)));
+    }
+    const cv::Mat x {cosines.t() * cosines};
+    m_high_pass = (1.0 - x).mul(2.0 - x);
+
+    m_templates.resize(templates.size());
+    for (size_t c {0}; c < templates.size(); c++)
+    {
+        for (const FlowerTemplate& templ : templates[c])
+        {
+            TemplateData data;
+            if (!templ.getTemplate().empty() && templ.getMask().size() == templ.getTemplate().size())
+            {
+                data.templ = templ.getTemplate();
+                cv::threshold(templ.getMask(), data.mask, 0, 255, cv::THRESH_BINARY);
+                cv::Mat gray;
+                cv::cvtColor(data.templ, gray, cv::COLOR_BGR2GRAY);
+                gray.convertTo(gray, CV_32F);
+                cv::Mat mask;
+                data.mask.convertTo(mask, CV_32F, 1.0 / 255);
+                data.log_polar_spectrum = logPolarSpectrum(gray.mul(mask));
+            }
+            // Always add them, so that indices match the ones of `templates`
+            m_templates[c].push_back(data);
+        }
+    }
+}
+
+bool FourierMellin::empty() const
+{
+    return m_templates.empty();
+}
+
+size_t FourierMellin::numClasses() const
+{
+    return m_templates.size();
+}
+
+size_t FourierMellin::numTemplates(const size_t c) const
+{
+    return m_templates.at(c).size();
+}
+
+cv::Mat FourierMellin::logPolarSpectrum(const cv::Mat& gray) const
+{
+    cv::Mat canvas {cv::Mat::zeros(m_canvas, m_canvas, CV_32F)};
+    gray.copyTo(canvas(cv::Rect{(m_canvas - gray.cols) / 2, (m_canvas - gray.rows) / 2, gray.cols, gray.rows}));
+    canvas = canvas.mul(m_canvas_window);
+
+    cv::Mat spectrum;
+    cv::dft(canvas, spectrum, cv::DFT_COMPLEX_OUTPUT);
+    std::vector<cv::Mat> planes;
+    cv::split(spectrum, planes);
+    cv::Mat magnitude;
+    cv::magnitude(planes[0], planes[1], magnitude);
+    shiftSpectrum(magnitude);
+    magnitude = magnitude.mul(m_high_pass);
+
+    const float center {static_cast<float>(m_canvas / 2)};
+    cv::Mat log_polar;
+    cv::warpPolar(magnitude, log_polar, cv::Size{log_polar_width, log_polar_height}, cv::Point2f{center, center},
+                  center, cv::WARP_POLAR_LOG | cv::INTER_LINEAR);
+    log_polar = log_polar.mul(m_log_polar_window);
+    cv::Mat log_polar_spectrum;
+    cv::dft(log_polar, log_polar_spectrum, cv::DFT_COMPLEX_OUTPUT);
+    return log_polar_spectrum;
+}
+
+void FourierMellin::prepareImage(const cv::Mat_<cv::Vec3b>& image, PreparedImage& prepared) const
+{
+    prepared.image = image;
+    prepared.log_polar_spectrum.release();
+    if (empty() || image.empty() || image.cols > m_canvas || image.rows > m_canvas)
+    {
+        return;
+    }
+    cv::Mat gray;
+    cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+    gray.convertTo(gray, CV_32F);
+    prepared.log_polar_spectrum = logPolarSpectrum(gray);
+}
+
+std::vector<FourierMellin::Pose> FourierMellin::estimatePoses(
+    const PreparedImage& prepared,
+    const size_t c,
+    const size_t t
+) const
+{
+    const TemplateData& templ {m_templates.at(c).at(t)};
+    std::vector<Pose> poses;
+    if (templ.log_polar_spectrum.empty() || prepared.log_polar_spectrum.empty())
+    {
+        return poses;
+    }
+
+    // Phase correlation: normalized cross-power spectrum
+    cv::Mat cross_power;
+    cv::mulSpectrums(prepared.log_polar_spectrum, templ.log_polar_spectrum, cross_power, 0, true);
+    std::vector<cv::Mat> planes;
+    cv::split(cross_power, planes);
+    cv::Mat magnitude;
+    cv::magnitude(planes[0], planes[1], magnitude);
+    magnitude += 1e-9;
+    cv::divide(planes[0], magnitude, planes[0]);
+    cv::divide(planes[1], magnitude, planes[1]);
+    cv::merge(planes, cross_power);
+    cv::Mat correlation;
+    cv::dft(cross_power, correlation, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT);
+
+    // Shifts along log radius are scales, along angle rotations; the map wraps around
+    const double log_base {log_polar_width / std::log(m_canvas / 2.0)};
+    const cv::Rect map_rect {0, 0, correlation.cols, correlation.rows};
+    for (int k {0}; k < m_poses; k++)
+    {
+        cv::Point peak;
+        cv::minMaxLoc(correlation, nullptr, nullptr, nullptr, &peak);
+        correlation(cv::Rect{peak.x - 2, peak.y - 2, 5, 5} & map_rect).setTo(-1.0f);
+        const int dx {peak.x < log_polar_width / 2 ? peak.x : peak.x - log_polar_width};
+        const int dy {peak.y < log_polar_height / 2 ? peak.y : peak.y - log_polar_height};
+        // A larger flower has a smaller spectrum
+        const Pose pose {std::exp(-dx / log_base), -360.0 * dy / log_polar_height};
+        poses.push_back(pose);
+    }
+    return poses;
+}
+
+double FourierMellin::maxScore(const PreparedImage& prepared, const size_t c, const size_t t, Pose* best_pose,
+                               cv::Rect* best_rect) const
+{
+    const TemplateData& templ {m_templates.at(c).at(t)};
+    double best {0.0};
+    for (const Pose& pose : estimatePoses(prepared, c, t))
+    {
+        for (const double angle : {pose.angle, pose.angle + 180.0})
+        {
+            const Pose candidate {pose.scale, angle};
+            cv::Rect rect;
+            const double score {verify(prepared.image, templ, candidate, rect)};
+            if (score > best)
+            {
+                best = score;
+                if (best_pose != nullptr)
+                {
+                    *best_pose = candidate;
+                }
+                if (best_rect != nullptr)
+                {
+                    *best_rect = rect;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+double FourierMellin::verify(const cv::Mat_<cv::Vec3b>& image, const TemplateData& templ, const Pose& pose,
+                             cv::Rect& match_rect) const
+{
+    // Warp template and mask into the bounding box of the scaled and rotated template
+    const cv::Point2f center {templ.templ.cols / 2.0f, templ.templ.rows / 2.0f};
+    cv::Mat rotation {cv::getRotationMatrix2D(center, pose.angle, pose.scale)};
+    const double cos_a {std::abs(rotation.at<double>(0, 0))};
+    const double sin_a {std::abs(rotation.at<double>(0, 1))};
+    const cv::Size box {static_cast<int>(std::ceil(templ.templ.rows * sin_a + templ.templ.cols * cos_a)),
+                        static_cast<int>(std::ceil(templ.templ.rows * cos_a + templ.templ.cols * sin_a))};
+    if (box.width < 8 || box.height < 8 || box.width > image.cols || box.height > image.rows)
+    {
+        return 0.0;
+    }
+    rotation.at<double>(0, 2) += box.width / 2.0 - center.x;
+    rotation.at<double>(1, 2) += box.height / 2.0 - center.y;
+    cv::Mat_<cv::Vec3b> warped_templ;
+    cv::Mat_<uchar> warped_mask;
+    cv::warpAffine(templ.templ, warped_templ, rotation, box);
+    cv::warpAffine(templ.mask, warped_mask, rotation, box, cv::INTER_NEAREST);
+    if (cv::countNonZero(warped_mask) == 0)
+    {
+        return 0.0;
+    }
+
+    cv::Mat_<float> result;
+    cv::matchTemplate(image, warped_templ, result, cv::TM_CCORR_NORMED, warped_mask);
+    cv::patchNaNs(result, 0.0);  // black image patches
+    double max_val;
+    cv::Point max_loc;
+    cv::minMaxLoc(result, nullptr, &max_val, nullptr, &max_loc);
+    match_rect = cv::Rect{max_loc, box};
+    return std::max(0.0, max_val);
+}
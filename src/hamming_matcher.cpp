@@ -0,0 +1,237 @@
+// Author: Luca Pellegrini
+#include <hamming_matcher.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <climits>
+#include <opencv2/core/hal/hal.hpp>
+
+namespace
+{
+
+std::atomic<HammingMatcher::Isa>& selectedIsa()
+{
+    static std::atomic<HammingMatcher::Isa> isa {HammingMatcher::bestIsa()};
+    return isa;
+}
+
+bool isSupported(const HammingMatcher::Isa isa)
+{
+    switch (isa)
+    {
+    case HammingMatcher::Isa::Scalar:
+        return true;
+    case HammingMatcher::Isa::AVX2:
+#ifdef TM_SIMD_AVX2
+        return cv::checkHardwareSupport(cv::CPU_AVX2);
+#else
+        return false;
+#endif
+    case HammingMatcher::Isa::AVX512:
+#ifdef TM_SIMD_AVX512
+        return cv::checkHardwareSupport(cv::CPU_AVX_512F) && cv::checkHardwareSupport(cv::CPU_AVX_512VPOPCNTDQ);
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+void runKernel(const HammingMatcher::Isa isa, const uchar* query, const uchar* train, const size_t train_step,
+               const int count, int* distances)
+{
+    switch (isa)
+    {
+#ifdef TM_SIMD_AVX512
+    case HammingMatcher::Isa::AVX512:
+        hammingDistancesAVX512(query, train, train_step, count, distances);
+        return;
+#endif
+#ifdef TM_SIMD_AVX2
+    case HammingMatcher::Isa::AVX2:
+        hammingDistancesAVX2(query, train, train_step, count, distances);
+        return;
+#endif
+    default:
+        hammingDistancesScalar(query, train, train_step, count, distances);
+        return;
+    }
+}
+
+// Insert a candidate into the sorted k nearest neighbours of a query; equally distant ones keep their order
+void insertNeighbour(std::vector<cv::DMatch>& neighbours, const size_t k, const cv::DMatch& candidate)
+{
+    const auto position {std::upper_bound(neighbours.begin(), neighbours.end(), candidate,
+                                          [](const cv::DMatch& a, const cv::DMatch& b)
+                                          {
+                                              return a.distance < b.distance;
+                                          })};
+    neighbours.insert(position, candidate);
+    if (neighbours.size() > k)
+    {
+        neighbours.pop_back();
+    }
+}
+
+} // namespace
+
+void hammingDistancesScalar(const uchar* query, const uchar* train, const size_t train_step, const int count,
+                            int* distances)
+{
+    for (int i {0}; i < count; i++)
+    {
+        distances[i] = cv::hal::normHamming(query, train + i * train_step, HammingMatcher::descriptor_bytes);
+    }
+}
+
+void HammingMatcher::knnMatch(const cv::Mat& queries, const cv::Mat& train, const int k,
+                              std::vector<std::vector<cv::DMatch>>& matches)
+{
+    matches.assign(queries.rows, {});
+    if (queries.empty() || train.empty() || k < 1)
+    {
+        return;
+    }
+    CV_Assert(queries.type() == CV_8U && queries.cols == descriptor_bytes);
+    CV_Assert(train.type() == CV_8U && train.cols == descriptor_bytes);
+
+    const Isa kernel {isa()};
+    const size_t max_neighbours {static_cast<size_t>(k)};
+    std::array<int, train_block> distances;
+    for (int q0 {0}; q0 < queries.rows; q0 += query_block)
+    {
+        const int q1 {std::min(q0 + query_block, queries.rows)};
+        for (int t0 {0}; t0 < train.rows; t0 += train_block)
+        {
+            const int count {std::min(train_block, train.rows - t0)};
+            for (int q {q0}; q < q1; q++)
+            {
+                runKernel(kernel, queries.ptr<uchar>(q), train.ptr<uchar>(t0), train.step, count, distances.data());
+                std::vector<cv::DMatch>& neighbours {matches[q]};
+                for (int i {0}; i < count; i++)
+                {
+                    const float distance {static_cast<float>(distances[i])};
+                    if (neighbours.size() < max_neighbours || distance < neighbours.back().distance)
+                    {
+                        insertNeighbour(neighbours, max_neighbours, cv::DMatch{q, t0 + i, distance});
+                    }
+                }
+            }
+        }
+    }
+}
+
+void HammingMatcher::match(const cv::Mat& queries, const cv::Mat& train, std::vector<cv::DMatch>& matches)
+{
+    std::vector<std::vector<cv::DMatch>> neighbours;
+    knnMatch(queries, train, 1, neighbours);
+    matches.clear();
+    matches.reserve(neighbours.size());
+    for (const std::vector<cv::DMatch>& nearest : neighbours)
+    {
+        if (!nearest.empty())
+        {
+            matches.push_back(nearest.front());
+        }
+    }
+}
+
+void HammingMatcher::ratioMatch(const cv::Mat& queries, const cv::Mat& train, const double ratio,
+                                const std::function<void(const cv::DMatch&)>& on_match)
+{
+    if (queries.empty() || train.empty())
+    {
+        return;
+    }
+    CV_Assert(queries.type() == CV_8U && queries.cols == descriptor_bytes);
+    CV_Assert(train.type() == CV_8U && train.cols == descriptor_bytes);
+
+    const Isa kernel {isa()};
+    std::array<int, train_block> distances;
+    std::array<int, query_block> best_rows;
+    std::array<int, query_block> best;
+    std::array<int, query_block> second;
+    for (int q0 {0}; q0 < queries.rows; q0 += query_block)
+    {
+        const int q1 {std::min(q0 + query_block, queries.rows)};
+        best.fill(INT_MAX);
+        second.fill(INT_MAX);
+        for (int t0 {0}; t0 < train.rows; t0 += train_block)
+        {
+            const int count {std::min(train_block, train.rows - t0)};
+            for (int q {q0}; q < q1; q++)
+            {
+                int& best_distance {best[q - q0]};
+                int& second_distance {second[q - q0]};
+                if (second_distance == 0)
+                {
+                    continue;
+                }
+                runKernel(kernel, queries.ptr<uchar>(q), train.ptr<uchar>(t0), train.step, count, distances.data());
+                for (int i {0}; i < count; i++)
+                {
+                    const int distance {distances[i]};
+                    if (distance < best_distance)
+                    {
+                        second_distance = best_distance;
+                        best_distance = distance;
+                        best_rows[q - q0] = t0 + i;
+                    }
+                    else if (distance < second_distance)
+                    {
+                        second_distance = distance;
+                    }
+                }
+            }
+        }
+        for (int q {q0}; q < q1; q++)
+        {
+            if (best[q - q0] < ratio * second[q - q0])
+            {
+                on_match(cv::DMatch{q, best_rows[q - q0], static_cast<float>(best[q - q0])});
+            }
+        }
+    }
+}
+
+HammingMatcher::Isa HammingMatcher::isa()
+{
+    return selectedIsa().load(std::memory_order_relaxed);
+}
+
+HammingMatcher::Isa HammingMatcher::bestIsa()
+{
+    for (const Isa isa : {Isa::AVX512, Isa::AVX2})
+    {
+        if (isSupported(isa))
+        {
+            return isa;
+        }
+    }
+    return Isa::Scalar;
+}
+
+bool HammingMatcher::setIsa(const Isa isa)
+{
+    if (!isSupported(isa))
+    {
+        return false;
+    }
+    selectedIsa().store(isa, std::memory_order_relaxed);
+    return true;
+}
+
+const char* HammingMatcher::isaName(const Isa isa)
+{
+    switch (isa)
+    {
+    case Isa::Scalar:
+        return "scalar";
+    case Isa::AVX2:
+        return "AVX2";
+    case Isa::AVX512:
+        return "AVX-512 VPOPCNTDQ";
+    }
+    return "unknown";
+}
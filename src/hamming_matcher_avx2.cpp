@@ -0,0 +1,45 @@
+// Author: Luca Pellegrini
+// Compiled with AVX2 enabled: only called after checking that the CPU supports it
+#include <hamming_matcher.hpp>
+
+#include <immintrin.h>
+
+namespace
+{
+
+// Differing bits of query and train row, summed into four 64-bit lanes: the popcount
+// of every byte is looked up for each nibble with `vpshufb`, and `vpsadbw` adds up 8 bytes
+inline __m256i differingBits(const __m256i query, const uchar* row)
+{
+    const __m256i lookup {_mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4)};
+    const __m256i low_nibble {_mm256_set1_epi8(0x0f)};
+    const __m256i bits {_mm256_xor_si256(query, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row)))};
+    const __m256i low {_mm256_shuffle_epi8(lookup, _mm256_and_si256(bits, low_nibble))};
+    const __m256i high {_mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(bits, 4), low_nibble))};
+    return _mm256_sad_epu8(_mm256_add_epi8(low, high), _mm256_setzero_si256());
+}
+
+} // namespace
+
+void hammingDistancesAVX2(const uchar* query, const uchar* train, const size_t train_step, const int count,
+                          int* distances)
+{
+    const __m256i q {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(query))};
+    int i {0};
+    for (; i + 4 <= count; i += 4)
+    {
+        const uchar* rows {train + i * train_step};
+        // Lane sums of 4 rows (below 2^32), added up pairwise until every row has its total
+        const __m256i sums01 {_mm256_hadd_epi32(differingBits(q, rows), differingBits(q, rows + train_step))};
+        const __m256i sums23 {_mm256_hadd_epi32(differingBits(q, rows + 2 * train_step),
+                                                differingBits(q, rows + 3 * train_step))};
+        const __m256i sums {_mm256_hadd_epi32(sums01, sums23)};
+        const __m128i totals {_mm_add_epi32(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1))};
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(distances + i), totals);
+    }
+    if (i < count)
+    {
+        hammingDistancesScalar(query, train + i * train_step, train_step, count - i, distances + i);
+    }
+}
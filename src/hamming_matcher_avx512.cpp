@@ -0,0 +1,46 @@
+// Author: Luca Pellegrini
+// Compiled with AVX-512 (F, VPOPCNTDQ) enabled: only called after checking that the CPU supports it
+#include <hamming_matcher.hpp>
+
+#include <immintrin.h>
+
+namespace
+{
+
+// Differing bits of the query and two train rows: the total of the first row ends up in
+// 64-bit lane 0, the one of the second row in lane 4
+inline __m512i differingBits(const __m512i query, const uchar* row, const size_t step)
+{
+    const __m512i rows {_mm512_inserti64x4(
+        _mm512_castsi256_si512(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row))),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + step)), 1)};
+    __m512i bits {_mm512_popcnt_epi64(_mm512_xor_si512(query, rows))};
+    bits = _mm512_add_epi64(bits, _mm512_shuffle_epi32(bits, _MM_PERM_BADC));
+    return _mm512_add_epi64(bits, _mm512_shuffle_i64x2(bits, bits, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+} // namespace
+
+void hammingDistancesAVX512(const uchar* query, const uchar* train, const size_t train_step, const int count,
+                            int* distances)
+{
+    const __m512i q {_mm512_broadcast_i64x4(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(query)))};
+    // Lanes 0 and 4 of both sources: the totals of 4 rows
+    const __m512i gather {_mm512_setr_epi64(0, 4, 8, 12, 0, 0, 0, 0)};
+    int i {0};
+    for (; i + 8 <= count; i += 8)
+    {
+        const uchar* rows {train + i * train_step};
+        const __m512i totals0123 {_mm512_permutex2var_epi64(differingBits(q, rows, train_step), gather,
+                                                            differingBits(q, rows + 2 * train_step, train_step))};
+        const __m512i totals4567 {_mm512_permutex2var_epi64(differingBits(q, rows + 4 * train_step, train_step),
+                                                            gather,
+                                                            differingBits(q, rows + 6 * train_step, train_step))};
+        const __m512i totals {_mm512_inserti64x4(totals0123, _mm512_castsi512_si256(totals4567), 1)};
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(distances + i), _mm512_cvtepi64_epi32(totals));
+    }
+    if (i < count)
+    {
+        hammingDistancesScalar(query, train + i * train_step, train_step, count - i, distances + i);
+    }
+}
@@ -3,6 +3,7 @@
 #include "hog.h"
 #include <cmath>
 #include <limits>
+#include <sstream>
 
 HOGExtractor::HOGExtractor(
     cv::Size winSize,
@@ -10,7 +11,15 @@ HOGExtractor::HOGExtractor(
     cv::Size blockStride,
     cv::Size cellSize,
     int nbins
-) : hog_(winSize, blockSize, blockStride, cellSize, nbins) {}
+) : hog_(winSize, blockSize, blockStride, cellSize, nbins) {
+    std::ostringstream key;
+    key << "HOG winSize=" << winSize.width << "x" << winSize.height
+        << " blockSize=" << blockSize.width << "x" << blockSize.height
+        << " blockStride=" << blockStride.width << "x" << blockStride.height
+        << " cellSize=" << cellSize.width << "x" << cellSize.height
+        << " nbins=" << nbins;
+    paramsKey_ = key.str();
+}
 
 bool HOGExtractor::extract(const cv::Mat &image, std::vector<float> &descriptors){
     if (image.empty()) {
@@ -44,3 +53,7 @@ double HOGExtractor::matchDescriptors(const std::vector<float> &descriptors1, co
     }
     return std::sqrt(sum);
 }
+
+const std::string &HOGExtractor::getParamsKey() const{
+    return paramsKey_;
+}
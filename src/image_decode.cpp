@@ -0,0 +1,179 @@
+// Author: Luca Pellegrini
+#include <image_decode.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace
+{
+
+uint32_t readBE16(const uint8_t* p)
+{
+    return (uint32_t{p[0]} << 8) | p[1];
+}
+
+uint32_t readBE32(const uint8_t* p)
+{
+    return (uint32_t{p[0]} << 24) | (uint32_t{p[1]} << 16) | (uint32_t{p[2]} << 8) | p[3];
+}
+
+uint32_t readLE24(const uint8_t* p)
+{
+    return uint32_t{p[0]} | (uint32_t{p[1]} << 8) | (uint32_t{p[2]} << 16);
+}
+
+bool readJpegSize(std::ifstream& file, cv::Size& size)
+{
+    // Walk the segments until a Start Of Frame marker is found
+    uint8_t buf[8];
+    file.seekg(2);
+    while (file.read(reinterpret_cast<char*>(buf), 2))
+    {
+        if (buf[0] != 0xFF)
+        {
+            return false;
+        }
+        uint8_t marker {buf[1]};
+        while (marker == 0xFF)  // fill bytes
+        {
+            if (!file.read(reinterpret_cast<char*>(&marker), 1))
+                return false;
+        }
+        if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+        {
+            continue;  // standalone markers, no payload
+        }
+        if (!file.read(reinterpret_cast<char*>(buf), 2))
+        {
+            return false;
+        }
+        const uint32_t length {readBE16(buf)};
+        const bool is_sof {marker >= 0xC0 && marker <= 0xCF &&
+                           marker != 0xC4 && marker != 0xC8 && marker != 0xCC};
+        if (is_sof)
+        {
+            // precision (1 byte), height (2 bytes), width (2 bytes)
+            if (!file.read(reinterpret_cast<char*>(buf), 5))
+                return false;
+            size = cv::Size(static_cast<int>(readBE16(buf + 3)), static_cast<int>(readBE16(buf + 1)));
+            return true;
+        }
+        if (length < 2)
+        {
+            return false;
+        }
+        file.seekg(length - 2, std::ios::cur);
+    }
+    return false;
+}
+
+} // namespace
+
+bool readImageSize(const std::string& img_path, cv::Size& size)
+{
+    std::ifstream file {img_path, std::ios::binary};
+    uint8_t hdr[32] {};
+    if (!file.read(reinterpret_cast<char*>(hdr), sizeof(hdr)))
+    {
+        return false;
+    }
+
+    static const uint8_t png_signature[8] {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    if (std::memcmp(hdr, png_signature, 8) == 0 && std::memcmp(hdr + 12, "IHDR", 4) == 0)
+    {
+        size = cv::Size(static_cast<int>(readBE32(hdr + 16)), static_cast<int>(readBE32(hdr + 20)));
+        return true;
+    }
+    if (hdr[0] == 0xFF && hdr[1] == 0xD8)
+    {
+        return readJpegSize(file, size);
+    }
+    if (std::memcmp(hdr, "RIFF", 4) == 0 && std::memcmp(hdr + 8, "WEBP", 4) == 0)
+    {
+        if (std::memcmp(hdr + 12, "VP8 ", 4) == 0)  // lossy
+        {
+            size = cv::Size(static_cast<int>((hdr[26] | (hdr[27] << 8)) & 0x3FFF),
+                            static_cast<int>((hdr[28] | (hdr[29] << 8)) & 0x3FFF));
+            return true;
+        }
+        if (std::memcmp(hdr + 12, "VP8L", 4) == 0)  // lossless
+        {
+            const uint8_t* b {hdr + 21};
+            size = cv::Size(static_cast<int>(1 + (b[0] | ((b[1] & 0x3F) << 8))),
+                            static_cast<int>(1 + ((b[1] >> 6) | (b[2] << 2) | ((b[3] & 0x0F) << 10))));
+            return true;
+        }
+        if (std::memcmp(hdr + 12, "VP8X", 4) == 0)  // extended
+        {
+            size = cv::Size(static_cast<int>(1 + readLE24(hdr + 24)), static_cast<int>(1 + readLE24(hdr + 27)));
+            return true;
+        }
+    }
+    return false;
+}
+
+cv::Size cappedSize(const cv::Size size, const DecodeOptions& opts)
+{
+    double scale {1.0};
+    if (opts.max_side > 0)
+    {
+        scale = std::min(scale, static_cast<double>(opts.max_side) / std::max(size.width, size.height));
+    }
+    if (opts.max_area > 0.0)
+    {
+        scale = std::min(scale, std::sqrt(opts.max_area / (static_cast<double>(size.width) * size.height)));
+    }
+    if (scale >= 1.0)
+    {
+        return size;
+    }
+    return cv::Size(std::max(1, static_cast<int>(std::lround(size.width * scale))),
+                    std::max(1, static_cast<int>(std::lround(size.height * scale))));
+}
+
+bool decodeImage(
+    const std::string& img_path,
+    cv::Mat_<cv::Vec3b>& img_color,
+    cv::Mat_<uchar>& img_gray,
+    const DecodeOptions& opts
+)
+{
+    int flags {cv::IMREAD_COLOR};
+    cv::Size file_size;
+    if (opts.enabled() && readImageSize(img_path, file_size) && !file_size.empty())
+    {
+        // Largest power-of-two reduction that still yields at least the capped size
+        const cv::Size target {cappedSize(file_size, opts)};
+        const double ratio {static_cast<double>(file_size.width) / target.width};
+        if (ratio >= 8.0)
+            flags = cv::IMREAD_REDUCED_COLOR_8;
+        else if (ratio >= 4.0)
+            flags = cv::IMREAD_REDUCED_COLOR_4;
+        else if (ratio >= 2.0)
+            flags = cv::IMREAD_REDUCED_COLOR_2;
+    }
+
+    img_color = cv::imread(img_path, flags);
+    if (img_color.empty())
+    {
+        return false;
+    }
+    if (opts.enabled())
+    {
+        // Computed on the decoded image, which may have been rotated (EXIF orientation)
+        const cv::Size target {cappedSize(img_color.size(), opts)};
+        if (target != img_color.size())
+        {
+            cv::Mat_<cv::Vec3b> resized;
+            cv::resize(img_color, resized, target, 0, 0, cv::INTER_AREA);
+            img_color = resized;
+        }
+    }
+    cv::cvtColor(img_color, img_gray, cv::COLOR_BGR2GRAY);
+    return !img_gray.empty();
+}
@@ -0,0 +1,121 @@
+// Author: Marco Carraro
+
+#include "labelled_descriptors.h"
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+namespace {
+
+std::atomic<double> ratioTest(0.0);
+
+} // namespace
+
+cv::Mat stackDescriptors(const std::vector<cv::Mat>& blocks)
+{
+    int rows = 0;
+    for (const auto& block : blocks) {
+        rows += block.rows;
+    }
+    if (rows == 0) {
+        return cv::Mat();
+    }
+
+    cv::Mat stacked;
+    int row = 0;
+    for (const auto& block : blocks) {
+        if (block.empty()) {
+            continue;
+        }
+        if (stacked.empty()) {
+            stacked.create(rows, block.cols, block.type());
+        }
+        CV_Assert(block.cols == stacked.cols && block.type() == stacked.type());
+        block.copyTo(stacked.rowRange(row, row + block.rows));
+        row += block.rows;
+    }
+
+    return stacked;
+}
+
+void buildLabelledDescriptors(
+    const std::map<FlowerType, cv::Mat>& train_descriptors,
+    LabelledDescriptors& labelled)
+{
+    labelled.descriptors.release();
+    labelled.labels.clear();
+    labelled.matcher.reset();
+
+    std::vector<cv::Mat> class_descriptors;
+    for (const auto& [flower_type, train_desc] : train_descriptors) {
+        if (!train_desc.empty()) {
+            class_descriptors.push_back(train_desc);
+            labelled.labels.insert(labelled.labels.end(), train_desc.rows, flower_type);
+        }
+    }
+
+    labelled.descriptors = stackDescriptors(class_descriptors);
+}
+
+void trainLabelledMatcher(LabelledDescriptors& labelled)
+{
+    labelled.matcher.reset();
+    if (labelled.descriptors.empty()) {
+        return;
+    }
+
+    labelled.matcher = cv::FlannBasedMatcher::create();
+    labelled.matcher->add(std::vector<cv::Mat>{labelled.descriptors});
+    labelled.matcher->train();
+}
+
+FlowerType mostVoted(const ClassVotes& votes)
+{
+    // Classes are visited in order: only a strictly larger count replaces the best one
+    FlowerType predicted_type = FlowerType::NoFlower;
+    int max_votes = 0;
+    for (size_t c = 0; c < votes.size(); c++) {
+        if (votes[c] > max_votes) {
+            max_votes = votes[c];
+            predicted_type = static_cast<FlowerType>(c);
+        }
+    }
+
+    return predicted_type;
+}
+
+FlowerType voteClasses(
+    const std::vector<cv::DMatch>& matches,
+    const std::vector<FlowerType>& labels,
+    double threshold)
+{
+    // Minimum distance of every class; a class without matches keeps the largest value, and gets no votes
+    std::array<double, num_classes> min_distance;
+    min_distance.fill(std::numeric_limits<double>::max());
+    for (const auto& match : matches) {
+        double& class_min = min_distance[static_cast<size_t>(labels[match.trainIdx])];
+        class_min = std::min(class_min, static_cast<double>(match.distance));
+    }
+
+    // A single match at distance 0 only silences its own class, as it did when the classes were matched one by one
+    ClassVotes votes{};
+    for (const auto& match : matches) {
+        const size_t c = static_cast<size_t>(labels[match.trainIdx]);
+        if (match.distance < threshold * min_distance[c]) {
+            votes[c]++;
+        }
+    }
+
+    return mostVoted(votes);
+}
+
+void setRatioTest(double ratio)
+{
+    CV_Assert(ratio >= 0.0 && ratio <= 1.0);
+    ratioTest.store(ratio);
+}
+
+double getRatioTest()
+{
+    return ratioTest.load();
+}
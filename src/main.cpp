@@ -1,5 +1,8 @@
 #include <iostream>
 #include <filesystem>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
@@ -10,8 +13,15 @@
 #include <flower_image_container.hpp>
 #include <flower_template.hpp>
 #include <preprocessing.hpp>
+#include <dataset_pack.hpp>
+#include <prefetch_pipeline.hpp>
+#include <feature_cache.hpp>
+#include <thread_pool.hpp>
 #include <template_match.hpp>
+#include <tm_workspace.hpp>
 #include <matching.h>
+#include <classifier_models.hpp>
+#include <watch_mode.hpp>
 #include <sift_processing.h>
 #include <orb_processing.h>
 
@@ -24,6 +34,37 @@ using std::cout;
 using std::cerr;
 using std::endl;
 
+namespace
+{
+
+// Parses a comma-separated list of positive integers (e.g. "1200,800")
+bool parseSides(const std::string& list, std::vector<int>& sides)
+{
+    sides.clear();
+    std::istringstream stream {list};
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        try
+        {
+            size_t parsed {0};
+            const int side {std::stoi(item, &parsed)};
+            if (side <= 0 || item.find_first_not_of(' ', parsed) != std::string::npos)
+            {
+                return false;
+            }
+            sides.push_back(side);
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+    }
+    return !sides.empty();
+}
+
+} // namespace
+
 int main(int argc, char *argv[])
 {
     // Preprocessing --> Luca
@@ -31,6 +72,32 @@ int main(int argc, char *argv[])
     const std::string parser_keys {
         "{help h ? | | print this message}"
         "{@path    | | path of the train/test dataset}"
+        "{threads  |0| number of threads used to decode images, train and classify (0 = all hardware threads)}"
+        "{pack     | | decode the dataset, write it to the given pack file and exit}"
+        "{from-pack| | load the decoded images from the given pack file (written with --pack)}"
+        "{max-side |0| downscale images at load time so that their longest side is at most the given size (0 = no limit)}"
+        "{max-mpix |0| downscale images at load time to at most the given number of megapixels (0 = no limit)}"
+        "{cache-mb |0| decode images on demand, keeping at most the given MiB of decoded pixels per image set (0 = decode everything up front)}"
+        "{prefetch |2| with --cache-mb, number of images decoded ahead of the one being classified (0 = no prefetching)}"
+        "{feature-cache| | directory of the persistent cache of features extracted from train images (disabled if empty)}"
+        "{orb-matcher|mih| ORB matching: mih (multi-index hashing), simd (brute force, SIMD Hamming kernel) or bf (cv::BFMatcher)}"
+        "{ratio-test|0| SIFT, SURF and ORB: keep the matches that pass Lowe's ratio test with the given ratio (e.g. 0.8), instead of the ones under threshold * minimum distance (0 = off)}"
+        "{save-model| | save the trained classifiers to the given snapshot file (e.g. model.yml.gz)}"
+        "{load-model| | load the trained classifiers from the given snapshot file, instead of training them}"
+        "{tm-method|ccorr| template matching score: ccorr (masked TM_CCORR_NORMED) or sqdiff (masked TM_SQDIFF_NORMED, integer engine; requires --tm-levels)}"
+        "{tm-levels|0| template matching: branch and bound on blocks of 2^N x 2^N positions, bounded from N pyramid levels down (0 = exhaustive search); exact, but scores most of the positions anyway}"
+        "{tm-top-k |5| template matching with --tm-eigen: number of peaks of every reconstructed map scored again exactly}"
+        "{tm-eigen |0| template matching: compress the templates of every class to the given number of eigen-templates (0 = no compression)}"
+        "{tm-fourier-mellin| | template matching: estimate scale and rotation of every template (log-polar phase correlation), instead of searching every scale}"
+        "{tm-fm-poses|1| template matching: candidate poses verified per template, with --tm-fourier-mellin}"
+        "{tm-verify| | template matching: also run the exhaustive search, and report how often the coarse-to-fine (or eigen-template) maximum differs}"
+        "{tm-scales|1200,800| template matching: longest side of every scale at which test images are searched, comma-separated}"
+        "{tm-prune | | template matching (lossy): skip the (class, scale) pairs whose coarse score suggests they cannot beat the best class; checked on every 10th test image}"
+        "{tm-prune-margin|0.05| template matching: margin added to coarse scores to estimate full resolution ones}"
+        "{tm-alloc-stats| | template matching: count the bytes of cv::Mat memory allocated while classifying every test image}"
+        "{tm-roi   | | crop every test image to the best template match of its predicted class before SIFT, SURF, ORB, HOG and BoW}"
+        "{tm-roi-margin|0.25| margin added to every side of the template matching crop, as a fraction of the match size}"
+        "{watch    | | train once, then classify every new image written to the given directory (until Ctrl+C)}"
     };
     cv::CommandLineParser parser {argc, argv, parser_keys};
     const std::string about_text {"flower_detector 0.1"};
@@ -42,7 +109,97 @@ int main(int argc, char *argv[])
         return 0;
     }
 
+    if (parser.has("tm-alloc-stats"))
+    {
+        TMWorkspace::countAllocations();  // before any other thread uses OpenCV
+    }
+
     std::string data_path_str = parser.get<std::string>("@path");
+    const int num_threads = parser.get<int>("threads");
+    if (num_threads < 0)
+    {
+        cerr << "Invalid number of threads: " << num_threads << endl;
+        return 1;
+    }
+    ThreadPool::setNumThreads(static_cast<size_t>(num_threads));
+    const int prefetch_depth = parser.get<int>("prefetch");
+    if (prefetch_depth < 0)
+    {
+        cerr << "Invalid prefetch depth: " << prefetch_depth << endl;
+        return 1;
+    }
+    setPrefetchDepth(static_cast<size_t>(prefetch_depth));
+    const std::string feature_cache_dir {parser.get<std::string>("feature-cache")};
+    if (!feature_cache_dir.empty() && !setFeatureCacheDir(feature_cache_dir))
+    {
+        return 1;
+    }
+    const std::string orb_matcher {parser.get<std::string>("orb-matcher")};
+    if (orb_matcher == "mih")
+    {
+        ORBExtractor::setMatcherType(ORBExtractor::MatcherType::MultiIndexHashing);
+    }
+    else if (orb_matcher == "simd")
+    {
+        ORBExtractor::setMatcherType(ORBExtractor::MatcherType::Hamming);
+    }
+    else if (orb_matcher == "bf")
+    {
+        ORBExtractor::setMatcherType(ORBExtractor::MatcherType::BruteForce);
+    }
+    else
+    {
+        cerr << "Invalid ORB matcher: " << orb_matcher << endl;
+        return 1;
+    }
+    const double ratio_test {parser.get<double>("ratio-test")};
+    if (ratio_test < 0.0 || ratio_test > 1.0)
+    {
+        cerr << "Invalid ratio test: " << ratio_test << " (must be in [0, 1])" << endl;
+        return 1;
+    }
+    setRatioTest(ratio_test);
+    TMSearchOptions tm_search_opts;
+    const std::string tm_method {parser.get<std::string>("tm-method")};
+    if (tm_method != "ccorr" && tm_method != "sqdiff")
+    {
+        cerr << "Invalid template matching method: " << tm_method << endl;
+        return 1;
+    }
+    tm_search_opts.method = (tm_method == "sqdiff") ? cv::TM_SQDIFF_NORMED : cv::TM_CCORR_NORMED;
+    tm_search_opts.pyramid_levels = parser.get<int>("tm-levels");
+    tm_search_opts.top_k = parser.get<int>("tm-top-k");
+    tm_search_opts.eigen_templates = parser.get<int>("tm-eigen");
+    tm_search_opts.fourier_mellin = parser.has("tm-fourier-mellin");
+    tm_search_opts.fm_poses = parser.get<int>("tm-fm-poses");
+    tm_search_opts.verify = parser.has("tm-verify");
+    tm_search_opts.prune = parser.has("tm-prune");
+    tm_search_opts.prune_margin = parser.get<double>("tm-prune-margin");
+    if (tm_search_opts.pyramid_levels < 0 || tm_search_opts.top_k < 1 || tm_search_opts.eigen_templates < 0 ||
+        tm_search_opts.fm_poses < 1 || tm_search_opts.prune_margin < 0.0 ||
+        !parseSides(parser.get<std::string>("tm-scales"), tm_search_opts.scales))
+    {
+        cerr << "Invalid template matching search options" << endl;
+        return 1;
+    }
+    if (tm_search_opts.method == cv::TM_SQDIFF_NORMED && tm_search_opts.pyramid_levels == 0)
+    {
+        // The exhaustive search would score every full resolution position in the spatial domain
+        cerr << "--tm-method=sqdiff requires the coarse-to-fine search: set --tm-levels to 1 or more" << endl;
+        return 1;
+    }
+    if (tm_search_opts.method == cv::TM_SQDIFF_NORMED && tm_search_opts.fourier_mellin)
+    {
+        cerr << "--tm-method=sqdiff does not apply to --tm-fourier-mellin" << endl;
+        return 1;
+    }
+    const bool tm_roi {parser.has("tm-roi")};
+    const double tm_roi_margin {parser.get<double>("tm-roi-margin")};
+    if (tm_roi_margin < 0.0)
+    {
+        cerr << "Invalid template matching crop margin: " << tm_roi_margin << endl;
+        return 1;
+    }
     if (data_path_str.empty())
     {
         cout << "No path to specified. Using default ('../Final_project_proposal/')" << endl;
@@ -87,34 +244,141 @@ int main(int argc, char *argv[])
     cout << "Valid path. Loading images..." << endl;
 
     // Load images
+    // The pack (if any) must outlive the images, whose pixels live in the mapped file
+    DatasetPack dataset_pack;
     FlowerImageContainer test_images;
     FlowerImageContainer train_healthy_images;
     FlowerImageContainer train_diseased_images;
 
+    const std::string from_pack_path {parser.get<std::string>("from-pack")};
+    const std::string pack_path {parser.get<std::string>("pack")};
+    const std::string load_model_path {parser.get<std::string>("load-model")};
+    const std::string save_model_path {parser.get<std::string>("save-model")};
+    const std::string watch_dir {parser.get<std::string>("watch")};
+    const int cache_mb {parser.get<int>("cache-mb")};
+    if (cache_mb < 0)
+    {
+        cerr << "Invalid cache size: " << cache_mb << endl;
+        return 1;
+    }
+    DecodeOptions decode_opts;
+    decode_opts.max_side = parser.get<int>("max-side");
+    decode_opts.max_area = parser.get<double>("max-mpix") * 1e6;
+    if (decode_opts.max_side < 0 || decode_opts.max_area < 0.0)
+    {
+        cerr << "Invalid resolution cap" << endl;
+        return 1;
+    }
+    if (cache_mb > 0 && from_pack_path.empty())
+    {
+        const size_t budget_bytes {static_cast<size_t>(cache_mb) * 1024 * 1024};
+        test_images.setLazy(budget_bytes, decode_opts);
+        train_healthy_images.setLazy(budget_bytes, decode_opts);
+        train_diseased_images.setLazy(budget_bytes, decode_opts);
+    }
+    if (!from_pack_path.empty())
+    {
+        cout << "Loading images from pack: " << from_pack_path << endl;
+        if (!dataset_pack.open(from_pack_path) ||
+            !dataset_pack.load(test_images, train_healthy_images, train_diseased_images))
+        {
+            cerr << "Error loading images from pack. Aborting." << endl;
+            return 1;
+        }
+    }
+    else if (!watch_dir.empty() && pack_path.empty())
+    {
+        // Watch mode: test images are not needed, and train images only if the models must be trained
+        if (load_model_path.empty() &&
+            (!loadImagesFromDataset(data_path / "train_healthy_photos", true, 0, train_healthy_images, decode_opts) ||
+             !loadImagesFromDataset(data_path / "train_diseased_photos", false, 0, train_diseased_images, decode_opts)))
+        {
+            cerr << "Error loading images. Aborting." << endl;
+            return 1;
+        }
+    }
+    else if (!load_model_path.empty() && pack_path.empty())
+    {
+        // Inference only: train images are not needed
+        if (!loadImagesFromDataset(data_path / "test_photos", true, 1, test_images, decode_opts))
+        {
+            cerr << "Error loading images. Aborting." << endl;
+            return 1;
+        }
+    }
     // CV_Assert(load_images(test_images, train_healthy_images, train_diseased_images));
-    if (!loadImages(data_path, test_images, train_healthy_images, train_diseased_images))
+    else if (!loadImages(data_path, test_images, train_healthy_images, train_diseased_images, decode_opts))
     {
         cerr << "Error loading images. Aborting." << endl;
         return 1;
     }
     cout << "Images loaded successfully!" << endl;
 
-    // Load template images
+    if (!pack_path.empty())
+    {
+        if (!writeDatasetPack(pack_path, test_images, train_healthy_images, train_diseased_images))
+        {
+            cerr << "Error writing pack file. Aborting." << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Load template images (from the model snapshot, if any)
+    // and trained classifiers (when they are needed outside of the batch wrappers)
+    ClassifierModels models;
+    models.tm_search = tm_search_opts;
+    bool pretrained {false};
     std::vector<FlowerTemplate> daisy_templates;
     std::vector<FlowerTemplate> dandelion_templates;
     std::vector<FlowerTemplate> rose_templates;
     std::vector<FlowerTemplate> sunflower_templates;
     std::vector<FlowerTemplate> tulip_templates;
-    bool templates_loaded = loadTemplates(
-        data_path,
-        daisy_templates, dandelion_templates, rose_templates, sunflower_templates, tulip_templates
-        );
-    if (!templates_loaded)
+    if (!load_model_path.empty())
     {
-        cerr << "Error loading templates. Aborting." << endl;
-        return 1;
+        if (!loadClassifierModels(load_model_path, models))
+        {
+            cerr << "Error loading model snapshot. Aborting." << endl;
+            return 1;
+        }
+        pretrained = true;
+        daisy_templates = models.templates[static_cast<size_t>(FlowerType::Daisy)];
+        dandelion_templates = models.templates[static_cast<size_t>(FlowerType::Dandelion)];
+        rose_templates = models.templates[static_cast<size_t>(FlowerType::Rose)];
+        sunflower_templates = models.templates[static_cast<size_t>(FlowerType::Sunflower)];
+        tulip_templates = models.templates[static_cast<size_t>(FlowerType::Tulip)];
+    }
+    else
+    {
+        bool templates_loaded = loadTemplates(
+            data_path,
+            daisy_templates, dandelion_templates, rose_templates, sunflower_templates, tulip_templates
+            );
+        if (!templates_loaded)
+        {
+            cerr << "Error loading templates. Aborting." << endl;
+            return 1;
+        }
+        cout << "Templates loaded successfully!" << endl;
+
+        if (!save_model_path.empty() || !watch_dir.empty())
+        {
+            const TemplateBank templates {
+                daisy_templates, dandelion_templates, rose_templates, sunflower_templates, tulip_templates
+            };
+            if (!trainClassifierModels(train_healthy_images, train_diseased_images, templates, models))
+            {
+                cerr << "Error training classifiers. Aborting." << endl;
+                return 1;
+            }
+            pretrained = true;
+            if (!save_model_path.empty() && !saveClassifierModels(save_model_path, models))
+            {
+                cerr << "Error saving model snapshot. Aborting." << endl;
+                return 1;
+            }
+        }
     }
-    cout << "Templates loaded successfully!" << endl;
 
     // Create results directory if it doesn't exist
     const fs::path output_dir {"../results"};
@@ -131,45 +395,106 @@ int main(int argc, char *argv[])
         cout << "\nOutput directory " << output_dir.string() << " already exists" << endl;
     }
 
-
-    // Processing - SIFT --> Marco
-    sift(test_images, train_healthy_images, train_diseased_images, output_dir.string());
-
-
-    // Processing - SURF --> Marco
-    #ifdef ENABLE_SURF
+    // Streaming mode: keep the trained models in memory and classify new images as they land
+    if (!watch_dir.empty())
     {
-        surf(test_images, train_healthy_images, train_diseased_images, output_dir.string());
-    } 
-    #else
-        cout << "\nSURF is disabled. To enable, recompile with -DCONFIG_ENABLE_SURF=ON \n" << endl;
-    #endif
+        if (!fs::is_directory(watch_dir))
+        {
+            cerr << "Invalid watch directory: " << watch_dir << endl;
+            return 1;
+        }
+        return watchDirectory(watch_dir, models, output_dir / "watch_recap.txt", decode_opts) ? 0 : 1;
+    }
+
 
-    
-    // Processing - ORB --> Marco
-    orb(test_images, train_healthy_images, train_diseased_images, output_dir.string());
-    
     // Processing - Template Matching --> Luca
+    // Runs first, so that its matches can restrict the other methods to the flower
     bool tm_success {false};
+    std::vector<cv::Rect> tm_rois;
     template_match(
         test_images,
         daisy_templates, dandelion_templates, rose_templates, sunflower_templates, tulip_templates,
         output_dir,
-        tm_success
+        tm_search_opts,
+        tm_success,
+        tm_roi ? &tm_rois : nullptr
     );
 
     if (!tm_success)
     {
         cerr << "Template Matching classifier failed!\n" << endl;
     }
+
+    FlowerImageContainer cropped_test_images;
+    if (tm_roi && tm_success)
+    {
+        const double kept {cropImages(test_images, tm_rois, tm_roi_margin, cropped_test_images)};
+        cout << "\nTest images cropped to their template matching regions: "
+             << 100.0 * kept << "% of the pixels kept" << endl;
+    }
+    else if (tm_roi)
+    {
+        cerr << "Test images are not cropped" << endl;
+    }
+    // Test images seen by the feature-based methods
+    const FlowerImageContainer& feature_test_images {cropped_test_images.empty() ? test_images : cropped_test_images};
+
+
+    // Processing - SIFT --> Marco
+    sift(feature_test_images, train_healthy_images, train_diseased_images, output_dir.string(),
+         pretrained ? &models.sift_descriptors : nullptr);
+
+
+    // Processing - SURF --> Marco
+    #ifdef ENABLE_SURF
+    {
+        surf(feature_test_images, train_healthy_images, train_diseased_images, output_dir.string(),
+             pretrained ? &models.surf_descriptors : nullptr);
+    } 
+    #else
+        cout << "\nSURF is disabled. To enable, recompile with -DCONFIG_ENABLE_SURF=ON \n" << endl;
+    #endif
+
+    
+    // Processing - ORB --> Marco
+    orb(feature_test_images, train_healthy_images, train_diseased_images, output_dir.string(),
+        pretrained ? &models.orb_descriptors : nullptr);
   
     // Processing - HOG --> Francesco
   
-    hog(test_images, train_healthy_images, train_diseased_images, output_dir.string());
+    hog(feature_test_images, train_healthy_images, train_diseased_images, output_dir.string(),
+        pretrained ? &models.hog : nullptr);
   
     // Processing - BOW --> Francesco
   
-    bow(test_images, train_healthy_images, train_diseased_images, output_dir.string());
+    bow(feature_test_images, train_healthy_images, train_diseased_images, output_dir.string(),
+        (pretrained && models.bow_trained) ? &models.bow : nullptr);
+
+    if (featureCacheEnabled())
+    {
+        const FeatureCacheStats stats {featureCacheStats()};
+        cout << "\nFeature cache: hits " << stats.hits
+             << " | misses " << stats.misses
+             << " | stored " << stats.stores << endl;
+    }
+
+    if (test_images.isLazy())
+    {
+        cout << "\nImage cache statistics:" << endl;
+        const std::vector<std::pair<std::string, const FlowerImageContainer*>> image_sets {
+            {"test", &test_images},
+            {"train healthy", &train_healthy_images},
+            {"train diseased", &train_diseased_images}
+        };
+        for (const auto& [set_name, images] : image_sets)
+        {
+            const ImageCacheStats stats {images->cacheStats()};
+            cout << set_name << ": hits " << stats.hits
+                 << " | misses " << stats.misses
+                 << " | evictions " << stats.evictions
+                 << " | resident " << stats.resident_bytes / (1024 * 1024) << " MiB" << endl;
+        }
+    }
 
     return 0;
 }
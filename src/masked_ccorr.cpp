@@ -0,0 +1,196 @@
+// Author: Luca Pellegrini
+#include <masked_ccorr.hpp>
+
+#include <atomic>
+#include <cmath>
+#include <vector>
+#include <opencv2/imgproc.hpp>
+
+namespace
+{
+
+std::atomic<MaskedCCorr::Isa>& selectedIsa()
+{
+    static std::atomic<MaskedCCorr::Isa> isa {MaskedCCorr::bestIsa()};
+    return isa;
+}
+
+bool isSupported(const MaskedCCorr::Isa isa)
+{
+    switch (isa)
+    {
+    case MaskedCCorr::Isa::Scalar:
+        return true;
+    case MaskedCCorr::Isa::AVX2:
+#ifdef TM_SIMD_AVX2
+        return cv::checkHardwareSupport(cv::CPU_AVX2);
+#else
+        return false;
+#endif
+    case MaskedCCorr::Isa::AVX512:
+#ifdef TM_SIMD_AVX512
+        return cv::checkHardwareSupport(cv::CPU_AVX_512F) && cv::checkHardwareSupport(cv::CPU_AVX_512BW) &&
+               cv::checkHardwareSupport(cv::CPU_AVX_512VL);
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+MaskedCCorrSums runKernel(const MaskedCCorr::Isa isa, const uchar* image, const size_t image_step,
+                          const uchar* masked_templ, const uchar* mask, const size_t templ_step,
+                          const int rows, const int row_bytes)
+{
+    switch (isa)
+    {
+#ifdef TM_SIMD_AVX512
+    case MaskedCCorr::Isa::AVX512:
+        return maskedCCorrAVX512(image, image_step, masked_templ, mask, templ_step, rows, row_bytes);
+#endif
+#ifdef TM_SIMD_AVX2
+    case MaskedCCorr::Isa::AVX2:
+        return maskedCCorrAVX2(image, image_step, masked_templ, mask, templ_step, rows, row_bytes);
+#endif
+    default:
+        return maskedCCorrScalar(image, image_step, masked_templ, mask, templ_step, rows, row_bytes);
+    }
+}
+
+} // namespace
+
+MaskedCCorrSums maskedCCorrScalar(const uchar* image, const size_t image_step,
+                                  const uchar* masked_templ, const uchar* mask, const size_t templ_step,
+                                  const int rows, const int row_bytes)
+{
+    MaskedCCorrSums sums;
+    for (int r {0}; r < rows; r++)
+    {
+        const uchar* img {image + r * image_step};
+        const uchar* templ {masked_templ + r * templ_step};
+        const uchar* m {mask + r * templ_step};
+        int32_t row_correlation {0};
+        int32_t row_energy {0};
+        for (int i {0}; i < row_bytes; i++)
+        {
+            const int32_t value {img[i]};
+            const int32_t masked_value {img[i] & m[i]};
+            row_correlation += value * templ[i];
+            row_energy += masked_value * masked_value;
+        }
+        sums.correlation += row_correlation;
+        sums.patch_energy += row_energy;
+    }
+    return sums;
+}
+
+MaskedCCorr::MaskedCCorr(const cv::Mat_<cv::Vec3b>& templ, const cv::Mat_<uchar>& mask)
+{
+    if (templ.empty() || mask.size() != templ.size())
+    {
+        return;
+    }
+    CV_Assert(3 * templ.cols <= max_row_bytes);
+
+    cv::Mat_<uchar> binary_mask;
+    cv::threshold(mask, binary_mask, 0, 255, cv::THRESH_BINARY);
+    cv::merge(std::vector<cv::Mat>{binary_mask, binary_mask, binary_mask}, m_mask);
+    cv::bitwise_and(templ, m_mask, m_masked_templ);
+    for (int r {0}; r < m_masked_templ.rows; r++)
+    {
+        const uchar* row {m_masked_templ.ptr<uchar>(r)};
+        for (int i {0}; i < 3 * m_masked_templ.cols; i++)
+        {
+            m_energy += row[i] * row[i];
+        }
+    }
+}
+
+bool MaskedCCorr::empty() const
+{
+    return m_masked_templ.empty();
+}
+
+cv::Size MaskedCCorr::size() const
+{
+    return m_masked_templ.size();
+}
+
+double MaskedCCorr::scoreAt(const cv::Mat_<cv::Vec3b>& image, const cv::Point pos) const
+{
+    CV_DbgAssert(pos.x >= 0 && pos.y >= 0 && pos.x + m_masked_templ.cols <= image.cols &&
+                 pos.y + m_masked_templ.rows <= image.rows);
+    if (m_energy == 0)
+    {
+        return 0.0;
+    }
+    const MaskedCCorrSums sums {runKernel(isa(), image.ptr<uchar>(pos.y) + 3 * pos.x, image.step,
+                                          m_masked_templ.ptr<uchar>(), m_mask.ptr<uchar>(), m_masked_templ.step,
+                                          m_masked_templ.rows, 3 * m_masked_templ.cols)};
+    if (sums.patch_energy == 0)
+    {
+        return 0.0;
+    }
+    return static_cast<double>(sums.correlation) /
+        std::sqrt(static_cast<double>(sums.patch_energy) * static_cast<double>(m_energy));
+}
+
+void MaskedCCorr::match(const cv::Mat_<cv::Vec3b>& image, cv::Mat_<float>& result) const
+{
+    const cv::Size result_size {image.cols - m_masked_templ.cols + 1, image.rows - m_masked_templ.rows + 1};
+    if (empty() || result_size.width <= 0 || result_size.height <= 0)
+    {
+        result.release();
+        return;
+    }
+    result.create(result_size);
+    for (int y {0}; y < result.rows; y++)
+    {
+        float* out {result.ptr<float>(y)};
+        for (int x {0}; x < result.cols; x++)
+        {
+            out[x] = static_cast<float>(scoreAt(image, cv::Point{x, y}));
+        }
+    }
+}
+
+MaskedCCorr::Isa MaskedCCorr::isa()
+{
+    return selectedIsa().load(std::memory_order_relaxed);
+}
+
+MaskedCCorr::Isa MaskedCCorr::bestIsa()
+{
+    for (const Isa isa : {Isa::AVX512, Isa::AVX2})
+    {
+        if (isSupported(isa))
+        {
+            return isa;
+        }
+    }
+    return Isa::Scalar;
+}
+
+bool MaskedCCorr::setIsa(const Isa isa)
+{
+    if (!isSupported(isa))
+    {
+        return false;
+    }
+    selectedIsa().store(isa, std::memory_order_relaxed);
+    return true;
+}
+
+const char* MaskedCCorr::isaName(const Isa isa)
+{
+    switch (isa)
+    {
+    case Isa::Scalar:
+        return "scalar";
+    case Isa::AVX2:
+        return "AVX2";
+    case Isa::AVX512:
+        return "AVX-512";
+    }
+    return "unknown";
+}
@@ -0,0 +1,77 @@
+// Author: Luca Pellegrini
+// Compiled with AVX2 enabled: only called after checking that the CPU supports it
+#include <masked_ccorr.hpp>
+
+#include <immintrin.h>
+
+namespace
+{
+
+int32_t horizontalSum(const __m256i v)
+{
+    __m128i sum {_mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1))};
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+
+// Accumulates 16 bytes: pixel values are widened to 16 bits, and every
+// `_mm256_madd_epi16()` adds up pairs of products (at most 2 * 255 * 255) into 32 bits
+inline void accumulate16(const __m128i img, const __m128i templ, const __m128i mask,
+                         __m256i& correlation, __m256i& energy)
+{
+    const __m256i img16 {_mm256_cvtepu8_epi16(img)};
+    const __m256i masked16 {_mm256_cvtepu8_epi16(_mm_and_si128(img, mask))};
+    correlation = _mm256_add_epi32(correlation, _mm256_madd_epi16(img16, _mm256_cvtepu8_epi16(templ)));
+    energy = _mm256_add_epi32(energy, _mm256_madd_epi16(masked16, masked16));
+}
+
+} // namespace
+
+MaskedCCorrSums maskedCCorrAVX2(const uchar* image, const size_t image_step,
+                                const uchar* masked_templ, const uchar* mask, const size_t templ_step,
+                                const int rows, const int row_bytes)
+{
+    MaskedCCorrSums sums;
+    for (int r {0}; r < rows; r++)
+    {
+        const uchar* img {image + r * image_step};
+        const uchar* templ {masked_templ + r * templ_step};
+        const uchar* m {mask + r * templ_step};
+        // Two pairs of accumulators, so that consecutive iterations do not wait for each other
+        __m256i correlation[2] {_mm256_setzero_si256(), _mm256_setzero_si256()};
+        __m256i energy[2] {_mm256_setzero_si256(), _mm256_setzero_si256()};
+        int i {0};
+        for (; i + 32 <= row_bytes; i += 32)
+        {
+            for (int half {0}; half < 2; half++)
+            {
+                const int offset {i + 16 * half};
+                accumulate16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(img + offset)),
+                             _mm_loadu_si128(reinterpret_cast<const __m128i*>(templ + offset)),
+                             _mm_loadu_si128(reinterpret_cast<const __m128i*>(m + offset)),
+                             correlation[half], energy[half]);
+            }
+        }
+        if (i + 16 <= row_bytes)
+        {
+            accumulate16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(img + i)),
+                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(templ + i)),
+                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(m + i)),
+                         correlation[0], energy[0]);
+            i += 16;
+        }
+        int32_t row_correlation {horizontalSum(_mm256_add_epi32(correlation[0], correlation[1]))};
+        int32_t row_energy {horizontalSum(_mm256_add_epi32(energy[0], energy[1]))};
+        for (; i < row_bytes; i++)
+        {
+            const int32_t value {img[i]};
+            const int32_t masked_value {img[i] & m[i]};
+            row_correlation += value * templ[i];
+            row_energy += masked_value * masked_value;
+        }
+        sums.correlation += row_correlation;
+        sums.patch_energy += row_energy;
+    }
+    return sums;
+}
@@ -0,0 +1,54 @@
+// Author: Luca Pellegrini
+// Compiled with AVX-512 (F, BW, VL) enabled: only called after checking that the CPU supports it
+#include <masked_ccorr.hpp>
+
+#include <immintrin.h>
+
+namespace
+{
+
+// Accumulates 32 bytes (see the AVX2 kernel); `lanes` selects the bytes to load
+inline void accumulate32(const uchar* img, const uchar* templ, const uchar* mask, const __mmask32 lanes,
+                         __m512i& correlation, __m512i& energy)
+{
+    const __m256i img8 {_mm256_maskz_loadu_epi8(lanes, img)};
+    const __m256i mask8 {_mm256_maskz_loadu_epi8(lanes, mask)};
+    const __m512i img16 {_mm512_cvtepu8_epi16(img8)};
+    const __m512i masked16 {_mm512_cvtepu8_epi16(_mm256_and_si256(img8, mask8))};
+    const __m512i templ16 {_mm512_cvtepu8_epi16(_mm256_maskz_loadu_epi8(lanes, templ))};
+    correlation = _mm512_add_epi32(correlation, _mm512_madd_epi16(img16, templ16));
+    energy = _mm512_add_epi32(energy, _mm512_madd_epi16(masked16, masked16));
+}
+
+} // namespace
+
+MaskedCCorrSums maskedCCorrAVX512(const uchar* image, const size_t image_step,
+                                  const uchar* masked_templ, const uchar* mask, const size_t templ_step,
+                                  const int rows, const int row_bytes)
+{
+    MaskedCCorrSums sums;
+    for (int r {0}; r < rows; r++)
+    {
+        const uchar* img {image + r * image_step};
+        const uchar* templ {masked_templ + r * templ_step};
+        const uchar* m {mask + r * templ_step};
+        __m512i correlation[2] {_mm512_setzero_si512(), _mm512_setzero_si512()};
+        __m512i energy[2] {_mm512_setzero_si512(), _mm512_setzero_si512()};
+        int i {0};
+        for (; i + 64 <= row_bytes; i += 64)
+        {
+            accumulate32(img + i, templ + i, m + i, ~__mmask32{0}, correlation[0], energy[0]);
+            accumulate32(img + i + 32, templ + i + 32, m + i + 32, ~__mmask32{0}, correlation[1], energy[1]);
+        }
+        // The tail is loaded with masked loads, which never read past the end of the row
+        for (; i < row_bytes; i += 32)
+        {
+            const int count {row_bytes - i < 32 ? row_bytes - i : 32};
+            const __mmask32 lanes {static_cast<__mmask32>(count == 32 ? ~0u : (1u << count) - 1u)};
+            accumulate32(img + i, templ + i, m + i, lanes, correlation[0], energy[0]);
+        }
+        sums.correlation += _mm512_reduce_add_epi32(_mm512_add_epi32(correlation[0], correlation[1]));
+        sums.patch_energy += _mm512_reduce_add_epi32(_mm512_add_epi32(energy[0], energy[1]));
+    }
+    return sums;
+}
@@ -0,0 +1,472 @@
+// Author: Luca Pellegrini
+#include <masked_ncc.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <opencv2/imgproc.hpp>
+#include <tm_workspace.hpp>
+
+namespace
+{
+
+// Masked template T * M (one plane per channel) and binary mask M (0 or 1), in single precision
+void maskedPlanes(const FlowerTemplate& templ, std::vector<cv::Mat>& masked_templ, cv::Mat& mask)
+{
+    cv::Mat binary_mask;
+    cv::threshold(templ.getMask(), binary_mask, 0, 1.0, cv::THRESH_BINARY);
+    binary_mask.convertTo(mask, CV_32F);
+    cv::Mat templ_f;
+    templ.getTemplate().convertTo(templ_f, CV_32F);
+    cv::split(templ_f, masked_templ);
+    for (cv::Mat& plane : masked_templ)
+    {
+        plane = plane.mul(mask);
+    }
+}
+
+} // namespace
+
+MaskedNCC::MaskedNCC(const TemplateBank& templates, const int eigen_templates)
+{
+    // Tiles must be larger than every template
+    cv::Size max_templ {0, 0};
+    m_min_templ = cv::Size{0, 0};
+    for (const std::vector<FlowerTemplate>& class_templates : templates)
+    {
+        for (const FlowerTemplate& templ : class_templates)
+        {
+            const cv::Size size {templ.getTemplate().size()};
+            max_templ.width = std::max(max_templ.width, size.width);
+            max_templ.height = std::max(max_templ.height, size.height);
+            if (m_min_templ.area() == 0 || size.area() < m_min_templ.area())
+            {
+                m_min_templ = size;
+            }
+        }
+    }
+    if (max_templ.area() == 0)
+    {
+        return;
+    }
+    // About half of every tile is new output: the best trade-off between the
+    // cost of a DFT and the number of tiles
+    m_dft_size = cv::Size{cv::getOptimalDFTSize(2 * max_templ.width - 1),
+                          cv::getOptimalDFTSize(2 * max_templ.height - 1)};
+    m_step = cv::Size{m_dft_size.width - max_templ.width + 1, m_dft_size.height - max_templ.height + 1};
+
+    m_templates.resize(templates.size());
+    if (eigen_templates > 0)
+    {
+        m_bases.resize(templates.size());
+        for (size_t c {0}; c < templates.size(); c++)
+        {
+            compressClass(templates[c], eigen_templates, m_bases[c], m_templates[c]);
+        }
+        return;
+    }
+    for (size_t c {0}; c < templates.size(); c++)
+    {
+        for (const FlowerTemplate& templ : templates[c])
+        {
+            TemplateSpectra spectra;
+            spectra.size = templ.getTemplate().size();
+            if (spectra.size.area() == 0 || templ.getMask().size() != spectra.size)
+            {
+                // Never matches
+                m_templates[c].push_back(spectra);
+                continue;
+            }
+
+            std::vector<cv::Mat> masked_templ;
+            cv::Mat mask;
+            maskedPlanes(templ, masked_templ, mask);
+            for (size_t ch {0}; ch < 3; ch++)
+            {
+                spectra.energy += masked_templ[ch].dot(masked_templ[ch]);
+                spectra.masked_templ[ch] = forwardDFT(masked_templ[ch]);
+            }
+            spectra.mask = forwardDFT(mask);
+            m_templates[c].push_back(spectra);
+        }
+    }
+}
+
+void MaskedNCC::compressClass(const std::vector<FlowerTemplate>& class_templates, const int eigen_templates,
+                              ClassBases& bases, std::vector<TemplateSpectra>& spectra) const
+{
+    // Templates compressed together: the ones of the same size as the first one
+    std::vector<size_t> members;
+    for (size_t t {0}; t < class_templates.size(); t++)
+    {
+        const FlowerTemplate& templ {class_templates[t]};
+        spectra.push_back(TemplateSpectra{});
+        spectra.back().size = templ.getTemplate().size();
+        if (spectra.back().size.area() == 0 || templ.getMask().size() != spectra.back().size)
+        {
+            continue;  // never matches
+        }
+        if (members.empty())
+        {
+            bases.size = spectra.back().size;
+        }
+        if (spectra.back().size == bases.size)
+        {
+            members.push_back(t);
+        }
+    }
+    if (members.empty())
+    {
+        return;
+    }
+
+    // One row per template: T * M with interleaved channels, and M
+    const int pixels {bases.size.area()};
+    cv::Mat templ_data {static_cast<int>(members.size()), 3 * pixels, CV_32F};
+    cv::Mat mask_data {static_cast<int>(members.size()), pixels, CV_32F};
+    for (size_t i {0}; i < members.size(); i++)
+    {
+        std::vector<cv::Mat> masked_templ;
+        cv::Mat mask;
+        maskedPlanes(class_templates[members[i]], masked_templ, mask);
+        for (const cv::Mat& plane : masked_templ)
+        {
+            spectra[members[i]].energy += plane.dot(plane);
+        }
+        cv::Mat merged;
+        cv::merge(masked_templ, merged);
+        merged.reshape(1, 1).copyTo(templ_data.row(static_cast<int>(i)));
+        mask.reshape(1, 1).copyTo(mask_data.row(static_cast<int>(i)));
+    }
+
+    const cv::PCA templ_pca {templ_data, cv::noArray(), cv::PCA::DATA_AS_ROW, eigen_templates};
+    const cv::PCA mask_pca {mask_data, cv::noArray(), cv::PCA::DATA_AS_ROW, eigen_templates};
+    auto addTemplBasis = [this, &bases](const cv::Mat& row)
+    {
+        std::vector<cv::Mat> planes;
+        cv::split(row.reshape(3, bases.size.height), planes);
+        bases.templ.push_back({forwardDFT(planes[0]), forwardDFT(planes[1]), forwardDFT(planes[2])});
+    };
+    addTemplBasis(templ_pca.mean);
+    for (int k {0}; k < templ_pca.eigenvectors.rows; k++)
+    {
+        addTemplBasis(templ_pca.eigenvectors.row(k));
+    }
+    bases.mask.push_back(forwardDFT(mask_pca.mean.reshape(1, bases.size.height)));
+    for (int k {0}; k < mask_pca.eigenvectors.rows; k++)
+    {
+        bases.mask.push_back(forwardDFT(mask_pca.eigenvectors.row(k).reshape(1, bases.size.height)));
+    }
+
+    // Coefficients of every template; the ones of the templates left out stay 0
+    const cv::Mat templ_coeffs {templ_pca.project(templ_data)};
+    const cv::Mat mask_coeffs {mask_pca.project(mask_data)};
+    bases.templ_coeffs = cv::Mat_<float>::zeros(static_cast<int>(spectra.size()), templ_coeffs.cols);
+    bases.mask_coeffs = cv::Mat_<float>::zeros(static_cast<int>(spectra.size()), mask_coeffs.cols);
+    for (size_t i {0}; i < members.size(); i++)
+    {
+        templ_coeffs.row(static_cast<int>(i)).copyTo(bases.templ_coeffs.row(static_cast<int>(members[i])));
+        mask_coeffs.row(static_cast<int>(i)).copyTo(bases.mask_coeffs.row(static_cast<int>(members[i])));
+    }
+}
+
+bool MaskedNCC::empty() const
+{
+    return m_templates.empty();
+}
+
+bool MaskedNCC::compressed() const
+{
+    return !m_bases.empty();
+}
+
+size_t MaskedNCC::numClasses() const
+{
+    return m_templates.size();
+}
+
+size_t MaskedNCC::numTemplates(const size_t c) const
+{
+    return m_templates.at(c).size();
+}
+
+cv::Size MaskedNCC::templateSize(const size_t c, const size_t t) const
+{
+    return m_templates.at(c).at(t).size;
+}
+
+cv::Mat MaskedNCC::forwardDFT(const cv::Mat& plane) const
+{
+    cv::Mat padded;
+    cv::Mat spectrum;
+    forwardDFT(plane, padded, spectrum);
+    return spectrum;
+}
+
+void MaskedNCC::forwardDFT(const cv::Mat& plane, cv::Mat& padded, cv::Mat& spectrum) const
+{
+    // Only the padding needs zeros, the plane overwrites the rest
+    padded.create(m_dft_size, CV_32F);
+    if (plane.cols < m_dft_size.width)
+    {
+        padded(cv::Rect{plane.cols, 0, m_dft_size.width - plane.cols, plane.rows}).setTo(0);
+    }
+    if (plane.rows < m_dft_size.height)
+    {
+        padded(cv::Rect{0, plane.rows, m_dft_size.width, m_dft_size.height - plane.rows}).setTo(0);
+    }
+    plane.copyTo(padded(cv::Rect{0, 0, plane.cols, plane.rows}));
+    cv::dft(padded, spectrum, 0, plane.rows);
+}
+
+void MaskedNCC::transformImage(const cv::Mat_<cv::Vec3b>& image, ImageSpectra& spectra) const
+{
+    spectra.image_size = image.size();
+    spectra.origins.clear();
+    if (empty() || image.cols < m_min_templ.width || image.rows < m_min_templ.height)
+    {
+        return;
+    }
+
+    TMWorkspace::Scope scope;
+    TMWorkspace& workspace {scope.workspace()};
+    cv::Mat image_f {workspace.image_f.get(image.size(), CV_32FC3)};
+    image.convertTo(image_f, CV_32F);
+    std::array<cv::Mat, 4> planes;
+    for (size_t k {0}; k < planes.size(); k++)
+    {
+        planes[k] = workspace.planes[k].get(image.size(), CV_32F);
+    }
+    cv::split(image_f, planes.data());
+    cv::multiply(planes[0], planes[0], planes[3]);
+    cv::accumulateSquare(planes[1], planes[3]);
+    cv::accumulateSquare(planes[2], planes[3]);
+
+    // Tiles cover every position at which the smallest template fits in the image
+    const cv::Rect image_rect {0, 0, image.cols, image.rows};
+    for (int y {0}; y <= image.rows - m_min_templ.height; y += m_step.height)
+    {
+        for (int x {0}; x <= image.cols - m_min_templ.width; x += m_step.width)
+        {
+            const cv::Rect roi {cv::Rect{x, y, m_dft_size.width, m_dft_size.height} & image_rect};
+            if (spectra.tiles.size() == spectra.origins.size())
+            {
+                spectra.tiles.emplace_back();
+            }
+            std::array<cv::Mat, 4>& tile {spectra.tiles[spectra.origins.size()]};
+            for (size_t k {0}; k < tile.size(); k++)
+            {
+                forwardDFT(planes[k](roi), workspace.padded, tile[k]);
+            }
+            spectra.origins.push_back(roi.tl());
+        }
+    }
+}
+
+void MaskedNCC::match(const ImageSpectra& spectra, const size_t c, const size_t t, cv::Mat_<float>& result) const
+{
+    if (compressed())
+    {
+        BasisMaps maps;
+        matchBases(spectra, c, maps);
+        reconstruct(maps, c, t, result);
+        return;
+    }
+
+    const cv::Size result_size {resultSize(spectra, m_templates.at(c).at(t))};
+    if (result_size.area() == 0)
+    {
+        result.release();
+        return;
+    }
+    result.create(result_size);
+    for (size_t i {0}; i < spectra.origins.size(); i++)
+    {
+        matchTile(spectra, c, t, i, result);
+    }
+}
+
+void MaskedNCC::tileOutputs(const ImageSpectra& spectra, const size_t c, const size_t t,
+                            std::vector<cv::Rect>& outputs) const
+{
+    const cv::Size result_size {resultSize(spectra, m_templates.at(c).at(t))};
+    outputs.clear();
+    for (size_t i {0}; i < spectra.origins.size(); i++)
+    {
+        outputs.push_back(result_size.area() > 0 ? tileOutput(spectra, result_size, i) : cv::Rect{});
+    }
+}
+
+void MaskedNCC::matchTile(const ImageSpectra& spectra, const size_t c, const size_t t, const size_t i,
+                          cv::Mat_<float>& result) const
+{
+    const TemplateSpectra& templ {m_templates.at(c).at(t)};
+    const cv::Size result_size {resultSize(spectra, templ)};
+    CV_Assert(!compressed() && result.size() == result_size);
+    const cv::Rect output {tileOutput(spectra, result_size, i)};
+    if (output.empty())
+    {
+        return;
+    }
+
+    TMWorkspace::Scope scope;
+    TMWorkspace& workspace {scope.workspace()};
+    cv::Mat& numerator_spectrum {workspace.numerator_spectrum};
+    cv::Mat& product {workspace.product};
+    cv::Mat& numerator {workspace.numerator};
+    cv::Mat& denominator {workspace.denominator};
+    const std::array<cv::Mat, 4>& tile {spectra.tiles[i]};
+
+    // Correlation is the product with the conjugate spectrum; channels add up
+    cv::mulSpectrums(tile[0], templ.masked_templ[0], numerator_spectrum, 0, true);
+    for (size_t ch {1}; ch < 3; ch++)
+    {
+        cv::mulSpectrums(tile[ch], templ.masked_templ[ch], product, 0, true);
+        numerator_spectrum += product;
+    }
+    cv::dft(numerator_spectrum, numerator, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT, output.height);
+    cv::mulSpectrums(tile[3], templ.mask, product, 0, true);
+    cv::dft(product, denominator, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT, output.height);
+
+    for (int r {0}; r < output.height; r++)
+    {
+        normalizeRow(numerator.ptr<float>(r), denominator.ptr<float>(r), templ.energy,
+                     result.ptr<float>(output.y + r) + output.x, output.width);
+    }
+}
+
+cv::Size MaskedNCC::resultSize(const ImageSpectra& spectra, const TemplateSpectra& templ) const
+{
+    const cv::Size size {spectra.image_size.width - templ.size.width + 1,
+                         spectra.image_size.height - templ.size.height + 1};
+    if (templ.energy <= 0.0 || size.width <= 0 || size.height <= 0)
+    {
+        return cv::Size{0, 0};
+    }
+    return size;
+}
+
+cv::Rect MaskedNCC::tileOutput(const ImageSpectra& spectra, const cv::Size result_size, const size_t i) const
+{
+    // Every tile computes the next m_step positions from its origin
+    const cv::Point origin {spectra.origins.at(i)};
+    return cv::Rect{origin, m_step} & cv::Rect{0, 0, result_size.width, result_size.height};
+}
+
+void MaskedNCC::matchBases(const ImageSpectra& spectra, const size_t c, BasisMaps& maps) const
+{
+    const ClassBases& bases {m_bases.at(c)};
+    const cv::Size result_size {spectra.image_size.width - bases.size.width + 1,
+                                spectra.image_size.height - bases.size.height + 1};
+    maps.numerators.clear();
+    maps.denominators.clear();
+    if (bases.templ.empty() || result_size.width <= 0 || result_size.height <= 0)
+    {
+        return;
+    }
+    maps.numerators.assign(bases.templ.size(), cv::Mat_<float>{});
+    maps.denominators.assign(bases.mask.size(), cv::Mat_<float>{});
+    for (cv::Mat_<float>& map : maps.numerators)
+    {
+        map.create(result_size);
+    }
+    for (cv::Mat_<float>& map : maps.denominators)
+    {
+        map.create(result_size);
+    }
+
+    cv::Mat numerator_spectrum;
+    cv::Mat product;
+    cv::Mat correlation;
+    for (size_t i {0}; i < spectra.origins.size(); i++)
+    {
+        const cv::Point origin {spectra.origins[i]};
+        const int rows {std::min(m_step.height, result_size.height - origin.y)};
+        const int cols {std::min(m_step.width, result_size.width - origin.x)};
+        if (rows <= 0 || cols <= 0)
+        {
+            continue;
+        }
+        const std::array<cv::Mat, 4>& tile {spectra.tiles[i]};
+        const cv::Rect output {origin.x, origin.y, cols, rows};
+
+        for (size_t b {0}; b < bases.templ.size(); b++)
+        {
+            cv::mulSpectrums(tile[0], bases.templ[b][0], numerator_spectrum, 0, true);
+            for (size_t ch {1}; ch < 3; ch++)
+            {
+                cv::mulSpectrums(tile[ch], bases.templ[b][ch], product, 0, true);
+                numerator_spectrum += product;
+            }
+            cv::dft(numerator_spectrum, correlation, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT, rows);
+            correlation(cv::Rect{0, 0, cols, rows}).copyTo(maps.numerators[b](output));
+        }
+        for (size_t b {0}; b < bases.mask.size(); b++)
+        {
+            cv::mulSpectrums(tile[3], bases.mask[b], product, 0, true);
+            cv::dft(product, correlation, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT, rows);
+            correlation(cv::Rect{0, 0, cols, rows}).copyTo(maps.denominators[b](output));
+        }
+    }
+}
+
+void MaskedNCC::reconstruct(const BasisMaps& maps, const size_t c, const size_t t, cv::Mat_<float>& result) const
+{
+    const TemplateSpectra& templ {m_templates.at(c).at(t)};
+    const ClassBases& bases {m_bases.at(c)};
+    if (templ.energy <= 0.0 || templ.size != bases.size || maps.numerators.empty() || maps.denominators.empty())
+    {
+        result.release();
+        return;
+    }
+
+    // Correlations are linear in the template and in the mask
+    cv::Mat_<float> numerator {maps.numerators[0].clone()};
+    for (int k {0}; k < bases.templ_coeffs.cols; k++)
+    {
+        cv::scaleAdd(maps.numerators[k + 1], bases.templ_coeffs(static_cast<int>(t), k), numerator, numerator);
+    }
+    cv::Mat_<float> denominator {maps.denominators[0].clone()};
+    for (int k {0}; k < bases.mask_coeffs.cols; k++)
+    {
+        cv::scaleAdd(maps.denominators[k + 1], bases.mask_coeffs(static_cast<int>(t), k), denominator, denominator);
+    }
+
+    result.create(numerator.size());
+    for (int r {0}; r < result.rows; r++)
+    {
+        normalizeRow(numerator.ptr<float>(r), denominator.ptr<float>(r), templ.energy, result.ptr<float>(r), result.cols);
+    }
+}
+
+void MaskedNCC::normalizeRow(const float* numerator, const float* denominator, const double energy,
+                             float* result, const int cols)
+{
+    for (int col {0}; col < cols; col++)
+    {
+        const double patch_energy {denominator[col]};
+        result[col] = (patch_energy < min_patch_energy) ? 0.0f :
+            static_cast<float>(numerator[col] / std::sqrt(patch_energy * energy));
+    }
+}
+
+double MaskedNCC::maxScore(const ImageSpectra& spectra, const size_t c, const size_t t, cv::Point* max_loc) const
+{
+    // The score map is only needed until its maximum is found
+    TMWorkspace::Scope scope;
+    cv::Mat_<float> result;
+    const cv::Size size {templateSize(c, t)};
+    const cv::Size result_size {spectra.image_size.width - size.width + 1, spectra.image_size.height - size.height + 1};
+    if (result_size.width > 0 && result_size.height > 0)
+    {
+        result = scope.workspace().scores.get<float>(result_size);
+    }
+    match(spectra, c, t, result);
+    if (result.empty())
+    {
+        return 0.0;
+    }
+    double max_val;
+    cv::minMaxLoc(result, nullptr, &max_val, nullptr, max_loc);
+    return std::max(0.0, max_val);
+}
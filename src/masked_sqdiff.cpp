@@ -0,0 +1,197 @@
+// Author: Luca Pellegrini
+#include <masked_sqdiff.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <opencv2/imgproc.hpp>
+#include <masked_ccorr.hpp>
+
+namespace
+{
+
+int64_t runKernel(const MaskedCCorr::Isa isa, const uchar* image, const size_t image_step,
+                  const uchar* masked_templ, const uchar* mask, const size_t templ_step,
+                  const int rows, const int row_bytes)
+{
+    switch (isa)
+    {
+#ifdef TM_SIMD_AVX512
+    case MaskedCCorr::Isa::AVX512:
+        return maskedSqDiffAVX512(image, image_step, masked_templ, mask, templ_step, rows, row_bytes);
+#endif
+#ifdef TM_SIMD_AVX2
+    case MaskedCCorr::Isa::AVX2:
+        return maskedSqDiffAVX2(image, image_step, masked_templ, mask, templ_step, rows, row_bytes);
+#endif
+    default:
+        return maskedSqDiffScalar(image, image_step, masked_templ, mask, templ_step, rows, row_bytes);
+    }
+}
+
+// Horizontal runs of the mask, merged with the identical runs of the rows below
+std::vector<cv::Rect> maskRectangles(const cv::Mat_<uchar>& mask)
+{
+    std::vector<cv::Rect> rects;
+    std::vector<size_t> open;  // rectangles that reach the previous row
+    std::vector<size_t> still_open;
+    for (int y {0}; y < mask.rows; y++)
+    {
+        const uchar* row {mask.ptr<uchar>(y)};
+        still_open.clear();
+        int x {0};
+        while (x < mask.cols)
+        {
+            if (row[x] == 0)
+            {
+                x++;
+                continue;
+            }
+            const int start {x};
+            while (x < mask.cols && row[x] != 0)
+            {
+                x++;
+            }
+            const auto same_run {std::find_if(open.begin(), open.end(), [&](const size_t i)
+            {
+                return rects[i].x == start && rects[i].width == x - start;
+            })};
+            if (same_run != open.end())
+            {
+                rects[*same_run].height++;
+                still_open.push_back(*same_run);
+            }
+            else
+            {
+                rects.emplace_back(start, y, x - start, 1);
+                still_open.push_back(rects.size() - 1);
+            }
+        }
+        open.swap(still_open);
+    }
+    return rects;
+}
+
+} // namespace
+
+int64_t maskedSqDiffScalar(const uchar* image, const size_t image_step,
+                           const uchar* masked_templ, const uchar* mask, const size_t templ_step,
+                           const int rows, const int row_bytes)
+{
+    int64_t sum {0};
+    for (int r {0}; r < rows; r++)
+    {
+        const uchar* img {image + r * image_step};
+        const uchar* templ {masked_templ + r * templ_step};
+        const uchar* m {mask + r * templ_step};
+        int32_t row_sum {0};
+        for (int i {0}; i < row_bytes; i++)
+        {
+            const int32_t difference {(img[i] & m[i]) - templ[i]};
+            row_sum += difference * difference;
+        }
+        sum += row_sum;
+    }
+    return sum;
+}
+
+MaskedSqDiff::MaskedSqDiff(const cv::Mat_<cv::Vec3b>& templ, const cv::Mat_<uchar>& mask)
+{
+    if (templ.empty() || mask.size() != templ.size())
+    {
+        return;
+    }
+    CV_Assert(3 * templ.cols <= MaskedCCorr::max_row_bytes);
+
+    cv::Mat_<uchar> binary_mask;
+    cv::threshold(mask, binary_mask, 0, 255, cv::THRESH_BINARY);
+    cv::merge(std::vector<cv::Mat>{binary_mask, binary_mask, binary_mask}, m_mask);
+    cv::bitwise_and(templ, m_mask, m_masked_templ);
+    m_mask_rects = maskRectangles(binary_mask);
+    for (int r {0}; r < m_masked_templ.rows; r++)
+    {
+        const uchar* row {m_masked_templ.ptr<uchar>(r)};
+        for (int i {0}; i < 3 * m_masked_templ.cols; i++)
+        {
+            m_energy += row[i] * row[i];
+        }
+    }
+}
+
+bool MaskedSqDiff::empty() const
+{
+    return m_masked_templ.empty();
+}
+
+cv::Size MaskedSqDiff::size() const
+{
+    return m_masked_templ.size();
+}
+
+void MaskedSqDiff::integrate(const cv::Mat_<cv::Vec3b>& image, cv::Mat_<double>& integral)
+{
+    integral.create(image.rows + 1, image.cols + 1);
+    std::fill_n(integral.ptr<double>(0), integral.cols, 0.0);
+    for (int y {0}; y < image.rows; y++)
+    {
+        const uchar* in {image.ptr<uchar>(y)};
+        const double* above {integral.ptr<double>(y)};
+        double* out {integral.ptr<double>(y + 1)};
+        int64_t row_sum {0};
+        out[0] = 0.0;
+        for (int x {0}; x < image.cols; x++)
+        {
+            row_sum += in[3 * x] * in[3 * x] + in[3 * x + 1] * in[3 * x + 1] + in[3 * x + 2] * in[3 * x + 2];
+            out[x + 1] = above[x + 1] + static_cast<double>(row_sum);
+        }
+    }
+}
+
+double MaskedSqDiff::scoreAt(const cv::Mat_<cv::Vec3b>& image, const cv::Mat_<double>& integral,
+                             const cv::Point pos) const
+{
+    CV_DbgAssert(pos.x >= 0 && pos.y >= 0 && pos.x + m_masked_templ.cols <= image.cols &&
+                 pos.y + m_masked_templ.rows <= image.rows && integral.rows == image.rows + 1 &&
+                 integral.cols == image.cols + 1);
+    if (m_energy == 0)
+    {
+        return 0.0;
+    }
+    double patch_energy {0.0};
+    for (const cv::Rect& rect : m_mask_rects)
+    {
+        const int x0 {pos.x + rect.x};
+        const int x1 {x0 + rect.width};
+        const double* top {integral.ptr<double>(pos.y + rect.y)};
+        const double* bottom {integral.ptr<double>(pos.y + rect.y + rect.height)};
+        patch_energy += (bottom[x1] - bottom[x0]) - (top[x1] - top[x0]);
+    }
+    if (patch_energy < 0.5)
+    {
+        return 0.0;
+    }
+    const int64_t sqdiff {runKernel(MaskedCCorr::isa(), image.ptr<uchar>(pos.y) + 3 * pos.x, image.step,
+                                    m_masked_templ.ptr<uchar>(), m_mask.ptr<uchar>(), m_masked_templ.step,
+                                    m_masked_templ.rows, 3 * m_masked_templ.cols)};
+    const double r {static_cast<double>(sqdiff) / std::sqrt(patch_energy * static_cast<double>(m_energy))};
+    return std::max(0.0, 1.0 - r / 2.0);
+}
+
+void MaskedSqDiff::match(const cv::Mat_<cv::Vec3b>& image, const cv::Mat_<double>& integral,
+                         cv::Mat_<float>& result) const
+{
+    const cv::Size result_size {image.cols - m_masked_templ.cols + 1, image.rows - m_masked_templ.rows + 1};
+    if (empty() || result_size.width <= 0 || result_size.height <= 0)
+    {
+        result.release();
+        return;
+    }
+    result.create(result_size);
+    for (int y {0}; y < result.rows; y++)
+    {
+        float* out {result.ptr<float>(y)};
+        for (int x {0}; x < result.cols; x++)
+        {
+            out[x] = static_cast<float>(scoreAt(image, integral, cv::Point{x, y}));
+        }
+    }
+}
@@ -0,0 +1,72 @@
+// Author: Luca Pellegrini
+// Compiled with AVX2 enabled: only called after checking that the CPU supports it
+#include <masked_sqdiff.hpp>
+
+#include <immintrin.h>
+
+namespace
+{
+
+int32_t horizontalSum(const __m256i v)
+{
+    __m128i sum {_mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1))};
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+
+// Accumulates 16 bytes: |I - T| with two saturating subtractions (one of them is 0),
+// masked, widened to 16 bits, and squared by `_mm256_madd_epi16()`, which adds up
+// pairs of squares (at most 2 * 255 * 255) into 32 bits
+inline void accumulate16(const __m128i img, const __m128i templ, const __m128i mask, __m256i& sum)
+{
+    const __m128i difference {_mm_and_si128(_mm_or_si128(_mm_subs_epu8(img, templ), _mm_subs_epu8(templ, img)),
+                                            mask)};
+    const __m256i difference16 {_mm256_cvtepu8_epi16(difference)};
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(difference16, difference16));
+}
+
+} // namespace
+
+int64_t maskedSqDiffAVX2(const uchar* image, const size_t image_step,
+                         const uchar* masked_templ, const uchar* mask, const size_t templ_step,
+                         const int rows, const int row_bytes)
+{
+    int64_t sum {0};
+    for (int r {0}; r < rows; r++)
+    {
+        const uchar* img {image + r * image_step};
+        const uchar* templ {masked_templ + r * templ_step};
+        const uchar* m {mask + r * templ_step};
+        // Two accumulators, so that consecutive iterations do not wait for each other
+        __m256i row_sums[2] {_mm256_setzero_si256(), _mm256_setzero_si256()};
+        int i {0};
+        for (; i + 32 <= row_bytes; i += 32)
+        {
+            for (int half {0}; half < 2; half++)
+            {
+                const int offset {i + 16 * half};
+                accumulate16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(img + offset)),
+                             _mm_loadu_si128(reinterpret_cast<const __m128i*>(templ + offset)),
+                             _mm_loadu_si128(reinterpret_cast<const __m128i*>(m + offset)),
+                             row_sums[half]);
+            }
+        }
+        if (i + 16 <= row_bytes)
+        {
+            accumulate16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(img + i)),
+                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(templ + i)),
+                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(m + i)),
+                         row_sums[0]);
+            i += 16;
+        }
+        int32_t row_sum {horizontalSum(_mm256_add_epi32(row_sums[0], row_sums[1]))};
+        for (; i < row_bytes; i++)
+        {
+            const int32_t difference {(img[i] & m[i]) - templ[i]};
+            row_sum += difference * difference;
+        }
+        sum += row_sum;
+    }
+    return sum;
+}
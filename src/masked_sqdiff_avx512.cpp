@@ -0,0 +1,52 @@
+// Author: Luca Pellegrini
+// Compiled with AVX-512 (F, BW, VL) enabled: only called after checking that the CPU supports it
+#include <masked_sqdiff.hpp>
+
+#include <immintrin.h>
+
+namespace
+{
+
+// Accumulates 32 bytes (see the AVX2 kernel); `lanes` selects the bytes to load
+inline void accumulate32(const uchar* img, const uchar* templ, const uchar* mask, const __mmask32 lanes,
+                         __m512i& sum)
+{
+    const __m256i img8 {_mm256_maskz_loadu_epi8(lanes, img)};
+    const __m256i templ8 {_mm256_maskz_loadu_epi8(lanes, templ)};
+    const __m256i difference {_mm256_and_si256(_mm256_or_si256(_mm256_subs_epu8(img8, templ8),
+                                                                _mm256_subs_epu8(templ8, img8)),
+                                               _mm256_maskz_loadu_epi8(lanes, mask))};
+    const __m512i difference16 {_mm512_cvtepu8_epi16(difference)};
+    sum = _mm512_add_epi32(sum, _mm512_madd_epi16(difference16, difference16));
+}
+
+} // namespace
+
+int64_t maskedSqDiffAVX512(const uchar* image, const size_t image_step,
+                           const uchar* masked_templ, const uchar* mask, const size_t templ_step,
+                           const int rows, const int row_bytes)
+{
+    int64_t sum {0};
+    for (int r {0}; r < rows; r++)
+    {
+        const uchar* img {image + r * image_step};
+        const uchar* templ {masked_templ + r * templ_step};
+        const uchar* m {mask + r * templ_step};
+        __m512i row_sums[2] {_mm512_setzero_si512(), _mm512_setzero_si512()};
+        int i {0};
+        for (; i + 64 <= row_bytes; i += 64)
+        {
+            accumulate32(img + i, templ + i, m + i, ~__mmask32{0}, row_sums[0]);
+            accumulate32(img + i + 32, templ + i + 32, m + i + 32, ~__mmask32{0}, row_sums[1]);
+        }
+        // The tail is loaded with masked loads, which never read past the end of the row
+        for (; i < row_bytes; i += 32)
+        {
+            const int count {row_bytes - i < 32 ? row_bytes - i : 32};
+            const __mmask32 lanes {static_cast<__mmask32>(count == 32 ? ~0u : (1u << count) - 1u)};
+            accumulate32(img + i, templ + i, m + i, lanes, row_sums[0]);
+        }
+        sum += _mm512_reduce_add_epi32(_mm512_add_epi32(row_sums[0], row_sums[1]));
+    }
+    return sum;
+}
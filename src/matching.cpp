@@ -14,91 +14,220 @@
 #include <print_stats.h>
 #include <hog.h>
 #include <bow.h>
+#include <parallel_images.hpp>
+#include <feature_cache.hpp>
 
 namespace fs = std::filesystem;
 
 namespace
 {
 
-std::vector<const FlowerImage*> getAllTrainImages(
+// Extracts one descriptor per train image, in load order (healthy images, then diseased ones), and the
+// flower type of each one. `extract` has signature bool(State& state, const cv::Mat& gray, Descriptor& out),
+// and is called concurrently from the threads of the ThreadPool: every task works on its own `make_state()`
+template <typename Descriptor, typename MakeState, typename ExtractFn>
+void extractTrainDescriptors(
     const FlowerImageContainer& train_healthy_images,
-    const FlowerImageContainer& train_diseased_images
+    const FlowerImageContainer& train_diseased_images,
+    MakeState make_state,
+    ExtractFn extract,
+    std::vector<Descriptor>& descriptors,
+    std::vector<FlowerType>& labels
 )
 {
-    std::vector<const FlowerImage*> train_images;
+    // Every train image gets its slot up front, so that the result does not depend on thread scheduling
+    const size_t healthy_count {train_healthy_images.size()};
+    descriptors.assign(healthy_count + train_diseased_images.size(), Descriptor{});
+    labels.resize(descriptors.size());
+    for (const FlowerImageContainer* train_set : {&train_healthy_images, &train_diseased_images})
+    {
+        const size_t offset {(train_set == &train_healthy_images) ? 0 : healthy_count};
+        forEachImage(*train_set, make_state, [&, offset](auto& state, size_t i, const FlowerImage& train_img)
+        {
+            labels[offset + i] = train_img.flowerType();
+            extract(state, train_img.getImageGrayscale(), descriptors[offset + i]);
+        });
+    }
+}
 
-    for (const FlowerImage& img : train_healthy_images.getImagesVector())
+} // namespace
+
+void trainHOG(
+    const FlowerImageContainer& train_healthy_images,
+    const FlowerImageContainer& train_diseased_images,
+    HOGModel& model
+)
+{
+    // cv::HOGDescriptor::compute() only reads the descriptor: one extractor serves all threads
+    HOGExtractor& extractor {model.extractor};
+    extractTrainDescriptors(
+        train_healthy_images, train_diseased_images,
+        []() { return 0; },
+        [&extractor](int&, const cv::Mat& gray, std::vector<float>& descriptor)
+        {
+            cv::Mat cached;
+            if (loadCachedFeatures(extractor.getParamsKey(), gray, nullptr, cached))
+            {
+                const float* data {cached.ptr<float>()};
+                descriptor.assign(data, data + cached.total());
+                return !descriptor.empty();
+            }
+            const bool ok {extractor.extract(gray, descriptor)};
+            storeCachedFeatures(extractor.getParamsKey(), gray, nullptr, cv::Mat(descriptor));
+            return ok;
+        },
+        model.train_descriptors, model.train_labels);
+}
+
+bool classifyHOG(
+    const cv::Mat& image_gray,
+    HOGModel& model,
+    FlowerType& predicted_type,
+    double& best_distance
+)
+{
+    std::vector<float> test_descriptor;
+    model.extractor.extract(image_gray, test_descriptor);
+    if (test_descriptor.empty())
     {
-        train_images.push_back(&img);
+        return false;
     }
-    for (const FlowerImage& img : train_diseased_images.getImagesVector())
+
+    best_distance = std::numeric_limits<double>::max();
+    predicted_type = FlowerType::NoFlower;
+
+    for (size_t i {0}; i < model.train_descriptors.size(); i++)
     {
-        train_images.push_back(&img);
+        if (model.train_descriptors[i].empty())
+        {
+            continue;
+        }
+
+        const double distance = model.extractor.matchDescriptors(test_descriptor, model.train_descriptors[i]);
+        if (distance < best_distance)
+        {
+            best_distance = distance;
+            predicted_type = model.train_labels[i];
+        }
+    }
+    return true;
+}
+
+bool trainBoW(
+    const FlowerImageContainer& train_healthy_images,
+    const FlowerImageContainer& train_diseased_images,
+    BoWModel& model
+)
+{
+    if (!model.extractor.buildVocabulary(train_healthy_images, train_diseased_images))
+    {
+        return false;
     }
 
-    return train_images;
+    const BoWExtractor& extractor {model.extractor};
+    extractTrainDescriptors(
+        train_healthy_images, train_diseased_images,
+        [&extractor]() { return extractor.clone(); },
+        [](BoWExtractor& task_extractor, const cv::Mat& gray, cv::Mat& histogram)
+        {
+            return task_extractor.extract(gray, histogram, true);
+        },
+        model.train_histograms, model.train_labels);
+    return true;
 }
 
-} // namespace
+bool classifyBoW(
+    const cv::Mat& image_gray,
+    BoWModel& model,
+    FlowerType& predicted_type,
+    double& best_distance
+)
+{
+    return classifyBoW(image_gray, model, model.extractor, predicted_type, best_distance);
+}
+
+bool classifyBoW(
+    const cv::Mat& image_gray,
+    const BoWModel& model,
+    BoWExtractor& extractor,
+    FlowerType& predicted_type,
+    double& best_distance
+)
+{
+    cv::Mat test_histogram;
+    if (!extractor.extract(image_gray, test_histogram))
+    {
+        return false;
+    }
+
+    best_distance = std::numeric_limits<double>::max();
+    predicted_type = FlowerType::NoFlower;
+
+    for (size_t i {0}; i < model.train_histograms.size(); i++)
+    {
+        if (model.train_histograms[i].empty())
+        {
+            continue;
+        }
+
+        const double distance = extractor.matchDescriptors(test_histogram, model.train_histograms[i]);
+        if (distance < best_distance)
+        {
+            best_distance = distance;
+            predicted_type = model.train_labels[i];
+        }
+    }
+    return true;
+}
 
 void hog(
     const FlowerImageContainer& test_images,
     const FlowerImageContainer& train_healthy_images,
     const FlowerImageContainer& train_diseased_images,
-    const std::string& output_dir
+    const std::string& output_dir,
+    HOGModel* pretrained
 )
 {
     std::cout << "\n[HOG] Simple matching" << std::endl;
     Metrics metrics = createMetrics(static_cast<int>(num_classes));
     ClassificationRecap records;
 
-    const std::vector<const FlowerImage*> train_images =
-        getAllTrainImages(train_healthy_images, train_diseased_images);
-    if (test_images.empty() || train_images.empty())
+    const bool no_train_images {train_healthy_images.empty() && train_diseased_images.empty()};
+    if (test_images.empty() || (pretrained == nullptr && no_train_images))
     {
         std::cout << "[HOG] No images available." << std::endl;
         return;
     }
 
-    HOGExtractor extractor;
-    std::vector<std::vector<float>> train_descriptors(train_images.size());
-    for (size_t i {0}; i < train_images.size(); i++)
+    HOGModel trained;
+    if (pretrained == nullptr)
     {
-        extractor.extract(train_images[i]->getImageGrayscale(), train_descriptors[i]);
+        trainHOG(train_healthy_images, train_diseased_images, trained);
     }
+    HOGModel& model {pretrained != nullptr ? *pretrained : trained};
 
-    for (const FlowerImage& test_img : test_images.getImagesVector())
+    // Classify test images in parallel (the model is only read)
+    std::vector<TestOutcome> outcomes(test_images.size());
+    std::vector<double> best_distances(test_images.size(), 0.0);
+    forEachImage(test_images, [&](size_t i, const FlowerImage& test_img)
     {
         auto start_time = std::chrono::high_resolution_clock::now();
+        outcomes[i].classified = classifyHOG(test_img.getImageGrayscale(), model, outcomes[i].predicted_type, best_distances[i]);
+        auto end_time = std::chrono::high_resolution_clock::now();
+        outcomes[i].time_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+    });
 
-        std::vector<float> test_descriptor;
-        extractor.extract(test_img.getImageGrayscale(), test_descriptor);
-        if (test_descriptor.empty())
+    for (size_t i {0}; i < test_images.size(); i++)
+    {
+        const FlowerImage& test_img {test_images.metadataAt(i)};
+        if (!outcomes[i].classified)
         {
             std::cout << "[HOG] " << test_img.name() << " -> skipped (no descriptor)" << std::endl;
             continue;
         }
-
-        double best_distance = std::numeric_limits<double>::max();
-        FlowerType predicted_type {FlowerType::NoFlower};
-
-        for (size_t i {0}; i < train_images.size(); i++)
-        {
-            if (train_descriptors[i].empty())
-            {
-                continue;
-            }
-
-            const double distance = extractor.matchDescriptors(test_descriptor, train_descriptors[i]);
-            if (distance < best_distance)
-            {
-                best_distance = distance;
-                predicted_type = train_images[i]->flowerType();
-            }
-        }
-
-        auto end_time = std::chrono::high_resolution_clock::now();
-        const double total_time = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+        const FlowerType predicted_type {outcomes[i].predicted_type};
+        const double best_distance {best_distances[i]};
+        const double total_time {outcomes[i].time_ms};
 
         const int true_class = static_cast<int>(test_img.flowerType());
         const int predicted_class = static_cast<int>(predicted_type);
@@ -128,72 +257,53 @@ void bow(
     const FlowerImageContainer& test_images,
     const FlowerImageContainer& train_healthy_images,
     const FlowerImageContainer& train_diseased_images,
-    const std::string& output_dir
+    const std::string& output_dir,
+    BoWModel* pretrained
 )
 {
     std::cout << "\n[BOW] Simple matching" << std::endl;
     Metrics metrics = createMetrics(static_cast<int>(num_classes));
     ClassificationRecap records;
 
-    const std::vector<const FlowerImage*> train_images =
-        getAllTrainImages(train_healthy_images, train_diseased_images);
-    if (test_images.empty() || train_images.empty())
+    const bool no_train_images {train_healthy_images.empty() && train_diseased_images.empty()};
+    if (test_images.empty() || (pretrained == nullptr && no_train_images))
     {
         std::cout << "[BOW] No images available." << std::endl;
         return;
     }
 
-    BoWExtractor extractor(300, 20);
-    std::vector<cv::Mat> train_gray_images;
-    train_gray_images.reserve(train_images.size());
-    for (const FlowerImage* train_img : train_images)
-    {
-        train_gray_images.push_back(train_img->getImageGrayscale());
-    }
-
-    if (!extractor.buildVocabulary(train_gray_images))
+    BoWModel trained;
+    if (pretrained == nullptr && !trainBoW(train_healthy_images, train_diseased_images, trained))
     {
         std::cout << "[BOW] Not enough descriptors to build vocabulary." << std::endl;
         return;
     }
-
-    std::vector<cv::Mat> train_histograms(train_images.size());
-    for (size_t i {0}; i < train_images.size(); i++)
-    {
-        extractor.extract(train_images[i]->getImageGrayscale(), train_histograms[i]);
-    }
-
-    for (const FlowerImage& test_img : test_images.getImagesVector())
+    BoWModel& model {pretrained != nullptr ? *pretrained : trained};
+
+    // Classify test images in parallel (the model is only read), each task with its own extractor
+    std::vector<TestOutcome> outcomes(test_images.size());
+    std::vector<double> best_distances(test_images.size(), 0.0);
+    forEachImage(test_images,
+        [&model]() { return model.extractor.clone(); },
+        [&](BoWExtractor& extractor, size_t i, const FlowerImage& test_img)
     {
         auto start_time = std::chrono::high_resolution_clock::now();
+        outcomes[i].classified = classifyBoW(test_img.getImageGrayscale(), model, extractor, outcomes[i].predicted_type, best_distances[i]);
+        auto end_time = std::chrono::high_resolution_clock::now();
+        outcomes[i].time_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+    });
 
-        cv::Mat test_histogram;
-        if (!extractor.extract(test_img.getImageGrayscale(), test_histogram))
+    for (size_t i {0}; i < test_images.size(); i++)
+    {
+        const FlowerImage& test_img {test_images.metadataAt(i)};
+        if (!outcomes[i].classified)
         {
             std::cout << "[BOW] " << test_img.name() << " -> skipped (no descriptor)" << std::endl;
             continue;
         }
-
-        double best_distance = std::numeric_limits<double>::max();
-        FlowerType predicted_type {FlowerType::NoFlower};
-
-        for (size_t i {0}; i < train_images.size(); i++)
-        {
-            if (train_histograms[i].empty())
-            {
-                continue;
-            }
-
-            const double distance = extractor.matchDescriptors(test_histogram, train_histograms[i]);
-            if (distance < best_distance)
-            {
-                best_distance = distance;
-                predicted_type = train_images[i]->flowerType();
-            }
-        }
-
-        auto end_time = std::chrono::high_resolution_clock::now();
-        const double total_time = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+        const FlowerType predicted_type {outcomes[i].predicted_type};
+        const double best_distance {best_distances[i]};
+        const double total_time {outcomes[i].time_ms};
 
         const int true_class = static_cast<int>(test_img.flowerType());
         const int predicted_class = static_cast<int>(predicted_type);
@@ -0,0 +1,237 @@
+// Author: Marco Carraro
+
+#include "mih_index.h"
+#include "hamming_matcher.hpp"
+#include <opencv2/core/hal/hal.hpp>
+#include <algorithm>
+#include <climits>
+
+namespace {
+
+constexpr int substring_bits = 16;
+constexpr int buckets = 1 << substring_bits;
+
+// Cost of probing a bucket and of checking a candidate, in rows of the linear scan: both read memory
+// at random, while the linear scan streams through it
+constexpr long long probe_cost = 2;
+constexpr long long candidate_cost = 4;
+
+// All 16-bit masks with s bits set, for every s from 0 to 16
+const std::vector<std::vector<uint16_t>>& masksByRadius() {
+    static const std::vector<std::vector<uint16_t>> masks = []() {
+        std::vector<std::vector<uint16_t>> by_radius(substring_bits + 1);
+        for (int mask = 0; mask < buckets; mask++) {
+            int bits = 0;
+            for (int m = mask; m != 0; m &= m - 1) {
+                bits++;
+            }
+            by_radius[bits].push_back(static_cast<uint16_t>(mask));
+        }
+        return by_radius;
+    }();
+    return masks;
+}
+
+inline uint16_t substring(const uchar *descriptor, int t) {
+    return static_cast<uint16_t>(descriptor[2 * t] | (descriptor[2 * t + 1] << 8));
+}
+
+// Outcome of the ratio test, given the two nearest distances found so far (INT_MAX if none) and a lower bound
+// of the distance of every descriptor not seen yet: 1 = passes, 0 = fails, -1 = not known yet.
+// Passes for sure if nothing unseen can be the nearest neighbour and d1 < ratio * min(d2, unseen);
+// fails for sure if it fails now and nothing unseen can be within ratio * d1 (a closer descriptor can only
+// make the test fail, unless it is less than ratio * d1 away)
+int ratioOutcome(int d1, int d2, int unseen, double ratio) {
+    if (d1 < ratio * std::min(d2, unseen)) {
+        return 1;
+    }
+    if (d1 >= ratio * d2 && ratio * d1 <= unseen) {
+        return 0;
+    }
+    return -1;
+}
+
+} // namespace
+
+MIHIndex::MIHIndex(const cv::Mat &descriptors) {
+    if (descriptors.empty()) {
+        return;
+    }
+    CV_Assert(descriptors.type() == CV_8U && descriptors.cols == descriptor_bytes);
+    descriptors_ = descriptors.isContinuous() ? descriptors : descriptors.clone();
+
+    // Counting sort of the rows by substring, one table at a time
+    offsets_.assign(substrings, std::vector<uint32_t>(buckets + 1, 0));
+    ids_.assign(substrings, std::vector<int>(descriptors_.rows));
+    for (int t = 0; t < substrings; t++) {
+        std::vector<uint32_t>& offsets = offsets_[t];
+        for (int i = 0; i < descriptors_.rows; i++) {
+            offsets[substring(descriptors_.ptr<uchar>(i), t) + 1]++;
+        }
+        for (int key = 0; key < buckets; key++) {
+            offsets[key + 1] += offsets[key];
+        }
+        std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+        for (int i = 0; i < descriptors_.rows; i++) {
+            ids_[t][next[substring(descriptors_.ptr<uchar>(i), t)]++] = i;
+        }
+    }
+}
+
+bool MIHIndex::empty() const {
+    return descriptors_.empty();
+}
+
+int MIHIndex::size() const {
+    return descriptors_.rows;
+}
+
+const cv::Mat& MIHIndex::descriptors() const {
+    return descriptors_;
+}
+
+void MIHIndex::match(const cv::Mat &queries, std::vector<cv::DMatch> &matches, int max_distance) const {
+    matches.clear();
+    if (empty() || queries.empty()) {
+        return;
+    }
+    CV_Assert(queries.type() == CV_8U && queries.cols == descriptor_bytes);
+    matches.reserve(queries.rows);
+    for (int q = 0; q < queries.rows; q++) {
+        int distance = 0;
+        const int row = nearest(queries.ptr<uchar>(q), distance, max_distance);
+        if (row >= 0) {
+            matches.emplace_back(q, row, static_cast<float>(distance));
+        }
+    }
+}
+
+int MIHIndex::nearest(const uchar *query, int &distance, int max_distance) const {
+    if (empty()) {
+        return -1;
+    }
+    const std::vector<std::vector<uint16_t>>& masks = masksByRadius();
+    int best_row = -1;
+    int best_distance = (max_distance >= 0) ? max_distance + 1 : INT_MAX;
+    // Probing stops paying off once it costs as much as the linear scan
+    long long cost = 0;
+    const long long budget = descriptors_.rows;
+
+    for (int s = 0; s <= substring_bits; s++) {
+        for (int t = 0; t < substrings; t++) {
+            const uint16_t key = substring(query, t);
+            const std::vector<uint32_t>& offsets = offsets_[t];
+            for (const uint16_t mask : masks[s]) {
+                const uint16_t probe = key ^ mask;
+                for (uint32_t k = offsets[probe]; k < offsets[probe + 1]; k++) {
+                    const int row = ids_[t][k];
+                    const int d = cv::hal::normHamming(query, descriptors_.ptr<uchar>(row), descriptor_bytes);
+                    if (d < best_distance) {
+                        best_distance = d;
+                        best_row = row;
+                    }
+                }
+                cost += probe_cost + candidate_cost * (offsets[probe + 1] - offsets[probe]);
+            }
+
+            // Every descriptor not seen yet differs by more than s bits in tables 0..t, and by at least
+            // s bits in the others: by at least 16 * s + t + 1 bits overall
+            const int seen_radius = substrings * s + t;
+            if (best_distance <= seen_radius + 1 || (max_distance >= 0 && seen_radius >= max_distance)) {
+                distance = best_distance;
+                return best_row;
+            }
+            if (cost > budget) {
+                return linearNearest(query, distance, max_distance);
+            }
+        }
+    }
+    distance = best_distance;
+    return best_row;
+}
+
+int MIHIndex::linearNearest(const uchar *query, int &distance, int max_distance) const {
+    const cv::Mat query_row(1, descriptor_bytes, CV_8U, const_cast<uchar*>(query));
+    std::vector<cv::DMatch> matches;
+    HammingMatcher::match(query_row, descriptors_, matches);
+    if (matches.empty() || (max_distance >= 0 && matches[0].distance > max_distance)) {
+        return -1;
+    }
+    distance = static_cast<int>(matches[0].distance);
+    return matches[0].trainIdx;
+}
+
+void MIHIndex::ratioMatch(const cv::Mat &queries, double ratio,
+                          const std::function<void(const cv::DMatch &)> &on_match) const {
+    if (empty() || queries.empty()) {
+        return;
+    }
+    CV_Assert(queries.type() == CV_8U && queries.cols == descriptor_bytes);
+    for (int q = 0; q < queries.rows; q++) {
+        int distance = 0;
+        const int row = ratioNearest(queries.ptr<uchar>(q), ratio, distance);
+        if (row >= 0) {
+            on_match(cv::DMatch(q, row, static_cast<float>(distance)));
+        }
+    }
+}
+
+int MIHIndex::ratioNearest(const uchar *query, double ratio, int &distance) const {
+    if (empty()) {
+        return -1;
+    }
+    const std::vector<std::vector<uint16_t>>& masks = masksByRadius();
+    int best_row = -1;
+    int best_distance = INT_MAX;
+    int second_distance = INT_MAX;
+    long long cost = 0;
+    const long long budget = descriptors_.rows;
+
+    for (int s = 0; s <= substring_bits; s++) {
+        for (int t = 0; t < substrings; t++) {
+            const uint16_t key = substring(query, t);
+            const std::vector<uint32_t>& offsets = offsets_[t];
+            for (const uint16_t mask : masks[s]) {
+                const uint16_t probe = key ^ mask;
+                for (uint32_t k = offsets[probe]; k < offsets[probe + 1]; k++) {
+                    const int row = ids_[t][k];
+                    if (row == best_row) {
+                        continue;   // found again through another table
+                    }
+                    const int d = cv::hal::normHamming(query, descriptors_.ptr<uchar>(row), descriptor_bytes);
+                    if (d < best_distance) {
+                        second_distance = best_distance;
+                        best_distance = d;
+                        best_row = row;
+                    } else if (d < second_distance) {
+                        second_distance = d;
+                    }
+                }
+                cost += probe_cost + candidate_cost * (offsets[probe + 1] - offsets[probe]);
+            }
+
+            // Same bound as in nearest()
+            const int seen_radius = substrings * s + t;
+            const int outcome = ratioOutcome(best_distance, second_distance, seen_radius + 1, ratio);
+            if (outcome >= 0) {
+                distance = best_distance;
+                return (outcome == 1) ? best_row : -1;
+            }
+            if (cost > budget) {
+                return linearRatioNearest(query, ratio, distance);
+            }
+        }
+    }
+    distance = best_distance;
+    return (ratioOutcome(best_distance, second_distance, INT_MAX, ratio) == 1) ? best_row : -1;
+}
+
+int MIHIndex::linearRatioNearest(const uchar *query, double ratio, int &distance) const {
+    const cv::Mat query_row(1, descriptor_bytes, CV_8U, const_cast<uchar*>(query));
+    int best_row = -1;
+    HammingMatcher::ratioMatch(query_row, descriptors_, ratio, [&](const cv::DMatch &match) {
+        best_row = match.trainIdx;
+        distance = static_cast<int>(match.distance);
+    });
+    return best_row;
+}
@@ -1,8 +1,17 @@
 // Author: Marco Carraro
 
 #include "orb.h"
+#include "hamming_matcher.hpp"
+#include <atomic>
 #include <chrono>
 #include <iostream>
+#include <sstream>
+
+namespace {
+
+std::atomic<ORBExtractor::MatcherType> matcherType(ORBExtractor::MatcherType::MultiIndexHashing);
+
+} // namespace
 
 ORBExtractor::ORBExtractor(
     int nfeatures,
@@ -13,6 +22,14 @@ ORBExtractor::ORBExtractor(
     int WTA_K,
     int patchSize
 ) : extractionTime_(0.0), keypointCount_(0), matchingTime_(0.0) {
+    nfeatures_ = nfeatures;
+    scaleFactor_ = scaleFactor;
+    nlevels_ = nlevels;
+    edgeThreshold_ = edgeThreshold;
+    firstLevel_ = firstLevel;
+    WTA_K_ = WTA_K;
+    patchSize_ = patchSize;
+
     orb_ = cv::ORB::create(
         nfeatures,
         scaleFactor,
@@ -24,6 +41,12 @@ ORBExtractor::ORBExtractor(
         patchSize
     );
 
+    std::ostringstream key;
+    key << "ORB nfeatures=" << nfeatures << " scaleFactor=" << scaleFactor << " nlevels=" << nlevels
+        << " edgeThreshold=" << edgeThreshold << " firstLevel=" << firstLevel << " WTA_K=" << WTA_K
+        << " patchSize=" << patchSize;
+    paramsKey_ = key.str();
+
     // Initialize the BFMatcher with Hamming distance for ORB descriptors
     matcher_ = cv::BFMatcher::create(cv::NORM_HAMMING, false);
 }
@@ -60,8 +83,43 @@ int ORBExtractor::matchDescriptors(const cv::Mat &descriptors1, const cv::Mat &d
     // Start timing
     auto start = std::chrono::high_resolution_clock::now();
     
-    // Match descriptors using the BFMatcher
-    matcher_->match(descriptors1, descriptors2, matches);
+    // Match descriptors by brute force: OpenCV's BFMatcher, or the SIMD Hamming kernels
+    if (getMatcherType() == MatcherType::BruteForce) {
+        matcher_->match(descriptors1, descriptors2, matches);
+    } else {
+        HammingMatcher::match(descriptors1, descriptors2, matches);
+    }
+    
+    // End timing
+    auto end = std::chrono::high_resolution_clock::now();
+    matchingTime_ = std::chrono::duration<double, std::milli>(end - start).count();
+
+    return static_cast<int>(matches.size());
+}
+
+int ORBExtractor::matchDescriptors(const cv::Mat &descriptors1, const MIHIndex &index2, std::vector<cv::DMatch> &matches){
+    // Check if descriptors are empty
+    if (descriptors1.empty() || index2.empty()) {
+        std::cerr << "[ORB ERROR] Empty descriptors for matching!" << std::endl;
+        matchingTime_ = 0.0;
+        return 0;
+    }
+    
+    // Start timing
+    auto start = std::chrono::high_resolution_clock::now();
+    
+    // Exact nearest neighbours from the multi-index hashing tables, or by brute force on the indexed descriptors
+    switch (getMatcherType()) {
+        case MatcherType::MultiIndexHashing:
+            index2.match(descriptors1, matches);
+            break;
+        case MatcherType::Hamming:
+            HammingMatcher::match(descriptors1, index2.descriptors(), matches);
+            break;
+        case MatcherType::BruteForce:
+            matcher_->match(descriptors1, index2.descriptors(), matches);
+            break;
+    }
     
     // End timing
     auto end = std::chrono::high_resolution_clock::now();
@@ -109,6 +167,60 @@ int ORBExtractor::matchAndFilter(const cv::Mat &descriptors1, const cv::Mat &des
     return static_cast<int>(goodMatches.size());
 }
 
+int ORBExtractor::matchAndFilter(const cv::Mat &descriptors1, const MIHIndex &index2, std::vector<cv::DMatch> &goodMatches, double threshold){
+    // Match
+    std::vector<cv::DMatch> allMatches;
+    matchDescriptors(descriptors1, index2, allMatches);
+    
+    // Filter
+    goodMatches = filterMatches(allMatches, threshold);
+    
+    return static_cast<int>(goodMatches.size());
+}
+
+int ORBExtractor::ratioMatch(const cv::Mat &descriptors1, const MIHIndex &index2, double ratio, const std::function<void(const cv::DMatch &)> &onMatch){
+    // Check if descriptors are empty
+    if (descriptors1.empty() || index2.empty()) {
+        std::cerr << "[ORB ERROR] Empty descriptors for matching!" << std::endl;
+        matchingTime_ = 0.0;
+        return 0;
+    }
+    
+    // Start timing
+    auto start = std::chrono::high_resolution_clock::now();
+    
+    // Count the accepted matches on their way to onMatch
+    int accepted = 0;
+    auto accept = [&](const cv::DMatch &match) {
+        accepted++;
+        onMatch(match);
+    };
+    switch (getMatcherType()) {
+        case MatcherType::MultiIndexHashing:
+            index2.ratioMatch(descriptors1, ratio, accept);
+            break;
+        case MatcherType::Hamming:
+            HammingMatcher::ratioMatch(descriptors1, index2.descriptors(), ratio, accept);
+            break;
+        case MatcherType::BruteForce: {
+            std::vector<std::vector<cv::DMatch>> knnMatches;
+            matcher_->knnMatch(descriptors1, index2.descriptors(), knnMatches, 2);
+            for (const auto& neighbours : knnMatches) {
+                if (neighbours.size() == 1 || (neighbours.size() == 2 && neighbours[0].distance < ratio * neighbours[1].distance)) {
+                    accept(neighbours[0]);
+                }
+            }
+            break;
+        }
+    }
+    
+    // End timing
+    auto end = std::chrono::high_resolution_clock::now();
+    matchingTime_ = std::chrono::duration<double, std::milli>(end - start).count();
+
+    return accepted;
+}
+
 // Get the time taken for the last extraction
 double ORBExtractor::getExtractionTime() const {
     return extractionTime_;
@@ -122,4 +234,23 @@ int ORBExtractor::getKeypointCount() const {
 // Get the time taken for the last matching operation
 double ORBExtractor::getMatchingTime() const {
     return matchingTime_;
+}
+
+// Get a string identifying the extraction parameters
+const std::string& ORBExtractor::getParamsKey() const {
+    return paramsKey_;
+}
+
+// Select the matcher used by every extractor
+void ORBExtractor::setMatcherType(MatcherType type) {
+    matcherType.store(type);
+}
+
+ORBExtractor::MatcherType ORBExtractor::getMatcherType() {
+    return matcherType.load();
+}
+
+// Create a new extractor with the same parameters
+ORBExtractor ORBExtractor::clone() const {
+    return ORBExtractor(nfeatures_, scaleFactor_, nlevels_, edgeThreshold_, firstLevel_, WTA_K_, patchSize_);
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include "orb_processing.h"
 #include "print_stats.h"
+#include "parallel_images.hpp"
+#include "feature_cache.hpp"
 #include <iostream>
 #include <chrono>
 #include <filesystem>
@@ -15,16 +17,24 @@ void extractORBFeaturesFromContainer(
     ORBExtractor& orb_extractor,
     std::map<FlowerType, std::vector<cv::Mat>>& temp_descriptors)
 {
+    // Extract in parallel, each task with its own extractor; descriptors are grouped in order afterwards
+    std::vector<cv::Mat> image_descriptors(images.size());
+    forEachImage(images,
+        [&orb_extractor]() { return orb_extractor.clone(); },
+        [&](ORBExtractor& extractor, size_t i, const FlowerImage& img) {
+            std::vector<cv::KeyPoint> keypoints;
+            cv::Mat& descriptors = image_descriptors[i];
+            
+            // Look up the feature cache before extracting
+            if (!loadCachedFeatures(extractor.getParamsKey(), img.getImageGrayscale(), &keypoints, descriptors)) {
+                extractor.extract(img.getImageGrayscale(), keypoints, descriptors);
+                storeCachedFeatures(extractor.getParamsKey(), img.getImageGrayscale(), &keypoints, descriptors);
+            }
+        });
+    
     for (size_t i = 0; i < images.size(); i++) {
-        const FlowerImage& img = images.at(i);
-        
-        std::vector<cv::KeyPoint> keypoints;
-        cv::Mat descriptors;
-        
-        orb_extractor.extract(img.getImageGrayscale(), keypoints, descriptors);
-        
-        if (!descriptors.empty()) {
-            temp_descriptors[img.flowerType()].push_back(descriptors);
+        if (!image_descriptors[i].empty()) {
+            temp_descriptors[images.metadataAt(i).flowerType()].push_back(image_descriptors[i]);
         }
     }
 }
@@ -37,14 +47,8 @@ void combineORBDescriptors(
     cout << "\nCombining training descriptors per class..." << endl;
     
     for (const auto& [flower_type, desc_vec] : temp_descriptors) {
-        cv::Mat combined;
-        for (const auto& desc : desc_vec) {
-            if (combined.empty()) {
-                combined = desc.clone();
-            } else {
-                cv::vconcat(combined, desc, combined);
-            }
-        }
+        // Every image's descriptors are copied once into the matrix of the class
+        cv::Mat combined = stackDescriptors(desc_vec);
         
         train_descriptors[flower_type] = combined;
         
@@ -54,13 +58,24 @@ void combineORBDescriptors(
     }
 }
 
+void buildORBIndex(
+    const std::map<FlowerType, cv::Mat>& train_descriptors,
+    ORBTrainIndex& train_index)
+{
+    LabelledDescriptors labelled;
+    buildLabelledDescriptors(train_descriptors, labelled);
+    train_index.index = MIHIndex(labelled.descriptors);
+    train_index.labels = std::move(labelled.labels);
+}
+
 void trainORB(
     const FlowerImageContainer& train_healthy,
     const FlowerImageContainer& train_diseased,
     ORBExtractor& orb_extractor,
     std::map<FlowerType, cv::Mat>& train_descriptors,
     const std::vector<std::string>& class_names,
-    bool use_diseased)
+    bool use_diseased,
+    ORBTrainIndex* train_index)
 {
     cout << "\nORB Training:" << endl;
     cout << "Extracting ORB features from training images..." << endl;
@@ -76,11 +91,56 @@ void trainORB(
     }
     
     combineORBDescriptors(temp_descriptors, train_descriptors, class_names);
+
+    if (train_index != nullptr) {
+        cout << "Building multi-index hashing index..." << endl;
+        buildORBIndex(train_descriptors, *train_index);
+    }
+}
+
+bool classifyORB(
+    const cv::Mat& image_gray,
+    const ORBTrainIndex& train_index,
+    ORBExtractor& orb_extractor,
+    double threshold,
+    FlowerType& predicted_type)
+{
+    std::vector<cv::KeyPoint> keypoints;
+    cv::Mat descriptors;
+    
+    // Extract ORB features from the test image
+    orb_extractor.extract(image_gray, keypoints, descriptors);
+    
+    if (descriptors.empty()) {
+        return false;
+    }
+    
+    if (train_index.index.empty()) {
+        predicted_type = FlowerType::NoFlower;
+        return true;
+    }
+    
+    // Nearest neighbours among the descriptors of all the classes: with the ratio test, every accepted
+    // match votes as soon as it is found; otherwise each one is filtered on the minimum distance of its class
+    const double ratio = getRatioTest();
+    if (ratio > 0.0) {
+        ClassVotes votes{};
+        orb_extractor.ratioMatch(descriptors, train_index.index, ratio, [&](const cv::DMatch& match) {
+            votes[static_cast<size_t>(train_index.labels[match.trainIdx])]++;
+        });
+        predicted_type = mostVoted(votes);
+    } else {
+        std::vector<cv::DMatch> matches;
+        orb_extractor.matchDescriptors(descriptors, train_index.index, matches);
+        predicted_type = voteClasses(matches, train_index.labels, threshold);
+    }
+    
+    return true;
 }
 
 void testORB(
     const FlowerImageContainer& test_images,
-    const std::map<FlowerType, cv::Mat>& train_descriptors,
+    const ORBTrainIndex& train_index,
     ORBExtractor& orb_extractor,
     Metrics& metrics,
     const std::vector<std::string>& class_names,
@@ -92,42 +152,33 @@ void testORB(
     cout << "Threshold: " << threshold << endl;
     cout << "Testing on " << test_images.size() << " images..." << endl;
     
+    // Classify test images in parallel, each task with its own extractor
+    std::vector<TestOutcome> outcomes(test_images.size());
+    forEachImage(test_images,
+        [&orb_extractor]() { return orb_extractor.clone(); },
+        [&](ORBExtractor& extractor, size_t i, const FlowerImage& test_img) {
+            // Start timing
+            auto start_time = std::chrono::high_resolution_clock::now();
+            
+            // Extract features and find best matching class
+            TestOutcome& outcome = outcomes[i];
+            outcome.classified = classifyORB(test_img.getImageGrayscale(), train_index, extractor, threshold, outcome.predicted_type);
+            
+            // End timing
+            auto end_time = std::chrono::high_resolution_clock::now();
+            outcome.time_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+        });
+    
     for (size_t i = 0; i < test_images.size(); i++) {
-        const FlowerImage& test_img = test_images.at(i);
-        
-        std::vector<cv::KeyPoint> test_keypoints;
-        cv::Mat test_descriptors;
-        
-        // Start timing
-        auto start_time = std::chrono::high_resolution_clock::now();
-        
-        // Extract ORB features from the test image
-        orb_extractor.extract(test_img.getImageGrayscale(), test_keypoints, test_descriptors);
-        
-        if (test_descriptors.empty()) {
+        const FlowerImage& test_img = test_images.metadataAt(i);
+        if (!outcomes[i].classified) {
             if (verbose) {
                 cout << "WARNING: No keypoints in " << test_img.name() << endl;
             }
             continue;
         }
-        
-        // Find best matching class
-        FlowerType predicted_type = FlowerType::NoFlower;
-        int max_matches = 0;
-        
-        for (const auto& [flower_type, train_desc] : train_descriptors) {
-            std::vector<cv::DMatch> good_matches;
-            orb_extractor.matchAndFilter(test_descriptors, train_desc, good_matches, threshold);
-            
-            if (static_cast<int>(good_matches.size()) > max_matches) {
-                max_matches = static_cast<int>(good_matches.size());
-                predicted_type = flower_type;
-            }
-        }
-        
-        // End timing
-        auto end_time = std::chrono::high_resolution_clock::now();
-        double total_time = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+        FlowerType predicted_type = outcomes[i].predicted_type;
+        double total_time = outcomes[i].time_ms;
         
         // Update metrics
         int true_class = static_cast<int>(test_img.flowerType());
@@ -156,21 +207,28 @@ void testORB(
 void orb(const FlowerImageContainer& test_images,
          const FlowerImageContainer& train_healthy,
          const FlowerImageContainer& train_diseased,
-         const std::string& output_dir)
+         const std::string& output_dir,
+         const std::map<FlowerType, cv::Mat>* pretrained_descriptors)
 {
     cout << "\n\n====================\n" << endl;
 
     ORBExtractor orb;  
     Metrics orb_metrics = createMetrics(6);
     std::map<FlowerType, cv::Mat> orb_train_descriptors;
+    ORBTrainIndex orb_train_index;
     ClassificationRecap orb_records;
     
-    // Train ORB
-    trainORB(train_healthy, train_diseased, orb, orb_train_descriptors, class_names, true);
+    // Train ORB, unless pretrained descriptors are given
+    if (pretrained_descriptors != nullptr) {
+        orb_train_descriptors = *pretrained_descriptors;
+        buildORBIndex(orb_train_descriptors, orb_train_index);
+    } else {
+        trainORB(train_healthy, train_diseased, orb, orb_train_descriptors, class_names, true, &orb_train_index);
+    }
     
     // Test ORB
-    double orb_threshold = 1.5;  // Can be tuned (higher = more matches, lower = stricter)
-    testORB(test_images, orb_train_descriptors, orb, orb_metrics, class_names, orb_threshold, &orb_records, true);
+    double orb_threshold = orb_default_threshold;
+    testORB(test_images, orb_train_index, orb, orb_metrics, class_names, orb_threshold, &orb_records, true);
     
     printClassificationReport(orb_metrics, class_names, "ORB");
 
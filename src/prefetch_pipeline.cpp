@@ -0,0 +1,69 @@
+// Author: Luca Pellegrini
+#include <prefetch_pipeline.hpp>
+
+#include <atomic>
+#include <utility>
+
+namespace
+{
+
+std::atomic<size_t> prefetch_depth {2};
+
+} // namespace
+
+void setPrefetchDepth(const size_t depth)
+{
+    prefetch_depth = depth;
+}
+
+size_t prefetchDepth()
+{
+    return prefetch_depth;
+}
+
+PrefetchThread& PrefetchThread::instance()
+{
+    static PrefetchThread prefetch_thread;
+    return prefetch_thread;
+}
+
+PrefetchThread::PrefetchThread() : m_thread {&PrefetchThread::run, this}
+{
+}
+
+PrefetchThread::~PrefetchThread()
+{
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_stop = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+}
+
+void PrefetchThread::submit(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_jobs.push_back(std::move(job));
+    }
+    m_cv.notify_one();
+}
+
+void PrefetchThread::run()
+{
+    std::unique_lock<std::mutex> lock {m_mutex};
+    while (true)
+    {
+        m_cv.wait(lock, [this]() { return m_stop || !m_jobs.empty(); });
+        if (m_jobs.empty())
+        {
+            return;  // stopping, and nothing left to run
+        }
+        std::function<void()> job {std::move(m_jobs.front())};
+        m_jobs.pop_front();
+        lock.unlock();
+        job();  // jobs handle their own exceptions
+        lock.lock();
+    }
+}
@@ -1,13 +1,19 @@
 // Author: Luca Pellegrini
 #include <preprocessing.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <filesystem>
 #include <iostream>
 #include <set>
+#include <utility>
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
 #include <flower_image_container.hpp>
+#include <parallel_images.hpp>
+#include <thread_pool.hpp>
 
 namespace fs = std::filesystem;
 using std::cout;
@@ -18,7 +24,8 @@ bool loadImages(
     const fs::path data_path,
     FlowerImageContainer& test_imgs,
     FlowerImageContainer& train_healthy_imgs,
-    FlowerImageContainer& train_diseased_imgs
+    FlowerImageContainer& train_diseased_imgs,
+    const DecodeOptions& decode_opts
 )
 {
     const fs::path test_path {data_path / "test_photos"};
@@ -26,9 +33,9 @@ bool loadImages(
     const fs::path train_diseased_path {data_path / "train_diseased_photos"};
 
     // Load test images
-    bool ok_1 = loadImagesFromDataset(test_path, true, 1, test_imgs);
-    bool ok_2 = loadImagesFromDataset(train_healthy_path, true, 0, train_healthy_imgs);
-    bool ok_3 = loadImagesFromDataset(train_diseased_path, false, 0, train_diseased_imgs);
+    bool ok_1 = loadImagesFromDataset(test_path, true, 1, test_imgs, decode_opts);
+    bool ok_2 = loadImagesFromDataset(train_healthy_path, true, 0, train_healthy_imgs, decode_opts);
+    bool ok_3 = loadImagesFromDataset(train_diseased_path, false, 0, train_diseased_imgs, decode_opts);
 
     return (ok_1 && ok_2 && ok_3);
 }
@@ -37,52 +44,115 @@ bool loadImagesFromDataset(
     const fs::path dir_path,
     const bool healthy,
     const int img_type,
-    FlowerImageContainer& imgs
+    FlowerImageContainer& imgs,
+    const DecodeOptions& decode_opts
+)
+{
+    std::vector<DatasetEntry> entries;
+    if (!listImagesFromDataset(dir_path, entries))
+    {
+        return false;
+    }
+    const size_t count {entries.size()};
+
+    if (imgs.isLazy())
+    {
+        // Images will be decoded on first access
+        for (const auto& entry : entries)
+        {
+            const FlowerImage img {entry.name, entry.fl_type, healthy, img_type, {}, {}};
+            imgs.push_back_lazy(entry.path.string(), img);
+        }
+        return true;
+    }
+
+    // Every task decodes into its own slots, so that the final ordering
+    // only depends on the (sorted) list of entries
+    std::vector<cv::Mat_<cv::Vec3b>> colors(count);
+    std::vector<cv::Mat_<uchar>> grays(count);
+    std::atomic<bool> ok {true};
+    ThreadPool::instance().parallelFor(count, [&](size_t begin, size_t end)
+    {
+        for (size_t i {begin}; i < end; i++)
+        {
+            const std::string img_path_str {entries[i].path.string()};
+            //cout << "Loading image: " << img_path_str << endl;  // DEBUG
+            if (!decodeImage(img_path_str, colors[i], grays[i], decode_opts))
+            {
+                cerr << "Error loading image: " << img_path_str << endl;
+                ok = false;
+            }
+        }
+    }, 1);
+    if (!ok)
+    {
+        return false;
+    }
+
+    for (size_t i {0}; i < count; i++)
+    {
+        imgs.emplace_back(entries[i].name, entries[i].fl_type, healthy, img_type,
+                          std::move(colors[i]), std::move(grays[i]));
+    }
+    return true;
+}
+
+bool listImagesFromDataset(
+    const fs::path dir_path,
+    std::vector<DatasetEntry>& entries
 )
 {
     using FlTp = FlowerType;
-    FlTp fl_type;
+    if (!fs::is_directory(dir_path))
+    {
+        cerr << "Not a directory: " << dir_path.string() << endl;
+        return false;
+    }
+
+    std::vector<fs::path> class_dirs;
     fs::directory_iterator fl_type_iterator {dir_path, fs::directory_options::skip_permission_denied};
     for (const auto& dir_entry : fl_type_iterator)
     {
         if (fs::is_directory(dir_entry))
         {
-            const std::string s {dir_entry.path().filename()};
-            cout << dir_entry.path() << endl;  // DEBUG
-            if (s == "daisy")
-                fl_type = FlTp::Daisy;
-            else if (s == "dandelion")
-                fl_type = FlTp::Dandelion;
-            else if (s == "roses")
-                fl_type = FlTp::Rose;
-            else if (s == "sunflowers")
-                fl_type = FlTp::Sunflower;
-            else if (s == "tulips")
-                fl_type = FlTp::Tulip;
-            else
-                fl_type = FlTp::NoFlower;
+            class_dirs.push_back(dir_entry.path());
+        }
+    }
+    std::sort(class_dirs.begin(), class_dirs.end());
 
-            fs::directory_iterator img_iterator {dir_entry.path(), fs::directory_options::skip_permission_denied};
-            for (const auto& img_entry : img_iterator)
+    for (const auto& class_dir : class_dirs)
+    {
+        const std::string s {class_dir.filename()};
+        FlTp fl_type;
+        if (s == "daisy")
+            fl_type = FlTp::Daisy;
+        else if (s == "dandelion")
+            fl_type = FlTp::Dandelion;
+        else if (s == "roses")
+            fl_type = FlTp::Rose;
+        else if (s == "sunflowers")
+            fl_type = FlTp::Sunflower;
+        else if (s == "tulips")
+            fl_type = FlTp::Tulip;
+        else
+            fl_type = FlTp::NoFlower;
+
+        std::vector<fs::path> img_paths;
+        fs::directory_iterator img_iterator {class_dir, fs::directory_options::skip_permission_denied};
+        for (const auto& img_entry : img_iterator)
+        {
+            const auto img_path {img_entry.path()};
+            if (fs::is_regular_file(img_entry) && isImage(img_path))
             {
-                const auto img_path {img_entry.path()};
-                if (fs::is_regular_file(img_entry) && isImage(img_path))
-                {
-                    const std::string img_path_str {img_path.string()};
-                    const std::string img_name {img_path.stem().string()};
-                    //cout << "Loading image: " << img_path_str << endl;  // DEBUG
-                    cv::Mat_<cv::Vec3b> img_color = cv::imread(img_path_str, cv::IMREAD_COLOR);
-                    cv::Mat_<uchar> img_gray = cv::imread(img_path_str, cv::IMREAD_GRAYSCALE);
-                    if (img_color.empty() || img_gray.empty())
-                    {
-                        cerr << "Error loading image: " << img_path_str << endl;
-                        return false;
-                    }
-                    FlowerImage img {img_name, fl_type, healthy, img_type, img_color, img_gray};
-                    imgs.push_back(img);
-                }
+                img_paths.push_back(img_path);
             }
         }
+        std::sort(img_paths.begin(), img_paths.end());
+
+        for (const auto& img_path : img_paths)
+        {
+            entries.push_back({img_path, img_path.stem().string(), fl_type});
+        }
     }
     return true;
 }
@@ -199,6 +269,93 @@ bool loadTemplateFromDataset(
     return (count_loaded == num_templ_per_class);
 }
 
+double cropImages(
+    const FlowerImageContainer& images,
+    const std::vector<cv::Rect>& rois,
+    const double margin,
+    FlowerImageContainer& cropped
+)
+{
+    CV_Assert(rois.size() == images.size());
+
+    // Region of image i, enlarged by the margin (empty: keep the whole image)
+    auto enlarged = [&rois, margin](const size_t i)
+    {
+        if (rois[i].empty())
+        {
+            return cv::Rect{};
+        }
+        const int dx {static_cast<int>(std::lround(margin * rois[i].width))};
+        const int dy {static_cast<int>(std::lround(margin * rois[i].height))};
+        return cv::Rect{rois[i].x - dx, rois[i].y - dy, rois[i].width + 2 * dx, rois[i].height + 2 * dy};
+    };
+
+    // Pixels of every image, and of its crop: the region clipped to the image, or the whole image
+    std::vector<size_t> full_pixels(images.size(), 0);
+    std::vector<size_t> kept_pixels(images.size(), 0);
+    std::vector<FlowerImage> crops;
+    if (!images.isLazy())
+    {
+        crops.resize(images.size());  // every image is cropped into its own slot, and appended in order
+    }
+    forEachImage(images, [&](size_t i, const FlowerImage& image)
+    {
+        const cv::Rect image_rect {0, 0, image.getImageColor().cols, image.getImageColor().rows};
+        cv::Rect roi {enlarged(i) & image_rect};
+        if (roi.empty())
+        {
+            roi = image_rect;
+        }
+        full_pixels[i] = static_cast<size_t>(image_rect.area());
+        kept_pixels[i] = static_cast<size_t>(roi.area());
+        if (images.isLazy())
+        {
+            return;  // only counting, the crops are taken below
+        }
+        if (image_rect.empty())
+        {
+            crops[i] = image;
+            return;
+        }
+        cv::Mat_<uchar> gray;
+        if (image.getImageGrayscale().size() == image.getImageColor().size())
+        {
+            gray = image.getImageGrayscale()(roi).clone();
+        }
+        crops[i] = FlowerImage{image.name(), image.flowerType(), image.isHealthy(), image.imageType(),
+                               image.getImageColor()(roi).clone(), gray};
+    });
+
+    if (images.isLazy())
+    {
+        // The crops are taken when the images are decoded again: `cropped` is lazy too, within the same budget
+        if (cropped.empty() && !cropped.isLazy())
+        {
+            cropped.setLazyLike(images);
+        }
+        for (size_t i {0}; i < images.size(); i++)
+        {
+            cropped.push_back_lazy(images, i, enlarged(i));
+        }
+    }
+    else
+    {
+        for (FlowerImage& crop : crops)
+        {
+            cropped.push_back(std::move(crop));
+        }
+    }
+
+    size_t kept {0};
+    size_t total {0};
+    for (size_t i {0}; i < images.size(); i++)
+    {
+        kept += kept_pixels[i];
+        total += full_pixels[i];
+    }
+    return (total > 0) ? static_cast<double>(kept) / total : 1.0;
+}
+
 bool isImage(const fs::path& file_path)
 {
     // Recognized extensions: JPG, JPEG, PNG, WEBP
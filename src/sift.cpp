@@ -3,6 +3,7 @@
 #include "sift.h"
 #include <chrono>
 #include <iostream>
+#include <sstream>
 #include <algorithm>
 
 SIFTExtractor::SIFTExtractor(
@@ -12,6 +13,12 @@ SIFTExtractor::SIFTExtractor(
     double edgeThreshold,
     double sigma
 ) : extractionTime_(0.0), keypointCount_(0), matchingTime_(0.0) {
+    nfeatures_ = nfeatures;
+    nOctaveLayers_ = nOctaveLayers;
+    contrastThreshold_ = contrastThreshold;
+    edgeThreshold_ = edgeThreshold;
+    sigma_ = sigma;
+
     sift_ = cv::SIFT::create(
         nfeatures,
         nOctaveLayers,
@@ -20,6 +27,12 @@ SIFTExtractor::SIFTExtractor(
         sigma
     );
 
+    std::ostringstream key;
+    key << "SIFT nfeatures=" << nfeatures << " nOctaveLayers=" << nOctaveLayers
+        << " contrastThreshold=" << contrastThreshold << " edgeThreshold=" << edgeThreshold
+        << " sigma=" << sigma;
+    paramsKey_ = key.str();
+
     // Initialize the BFMacher with L2 distance
     matcher_ = cv::FlannBasedMatcher::create();
 }
@@ -56,8 +69,9 @@ int SIFTExtractor::matchDescriptors(const cv::Mat &descriptors1, const cv::Mat &
     // Start timing
     auto start = std::chrono::high_resolution_clock::now();
     
-    // Match descriptors using the BFMatcher
-    matcher_->match(descriptors1, descriptors2, matches);
+    // Match descriptors using the FLANN index of descriptors2
+    trainMatcher(descriptors2);
+    matcher_->match(descriptors1, matches);
     
     // End timing
     auto end = std::chrono::high_resolution_clock::now();
@@ -66,6 +80,52 @@ int SIFTExtractor::matchDescriptors(const cv::Mat &descriptors1, const cv::Mat &
     return static_cast<int>(matches.size());
 }
 
+int SIFTExtractor::ratioMatch(const cv::Mat &descriptors1, const cv::Mat &descriptors2, double ratio, const std::function<void(const cv::DMatch &)> &onMatch){
+    // Check if descriptors are empty
+    if (descriptors1.empty() || descriptors2.empty()) {
+        std::cerr << "[SIFT ERROR] Empty descriptors for matching!" << std::endl;
+        matchingTime_ = 0.0;
+        return 0;
+    }
+    
+    // Start timing
+    auto start = std::chrono::high_resolution_clock::now();
+    
+    // Two nearest neighbours from the FLANN index (approximate: the search cannot stop early),
+    // then the ratio test; the match vectors are reused from call to call
+    trainMatcher(descriptors2);
+    matcher_->knnMatch(descriptors1, knnMatches_, 2);
+    int accepted = 0;
+    for (const auto& neighbours : knnMatches_) {
+        if (neighbours.size() == 1 || (neighbours.size() == 2 && neighbours[0].distance < ratio * neighbours[1].distance)) {
+            accepted++;
+            onMatch(neighbours[0]);
+        }
+    }
+    
+    // End timing
+    auto end = std::chrono::high_resolution_clock::now();
+    matchingTime_ = std::chrono::duration<double, std::milli>(end - start).count();
+
+    return accepted;
+}
+
+void SIFTExtractor::trainMatcher(const cv::Mat &descriptors){
+    // Index the train descriptors only when they change: matching every test image against
+    // the same matrix reuses the trained FLANN index
+    if (descriptors.data != trainDescriptors_.data || descriptors.size() != trainDescriptors_.size()) {
+        matcher_ = cv::FlannBasedMatcher::create();     // the previous index may be shared: never clear it
+        matcher_->add(std::vector<cv::Mat>{descriptors});
+        matcher_->train();
+        trainDescriptors_ = descriptors;    // holds the data, so that its address is not reused
+    }
+}
+
+void SIFTExtractor::setTrainedMatcher(const cv::Mat &descriptors, const cv::Ptr<cv::DescriptorMatcher> &matcher){
+    matcher_ = matcher;
+    trainDescriptors_ = descriptors;    // trainMatcher() finds them already indexed
+}
+
 std::vector<cv::DMatch> SIFTExtractor::filterMatches(const std::vector<cv::DMatch> &matches, double threshold){
     // Check if there are matches to filter
     if (matches.empty()) {
@@ -118,4 +178,14 @@ int SIFTExtractor::getKeypointCount() const {
 // Get the time taken for the last matching operation
 double SIFTExtractor::getMatchingTime() const {
     return matchingTime_;
+}
+
+// Get a string identifying the extraction parameters
+const std::string& SIFTExtractor::getParamsKey() const {
+    return paramsKey_;
+}
+
+// Create a new extractor with the same parameters
+SIFTExtractor SIFTExtractor::clone() const {
+    return SIFTExtractor(nfeatures_, nOctaveLayers_, contrastThreshold_, edgeThreshold_, sigma_);
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include "sift_processing.h"
 #include "print_stats.h"
+#include "parallel_images.hpp"
+#include "feature_cache.hpp"
 #include <iostream>
 #include <chrono>
 #include <filesystem>
@@ -15,16 +17,24 @@ void extractSIFTFeaturesFromContainer(
     SIFTExtractor& sift_extractor,
     std::map<FlowerType, std::vector<cv::Mat>>& temp_descriptors)
 {
+    // Extract in parallel, each task with its own extractor; descriptors are grouped in order afterwards
+    std::vector<cv::Mat> image_descriptors(images.size());
+    forEachImage(images,
+        [&sift_extractor]() { return sift_extractor.clone(); },
+        [&](SIFTExtractor& extractor, size_t i, const FlowerImage& img) {
+            std::vector<cv::KeyPoint> keypoints;
+            cv::Mat& descriptors = image_descriptors[i];
+            
+            // Look up the feature cache before extracting
+            if (!loadCachedFeatures(extractor.getParamsKey(), img.getImageGrayscale(), &keypoints, descriptors)) {
+                extractor.extract(img.getImageGrayscale(), keypoints, descriptors);
+                storeCachedFeatures(extractor.getParamsKey(), img.getImageGrayscale(), &keypoints, descriptors);
+            }
+        });
+    
     for (size_t i = 0; i < images.size(); i++) {
-        const FlowerImage& img = images.at(i);
-        
-        std::vector<cv::KeyPoint> keypoints;
-        cv::Mat descriptors;
-        
-        sift_extractor.extract(img.getImageGrayscale(), keypoints, descriptors);
-        
-        if (!descriptors.empty()) {
-            temp_descriptors[img.flowerType()].push_back(descriptors);
+        if (!image_descriptors[i].empty()) {
+            temp_descriptors[images.metadataAt(i).flowerType()].push_back(image_descriptors[i]);
         }
     }
 }
@@ -37,14 +47,8 @@ void combineSIFTDescriptors(
     cout << "\nCombining training descriptors per class..." << endl;
     
     for (const auto& [flower_type, desc_vec] : temp_descriptors) {
-        cv::Mat combined;
-        for (const auto& desc : desc_vec) {
-            if (combined.empty()) {
-                combined = desc.clone();
-            } else {
-                cv::vconcat(combined, desc, combined);
-            }
-        }
+        // Every image's descriptors are copied once into the matrix of the class
+        cv::Mat combined = stackDescriptors(desc_vec);
         
         train_descriptors[flower_type] = combined;
         
@@ -81,9 +85,54 @@ void trainSIFT(
     combineSIFTDescriptors(temp_descriptors, train_descriptors, class_names);
 }
 
+bool classifySIFT(
+    const cv::Mat& image_gray,
+    const LabelledDescriptors& train_descriptors,
+    SIFTExtractor& sift_extractor,
+    double threshold,
+    FlowerType& predicted_type)
+{
+    std::vector<cv::KeyPoint> keypoints;
+    cv::Mat descriptors;
+    
+    // Extract features
+    sift_extractor.extract(image_gray, keypoints, descriptors);
+    
+    if (descriptors.empty()) {
+        return false;
+    }
+    
+    if (train_descriptors.descriptors.empty()) {
+        predicted_type = FlowerType::NoFlower;
+        return true;
+    }
+    
+    // Reuse the FLANN index shared by all the threads, if it has been trained
+    if (train_descriptors.matcher) {
+        sift_extractor.setTrainedMatcher(train_descriptors.descriptors, train_descriptors.matcher);
+    }
+    
+    // Nearest neighbours among the descriptors of all the classes: with the ratio test, every accepted
+    // match votes as soon as it is found; otherwise each one is filtered on the minimum distance of its class
+    const double ratio = getRatioTest();
+    if (ratio > 0.0) {
+        ClassVotes votes{};
+        sift_extractor.ratioMatch(descriptors, train_descriptors.descriptors, ratio, [&](const cv::DMatch& match) {
+            votes[static_cast<size_t>(train_descriptors.labels[match.trainIdx])]++;
+        });
+        predicted_type = mostVoted(votes);
+    } else {
+        std::vector<cv::DMatch> matches;
+        sift_extractor.matchDescriptors(descriptors, train_descriptors.descriptors, matches);
+        predicted_type = voteClasses(matches, train_descriptors.labels, threshold);
+    }
+    
+    return true;
+}
+
 void testSIFT(
     const FlowerImageContainer& test_images,
-    const std::map<FlowerType, cv::Mat>& train_descriptors,
+    const LabelledDescriptors& train_descriptors,
     SIFTExtractor& sift_extractor,
     Metrics& metrics,
     const std::vector<std::string>& class_names,
@@ -95,42 +144,33 @@ void testSIFT(
     cout << "Threshold: " << threshold << endl;
     cout << "Testing on " << test_images.size() << " images..." << endl;
         
+    // Classify test images in parallel, each task with its own extractor
+    std::vector<TestOutcome> outcomes(test_images.size());
+    forEachImage(test_images,
+        [&sift_extractor]() { return sift_extractor.clone(); },
+        [&](SIFTExtractor& extractor, size_t i, const FlowerImage& test_img) {
+            // Start timing
+            auto start_time = std::chrono::high_resolution_clock::now();
+            
+            // Extract features and find best matching class
+            TestOutcome& outcome = outcomes[i];
+            outcome.classified = classifySIFT(test_img.getImageGrayscale(), train_descriptors, extractor, threshold, outcome.predicted_type);
+            
+            // End timing
+            auto end_time = std::chrono::high_resolution_clock::now();
+            outcome.time_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+        });
+    
     for (size_t i = 0; i < test_images.size(); i++) {
-        const FlowerImage& test_img = test_images.at(i);
-        
-        std::vector<cv::KeyPoint> test_keypoints;
-        cv::Mat test_descriptors;
-        
-        // Start timing
-        auto start_time = std::chrono::high_resolution_clock::now();
-        
-        // Extract features
-        sift_extractor.extract(test_img.getImageGrayscale(), test_keypoints, test_descriptors);
-        
-        if (test_descriptors.empty()) {
+        const FlowerImage& test_img = test_images.metadataAt(i);
+        if (!outcomes[i].classified) {
             if (verbose) {
                 cout << "WARNING: No keypoints in " << test_img.name() << endl;
             }
             continue;
         }
-        
-        // Find best match
-        FlowerType predicted_type = FlowerType::NoFlower;
-        int max_matches = 0;
-        
-        for (const auto& [flower_type, train_desc] : train_descriptors) {
-            std::vector<cv::DMatch> good_matches;
-            sift_extractor.matchAndFilter(test_descriptors, train_desc, good_matches, threshold);
-            
-            if (static_cast<int>(good_matches.size()) > max_matches) {
-                max_matches = static_cast<int>(good_matches.size());
-                predicted_type = flower_type;
-            }
-        }
-        
-        // End timing
-        auto end_time = std::chrono::high_resolution_clock::now();
-        double total_time = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+        FlowerType predicted_type = outcomes[i].predicted_type;
+        double total_time = outcomes[i].time_ms;
         
         // Update metrics
         int true_class = static_cast<int>(test_img.flowerType());
@@ -160,19 +200,28 @@ void sift(
     const FlowerImageContainer& test_images,
     const FlowerImageContainer& train_healthy,
     const FlowerImageContainer& train_diseased,
-    const std::string& output_dir
+    const std::string& output_dir,
+    const std::map<FlowerType, cv::Mat>* pretrained_descriptors
 ) {
     SIFTExtractor sift;
     Metrics sift_metrics = createMetrics(6);
     std::map<FlowerType, cv::Mat> sift_train_descriptors;
+    LabelledDescriptors sift_train_labelled;
     ClassificationRecap sift_records;
     
-    // Train SIFT
-    trainSIFT(train_healthy, train_diseased, sift, sift_train_descriptors, class_names, true);
+    // Train SIFT, unless pretrained descriptors are given
+    if (pretrained_descriptors != nullptr) {
+        sift_train_descriptors = *pretrained_descriptors;
+    } else {
+        trainSIFT(train_healthy, train_diseased, sift, sift_train_descriptors, class_names, true);
+    }
+    
+    buildLabelledDescriptors(sift_train_descriptors, sift_train_labelled);
+    trainLabelledMatcher(sift_train_labelled);
     
     // Test SIFT
-    double sift_threshold = 1.7;  // Can be tuned (higher = more matches, lower = stricter)
-    testSIFT(test_images, sift_train_descriptors, sift, sift_metrics, class_names, sift_threshold, &sift_records, true);
+    double sift_threshold = sift_default_threshold;
+    testSIFT(test_images, sift_train_labelled, sift, sift_metrics, class_names, sift_threshold, &sift_records, true);
     
     // Display results
     printClassificationReport(sift_metrics, class_names, "SIFT");
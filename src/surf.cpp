@@ -5,6 +5,7 @@
 #include "surf.h"
 #include <chrono>
 #include <iostream>
+#include <sstream>
 
 SURFExtractor::SURFExtractor(
     double hessianThreshold,
@@ -13,6 +14,12 @@ SURFExtractor::SURFExtractor(
     bool extended,
     bool upright
 ) : extractionTime_(0.0), keypointCount_(0) {
+    hessianThreshold_ = hessianThreshold;
+    nOctaves_ = nOctaves;
+    nOctaveLayers_ = nOctaveLayers;
+    extended_ = extended;
+    upright_ = upright;
+
     surf_ = cv::xfeatures2d::SURF::create(
         hessianThreshold,
         nOctaves,
@@ -21,6 +28,11 @@ SURFExtractor::SURFExtractor(
         upright
     );
 
+    std::ostringstream key;
+    key << "SURF hessianThreshold=" << hessianThreshold << " nOctaves=" << nOctaves
+        << " nOctaveLayers=" << nOctaveLayers << " extended=" << extended << " upright=" << upright;
+    paramsKey_ = key.str();
+
     // Use FLANN-based matcher for SURF descriptors
     matcher_ = cv::FlannBasedMatcher::create();
 }
@@ -57,8 +69,9 @@ int SURFExtractor::matchDescriptors(const cv::Mat &descriptors1, const cv::Mat &
     // Start timing
     auto start = std::chrono::high_resolution_clock::now();
     
-    // Match descriptors using the BFMatcher
-    matcher_->match(descriptors1, descriptors2, matches);
+    // Match descriptors using the FLANN index of descriptors2
+    trainMatcher(descriptors2);
+    matcher_->match(descriptors1, matches);
     
     // End timing
     auto end = std::chrono::high_resolution_clock::now();
@@ -67,6 +80,52 @@ int SURFExtractor::matchDescriptors(const cv::Mat &descriptors1, const cv::Mat &
     return static_cast<int>(matches.size());
 }
 
+int SURFExtractor::ratioMatch(const cv::Mat &descriptors1, const cv::Mat &descriptors2, double ratio, const std::function<void(const cv::DMatch &)> &onMatch){
+    // Check if descriptors are empty
+    if (descriptors1.empty() || descriptors2.empty()) {
+        std::cerr << "[SURF ERROR] Empty descriptors for matching!" << std::endl;
+        matchingTime_ = 0.0;
+        return 0;
+    }
+    
+    // Start timing
+    auto start = std::chrono::high_resolution_clock::now();
+    
+    // Two nearest neighbours from the FLANN index (approximate: the search cannot stop early),
+    // then the ratio test; the match vectors are reused from call to call
+    trainMatcher(descriptors2);
+    matcher_->knnMatch(descriptors1, knnMatches_, 2);
+    int accepted = 0;
+    for (const auto& neighbours : knnMatches_) {
+        if (neighbours.size() == 1 || (neighbours.size() == 2 && neighbours[0].distance < ratio * neighbours[1].distance)) {
+            accepted++;
+            onMatch(neighbours[0]);
+        }
+    }
+    
+    // End timing
+    auto end = std::chrono::high_resolution_clock::now();
+    matchingTime_ = std::chrono::duration<double, std::milli>(end - start).count();
+
+    return accepted;
+}
+
+void SURFExtractor::trainMatcher(const cv::Mat &descriptors){
+    // Index the train descriptors only when they change: matching every test image against
+    // the same matrix reuses the trained FLANN index
+    if (descriptors.data != trainDescriptors_.data || descriptors.size() != trainDescriptors_.size()) {
+        matcher_ = cv::FlannBasedMatcher::create();     // the previous index may be shared: never clear it
+        matcher_->add(std::vector<cv::Mat>{descriptors});
+        matcher_->train();
+        trainDescriptors_ = descriptors;    // holds the data, so that its address is not reused
+    }
+}
+
+void SURFExtractor::setTrainedMatcher(const cv::Mat &descriptors, const cv::Ptr<cv::DescriptorMatcher> &matcher){
+    matcher_ = matcher;
+    trainDescriptors_ = descriptors;    // trainMatcher() finds them already indexed
+}
+
 std::vector<cv::DMatch> SURFExtractor::filterMatches(const std::vector<cv::DMatch> &matches, double threshold){
     // Check if there are matches to filter
     if (matches.empty()) {
@@ -121,4 +180,14 @@ double SURFExtractor::getMatchingTime() const {
     return matchingTime_;
 }
 
+// Get a string identifying the extraction parameters
+const std::string& SURFExtractor::getParamsKey() const {
+    return paramsKey_;
+}
+
+// Create a new extractor with the same parameters
+SURFExtractor SURFExtractor::clone() const {
+    return SURFExtractor(hessianThreshold_, nOctaves_, nOctaveLayers_, extended_, upright_);
+}
+
 #endif // ENABLE_SURF
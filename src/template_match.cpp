@@ -1,14 +1,23 @@
 // Author: Luca Pellegrini
 #include <template_match.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
 #include <iostream>
+#include <sstream>
 #include <filesystem>
+#include <utility>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
 
 #include <flower_type.hpp>  // num_classes, class_names
 #include <metrics.h>
 #include <print_stats.h>
+#include <parallel_images.hpp>
+#include <thread_pool.hpp>
 
 namespace fs = std::filesystem;
 using std::cout;
@@ -18,6 +27,49 @@ using std::endl;
 using ClassificationRecord = std::array<std::string, 3>;
 using ClassificationRecap = std::vector<ClassificationRecord>;
 
+namespace
+{
+
+// Lock-free maximum: retry until `value` is stored or a greater value is found
+void atomicMax(std::atomic<double>& max_value, const double value)
+{
+    double current {max_value.load(std::memory_order_relaxed)};
+    while (value > current && !max_value.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+// Maps a rectangle from an image of size `from` to the same image resized to `to`
+cv::Rect scaleRect(const cv::Rect& rect, const cv::Size& from, const cv::Size& to)
+{
+    if (rect.empty() || from.area() == 0)
+    {
+        return cv::Rect{};
+    }
+    const double fx {static_cast<double>(to.width) / from.width};
+    const double fy {static_cast<double>(to.height) / from.height};
+    const cv::Point tl {static_cast<int>(std::floor(rect.x * fx)), static_cast<int>(std::floor(rect.y * fy))};
+    const cv::Point br {static_cast<int>(std::ceil(rect.br().x * fx)), static_cast<int>(std::ceil(rect.br().y * fy))};
+    return cv::Rect{tl, br} & cv::Rect{cv::Point{0, 0}, to};
+}
+
+// ThreadPool::parallelFor(), attributing the cv::Mat allocations of every task to the test image of the
+// calling thread, whichever thread runs the task. While it waits, the calling thread may run tasks of
+// other images (which take their own counter) or of no image: its own counter is paused meanwhile
+template <typename Body>
+void parallelForImage(const size_t count, Body body, const size_t grain)
+{
+    std::atomic<size_t>* const counter {TMWorkspace::AllocationCount::current()};
+    const TMWorkspace::AllocationCount waiting {nullptr};
+    ThreadPool::instance().parallelFor(count, [counter, &body](size_t begin, size_t end)
+    {
+        const TMWorkspace::AllocationCount counting {counter};
+        body(begin, end);
+    }, grain);
+}
+
+} // namespace
+
 void template_match(
     const FlowerImageContainer& test_images,
     const std::vector<FlowerTemplate>& daisy_templates,
@@ -26,7 +78,9 @@ void template_match(
     const std::vector<FlowerTemplate>& sunflower_templates,
     const std::vector<FlowerTemplate>& tulip_templates,
     const fs::path output_dir,
-    bool& success
+    const TMSearchOptions& search_opts,
+    bool& success,
+    std::vector<cv::Rect>* rois
 )
 {
     success = false;  // initial value
@@ -36,6 +90,20 @@ void template_match(
     // Create classification records' vector
     ClassificationRecap tm_class_records;
 
+    // Everything about the templates is computed once, and reused for every test image and scale
+    TemplateSearch templates;
+    try
+    {
+        templates = TemplateSearch{TemplateBank{
+            daisy_templates, dandelion_templates, rose_templates, sunflower_templates, tulip_templates
+        }, search_opts};
+    }
+    catch (const cv::Exception& e)
+    {
+        cerr << "Error: template_match: " << e.what() << endl;
+        return;
+    }
+
     // for (const auto& templ : tulip_templates)
     // {
     //     const std::string templ_window {templ.name() + " template"};
@@ -47,140 +115,63 @@ void template_match(
     //     cv::waitKey(0);
     // }
 
-    // Process one test image at a time
+    // Test images are classified concurrently; results are stored by index and combined in order
     const size_t sz {test_images.size()};
-    for (size_t i {0}; i < sz; i++)
+    std::vector<TestOutcome> outcomes(sz);
+    std::vector<cv::Rect> predicted_rects(sz);
+    std::vector<size_t> allocated_bytes(sz, 0);
+    std::atomic<size_t> processed {0};
+    forEachImage(test_images, [&](size_t i, const FlowerImage& image)
     {
-        cout << "template_match: processing image [" << i+1 << "/" << sz << "] ..." << endl;
-        const FlowerImage& image = test_images.at(i);
-        const cv::Mat_<cv::Vec3b> img_test = image.getImageColor();
-        if (img_test.empty())
+        if (!image.getImageColor().empty())
         {
-            cerr << "Error: template_match: empty test image" << endl;
-            return;
-        }
+            std::atomic<size_t> image_bytes {0};
+            const TMWorkspace::AllocationCount counting {&image_bytes};
+            TMWorkspace::Scope scope;
 
-        // Start timing
-        auto start_time = std::chrono::high_resolution_clock::now();
+            // Start timing (scaling is part of the work done for every test image)
+            auto start_time = std::chrono::high_resolution_clock::now();
 
-        // Resize test image to two different sizes
-        cv::Mat_<cv::Vec3b> dst_1;
-        cv::Mat_<cv::Vec3b> dst_2;
-        cv::resize(img_test, dst_1, cv::Size(1200, 900));
-        cv::resize(img_test, dst_2, cv::Size(800, 600));
+            const std::vector<cv::Mat_<cv::Vec3b>>& scaled_images {
+                scaleForTM(image.getImageColor(), templates.options().scales, scope.workspace())};
 
-        // Array to store best matches for each test images
-        // For every class, store the maximum score achieved by one of the templates.
-        // The highest score determines the class assigned to the test image.
-        std::vector<double> class_scores(num_classes-1, 0.0);
+            std::vector<cv::Rect> class_rects;
+            outcomes[i].predicted_type = classifyTMScaled(scaled_images, templates, nullptr, &class_rects,
+                                                          templates.verifyPruning(i));
+            outcomes[i].classified = true;
 
-        double score_1, score_2;
-        // Daisy
-        {
-            score_1 = processImage(dst_1, daisy_templates);
-            score_2 = processImage(dst_2, daisy_templates);
-            double best_score = (score_1 > score_2) ? score_1 : score_2;
-            // cout << "template_match: image " << image.name()
-            //      << " class " << flowerTypeToString(FlowerType::Daisy)
-            //      << " score " << best_score << endl;  // DEBUG
-            class_scores.at(0) = best_score;
-        }
-        // Dandelion
-        {
-            score_1 = processImage(dst_1, dandelion_templates);
-            score_2 = processImage(dst_2, dandelion_templates);
-            double best_score = (score_1 > score_2) ? score_1 : score_2;
-            // cout << "template_match: image " << image.name()
-            //      << " class " << flowerTypeToString(FlowerType::Dandelion)
-            //      << " score " << best_score << endl;  // DEBUG
-            class_scores.at(1) = best_score;
-        }
-        // Rose
-        {
-            score_1 = processImage(dst_1, rose_templates);
-            score_2 = processImage(dst_2, rose_templates);
-            double best_score = (score_1 > score_2) ? score_1 : score_2;
-            // cout << "template_match: image " << image.name()
-            //      << " class " << flowerTypeToString(FlowerType::Rose)
-            //      << " score " << best_score << endl;  // DEBUG
-            class_scores.at(2) = best_score;
-        }
-        // Sunflower
-        {
-            score_1 = processImage(dst_1, sunflower_templates);
-            score_2 = processImage(dst_2, sunflower_templates);
-            double best_score = (score_1 > score_2) ? score_1 : score_2;
-            // cout << "template_match: image " << image.name()
-            //      << " class " << flowerTypeToString(FlowerType::Sunflower)
-            //      << " score " << best_score << endl;  // DEBUG
-            class_scores.at(3) = best_score;
+            // End timing
+            auto end_time = std::chrono::high_resolution_clock::now();
+            outcomes[i].time_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+
+            if (!scaled_images.empty())
+            {
+                predicted_rects[i] = scaleRect(class_rects[static_cast<size_t>(outcomes[i].predicted_type)],
+                                               scaled_images.front().size(), image.getImageColor().size());
+            }
+            allocated_bytes[i] = image_bytes;
         }
-        // Tulip
+        std::ostringstream progress;
+        progress << "template_match: processed image [" << ++processed << "/" << sz << "]\n";
+        cout << progress.str() << std::flush;
+    });
+
+    for (size_t i {0}; i < sz; i++)
+    {
+        const FlowerImage& image {test_images.metadataAt(i)};
+        if (!outcomes[i].classified)
         {
-            score_1 = processImage(dst_1, tulip_templates);
-            score_2 = processImage(dst_2, tulip_templates);
-            double best_score = (score_1 > score_2) ? score_1 : score_2;
-            // cout << "template_match: image " << image.name()
-            //      << " class " << flowerTypeToString(FlowerType::Tulip)
-            //      << " score " << best_score << endl;  // DEBUG
-            class_scores.at(4) = best_score;
+            cerr << "Error: template_match: empty test image" << endl;
+            return;
         }
-
-        // for (int j {0}; j < num_classes-1; j++)
-        // {
-        //     double score_1, score_2;
-        //     FlowerType fl_type;
-        //     switch (j)
-        //     {
-        //     case 0:  // Daisy
-        //         fl_type = FlowerType::Daisy;
-        //         score_1 = processImage(img_test, daisy_templates);
-        //         score_2 = processImage(img_test, daisy_templates);
-        //         break;
-        //     case 1:  // Dandelion
-        //         fl_type = FlowerType::Dandelion;
-        //         score_1 = processImage(img_test, dandelion_templates);
-        //         score_2 = processImage(img_test, dandelion_templates);
-        //         break;
-        //     case 2:  // Rose
-        //         fl_type = FlowerType::Rose;
-        //         score_1 = processImage(img_test, rose_templates);
-        //         score_2 = processImage(img_test, rose_templates);
-        //         break;
-        //     case 3:  // Sunflower
-        //         fl_type = FlowerType::Sunflower;
-        //         score_1 = processImage(img_test, sunflower_templates);
-        //         score_2 = processImage(img_test, sunflower_templates);
-        //         break;
-        //     case 4:  // Tulip
-        //         fl_type = FlowerType::Tulip;
-        //         score_1 = processImage(img_test, tulip_templates);
-        //         score_2 = processImage(img_test, tulip_templates);
-        //         break;
-        //     }
-        //     double best_score = (score_1 > score_2) ? score_1 : score_2;
-        //     cout << "template_match: image " << image.name()
-        //          << " class " << flowerTypeToString(fl_type)
-        //          << " score " << best_score << endl;  // DEBUG
-        //     class_scores.at(j) = best_score;
-        // }
-
-        // End timing
-        auto end_time = std::chrono::high_resolution_clock::now();
-        double total_time = std::chrono::duration<double, std::milli>(end_time - start_time).count();
-
-        std::vector<double>::iterator max;
-        max = std::max_element(class_scores.begin(), class_scores.end());
-        const int idx = std::distance(class_scores.begin(), max);
-        const auto predicted_type {static_cast<FlowerType>(idx)};
-        const double predicted_score {*max};
+        const FlowerType predicted_type {outcomes[i].predicted_type};
 
         // Update metrics
         int true_class = static_cast<int>(image.flowerType());
         int predicted_class = static_cast<int>(predicted_type);
 
         addPrediction(tm_metrics, true_class, predicted_class);
-        addProcessingTime(tm_metrics, total_time);
+        addProcessingTime(tm_metrics, outcomes[i].time_ms);
 
         ClassificationRecord record = {
             image.name(),
@@ -193,81 +184,352 @@ void template_match(
     }
 
     printClassificationReport(tm_metrics, class_names, "Template Matching");
+    if (templates.options().pyramid_levels > 0)
+    {
+        const TMSearchStats stats {templates.searchStats()};
+        cout << "Coarse-to-fine search (exact, " << templates.options().pyramid_levels << " levels): scored "
+             << stats.refined << " of " << stats.blocks
+             << (templates.options().method == cv::TM_SQDIFF_NORMED ? " blocks of positions" : " tiles")
+             << " at full resolution (" << (stats.blocks > 0 ? 100.0 * stats.refined / stats.blocks : 0.0) << "%)"
+             << endl;
+        if (templates.options().verify)
+        {
+            cout << "Coarse-to-fine search: maximum differs from the exhaustive one in " << stats.differing << " of "
+                 << stats.searches << " searches, largest difference " << stats.max_difference << endl;
+        }
+    }
+    if (templates.options().eigen_templates > 0 && templates.options().verify)
+    {
+        const TMSearchStats stats {templates.searchStats()};
+        cout << "Eigen-templates (" << templates.options().eigen_templates << " per class, top "
+             << templates.options().top_k << "): maximum differs from the exhaustive one in "
+             << stats.differing << " of " << stats.searches << " searches ("
+             << (stats.searches > 0 ? 100.0 * stats.differing / stats.searches : 0.0)
+             << "%), largest difference " << stats.max_difference << endl;
+    }
+    if (templates.options().prune)
+    {
+        const TMSearchStats stats {templates.searchStats()};
+        cout << "Pruning (lossy): skipped " << stats.pruned << " of " << stats.pairs << " (class, scale) pairs; on "
+             << stats.pruning_verified << " verified test images, " << stats.wrongly_pruned
+             << " skipped pairs would have beaten the best class" << endl;
+        if (stats.wrongly_pruned > 0)
+        {
+            cerr << "Warning: template matching pruning skipped winning pairs: "
+                 << "increase --tm-prune-margin, or search without --tm-prune" << endl;
+        }
+    }
+    if (TMWorkspace::countingAllocations() && sz > 0)
+    {
+        // Workspaces grow on the first images of every thread, and on images larger than the ones seen
+        // so far; after that, classifying should not allocate. Test images are classified in no
+        // particular order, so no range of indices is known to be past the warm-up: count the images
+        // that did not allocate instead
+        size_t total {0};
+        size_t max {0};
+        size_t no_allocation {0};
+        for (size_t i {0}; i < sz; i++)
+        {
+            total += allocated_bytes[i];
+            max = std::max(max, allocated_bytes[i]);
+            if (allocated_bytes[i] == 0)
+            {
+                no_allocation++;
+            }
+        }
+        cout << "Template matching allocations (cv::Mat): " << total / sz << " bytes per image, at most " << max
+             << "; " << no_allocation << " of " << sz << " test images allocated nothing" << endl;
+    }
     // Save classification recap to file
     fs::path records_path {output_dir / "tm_recap.txt"};
     saveClassificationRecap(tm_class_records, tm_metrics, class_names, "TM", records_path.string());
 
+    if (rois != nullptr)
+    {
+        *rois = std::move(predicted_rects);
+    }
     success = true;
 }
 
-double processImage(
-    const cv::Mat_<cv::Vec3b> img_test,
-    const std::vector<FlowerTemplate>& templates
+const std::vector<cv::Mat_<cv::Vec3b>>& scaleForTM(
+    const cv::Mat_<cv::Vec3b>& image,
+    const std::vector<int>& scales,
+    TMWorkspace& workspace
+)
+{
+    // One pyramid per test image: from the largest scale to the smallest one, every
+    // scale is resized from the previous one. The aspect ratio is preserved
+    std::vector<int> sides {scales};
+    std::sort(sides.begin(), sides.end(), std::greater<int>());
+    sides.erase(std::unique(sides.begin(), sides.end()), sides.end());
+
+    std::vector<cv::Mat_<cv::Vec3b>>& scaled_images {workspace.scaled_images};
+    scaled_images.clear();
+    if (workspace.scale_buffers.size() < sides.size())
+    {
+        workspace.scale_buffers.resize(sides.size());
+    }
+    const double longest_side {static_cast<double>(std::max(image.cols, image.rows))};
+    for (const int side : sides)
+    {
+        const double factor {side / longest_side};
+        const cv::Size size {std::max(1, static_cast<int>(std::lround(image.cols * factor))),
+                             std::max(1, static_cast<int>(std::lround(image.rows * factor)))};
+        cv::Mat_<cv::Vec3b> scaled {workspace.scale_buffers[scaled_images.size()].get<cv::Vec3b>(size)};
+        if (scaled_images.empty())
+        {
+            cv::resize(image, scaled, size);
+        }
+        else
+        {
+            cv::resize(scaled_images.back(), scaled, size, 0, 0, cv::INTER_AREA);
+        }
+        scaled_images.push_back(scaled);
+    }
+    return scaled_images;
+}
+
+FlowerType classifyTMScaled(
+    const std::vector<cv::Mat_<cv::Vec3b>>& scaled_images,
+    const TemplateSearch& templates,
+    std::vector<double>* class_scores,
+    std::vector<cv::Rect>* class_rects,
+    const bool verify_pruning
 )
 {
-    // Current best score for this class
-    float score {0.0f};
+    // Every scaled image is prepared once, and shared by the templates of all classes.
+    // Prepared images are reused from one test image to the next
+    TMWorkspace::Scope scope;
+    std::vector<TemplateSearch::PreparedImage>& prepared {scope.workspace().prepared};
+    if (prepared.size() < scaled_images.size())
+    {
+        prepared.resize(scaled_images.size());
+    }
+    parallelForImage(scaled_images.size(), [&](size_t begin, size_t end)
+    {
+        for (size_t i {begin}; i < end; i++)
+        {
+            templates.prepareImage(scaled_images[i], prepared[i]);
+        }
+    }, 1);
 
-    for (const auto& templ : templates)
+    // Every (class, scale, template) triple is an independent task; with eigen-templates,
+    // the templates of a class share most of the work, and every (class, scale) pair is a task
+    struct Evaluation
     {
-        const cv::Mat_<cv::Vec3b> img_template = templ.getTemplate();
-        const cv::Mat_<uchar> img_mask = templ.getMask();
-        if (img_template.empty() || img_mask.empty())
+        size_t c;
+        size_t scale;
+        size_t t;
+    };
+    const size_t num_scales {scaled_images.size()};
+    const bool by_class {templates.searchesByClass()};
+    auto addPair = [&templates, by_class](std::vector<Evaluation>& evaluations, const size_t c, const size_t scale)
+    {
+        for (size_t t {0}; t < (by_class ? 1 : templates.numTemplates(c)); t++)
         {
-            cerr << "Error: processImage: empty template of mask image" << endl;
-            continue;
+            evaluations.push_back({c, scale, t});
         }
+    };
+    auto score = [&](const Evaluation& eval, cv::Rect* match_rect = nullptr)
+    {
+        return by_class ? templates.classMaxScore(prepared[eval.scale], eval.c, match_rect) :
+                          templates.maxScore(prepared[eval.scale], eval.c, eval.t, match_rect);
+    };
 
-        auto match_method = cv::TM_CCORR_NORMED;  // TM_SQDIFF or TM_CCORR_NORMED
-
-        // const std::string image_window {"Test image"};
-        // const std::string templ_window {"Template image"};
-        // const std::string result_window {"TM result"};
-        // cv::namedWindow(image_window, cv::WINDOW_AUTOSIZE);
-        // cv::namedWindow(templ_window, cv::WINDOW_AUTOSIZE);
-        // cv::namedWindow(result_window, cv::WINDOW_AUTOSIZE);
-        // cv::Mat_<cv::Vec3b> img_display;
-        // img_test.copyTo(img_display);
-
-        const int result_cols = img_test.cols - img_template.cols + 1;
-        const int result_rows = img_test.rows - img_template.rows + 1;
-        cv::Mat_<float> result;
-        result.create(result_rows, result_cols);
-
-        cv::matchTemplate(img_test, img_template, result, match_method, img_mask);
-        // Divide all elements of `result` by the mask_white_area
-        // float mask_white_area = cv::countNonZero(img_mask);
-        // cv::MatIterator_<float> it, end;
-        // for (it = result.begin(), end = result.end(); it != end; it++)
-        // {
-        //     *it = *it / mask_white_area;
-        // }
-
-        // Localize min and max in result
-        double minVal; double maxVal; cv::Point minLoc; cv::Point maxLoc;
-        cv::Point matchLoc;
-        cv::minMaxLoc(result, &minVal, &maxVal, &minLoc, &maxLoc);
-        if( match_method  == cv::TM_SQDIFF || match_method == cv::TM_SQDIFF_NORMED )
+    // For every class, store the best match of one of the templates.
+    // The highest score determines the class assigned to the test image
+    struct Match
+    {
+        double score {0.0};
+        size_t scale {0};
+        cv::Rect rect;  // in the coordinates of scaled_images[scale]
+    };
+    std::vector<Match> best_matches(templates.numClasses());
+    auto evaluate = [&](const std::vector<Evaluation>& evaluations)
+    {
+        std::vector<Match> found(evaluations.size());
+        parallelForImage(evaluations.size(), [&](size_t begin, size_t end)
+        {
+            for (size_t e {begin}; e < end; e++)
+            {
+                const Evaluation& eval {evaluations[e]};
+                found[e].score = score(eval, &found[e].rect);
+                found[e].scale = eval.scale;
+            }
+        }, 1);
+        // Combined in order: the best matches do not depend on the order in which tasks end
+        for (size_t e {0}; e < evaluations.size(); e++)
         {
-            matchLoc = minLoc;
+            Match& best {best_matches[evaluations[e].c]};
+            if (found[e].score > best.score)
+            {
+                best = found[e];
+            }
         }
-        else
+    };
+    auto bestScore = [&best_matches]()
+    {
+        double best {0.0};
+        for (const Match& match : best_matches)
+        {
+            best = std::max(best, match.score);
+        }
+        return best;
+    };
+
+    if (!templates.options().prune)
+    {
+        std::vector<Evaluation> evaluations;
+        for (size_t c {0}; c < templates.numClasses(); c++)
+        {
+            for (size_t scale {0}; scale < num_scales; scale++)
+            {
+                addPair(evaluations, c, scale);
+            }
+        }
+        evaluate(evaluations);
+    }
+    else
+    {
+        // Estimated score of every (class, scale) pair, from the coarse scores of its templates
+        std::vector<Evaluation> all_evaluations;
+        for (size_t c {0}; c < templates.numClasses(); c++)
+        {
+            for (size_t scale {0}; scale < num_scales; scale++)
+            {
+                for (size_t t {0}; t < templates.numTemplates(c); t++)
+                {
+                    all_evaluations.push_back({c, scale, t});
+                }
+            }
+        }
+        std::vector<std::atomic<double>> estimates(templates.numClasses() * num_scales);
+        for (std::atomic<double>& estimate : estimates)
         {
-            matchLoc = maxLoc;
+            estimate.store(0.0, std::memory_order_relaxed);
         }
-        if (maxVal > score)
+        parallelForImage(all_evaluations.size(), [&](size_t begin, size_t end)
+        {
+            for (size_t e {begin}; e < end; e++)
+            {
+                const Evaluation& eval {all_evaluations[e]};
+                atomicMax(estimates[eval.c * num_scales + eval.scale],
+                          templates.coarseEstimate(prepared[eval.scale], eval.c, eval.t));
+            }
+        }, 1);
+
+        // First the most promising scale of every class, then only the pairs that can
+        // still beat the best class. Both steps depend only on the estimates and on the
+        // scores of the first step, so pruning is deterministic too
+        std::vector<Evaluation> evaluations;
+        std::vector<size_t> first_scale(templates.numClasses(), 0);
+        for (size_t c {0}; c < templates.numClasses(); c++)
         {
-            score = maxVal;
+            for (size_t scale {1}; scale < num_scales; scale++)
+            {
+                if (estimates[c * num_scales + scale] > estimates[c * num_scales + first_scale[c]])
+                {
+                    first_scale[c] = scale;
+                }
+            }
+            if (num_scales > 0)
+            {
+                addPair(evaluations, c, first_scale[c]);
+            }
         }
+        evaluate(evaluations);
 
-        // Show result
-        // cv::rectangle(img_display, matchLoc, cv::Point(matchLoc.x + img_template.cols , matchLoc.y + img_template.rows), cv::Scalar::all(0), 2, 8, 0);
-        // cv::rectangle(result, matchLoc, cv::Point(matchLoc.x + img_template.cols , matchLoc.y + img_template.rows), cv::Scalar::all(0), 2, 8, 0);
-        // cv::imshow(image_window, img_display);
-        // cv::imshow(templ_window, img_template);
-        // cv::imshow(result_window, result);
-        // cv::waitKey(0);
+        const double best_after_first {bestScore()};
+        evaluations.clear();
+        std::vector<std::pair<size_t, size_t>> pruned_pairs;
+        for (size_t c {0}; c < templates.numClasses(); c++)
+        {
+            for (size_t scale {0}; scale < num_scales; scale++)
+            {
+                if (scale == first_scale[c])
+                {
+                    continue;
+                }
+                if (estimates[c * num_scales + scale] > best_after_first)
+                {
+                    addPair(evaluations, c, scale);
+                }
+                else
+                {
+                    pruned_pairs.push_back({c, scale});
+                }
+            }
+        }
+        evaluate(evaluations);
+
+        // Pairs skipped by mistake: their actual score would have beaten the best class.
+        // Estimates are not bounds, so the caller has this checked on some images (see TemplateSearch::verifyPruning())
+        size_t wrongly_pruned {0};
+        if (verify_pruning)
+        {
+            const double best {bestScore()};
+            for (const auto& [c, scale] : pruned_pairs)
+            {
+                std::vector<Evaluation> pair_evaluations;
+                addPair(pair_evaluations, c, scale);
+                for (const Evaluation& eval : pair_evaluations)
+                {
+                    if (score(eval) > best)
+                    {
+                        wrongly_pruned++;
+                        break;
+                    }
+                }
+            }
+        }
+        templates.recordPruning(templates.numClasses() * num_scales, pruned_pairs.size(), wrongly_pruned, verify_pruning);
     }
 
-    return score;
+    std::vector<double> scores(best_matches.size());
+    for (size_t c {0}; c < scores.size(); c++)
+    {
+        scores[c] = best_matches[c].score;
+    }
+    if (class_rects != nullptr)
+    {
+        class_rects->assign(best_matches.size(), cv::Rect{});
+        for (size_t c {0}; c < best_matches.size(); c++)
+        {
+            const Match& match {best_matches[c]};
+            if (match.score > 0.0)
+            {
+                (*class_rects)[c] = scaleRect(match.rect, scaled_images[match.scale].size(),
+                                              scaled_images.front().size());
+            }
+        }
+    }
+
+    const auto max {std::max_element(scores.begin(), scores.end())};
+    const auto predicted_type {static_cast<FlowerType>(std::distance(scores.begin(), max))};
+    if (class_scores != nullptr)
+    {
+        *class_scores = std::move(scores);
+    }
+    return predicted_type;
+}
+
+FlowerType classifyTM(
+    const cv::Mat_<cv::Vec3b>& image,
+    const TemplateSearch& templates,
+    std::vector<double>* class_scores,
+    std::vector<cv::Rect>* class_rects,
+    const bool verify_pruning
+)
+{
+    TMWorkspace::Scope scope;
+    const std::vector<cv::Mat_<cv::Vec3b>>& scaled_images {scaleForTM(image, templates.options().scales, scope.workspace())};
+    const FlowerType predicted_type {classifyTMScaled(scaled_images, templates, class_scores, class_rects, verify_pruning)};
+    if (class_rects != nullptr && !scaled_images.empty())
+    {
+        for (cv::Rect& rect : *class_rects)
+        {
+            rect = scaleRect(rect, scaled_images.front().size(), image.size());
+        }
+    }
+    return predicted_type;
 }
@@ -0,0 +1,548 @@
+// Author: Luca Pellegrini
+#include <template_search.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <opencv2/imgproc.hpp>
+#include <tm_workspace.hpp>
+
+namespace
+{
+
+// Coarse templates must keep at least this many pixels on their shortest side
+constexpr int min_coarse_side {8};
+
+// Refined and exhaustive maxima closer than this are the same match
+// (MaskedNCC and the spatial-domain scores differ by about 1e-6)
+constexpr double verify_tolerance {1e-4};
+
+template <typename T>
+cv::Mat_<T> pyrDownOnce(const cv::Mat_<T>& image)
+{
+    cv::Mat_<T> down;
+    cv::pyrDown(image, down);
+    return down;
+}
+
+} // namespace
+
+TemplateSearch::TemplateSearch(const TemplateBank& templates, const TMSearchOptions& opts) :
+    m_opts{opts}
+{
+    m_opts.pyramid_levels = std::max(0, m_opts.pyramid_levels);
+    m_opts.top_k = std::max(1, m_opts.top_k);
+    m_opts.eigen_templates = std::max(0, m_opts.eigen_templates);
+    if (m_opts.method != cv::TM_CCORR_NORMED && m_opts.method != cv::TM_SQDIFF_NORMED)
+    {
+        CV_Error(cv::Error::StsBadArg, "TemplateSearch: method must be TM_CCORR_NORMED or TM_SQDIFF_NORMED");
+    }
+    if (sqdiff() && m_opts.fourier_mellin)
+    {
+        CV_Error(cv::Error::StsBadArg, "TemplateSearch: TM_SQDIFF_NORMED does not apply to the Fourier-Mellin search");
+    }
+    if (m_opts.fourier_mellin)
+    {
+        // Scale and rotation come from the pose estimates: one scale of the test image, and no other search
+        const int side {m_opts.scales.empty() ? TMSearchOptions{}.scales.front() :
+                                                *std::max_element(m_opts.scales.begin(), m_opts.scales.end())};
+        m_opts.scales.assign(1, side);
+        m_opts.pyramid_levels = 0;
+        m_opts.eigen_templates = 0;
+        m_opts.prune = false;
+        m_opts.verify = false;
+        m_fourier_mellin = FourierMellin{templates, side, m_opts.fm_poses};
+        m_ccorr.resize(templates.size());
+        for (size_t c {0}; c < templates.size(); c++)
+        {
+            m_ccorr[c].resize(templates[c].size());
+        }
+        return;
+    }
+
+    // Do not go down to templates of a few pixels
+    int min_side {0};
+    for (const std::vector<FlowerTemplate>& class_templates : templates)
+    {
+        for (const FlowerTemplate& templ : class_templates)
+        {
+            const cv::Size size {templ.getTemplate().size()};
+            const int side {std::min(size.width, size.height)};
+            if (side > 0 && (min_side == 0 || side < min_side))
+            {
+                min_side = side;
+            }
+        }
+    }
+    int max_levels {0};
+    while ((min_side >> (max_levels + 1)) >= min_coarse_side)
+    {
+        max_levels++;
+    }
+    m_opts.pyramid_levels = std::min(m_opts.pyramid_levels, max_levels);
+    if (sqdiff() && !coarseToFine())
+    {
+        // Whole maps at full resolution cost a pass over the template per position (hours per test set)
+        CV_Error(cv::Error::StsBadArg, "TemplateSearch: TM_SQDIFF_NORMED requires the coarse-to-fine search "
+                                       "(pyramid_levels > 0, and templates large enough to go down the pyramid)");
+    }
+    if (sqdiff())
+    {
+        m_opts.eigen_templates = 0;  // every score is computed in the spatial domain
+    }
+    if (coarseToFine())
+    {
+        m_opts.eigen_templates = 0;  // the coarse-to-fine search scores the tiles of every template on their own
+    }
+    if (m_opts.prune)
+    {
+        m_coarse_levels = coarseToFine() ? m_opts.pyramid_levels : std::min(estimate_levels, max_levels);
+    }
+
+    m_ccorr.resize(templates.size());
+    m_sqdiff.resize(templates.size());
+    m_bounds.resize(templates.size());
+    TemplateBank coarse_templates;
+    for (size_t c {0}; c < templates.size(); c++)
+    {
+        for (const FlowerTemplate& templ : templates[c])
+        {
+            const bool valid {!templ.getTemplate().empty() && templ.getMask().size() == templ.getTemplate().size()};
+            // Always add them, so that indices match the ones of `templates`
+            m_ccorr[c].push_back(searchesByClass() ? MaskedCCorr{templ.getTemplate(), templ.getMask()} :
+                                                     MaskedCCorr{});
+            m_sqdiff[c].push_back(sqdiff() && valid ? MaskedSqDiff{templ.getTemplate(), templ.getMask()} :
+                                                      MaskedSqDiff{});
+            m_bounds[c].push_back(coarseToFine() && valid ?
+                                  CoarseBound{templ.getTemplate(), templ.getMask(), m_opts.pyramid_levels} :
+                                  CoarseBound{});
+            if (m_coarse_levels == 0)
+            {
+                continue;
+            }
+
+            cv::Mat_<cv::Vec3b> level_templ {templ.getTemplate()};
+            cv::Mat_<uchar> binary_mask;
+            cv::Mat_<uchar> level_mask;
+            if (valid)
+            {
+                // Masks are used as binary masks: at every level, keep the pixels that are mostly inside
+                cv::threshold(templ.getMask(), binary_mask, 0, 255, cv::THRESH_BINARY);
+                for (int l {0}; l < m_coarse_levels; l++)
+                {
+                    level_templ = pyrDownOnce(level_templ);
+                    binary_mask = pyrDownOnce(binary_mask);
+                    cv::threshold(binary_mask, level_mask, 127, 255, cv::THRESH_BINARY);
+                }
+            }
+            else
+            {
+                level_templ.release();
+            }
+            coarse_templates[c].emplace_back(templ.name(), templ.flowerType(), templ.isHealthy(),
+                                             templ.imageType(), level_templ, level_mask);
+        }
+    }
+    if (m_coarse_levels > 0)
+    {
+        m_coarse = MaskedNCC{coarse_templates};
+    }
+    if (searchesByClass())
+    {
+        m_eigen = MaskedNCC{templates, m_opts.eigen_templates};
+    }
+    if (!sqdiff() && (!searchesByClass() || m_opts.verify))
+    {
+        m_full = MaskedNCC{templates};
+    }
+}
+
+bool TemplateSearch::empty() const
+{
+    return m_full.empty() && m_eigen.empty() && m_coarse.empty() && m_fourier_mellin.empty() &&
+        (!sqdiff() || m_sqdiff.empty());
+}
+
+size_t TemplateSearch::numClasses() const
+{
+    return m_ccorr.size();
+}
+
+size_t TemplateSearch::numTemplates(const size_t c) const
+{
+    return m_ccorr.at(c).size();
+}
+
+const TMSearchOptions& TemplateSearch::options() const
+{
+    return m_opts;
+}
+
+bool TemplateSearch::coarseToFine() const
+{
+    return (m_opts.pyramid_levels > 0);
+}
+
+bool TemplateSearch::sqdiff() const
+{
+    return (m_opts.method == cv::TM_SQDIFF_NORMED);
+}
+
+bool TemplateSearch::searchesByClass() const
+{
+    return (m_opts.eigen_templates > 0);
+}
+
+void TemplateSearch::prepareImage(const cv::Mat_<cv::Vec3b>& image, PreparedImage& prepared) const
+{
+    prepared.image = image;
+    if (m_opts.fourier_mellin)
+    {
+        m_fourier_mellin.prepareImage(image, prepared.fourier_mellin);
+        return;
+    }
+    // Both objects cut test images into the same tiles
+    if (!m_full.empty())
+    {
+        m_full.transformImage(image, prepared.spectra);
+    }
+    else if (!m_eigen.empty())
+    {
+        m_eigen.transformImage(image, prepared.spectra);
+    }
+    if (coarseToFine())
+    {
+        CoarseBound::prepareImage(image, m_opts.pyramid_levels, prepared.coarse_bound);
+    }
+    if (sqdiff())
+    {
+        MaskedSqDiff::integrate(image, prepared.integral);
+    }
+    if (m_coarse_levels > 0)
+    {
+        if (prepared.level_buffers.size() < static_cast<size_t>(m_coarse_levels))
+        {
+            prepared.level_buffers.resize(m_coarse_levels);
+        }
+        cv::Mat_<cv::Vec3b> coarse {image};
+        for (int l {1}; l <= m_coarse_levels; l++)
+        {
+            const cv::Size down_size {(coarse.cols + 1) / 2, (coarse.rows + 1) / 2};
+            cv::Mat_<cv::Vec3b> down {prepared.level_buffers[l - 1].get<cv::Vec3b>(down_size)};
+            cv::pyrDown(coarse, down);
+            coarse = down;
+        }
+        m_coarse.transformImage(coarse, prepared.coarse_spectra);
+    }
+}
+
+double TemplateSearch::maxScore(const PreparedImage& prepared, const size_t c, const size_t t,
+                                cv::Rect* match_rect) const
+{
+    if (m_opts.fourier_mellin)
+    {
+        return m_fourier_mellin.maxScore(prepared.fourier_mellin, c, t, nullptr, match_rect);
+    }
+    if (searchesByClass())
+    {
+        cv::Mat_<float> scores;
+        m_eigen.match(prepared.spectra, c, t, scores);
+        const double found {rescore(prepared, c, t, scores, match_rect)};
+        if (m_opts.verify)
+        {
+            recordVerification(m_full.maxScore(prepared.spectra, c, t), found);
+        }
+        return found;
+    }
+    if (!coarseToFine())
+    {
+        cv::Point max_loc;
+        const double found {m_full.maxScore(prepared.spectra, c, t, &max_loc)};
+        if (match_rect != nullptr && found > 0.0)
+        {
+            *match_rect = cv::Rect{max_loc, m_full.templateSize(c, t)};
+        }
+        return found;
+    }
+
+    const double refined {refine(prepared, c, t, match_rect)};
+    if (m_opts.verify)
+    {
+        const double exact {sqdiff() ? exhaustiveSqDiff(prepared, c, t, nullptr) :
+                                       m_full.maxScore(prepared.spectra, c, t)};
+        recordVerification(exact, refined);
+    }
+    return refined;
+}
+
+double TemplateSearch::classMaxScore(const PreparedImage& prepared, const size_t c, cv::Rect* match_rect) const
+{
+    double best {0.0};
+    cv::Rect rect;
+    if (!searchesByClass())
+    {
+        for (size_t t {0}; t < numTemplates(c); t++)
+        {
+            const double found {maxScore(prepared, c, t, &rect)};
+            if (found > best)
+            {
+                best = found;
+                if (match_rect != nullptr)
+                {
+                    *match_rect = rect;
+                }
+            }
+        }
+        return best;
+    }
+
+    MaskedNCC::BasisMaps maps;
+    m_eigen.matchBases(prepared.spectra, c, maps);
+    cv::Mat_<float> scores;
+    for (size_t t {0}; t < numTemplates(c); t++)
+    {
+        m_eigen.reconstruct(maps, c, t, scores);
+        const double found {rescore(prepared, c, t, scores, &rect)};
+        if (m_opts.verify)
+        {
+            recordVerification(m_full.maxScore(prepared.spectra, c, t), found);
+        }
+        if (found > best)
+        {
+            best = found;
+            if (match_rect != nullptr)
+            {
+                *match_rect = rect;
+            }
+        }
+    }
+    return best;
+}
+
+double TemplateSearch::coarseEstimate(const PreparedImage& prepared, const size_t c, const size_t t) const
+{
+    if (m_coarse_levels == 0)
+    {
+        return 1.0;  // normalized cross-correlation never exceeds 1
+    }
+    return std::min(1.0, m_coarse.maxScore(prepared.coarse_spectra, c, t) + m_opts.prune_margin);
+}
+
+bool TemplateSearch::verifyPruning(const size_t image_index) const
+{
+    return m_opts.verify || (image_index % prune_verify_interval == 0);
+}
+
+void TemplateSearch::recordPruning(const size_t pairs, const size_t pruned, const size_t wrongly_pruned,
+                                   const bool verified) const
+{
+    std::lock_guard<std::mutex> lock {m_stats->mutex};
+    m_stats->stats.pairs += pairs;
+    m_stats->stats.pruned += pruned;
+    if (verified)
+    {
+        m_stats->stats.wrongly_pruned += wrongly_pruned;
+        m_stats->stats.pruning_verified++;
+    }
+}
+
+double TemplateSearch::refine(const PreparedImage& prepared, const size_t c, const size_t t,
+                              cv::Rect* match_rect) const
+{
+    const CoarseBound& bound {m_bounds.at(c).at(t)};
+    if (bound.empty())
+    {
+        return 0.0;
+    }
+    const cv::Size templ {sqdiff() ? m_sqdiff[c][t].size() : m_full.templateSize(c, t)};
+    const cv::Size result_size {prepared.image.cols - templ.width + 1, prepared.image.rows - templ.height + 1};
+    if (result_size.width <= 0 || result_size.height <= 0)
+    {
+        return 0.0;
+    }
+    const int block {bound.blockSize()};
+    TMWorkspace::Scope scope;
+    TMWorkspace& workspace {scope.workspace()};
+    cv::Mat_<float> bounds {workspace.bounds.get<float>(cv::Size{(result_size.width + block - 1) / block,
+                                                                  (result_size.height + block - 1) / block})};
+    bound.bounds(prepared.coarse_bound, result_size, bounds);
+
+    // Branch and bound: blocks of positions are scored in decreasing order of their bound, until the next
+    // bound does not exceed the best score found. The blocks are the tiles of MaskedNCC, which score all their
+    // positions at once, or the coarse cells with TM_SQDIFF_NORMED, whose positions are scored one by one
+    std::vector<std::pair<float, size_t>> order;
+    std::vector<cv::Rect> tiles;
+    if (sqdiff())
+    {
+        for (int y {0}; y < bounds.rows; y++)
+        {
+            for (int x {0}; x < bounds.cols; x++)
+            {
+                order.emplace_back(bounds(y, x), static_cast<size_t>(y) * bounds.cols + x);
+            }
+        }
+    }
+    else
+    {
+        m_full.tileOutputs(prepared.spectra, c, t, tiles);
+        for (size_t i {0}; i < tiles.size(); i++)
+        {
+            const cv::Rect& tile {tiles[i]};
+            if (tile.empty())
+            {
+                continue;
+            }
+            const cv::Rect cells {cv::Point{tile.x / block, tile.y / block},
+                                  cv::Point{(tile.br().x - 1) / block + 1, (tile.br().y - 1) / block + 1}};
+            double tile_bound;
+            cv::minMaxLoc(bounds(cells), nullptr, &tile_bound);
+            order.emplace_back(static_cast<float>(tile_bound), i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    cv::Mat_<float> scores;
+    if (!sqdiff())
+    {
+        scores = workspace.scores.get<float>(result_size);
+    }
+    double best {0.0};
+    cv::Point best_pos;
+    size_t refined {0};
+    for (const auto& [block_bound, index] : order)
+    {
+        if (block_bound <= best)
+        {
+            break;  // neither this block nor the next ones can beat the best score
+        }
+        refined++;
+        if (sqdiff())
+        {
+            const int x {static_cast<int>(index % bounds.cols)};
+            const int y {static_cast<int>(index / bounds.cols)};
+            const cv::Rect positions {cv::Rect{x * block, y * block, block, block} &
+                                      cv::Rect{0, 0, result_size.width, result_size.height}};
+            for (int py {positions.y}; py < positions.y + positions.height; py++)
+            {
+                for (int px {positions.x}; px < positions.x + positions.width; px++)
+                {
+                    const double score {m_sqdiff[c][t].scoreAt(prepared.image, prepared.integral, cv::Point{px, py})};
+                    if (score > best)
+                    {
+                        best = score;
+                        best_pos = cv::Point{px, py};
+                    }
+                }
+            }
+        }
+        else
+        {
+            m_full.matchTile(prepared.spectra, c, t, index, scores);
+            double tile_max;
+            cv::Point tile_loc;
+            cv::minMaxLoc(scores(tiles[index]), nullptr, &tile_max, nullptr, &tile_loc);
+            if (tile_max > best)
+            {
+                best = tile_max;
+                best_pos = tiles[index].tl() + tile_loc;
+            }
+        }
+    }
+    recordRefinement(order.size(), refined);
+    if (match_rect != nullptr && best > 0.0)
+    {
+        *match_rect = cv::Rect{best_pos, templ};
+    }
+    return best;
+}
+
+double TemplateSearch::exhaustiveSqDiff(const PreparedImage& prepared, const size_t c, const size_t t,
+                                        cv::Rect* match_rect) const
+{
+    // Verification of the coarse-to-fine search
+    const MaskedSqDiff& templ {m_sqdiff.at(c).at(t)};
+    const cv::Mat_<cv::Vec3b>& image {prepared.image};
+    if (templ.empty())
+    {
+        return 0.0;
+    }
+    const cv::Size size {image.cols - templ.size().width + 1, image.rows - templ.size().height + 1};
+    if (size.width <= 0 || size.height <= 0)
+    {
+        return 0.0;
+    }
+    TMWorkspace::Scope scope;
+    cv::Mat_<float> scores {scope.workspace().scores.get<float>(size)};
+    templ.match(image, prepared.integral, scores);
+    double max_val;
+    cv::Point max_loc;
+    cv::minMaxLoc(scores, nullptr, &max_val, nullptr, &max_loc);
+    if (match_rect != nullptr && max_val > 0.0)
+    {
+        *match_rect = cv::Rect{max_loc, templ.size()};
+    }
+    return max_val;
+}
+
+double TemplateSearch::rescore(const PreparedImage& prepared, const size_t c, const size_t t,
+                               cv::Mat_<float>& scores, cv::Rect* match_rect) const
+{
+    const MaskedCCorr& templ {m_ccorr.at(c).at(t)};
+    if (scores.empty() || templ.empty())
+    {
+        return 0.0;
+    }
+    double best {0.0};
+    cv::Point pos;
+    for (int k {0}; k < m_opts.top_k && nextPeak(scores, pos); k++)
+    {
+        const double score {templ.scoreAt(prepared.image, pos)};
+        if (score > best)
+        {
+            best = score;
+            if (match_rect != nullptr)
+            {
+                *match_rect = cv::Rect{pos, templ.size()};
+            }
+        }
+    }
+    return best;
+}
+
+bool TemplateSearch::nextPeak(cv::Mat_<float>& scores, cv::Point& pos)
+{
+    double peak;
+    cv::minMaxLoc(scores, nullptr, &peak, nullptr, &pos);
+    if (peak < 0.0)
+    {
+        return false;  // every position has already been taken
+    }
+    // Suppress the peak and its neighbours, so that the next candidate is a different match
+    scores(cv::Rect{pos.x - 1, pos.y - 1, 3, 3} & cv::Rect{0, 0, scores.cols, scores.rows}).setTo(-1.0f);
+    return true;
+}
+
+void TemplateSearch::recordRefinement(const size_t blocks, const size_t refined) const
+{
+    std::lock_guard<std::mutex> lock {m_stats->mutex};
+    m_stats->stats.blocks += blocks;
+    m_stats->stats.refined += refined;
+}
+
+void TemplateSearch::recordVerification(const double exact, const double found) const
+{
+    const double difference {std::abs(exact - found)};
+    std::lock_guard<std::mutex> lock {m_stats->mutex};
+    m_stats->stats.searches++;
+    if (difference > verify_tolerance)
+    {
+        m_stats->stats.differing++;
+    }
+    m_stats->stats.max_difference = std::max(m_stats->stats.max_difference, difference);
+}
+
+TMSearchStats TemplateSearch::searchStats() const
+{
+    std::lock_guard<std::mutex> lock {m_stats->mutex};
+    return m_stats->stats;
+}
@@ -0,0 +1,220 @@
+// Author: Luca Pellegrini
+#include <thread_pool.hpp>
+
+#include <utility>
+#include <opencv2/core.hpp>
+
+namespace
+{
+
+std::atomic<size_t> configured_threads {0};
+
+// Index of the worker running on this thread (in the pool's queues), or -1 outside the pool
+thread_local int worker_index {-1};
+
+} // namespace
+
+ThreadPool& ThreadPool::instance()
+{
+    static ThreadPool pool {configured_threads};
+    return pool;
+}
+
+void ThreadPool::setNumThreads(const size_t num_threads)
+{
+    const size_t hw_threads {std::max<size_t>(1, std::thread::hardware_concurrency())};
+    const size_t n {num_threads > 0 ? num_threads : hw_threads};
+    configured_threads = n;
+    // Each pool thread may call into OpenCV: share the hardware threads among them
+    cv::setNumThreads(static_cast<int>(std::max<size_t>(1, hw_threads / n)));
+}
+
+ThreadPool::ThreadPool(size_t num_threads)
+{
+    if (num_threads == 0)
+    {
+        num_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    const size_t num_workers {num_threads - 1};  // the submitting thread helps too
+    for (size_t i {0}; i <= num_workers; i++)
+    {
+        m_queues.push_back(std::make_unique<TaskQueue>());
+    }
+    for (size_t i {0}; i < num_workers; i++)
+    {
+        m_workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock {m_sleep_mutex};
+        m_stop = true;
+    }
+    m_sleep_cv.notify_all();
+    for (auto& worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::numThreads() const
+{
+    return m_workers.size() + 1;
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    const size_t queue_index {worker_index >= 0 ? static_cast<size_t>(worker_index) : m_queues.size() - 1};
+    {
+        TaskQueue& queue {*m_queues[queue_index]};
+        std::lock_guard<std::mutex> lock {queue.mutex};
+        queue.tasks.push_back(std::move(task));
+    }
+    {
+        // Taken so that a worker cannot miss the notification between its check and its wait
+        std::lock_guard<std::mutex> lock {m_sleep_mutex};
+        m_queued++;
+        if (m_waiters > 0)
+        {
+            m_wait_cv.notify_all();
+        }
+    }
+    m_sleep_cv.notify_one();
+}
+
+bool ThreadPool::runPendingTask()
+{
+    std::function<void()> task;
+    const size_t num_queues {m_queues.size()};
+    const size_t own {worker_index >= 0 ? static_cast<size_t>(worker_index) : num_queues - 1};
+
+    // Own queue first (most recent task, likely to be hot in cache), then steal the oldest ones
+    {
+        TaskQueue& queue {*m_queues[own]};
+        std::lock_guard<std::mutex> lock {queue.mutex};
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+    }
+    for (size_t k {1}; !task && k < num_queues; k++)
+    {
+        TaskQueue& queue {*m_queues[(own + k) % num_queues]};
+        std::lock_guard<std::mutex> lock {queue.mutex};
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+    }
+    if (!task)
+    {
+        return false;
+    }
+    m_queued--;
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop(const size_t index)
+{
+    worker_index = static_cast<int>(index);
+    while (true)
+    {
+        if (runPendingTask())
+        {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock {m_sleep_mutex};
+        m_sleep_cv.wait(lock, [this] { return m_stop || m_queued > 0; });
+        if (m_stop)
+        {
+            return;
+        }
+    }
+}
+
+ThreadPool::TaskGroup::TaskGroup(ThreadPool& pool)
+    : m_pool {pool}
+{
+}
+
+ThreadPool::TaskGroup::~TaskGroup()
+{
+    // Tasks reference the group: never leave them running
+    waitPending();
+}
+
+void ThreadPool::TaskGroup::run(std::function<void()> task)
+{
+    if (m_pool.m_workers.empty())
+    {
+        execute(task);  // single-threaded pool
+        return;
+    }
+    m_pending++;
+    m_pool.submit([this, task = std::move(task)]()
+    {
+        execute(task);
+        // The group may be destroyed as soon as m_pending reaches 0: only the pool is used afterwards.
+        // The decrement is done under the lock, so a waiter cannot miss it between its check and its wait
+        ThreadPool& pool {m_pool};
+        {
+            std::lock_guard<std::mutex> lock {pool.m_sleep_mutex};
+            if (--m_pending > 0 || pool.m_waiters == 0)  // last access to the group
+            {
+                return;
+            }
+        }
+        pool.m_wait_cv.notify_all();
+    });
+}
+
+void ThreadPool::TaskGroup::execute(const std::function<void()>& task)
+{
+    try
+    {
+        task();
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock {m_error_mutex};
+        if (!m_error)
+        {
+            m_error = std::current_exception();
+        }
+    }
+}
+
+void ThreadPool::TaskGroup::waitPending()
+{
+    while (m_pending > 0)
+    {
+        if (m_pool.runPendingTask())
+        {
+            continue;
+        }
+        // Nothing to run: the remaining tasks of the group are running on other threads
+        std::unique_lock<std::mutex> lock {m_pool.m_sleep_mutex};
+        m_pool.m_waiters++;
+        m_pool.m_wait_cv.wait(lock, [this] { return m_pending == 0 || m_pool.m_queued > 0; });
+        m_pool.m_waiters--;
+    }
+}
+
+void ThreadPool::TaskGroup::wait()
+{
+    waitPending();
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock {m_error_mutex};
+        std::swap(error, m_error);
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,108 @@
+// Author: Luca Pellegrini
+#include <tm_workspace.hpp>
+
+#include <atomic>
+#include <memory>
+
+namespace
+{
+
+std::atomic<bool> counting {false};
+
+// Counter of the calling thread (see TMWorkspace::AllocationCount)
+thread_local std::atomic<size_t>* counted_bytes {nullptr};
+
+// Forwards to OpenCV's standard allocator, and counts the bytes of every new buffer
+// on the counter of the allocating thread. Buffers record the standard allocator as
+// theirs, so they are released by it directly
+class CountingAllocator : public cv::MatAllocator
+{
+public:
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usage_flags) const override
+    {
+        cv::UMatData* u {cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage_flags)};
+        if (u != nullptr && data == nullptr && counted_bytes != nullptr)
+        {
+            counted_bytes->fetch_add(u->size, std::memory_order_relaxed);
+        }
+        return u;
+    }
+
+    bool allocate(cv::UMatData* u, cv::AccessFlag flags, cv::UMatUsageFlags usage_flags) const override
+    {
+        return cv::Mat::getStdAllocator()->allocate(u, flags, usage_flags);
+    }
+
+    void deallocate(cv::UMatData* u) const override
+    {
+        cv::Mat::getStdAllocator()->deallocate(u);
+    }
+};
+
+// Workspaces of the calling thread; the first `depth` ones are in use
+struct ThreadWorkspaces
+{
+    std::vector<std::unique_ptr<TMWorkspace>> workspaces;
+    size_t depth {0};
+};
+
+ThreadWorkspaces& threadWorkspaces()
+{
+    thread_local ThreadWorkspaces workspaces;
+    return workspaces;
+}
+
+} // namespace
+
+TMWorkspace::Scope::Scope()
+{
+    ThreadWorkspaces& thread {threadWorkspaces()};
+    if (thread.depth == thread.workspaces.size())
+    {
+        thread.workspaces.push_back(std::make_unique<TMWorkspace>());
+    }
+    m_workspace = thread.workspaces[thread.depth].get();
+    thread.depth++;
+}
+
+TMWorkspace::Scope::~Scope()
+{
+    // Scopes are nested: the last one taken is the first one released
+    threadWorkspaces().depth--;
+}
+
+TMWorkspace& TMWorkspace::Scope::workspace() const
+{
+    return *m_workspace;
+}
+
+TMWorkspace::AllocationCount::AllocationCount(std::atomic<size_t>* bytes)
+    : m_previous {counted_bytes}
+{
+    counted_bytes = bytes;
+}
+
+TMWorkspace::AllocationCount::~AllocationCount()
+{
+    counted_bytes = m_previous;
+}
+
+std::atomic<size_t>* TMWorkspace::AllocationCount::current()
+{
+    return counted_bytes;
+}
+
+void TMWorkspace::countAllocations()
+{
+    static CountingAllocator allocator;
+    if (!counting.exchange(true))
+    {
+        cv::Mat::setDefaultAllocator(&allocator);
+    }
+}
+
+bool TMWorkspace::countingAllocations()
+{
+    return counting.load();
+}
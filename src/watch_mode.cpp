@@ -0,0 +1,207 @@
+// Author: Luca Pellegrini
+#include <watch_mode.hpp>
+
+#include <cerrno>
+#include <chrono>
+#include <climits>  // NAME_MAX
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <flower_type.hpp>
+#include <preprocessing.hpp>  // isImage()
+
+namespace fs = std::filesystem;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace
+{
+
+volatile std::sig_atomic_t stop_requested {0};
+
+void requestStop(int)
+{
+    stop_requested = 1;
+}
+
+void classifyNewImage(
+    const fs::path& img_path,
+    ClassifierModels& models,
+    const DecodeOptions& decode_opts,
+    std::ofstream& recap
+)
+{
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    cv::Mat_<cv::Vec3b> img_color;
+    cv::Mat_<uchar> img_gray;
+    if (!decodeImage(img_path.string(), img_color, img_gray, decode_opts))
+    {
+        cerr << "watch: cannot decode " << img_path.string() << endl;
+        return;
+    }
+    const ImagePredictions predictions {classifyImage(img_color, img_gray, models)};
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    double total_time = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+
+    std::string line {img_path.filename().string()};
+    line += " | SIFT: " + flowerTypeToString(predictions.sift);
+#ifdef ENABLE_SURF
+    line += " | SURF: " + flowerTypeToString(predictions.surf);
+#endif
+    line += " | ORB: " + flowerTypeToString(predictions.orb);
+    line += " | TM: " + flowerTypeToString(predictions.tm);
+    line += " | HOG: " + flowerTypeToString(predictions.hog);
+    line += " | BoW: " + flowerTypeToString(predictions.bow);
+    line += " | time: " + std::to_string(total_time) + " ms";
+
+    cout << "watch: " << line << endl;
+    recap << line << endl;  // flush, so that the recap can be followed while it grows
+}
+
+// Classify the images of the directory that are not in `seen`; `seen` then holds the names present in the
+// directory (the ones removed while events were dropped are forgotten)
+void classifyUnseenImages(
+    const fs::path& watch_dir,
+    std::set<std::string>& seen,
+    ClassifierModels& models,
+    const DecodeOptions& decode_opts,
+    std::ofstream& recap
+)
+{
+    std::set<std::string> present;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator {watch_dir, fs::directory_options::skip_permission_denied, ec})
+    {
+        const fs::path& img_path {entry.path()};
+        std::string name {img_path.filename().string()};
+        if (entry.is_regular_file(ec) && isImage(img_path) && seen.count(name) == 0)
+        {
+            classifyNewImage(img_path, models, decode_opts, recap);
+        }
+        present.insert(std::move(name));
+    }
+    if (ec)
+    {
+        cerr << "watch: cannot list " << watch_dir.string() << endl;
+        return;  // keep the old names, rather than classify everything again at the next overflow
+    }
+    seen = std::move(present);
+}
+
+} // namespace
+
+bool watchDirectory(
+    const fs::path watch_dir,
+    ClassifierModels& models,
+    const fs::path recap_path,
+    const DecodeOptions& decode_opts
+)
+{
+    const int fd {inotify_init1(IN_NONBLOCK | IN_CLOEXEC)};
+    if (fd < 0)
+    {
+        cerr << "watch: inotify_init1 failed" << endl;
+        return false;
+    }
+    if (inotify_add_watch(fd, watch_dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) < 0)
+    {
+        cerr << "watch: cannot watch " << watch_dir.string() << endl;
+        ::close(fd);
+        return false;
+    }
+    std::ofstream recap {recap_path, std::ios::app};
+    if (!recap)
+    {
+        cerr << "watch: cannot open " << recap_path.string() << endl;
+        ::close(fd);
+        return false;
+    }
+
+    // Names of the files in the directory (already present, or classified): when the event queue overflows, the
+    // directory is rescanned and only the images not in here are classified. Names are dropped when their file
+    // is deleted or moved away, so the set does not grow with the files that go through the directory
+    std::set<std::string> seen;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator {watch_dir, fs::directory_options::skip_permission_denied, ec})
+    {
+        seen.insert(entry.path().filename().string());
+    }
+
+    stop_requested = 0;
+    const auto prev_sigint {std::signal(SIGINT, requestStop)};
+    const auto prev_sigterm {std::signal(SIGTERM, requestStop)};
+
+    cout << "Watching " << watch_dir.string() << " for new images (Ctrl+C to stop)..." << endl;
+    cout << "Predictions are appended to " << recap_path.string() << endl;
+
+    // Large enough for several events; aligned as required by struct inotify_event
+    alignas(struct inotify_event) char buf[64 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+    pollfd pfd {fd, POLLIN, 0};
+    bool ok {true};
+    while (!stop_requested)
+    {
+        // Wake up periodically to check whether a stop was requested
+        const int ready {poll(&pfd, 1, 500)};
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            cerr << "watch: poll failed" << endl;
+            ok = false;
+            break;
+        }
+        if (ready == 0)
+        {
+            continue;
+        }
+
+        const ssize_t len {read(fd, buf, sizeof(buf))};
+        if (len <= 0)
+        {
+            continue;  // EAGAIN or EINTR
+        }
+        for (char* ptr {buf}; ptr < buf + len; )
+        {
+            const struct inotify_event* event {reinterpret_cast<const struct inotify_event*>(ptr)};
+            ptr += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                // Events were dropped: look for the images they were about
+                cerr << "watch: inotify event queue overflow, rescanning " << watch_dir.string() << endl;
+                classifyUnseenImages(watch_dir, seen, models, decode_opts, recap);
+                continue;
+            }
+            if (event->len == 0 || (event->mask & IN_ISDIR))
+            {
+                continue;
+            }
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+            {
+                seen.erase(event->name);
+                continue;
+            }
+            const fs::path img_path {watch_dir / event->name};
+            if (isImage(img_path))
+            {
+                seen.insert(event->name);
+                classifyNewImage(img_path, models, decode_opts, recap);
+            }
+        }
+    }
+
+    std::signal(SIGINT, prev_sigint);
+    std::signal(SIGTERM, prev_sigterm);
+    ::close(fd);
+    cout << "Stopped watching " << watch_dir.string() << endl;
+    return ok;
+}
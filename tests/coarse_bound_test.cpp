@@ -0,0 +1,110 @@
+// Author: Luca Pellegrini
+// Checks that CoarseBound bounds the masked TM_CCORR_NORMED and TM_SQDIFF_NORMED scores of cv::matchTemplate()
+// at every position of every block: on smooth and on noisy images, with elliptic masks, templates whose
+// sides are not multiples of the blocks, and templates cut from the image itself (scores of 1)
+#include <iostream>
+#include <string>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <coarse_bound.hpp>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace
+{
+
+int failures {0};
+
+void check(const bool ok, const std::string& what)
+{
+    if (!ok)
+    {
+        cerr << "FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+cv::Mat_<cv::Vec3b> randomImage(const cv::Size size, const double blur, cv::RNG& rng)
+{
+    cv::Mat_<cv::Vec3b> image {size};
+    rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+    if (blur > 0.0)
+    {
+        cv::GaussianBlur(image, image, cv::Size{0, 0}, blur);
+    }
+    return image;
+}
+
+// Every score of `scores` must be at most the bound of its block
+void checkBounds(const cv::Mat& scores, const cv::Mat_<float>& bounds, const int block, const std::string& what)
+{
+    int violations {0};
+    for (int y {0}; y < scores.rows; y++)
+    {
+        for (int x {0}; x < scores.cols; x++)
+        {
+            if (scores.at<float>(y, x) > bounds(y / block, x / block))
+            {
+                violations++;
+            }
+        }
+    }
+    check(violations == 0, what + ": " + std::to_string(violations) + " positions above their bound");
+}
+
+void checkTemplate(const cv::Mat_<cv::Vec3b>& image, const cv::Rect& cut, const std::string& name)
+{
+    const cv::Mat_<cv::Vec3b> templ {image(cut).clone()};
+    cv::Mat_<uchar> mask {cv::Mat_<uchar>::zeros(templ.size())};
+    cv::ellipse(mask, cv::Point{templ.cols / 2, templ.rows / 2}, cv::Size{templ.cols * 2 / 5, templ.rows * 2 / 5},
+                0.0, 0.0, 360.0, cv::Scalar{255}, cv::FILLED);
+
+    cv::Mat ccorr;
+    cv::matchTemplate(image, templ, ccorr, cv::TM_CCORR_NORMED, mask);
+    // MaskedSqDiff scores 1 - R / 2
+    cv::Mat sqdiff;
+    cv::matchTemplate(image, templ, sqdiff, cv::TM_SQDIFF_NORMED, mask);
+    sqdiff.convertTo(sqdiff, CV_32F, -0.5, 1.0);
+
+    for (int levels {1}; levels <= 3; levels++)
+    {
+        const std::string what {name + ", " + std::to_string(levels) + " levels"};
+        const CoarseBound bound {templ, mask, levels};
+        CoarseBound::PreparedImage prepared;
+        CoarseBound::prepareImage(image, levels, prepared);
+        cv::Mat_<float> bounds;
+        bound.bounds(prepared, ccorr.size(), bounds);
+        const int block {bound.blockSize()};
+        check(bounds.cols == (ccorr.cols + block - 1) / block && bounds.rows == (ccorr.rows + block - 1) / block,
+              what + ": size of the bounds");
+        checkBounds(ccorr, bounds, block, what + ", TM_CCORR_NORMED");
+        checkBounds(sqdiff, bounds, block, what + ", TM_SQDIFF_NORMED");
+        check(bounds(cut.y / block, cut.x / block) >= 1.0f, what + ": bound of the template itself");
+    }
+}
+
+} // namespace
+
+int main()
+{
+    cv::RNG rng {12345};
+    for (const double blur : {0.0, 1.5, 6.0})
+    {
+        const cv::Mat_<cv::Vec3b> image {randomImage(cv::Size{157, 121}, blur, rng)};
+        const std::string name {"blur " + std::to_string(blur)};
+        checkTemplate(image, cv::Rect{37, 29, 61, 45}, name + ", template 61x45");
+        checkTemplate(image, cv::Rect{8, 51, 64, 48}, name + ", template 64x48");
+    }
+
+    if (failures > 0)
+    {
+        cerr << failures << " checks failed" << endl;
+        return 1;
+    }
+    cout << "All checks passed" << endl;
+    return 0;
+}
@@ -0,0 +1,180 @@
+// Author: Luca Pellegrini
+// Checks the masked TM_CCORR_NORMED and TM_SQDIFF_NORMED kernels: every kernel supported by the CPU and
+// the build must compute the same integer sums as the scalar one, and MaskedCCorr / MaskedSqDiff the
+// same scores as cv::matchTemplate(), with every kernel. Row widths cover every tail of the SIMD loops
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <masked_ccorr.hpp>
+#include <masked_sqdiff.hpp>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace
+{
+
+// Scores of cv::matchTemplate() are computed in single precision
+constexpr double score_tolerance {1e-5};
+
+int failures {0};
+
+void check(const bool ok, const std::string& what)
+{
+    if (!ok)
+    {
+        cerr << "FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+using CCorrKernel = MaskedCCorrSums (*)(const uchar*, const size_t, const uchar*, const uchar*, const size_t,
+                                        const int, const int);
+using SqDiffKernel = int64_t (*)(const uchar*, const size_t, const uchar*, const uchar*, const size_t,
+                                 const int, const int);
+
+struct SimdKernels
+{
+    MaskedCCorr::Isa isa;
+    CCorrKernel ccorr;
+    SqDiffKernel sqdiff;
+};
+
+// The SIMD kernels compiled in, and supported by the CPU
+std::vector<SimdKernels> supportedSimdKernels()
+{
+    std::vector<SimdKernels> kernels;
+#ifdef TM_SIMD_AVX2
+    if (MaskedCCorr::setIsa(MaskedCCorr::Isa::AVX2))
+    {
+        kernels.push_back({MaskedCCorr::Isa::AVX2, maskedCCorrAVX2, maskedSqDiffAVX2});
+    }
+#endif
+#ifdef TM_SIMD_AVX512
+    if (MaskedCCorr::setIsa(MaskedCCorr::Isa::AVX512))
+    {
+        kernels.push_back({MaskedCCorr::Isa::AVX512, maskedCCorrAVX512, maskedSqDiffAVX512});
+    }
+#endif
+    return kernels;
+}
+
+// Row widths from 1 to 3 AVX-512 vectors and a bit, at odd offsets and steps, so that loads are
+// unaligned, and every tail (AVX-512 masked tail, AVX2 16-byte and scalar tails) is reached
+void checkKernelSums(const std::vector<SimdKernels>& kernels, cv::RNG& rng)
+{
+    constexpr int rows {5};
+    constexpr int max_row_bytes {3 * 64 + 17};
+    for (int row_bytes {1}; row_bytes <= max_row_bytes; row_bytes++)
+    {
+        const size_t image_step {static_cast<size_t>(row_bytes + 13)};
+        const size_t templ_step {static_cast<size_t>(row_bytes + 3)};
+        cv::Mat image {rows, static_cast<int>(image_step) + 1, CV_8U};
+        cv::Mat templ {rows, static_cast<int>(templ_step), CV_8U};
+        cv::Mat mask {rows, static_cast<int>(templ_step), CV_8U};
+        rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+        rng.fill(templ, cv::RNG::UNIFORM, 0, 256);
+        rng.fill(mask, cv::RNG::UNIFORM, 0, 2);
+        mask *= 255;
+        cv::Mat masked_templ;
+        cv::bitwise_and(templ, mask, masked_templ);
+
+        const uchar* image_data {image.data + 1};  // odd address
+        const MaskedCCorrSums expected {maskedCCorrScalar(image_data, image.step, masked_templ.data, mask.data,
+                                                          templ_step, rows, row_bytes)};
+        const int64_t expected_sqdiff {maskedSqDiffScalar(image_data, image.step, masked_templ.data, mask.data,
+                                                          templ_step, rows, row_bytes)};
+        for (const SimdKernels& kernel : kernels)
+        {
+            const std::string what {std::string{MaskedCCorr::isaName(kernel.isa)} + ", row of " +
+                                    std::to_string(row_bytes) + " bytes"};
+            const MaskedCCorrSums sums {kernel.ccorr(image_data, image.step, masked_templ.data, mask.data,
+                                                     templ_step, rows, row_bytes)};
+            check(sums.correlation == expected.correlation, what + ": correlation");
+            check(sums.patch_energy == expected.patch_energy, what + ": patch energy");
+            check(kernel.sqdiff(image_data, image.step, masked_templ.data, mask.data, templ_step, rows, row_bytes) ==
+                  expected_sqdiff, what + ": sum of squared differences");
+        }
+    }
+}
+
+// Whole score maps of templates with odd widths, against cv::matchTemplate()
+void checkScoreMaps(const std::vector<MaskedCCorr::Isa>& isas, cv::RNG& rng)
+{
+    cv::Mat_<cv::Vec3b> image {23, 97};
+    rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+    cv::Mat_<double> integral;
+    MaskedSqDiff::integrate(image, integral);
+
+    for (const int width : {1, 3, 5, 11, 21, 22, 43, 85})
+    {
+        cv::Mat_<cv::Vec3b> templ {7, width};
+        cv::Mat_<uchar> mask {7, width};
+        rng.fill(templ, cv::RNG::UNIFORM, 0, 256);
+        rng.fill(mask, cv::RNG::UNIFORM, 0, 2);
+        mask *= 255;
+        mask(0, 0) = 255;  // never an empty mask
+
+        cv::Mat reference;
+        cv::matchTemplate(image, templ, reference, cv::TM_CCORR_NORMED, mask);
+        // MaskedSqDiff scores 1 - R / 2, clamped at 0
+        cv::Mat sqdiff_reference;
+        cv::matchTemplate(image, templ, sqdiff_reference, cv::TM_SQDIFF_NORMED, mask);
+        sqdiff_reference.convertTo(sqdiff_reference, CV_32F, -0.5, 1.0);
+        cv::threshold(sqdiff_reference, sqdiff_reference, 0.0, 0.0, cv::THRESH_TOZERO);
+
+        const MaskedCCorr ccorr {templ, mask};
+        const MaskedSqDiff sqdiff {templ, mask};
+        for (const MaskedCCorr::Isa isa : isas)
+        {
+            MaskedCCorr::setIsa(isa);
+            const std::string what {std::string{MaskedCCorr::isaName(isa)} + ", template width " +
+                                    std::to_string(width)};
+            cv::Mat_<float> result;
+            ccorr.match(image, result);
+            check(result.size() == reference.size() && cv::norm(result, reference, cv::NORM_INF) < score_tolerance,
+                  what + ": TM_CCORR_NORMED map");
+            sqdiff.match(image, integral, result);
+            check(result.size() == sqdiff_reference.size() &&
+                  cv::norm(result, sqdiff_reference, cv::NORM_INF) < score_tolerance,
+                  what + ": TM_SQDIFF_NORMED map");
+        }
+    }
+}
+
+} // namespace
+
+int main()
+{
+    const MaskedCCorr::Isa best_isa {MaskedCCorr::bestIsa()};
+    cv::RNG rng {12345};
+
+    const std::vector<SimdKernels> kernels {supportedSimdKernels()};
+    std::vector<MaskedCCorr::Isa> isas {MaskedCCorr::Isa::Scalar};
+    for (const SimdKernels& kernel : kernels)
+    {
+        isas.push_back(kernel.isa);
+    }
+    for (const MaskedCCorr::Isa isa : isas)
+    {
+        cout << "Checking " << MaskedCCorr::isaName(isa) << endl;
+    }
+
+    checkKernelSums(kernels, rng);
+    checkScoreMaps(isas, rng);
+    MaskedCCorr::setIsa(best_isa);
+
+    if (failures > 0)
+    {
+        cerr << failures << " checks failed" << endl;
+        return 1;
+    }
+    cout << "All checks passed" << endl;
+    return 0;
+}
@@ -0,0 +1,180 @@
+// Author: Marco Carraro
+// Checks MIHIndex and HammingMatcher against cv::BFMatcher (NORM_HAMMING) on random and duplicate-heavy
+// descriptors: same nearest distances, same max_distance cut and same ratio test decisions, for queries
+// close to the train descriptors (found by probing) and far from all of them (linear scan fallback)
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+#include "hamming_matcher.hpp"
+#include "mih_index.h"
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string &what)
+{
+    if (!ok) {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+cv::Mat randomDescriptors(int rows, cv::RNG &rng)
+{
+    cv::Mat descriptors(rows, MIHIndex::descriptor_bytes, CV_8U);
+    rng.fill(descriptors, cv::RNG::UNIFORM, 0, 256);
+    return descriptors;
+}
+
+// Few distinct descriptors, each repeated several times, some of them with a few bits flipped:
+// many queries have equally distant neighbours, or a second neighbour at distance 0
+cv::Mat duplicateDescriptors(int distinct, int copies, cv::RNG &rng)
+{
+    cv::Mat base = randomDescriptors(distinct, rng);
+    cv::Mat descriptors(distinct * copies, MIHIndex::descriptor_bytes, CV_8U);
+    for (int r = 0; r < descriptors.rows; r++) {
+        base.row(r % distinct).copyTo(descriptors.row(r));
+        if (r % 3 == 2) {
+            const int bit = rng.uniform(0, 8 * MIHIndex::descriptor_bytes);
+            descriptors.at<uchar>(r, bit / 8) ^= static_cast<uchar>(1 << (bit % 8));
+        }
+    }
+    return descriptors;
+}
+
+// Train rows with 0 to 40 bits flipped (found by probing), and random descriptors (linear scan fallback)
+cv::Mat makeQueries(const cv::Mat &train, int count, cv::RNG &rng)
+{
+    cv::Mat queries = randomDescriptors(count, rng);
+    for (int q = 0; q < count; q += 2) {
+        train.row(rng.uniform(0, train.rows)).copyTo(queries.row(q));
+        const int flips = (q % 8 == 0) ? 0 : rng.uniform(0, 41);
+        for (int f = 0; f < flips; f++) {
+            const int bit = rng.uniform(0, 8 * MIHIndex::descriptor_bytes);
+            queries.at<uchar>(q, bit / 8) ^= static_cast<uchar>(1 << (bit % 8));
+        }
+    }
+    return queries;
+}
+
+int distanceOf(const cv::DMatch &match)
+{
+    return static_cast<int>(match.distance);
+}
+
+void checkTrainSet(const std::string &name, const cv::Mat &train, const cv::Mat &queries)
+{
+    // Reference: the two nearest neighbours of every query
+    std::vector<std::vector<cv::DMatch>> reference;
+    cv::BFMatcher(cv::NORM_HAMMING).knnMatch(queries, train, reference, 2);
+
+    const MIHIndex index(train);
+    for (int q = 0; q < queries.rows; q++) {
+        const std::string what = name + ", query " + std::to_string(q);
+        const int d1 = distanceOf(reference[q][0]);
+        const int d2 = distanceOf(reference[q][1]);
+
+        // Nearest neighbour: same distance (equally distant rows may differ)
+        int distance = -1;
+        const int row = index.nearest(queries.ptr<uchar>(q), distance);
+        check(row >= 0 && distance == d1 &&
+              cv::norm(queries.row(q), train.row(row), cv::NORM_HAMMING) == d1, what + ": nearest");
+
+        // Nearest neighbour within max_distance
+        for (const int max_distance : {0, 8, 24, 64}) {
+            const int bounded = index.nearest(queries.ptr<uchar>(q), distance, max_distance);
+            check((bounded >= 0) == (d1 <= max_distance) && (bounded < 0 || distance == d1),
+                  what + ": nearest within " + std::to_string(max_distance));
+        }
+
+        // Ratio test
+        for (const double ratio : {0.6, 0.8, 1.0}) {
+            const bool accepted = d1 < ratio * d2;
+            const int ratio_row = index.ratioNearest(queries.ptr<uchar>(q), ratio, distance);
+            check((ratio_row >= 0) == accepted && (ratio_row < 0 || distance == d1),
+                  what + ": ratio test " + std::to_string(ratio));
+        }
+    }
+
+    // Batch searches, against the same reference
+    std::vector<cv::DMatch> matches;
+    index.match(queries, matches);
+    check(matches.size() == static_cast<size_t>(queries.rows), name + ": match count");
+    for (const cv::DMatch &match : matches) {
+        check(distanceOf(match) == distanceOf(reference[match.queryIdx][0]), name + ": match distance");
+    }
+    const int max_distance = 24;
+    index.match(queries, matches, max_distance);
+    size_t within = 0;
+    for (const auto &neighbours : reference) {
+        within += (distanceOf(neighbours[0]) <= max_distance) ? 1 : 0;
+    }
+    check(matches.size() == within, name + ": match count within max_distance");
+
+    const double ratio = 0.8;
+    for (const HammingMatcher::Isa isa : {HammingMatcher::Isa::Scalar, HammingMatcher::Isa::AVX2, HammingMatcher::Isa::AVX512}) {
+        if (!HammingMatcher::setIsa(isa)) {
+            continue;
+        }
+        const std::string isa_name = name + ", " + HammingMatcher::isaName(isa);
+
+        // k nearest neighbours: same distances (equally distant rows may come in another order)
+        std::vector<std::vector<cv::DMatch>> knn;
+        HammingMatcher::knnMatch(queries, train, 2, knn);
+        bool same = knn.size() == reference.size();
+        for (size_t q = 0; same && q < knn.size(); q++) {
+            same = knn[q].size() == 2;
+            for (size_t k = 0; same && k < 2; k++) {
+                same = distanceOf(knn[q][k]) == distanceOf(reference[q][k]);
+            }
+        }
+        check(same, isa_name + ": knnMatch");
+
+        // Ratio test, brute force and with the index: same accepted queries and distances
+        std::vector<int> hamming_accepted(queries.rows, -1);
+        HammingMatcher::ratioMatch(queries, train, ratio, [&](const cv::DMatch &match) {
+            hamming_accepted[match.queryIdx] = distanceOf(match);
+        });
+        std::vector<int> mih_accepted(queries.rows, -1);
+        index.ratioMatch(queries, ratio, [&](const cv::DMatch &match) {
+            mih_accepted[match.queryIdx] = distanceOf(match);
+        });
+        for (int q = 0; q < queries.rows; q++) {
+            const int d1 = distanceOf(reference[q][0]);
+            const int expected = (d1 < ratio * distanceOf(reference[q][1])) ? d1 : -1;
+            check(hamming_accepted[q] == expected, isa_name + ", query " + std::to_string(q) + ": HammingMatcher::ratioMatch");
+            check(mih_accepted[q] == expected, isa_name + ", query " + std::to_string(q) + ": MIHIndex::ratioMatch");
+        }
+    }
+    HammingMatcher::setIsa(HammingMatcher::bestIsa());
+}
+
+} // namespace
+
+int main()
+{
+    cv::RNG rng(2024);
+
+    const cv::Mat random_train = randomDescriptors(20000, rng);
+    checkTrainSet("random", random_train, makeQueries(random_train, 600, rng));
+
+    const cv::Mat duplicate_train = duplicateDescriptors(1500, 6, rng);
+    checkTrainSet("duplicates", duplicate_train, makeQueries(duplicate_train, 600, rng));
+
+    // Small index: probing never pays off, every query takes the linear scan
+    const cv::Mat small_train = duplicateDescriptors(40, 3, rng);
+    checkTrainSet("small", small_train, makeQueries(small_train, 200, rng));
+
+    if (failures > 0) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All checks passed" << std::endl;
+    return 0;
+}